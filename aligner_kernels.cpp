@@ -0,0 +1,526 @@
+#include "aligner_kernels.h"
+#include <math.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+
+namespace mirror {
+
+/* Reference landmarks of the 112x112 aligned face. */
+static const float kTemplateX[kNumLandmarks] = {
+	30.2946f + 8.0f, 65.5318f + 8.0f, 48.0252f + 8.0f, 33.5493f + 8.0f, 62.7299f + 8.0f
+};
+static const float kTemplateY[kNumLandmarks] = {
+	51.6963f, 51.5014f, 71.7366f, 92.3655f, 92.2041f
+};
+
+/* Below this spread (in squared pixels) the landmarks are treated as a single
+ * point and no transform can be estimated. */
+static const float kMinLandmarkSpread = 1e-6f;
+
+/* Below this squared scale the whole face would collapse to a point. */
+static const float kMinSquaredScale = 1e-12f;
+
+int EstimateSimilarityBatch(const float *src_x, const float *src_y,
+	int num_faces, float *transforms) {
+	float dst_mean_x = 0, dst_mean_y = 0;
+	for (int k = 0; k < kNumLandmarks; k++) {
+		dst_mean_x += kTemplateX[k];
+		dst_mean_y += kTemplateY[k];
+	}
+	dst_mean_x /= kNumLandmarks;
+	dst_mean_y /= kNumLandmarks;
+
+	float dst_x[kNumLandmarks], dst_y[kNumLandmarks];
+	for (int k = 0; k < kNumLandmarks; k++) {
+		dst_x[k] = kTemplateX[k] - dst_mean_x;
+		dst_y[k] = kTemplateY[k] - dst_mean_y;
+	}
+
+	int num_degenerate = 0;
+	for (int f = 0; f < num_faces; f++) {
+		const float *xs = src_x + f * kNumLandmarks;
+		const float *ys = src_y + f * kNumLandmarks;
+		float *m = transforms + f * 6;
+
+		float src_mean_x = 0, src_mean_y = 0;
+		for (int k = 0; k < kNumLandmarks; k++) {
+			src_mean_x += xs[k];
+			src_mean_y += ys[k];
+		}
+		src_mean_x /= kNumLandmarks;
+		src_mean_y /= kNumLandmarks;
+
+		/* With demeaned source (x, y) and destination (u, v) the optimal
+		 * similarity is u = a * x - b * y, v = b * x + a * y where
+		 * a = sum(x * u + y * v) / sum(x^2 + y^2) and
+		 * b = sum(x * v - y * u) / sum(x^2 + y^2). */
+		float spread = 0, dot = 0, cross = 0;
+		for (int k = 0; k < kNumLandmarks; k++) {
+			float x = xs[k] - src_mean_x;
+			float y = ys[k] - src_mean_y;
+			spread += x * x + y * y;
+			dot += x * dst_x[k] + y * dst_y[k];
+			cross += x * dst_y[k] - y * dst_x[k];
+		}
+
+		float a = 0, b = 0;
+		if (spread >= kMinLandmarkSpread) {
+			a = dot / spread;
+			b = cross / spread;
+		}
+		if (a * a + b * b < kMinSquaredScale) {
+			for (int i = 0; i < 6; i++)
+				m[i] = 0;
+			num_degenerate++;
+			continue;
+		}
+
+		m[0] = a;
+		m[1] = -b;
+		m[2] = dst_mean_x - (a * src_mean_x - b * src_mean_y);
+		m[3] = b;
+		m[4] = a;
+		m[5] = dst_mean_y - (b * src_mean_x + a * src_mean_y);
+	}
+	return num_degenerate;
+}
+
+void ComposeCropTransform(const float *transform, float left, float top,
+	float scale, float *crop_transform) {
+	for (int r = 0; r < 2; r++) {
+		const float *m = transform + r * 3;
+		float *c = crop_transform + r * 3;
+		c[0] = m[0] / scale;
+		c[1] = m[1] / scale;
+		c[2] = m[0] * left + m[1] * top + m[2];
+	}
+}
+
+/* Inverts a 2x3 affine transform. Returns false if it is singular. */
+static bool InvertTransform(const float *m, float *inv) {
+	float det = m[0] * m[4] - m[1] * m[3];
+	if (fabsf(det) < 1e-12f)
+		return false;
+	inv[0] = m[4] / det;
+	inv[1] = -m[1] / det;
+	inv[3] = -m[3] / det;
+	inv[4] = m[0] / det;
+	inv[2] = -(inv[0] * m[2] + inv[1] * m[5]);
+	inv[5] = -(inv[3] * m[2] + inv[4] * m[5]);
+	return true;
+}
+
+bool ComputeAlignmentSourceRect(const float *transform, int frame_width,
+	int frame_height, int *left, int *top, int *right, int *bottom) {
+	float inv[6];
+	if (!InvertTransform(transform, inv))
+		return false;
+
+	/* The footprint of the aligned face is the parallelogram spanned by its
+	 * corner pixels. */
+	static const float kCorners[4][2] = {
+		{ 0, 0 },
+		{ kAlignedFaceSize - 1, 0 },
+		{ 0, kAlignedFaceSize - 1 },
+		{ kAlignedFaceSize - 1, kAlignedFaceSize - 1 }
+	};
+	float min_x = INFINITY, min_y = INFINITY;
+	float max_x = -INFINITY, max_y = -INFINITY;
+	for (int i = 0; i < 4; i++) {
+		float x = inv[0] * kCorners[i][0] + inv[1] * kCorners[i][1] + inv[2];
+		float y = inv[3] * kCorners[i][0] + inv[4] * kCorners[i][1] + inv[5];
+		min_x = fminf(min_x, x);
+		min_y = fminf(min_y, y);
+		max_x = fmaxf(max_x, x);
+		max_y = fmaxf(max_y, y);
+	}
+
+	/* Bilinear sampling at x reads floor(x) and floor(x) + 1. */
+	float l = fmaxf(floorf(min_x), 0.0f);
+	float t = fmaxf(floorf(min_y), 0.0f);
+	float r = fminf(floorf(max_x) + 2.0f, (float) frame_width);
+	float b = fminf(floorf(max_y) + 2.0f, (float) frame_height);
+	if (l >= r || t >= b)
+		return false;
+
+	*left = (int) l;
+	*top = (int) t;
+	*right = (int) r;
+	*bottom = (int) b;
+	return true;
+}
+
+/* Returns the RGBA pixel at (x, y), or black when outside of the image. */
+static inline const unsigned char *PixelOrBorder(const unsigned char *src,
+	int src_width, int src_height, int src_pitch, int x, int y) {
+	static const unsigned char kBorder[4] = { 0, 0, 0, 0 };
+	if (x < 0 || y < 0 || x >= src_width || y >= src_height)
+		return kBorder;
+	return src + y * src_pitch + x * 4;
+}
+
+bool WarpAffineRGBA(const unsigned char *src, int src_width, int src_height,
+	int src_pitch, const float *transform, unsigned char *dst, int dst_pitch,
+	int dst_channels) {
+	/* Invert the forward transform so that every destination pixel can be
+	 * traced back to the source. */
+	float inv[6];
+	if (!InvertTransform(transform, inv)) {
+		for (int y = 0; y < kAlignedFaceSize; y++)
+			memset(dst + y * dst_pitch, 0, kAlignedFaceSize * dst_channels);
+		return false;
+	}
+	float ia = inv[0], ib = inv[1], itx = inv[2];
+	float ic = inv[3], id = inv[4], ity = inv[5];
+
+	for (int y = 0; y < kAlignedFaceSize; y++) {
+		unsigned char *out = dst + y * dst_pitch;
+		for (int x = 0; x < kAlignedFaceSize; x++, out += dst_channels) {
+			float sx = ia * x + ib * y + itx;
+			float sy = ic * x + id * y + ity;
+			float fx0 = floorf(sx);
+			float fy0 = floorf(sy);
+			int x0 = (int) fx0;
+			int y0 = (int) fy0;
+			float wx = sx - fx0;
+			float wy = sy - fy0;
+
+			if (x0 < -1 || y0 < -1 || x0 >= src_width || y0 >= src_height) {
+				memset(out, 0, dst_channels);
+				continue;
+			}
+
+			const unsigned char *p00, *p01, *p10, *p11;
+			if (x0 >= 0 && y0 >= 0 && x0 + 1 < src_width && y0 + 1 < src_height) {
+				p00 = src + y0 * src_pitch + x0 * 4;
+				p01 = p00 + 4;
+				p10 = p00 + src_pitch;
+				p11 = p10 + 4;
+			} else {
+				p00 = PixelOrBorder(src, src_width, src_height, src_pitch, x0, y0);
+				p01 = PixelOrBorder(src, src_width, src_height, src_pitch, x0 + 1, y0);
+				p10 = PixelOrBorder(src, src_width, src_height, src_pitch, x0, y0 + 1);
+				p11 = PixelOrBorder(src, src_width, src_height, src_pitch, x0 + 1, y0 + 1);
+			}
+
+			for (int c = 0; c < dst_channels; c++) {
+				float top = p00[c] + (p01[c] - p00[c]) * wx;
+				float bottom = p10[c] + (p11[c] - p10[c]) * wx;
+				float v = top + (bottom - top) * wy;
+				out[c] = (unsigned char) (v + 0.5f);
+			}
+		}
+	}
+	return true;
+}
+
+/* State shared by the row kernels of WarpAffineRGBAToPlanar. */
+struct PlanarWarp {
+	const unsigned char *src;
+	int src_width;
+	int src_height;
+	int src_pitch;
+	/* Inverse transform, mapping aligned face pixels to the source. */
+	float inv[6];
+	float scale;
+	/* -scale * mean of every output plane. */
+	float bias[3];
+	/* Bit offset of the source channel of every output plane. */
+	int shift[3];
+};
+
+typedef void (*PlanarRowFunc)(const PlanarWarp &w, int y, float *const *rows);
+
+/* Returns the RGBA pixel at (x, y) as a little-endian word, or black when
+ * outside of the image. */
+static inline unsigned int FetchRGBA(const PlanarWarp &w, int x, int y) {
+	unsigned int pixel = 0;
+	if (x >= 0 && y >= 0 && x < w.src_width && y < w.src_height)
+		memcpy(&pixel, w.src + y * w.src_pitch + x * 4, 4);
+	return pixel;
+}
+
+static inline void WarpPixelToPlanar(const PlanarWarp &w, int x, int y,
+	float *const *rows) {
+	float sx = w.inv[0] * x + w.inv[1] * y + w.inv[2];
+	float sy = w.inv[3] * x + w.inv[4] * y + w.inv[5];
+	float fx0 = floorf(sx);
+	float fy0 = floorf(sy);
+	float wx = sx - fx0;
+	float wy = sy - fy0;
+	/* Anything this far out only samples the border. */
+	if (fabsf(fx0) > 1 << 24 || fabsf(fy0) > 1 << 24) {
+		for (int c = 0; c < 3; c++)
+			rows[c][x] = w.bias[c];
+		return;
+	}
+	int x0 = (int) fx0;
+	int y0 = (int) fy0;
+
+	unsigned int p00 = FetchRGBA(w, x0, y0);
+	unsigned int p01 = FetchRGBA(w, x0 + 1, y0);
+	unsigned int p10 = FetchRGBA(w, x0, y0 + 1);
+	unsigned int p11 = FetchRGBA(w, x0 + 1, y0 + 1);
+
+	for (int c = 0; c < 3; c++) {
+		int sh = w.shift[c];
+		float v00 = (float) ((p00 >> sh) & 0xff);
+		float v01 = (float) ((p01 >> sh) & 0xff);
+		float v10 = (float) ((p10 >> sh) & 0xff);
+		float v11 = (float) ((p11 >> sh) & 0xff);
+		float top = v00 + (v01 - v00) * wx;
+		float bottom = v10 + (v11 - v10) * wx;
+		float v = top + (bottom - top) * wy;
+		rows[c][x] = v * w.scale + w.bias[c];
+	}
+}
+
+static void WarpRowToPlanarScalar(const PlanarWarp &w, int y,
+	float *const *rows) {
+	for (int x = 0; x < kAlignedFaceSize; x++)
+		WarpPixelToPlanar(w, x, y, rows);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Eight pixels per iteration. The four bilinear neighbours are fetched with
+ * masked gathers so that pixels outside of the source read as black. */
+__attribute__((target("avx2,fma")))
+static void WarpRowToPlanarAVX2(const PlanarWarp &w, int y,
+	float *const *rows) {
+	const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256 ia = _mm256_set1_ps(w.inv[0]);
+	const __m256 ic = _mm256_set1_ps(w.inv[3]);
+	const __m256 bx = _mm256_set1_ps(w.inv[1] * y + w.inv[2]);
+	const __m256 by = _mm256_set1_ps(w.inv[4] * y + w.inv[5]);
+	const __m256 limit = _mm256_set1_ps((float) (1 << 24));
+	const __m256 scale = _mm256_set1_ps(w.scale);
+	const __m256i width = _mm256_set1_epi32(w.src_width);
+	const __m256i height = _mm256_set1_epi32(w.src_height);
+	const __m256i pitch = _mm256_set1_epi32(w.src_pitch);
+	const __m256i minus_one = _mm256_set1_epi32(-1);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i four = _mm256_set1_epi32(4);
+	const __m256i byte_mask = _mm256_set1_epi32(0xff);
+	const __m256i zero = _mm256_setzero_si256();
+	const int *base = (const int *) w.src;
+
+	int x = 0;
+	for (; x + 8 <= kAlignedFaceSize; x += 8) {
+		__m256 xs = _mm256_add_ps(_mm256_set1_ps((float) x), lane);
+		__m256 sx = _mm256_fmadd_ps(ia, xs, bx);
+		__m256 sy = _mm256_fmadd_ps(ic, xs, by);
+		__m256 fx0 = _mm256_floor_ps(sx);
+		__m256 fy0 = _mm256_floor_ps(sy);
+		__m256 wx = _mm256_sub_ps(sx, fx0);
+		__m256 wy = _mm256_sub_ps(sy, fy0);
+
+		/* Lanes that are far out of range only sample the border. */
+		__m256 near = _mm256_and_ps(
+			_mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), fx0), limit, _CMP_LT_OQ),
+			_mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), fy0), limit, _CMP_LT_OQ));
+		__m256i in_range = _mm256_castps_si256(near);
+
+		__m256i x0 = _mm256_cvttps_epi32(fx0);
+		__m256i y0 = _mm256_cvttps_epi32(fy0);
+		__m256i x1 = _mm256_add_epi32(x0, one);
+		__m256i y1 = _mm256_add_epi32(y0, one);
+		__m256i vx0 = _mm256_and_si256(_mm256_cmpgt_epi32(x0, minus_one),
+			_mm256_cmpgt_epi32(width, x0));
+		__m256i vx1 = _mm256_and_si256(_mm256_cmpgt_epi32(x1, minus_one),
+			_mm256_cmpgt_epi32(width, x1));
+		__m256i vy0 = _mm256_and_si256(_mm256_cmpgt_epi32(y0, minus_one),
+			_mm256_cmpgt_epi32(height, y0));
+		__m256i vy1 = _mm256_and_si256(_mm256_cmpgt_epi32(y1, minus_one),
+			_mm256_cmpgt_epi32(height, y1));
+		vy0 = _mm256_and_si256(vy0, in_range);
+		vy1 = _mm256_and_si256(vy1, in_range);
+
+		__m256i off00 = _mm256_add_epi32(_mm256_mullo_epi32(y0, pitch),
+			_mm256_slli_epi32(x0, 2));
+		__m256i off01 = _mm256_add_epi32(off00, four);
+		__m256i off10 = _mm256_add_epi32(off00, pitch);
+		__m256i off11 = _mm256_add_epi32(off10, four);
+
+		__m256i p00 = _mm256_mask_i32gather_epi32(zero, base, off00,
+			_mm256_and_si256(vy0, vx0), 1);
+		__m256i p01 = _mm256_mask_i32gather_epi32(zero, base, off01,
+			_mm256_and_si256(vy0, vx1), 1);
+		__m256i p10 = _mm256_mask_i32gather_epi32(zero, base, off10,
+			_mm256_and_si256(vy1, vx0), 1);
+		__m256i p11 = _mm256_mask_i32gather_epi32(zero, base, off11,
+			_mm256_and_si256(vy1, vx1), 1);
+
+		for (int c = 0; c < 3; c++) {
+			__m128i sh = _mm_cvtsi32_si128(w.shift[c]);
+			__m256 v00 = _mm256_cvtepi32_ps(
+				_mm256_and_si256(_mm256_srl_epi32(p00, sh), byte_mask));
+			__m256 v01 = _mm256_cvtepi32_ps(
+				_mm256_and_si256(_mm256_srl_epi32(p01, sh), byte_mask));
+			__m256 v10 = _mm256_cvtepi32_ps(
+				_mm256_and_si256(_mm256_srl_epi32(p10, sh), byte_mask));
+			__m256 v11 = _mm256_cvtepi32_ps(
+				_mm256_and_si256(_mm256_srl_epi32(p11, sh), byte_mask));
+			__m256 top = _mm256_fmadd_ps(_mm256_sub_ps(v01, v00), wx, v00);
+			__m256 bottom = _mm256_fmadd_ps(_mm256_sub_ps(v11, v10), wx, v10);
+			__m256 v = _mm256_fmadd_ps(_mm256_sub_ps(bottom, top), wy, top);
+			_mm256_storeu_ps(rows[c] + x,
+				_mm256_fmadd_ps(v, scale, _mm256_set1_ps(w.bias[c])));
+		}
+	}
+	for (; x < kAlignedFaceSize; x++)
+		WarpPixelToPlanar(w, x, y, rows);
+}
+#endif
+
+#if defined(__aarch64__)
+/* Four pixels per iteration. NEON has no gather, so the neighbours are
+ * fetched one by one and everything else is vectorised. */
+static void WarpRowToPlanarNEON(const PlanarWarp &w, int y,
+	float *const *rows) {
+	static const float kLane[4] = { 0, 1, 2, 3 };
+	const float32x4_t lane = vld1q_f32(kLane);
+	const float32x4_t ia = vdupq_n_f32(w.inv[0]);
+	const float32x4_t ic = vdupq_n_f32(w.inv[3]);
+	const float32x4_t bx = vdupq_n_f32(w.inv[1] * y + w.inv[2]);
+	const float32x4_t by = vdupq_n_f32(w.inv[4] * y + w.inv[5]);
+	const float32x4_t scale = vdupq_n_f32(w.scale);
+	const uint32x4_t byte_mask = vdupq_n_u32(0xff);
+
+	int x = 0;
+	for (; x + 4 <= kAlignedFaceSize; x += 4) {
+		float32x4_t xs = vaddq_f32(vdupq_n_f32((float) x), lane);
+		float32x4_t sx = vfmaq_f32(bx, ia, xs);
+		float32x4_t sy = vfmaq_f32(by, ic, xs);
+		float32x4_t fx0 = vrndmq_f32(sx);
+		float32x4_t fy0 = vrndmq_f32(sy);
+		float32x4_t wx = vsubq_f32(sx, fx0);
+		float32x4_t wy = vsubq_f32(sy, fy0);
+
+		float lx[4], ly[4];
+		unsigned int q00[4], q01[4], q10[4], q11[4];
+		vst1q_f32(lx, fx0);
+		vst1q_f32(ly, fy0);
+		for (int i = 0; i < 4; i++) {
+			if (fabsf(lx[i]) > 1 << 24 || fabsf(ly[i]) > 1 << 24) {
+				q00[i] = q01[i] = q10[i] = q11[i] = 0;
+				continue;
+			}
+			int x0 = (int) lx[i];
+			int y0 = (int) ly[i];
+			q00[i] = FetchRGBA(w, x0, y0);
+			q01[i] = FetchRGBA(w, x0 + 1, y0);
+			q10[i] = FetchRGBA(w, x0, y0 + 1);
+			q11[i] = FetchRGBA(w, x0 + 1, y0 + 1);
+		}
+		uint32x4_t p00 = vld1q_u32(q00);
+		uint32x4_t p01 = vld1q_u32(q01);
+		uint32x4_t p10 = vld1q_u32(q10);
+		uint32x4_t p11 = vld1q_u32(q11);
+
+		for (int c = 0; c < 3; c++) {
+			int32x4_t sh = vdupq_n_s32(-w.shift[c]);
+			float32x4_t v00 = vcvtq_f32_u32(vandq_u32(vshlq_u32(p00, sh), byte_mask));
+			float32x4_t v01 = vcvtq_f32_u32(vandq_u32(vshlq_u32(p01, sh), byte_mask));
+			float32x4_t v10 = vcvtq_f32_u32(vandq_u32(vshlq_u32(p10, sh), byte_mask));
+			float32x4_t v11 = vcvtq_f32_u32(vandq_u32(vshlq_u32(p11, sh), byte_mask));
+			float32x4_t top = vfmaq_f32(v00, vsubq_f32(v01, v00), wx);
+			float32x4_t bottom = vfmaq_f32(v10, vsubq_f32(v11, v10), wx);
+			float32x4_t v = vfmaq_f32(top, vsubq_f32(bottom, top), wy);
+			vst1q_f32(rows[c] + x, vfmaq_f32(vdupq_n_f32(w.bias[c]), v, scale));
+		}
+	}
+	for (; x < kAlignedFaceSize; x++)
+		WarpPixelToPlanar(w, x, y, rows);
+}
+#endif
+
+static PlanarRowFunc SelectPlanarRowFunc() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return WarpRowToPlanarAVX2;
+#elif defined(__aarch64__)
+	return WarpRowToPlanarNEON;
+#endif
+	return WarpRowToPlanarScalar;
+}
+
+/* Returns nullptr if kernel is not built in or the CPU lacks it. */
+static PlanarRowFunc PlanarRowFuncOf(PlanarWarpKernel kernel) {
+	switch (kernel) {
+	case kPlanarWarpAuto:
+		return SelectPlanarRowFunc();
+	case kPlanarWarpScalar:
+		return WarpRowToPlanarScalar;
+	case kPlanarWarpAVX2:
+#if defined(__x86_64__) || defined(__i386__)
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			return WarpRowToPlanarAVX2;
+#endif
+		return nullptr;
+	case kPlanarWarpNEON:
+#if defined(__aarch64__)
+		return WarpRowToPlanarNEON;
+#endif
+		return nullptr;
+	}
+	return nullptr;
+}
+
+bool PlanarWarpKernelSupported(PlanarWarpKernel kernel) {
+	return PlanarRowFuncOf(kernel) != nullptr;
+}
+
+static bool WarpAffineRGBAToPlanarWith(PlanarRowFunc row_func,
+	const unsigned char *src, int src_width, int src_height, int src_pitch,
+	const float *transform, const TensorNormalization &norm, float *dst,
+	int dst_pitch) {
+	PlanarWarp w;
+	w.src = src;
+	w.src_width = src_width;
+	w.src_height = src_height;
+	w.src_pitch = src_pitch;
+	w.scale = norm.scale;
+	for (int c = 0; c < 3; c++) {
+		w.bias[c] = -norm.means[c] * norm.scale;
+		w.shift[c] = norm.channel_map[c] * 8;
+	}
+
+	bool invertible = InvertTransform(transform, w.inv);
+	if (!invertible) {
+		/* Every pixel samples the border. */
+		w.src_width = w.src_height = 0;
+		memset(w.inv, 0, sizeof(w.inv));
+	}
+
+	for (int y = 0; y < kAlignedFaceSize; y++) {
+		float *rows[3];
+		for (int c = 0; c < 3; c++)
+			rows[c] = (float *) ((unsigned char *) dst +
+				(size_t) (c * kAlignedFaceSize + y) * dst_pitch);
+		row_func(w, y, rows);
+	}
+	return invertible;
+}
+
+bool WarpAffineRGBAToPlanar(const unsigned char *src, int src_width,
+	int src_height, int src_pitch, const float *transform,
+	const TensorNormalization &norm, float *dst, int dst_pitch) {
+	static const PlanarRowFunc row_func = SelectPlanarRowFunc();
+	return WarpAffineRGBAToPlanarWith(row_func, src, src_width, src_height,
+		src_pitch, transform, norm, dst, dst_pitch);
+}
+
+bool WarpAffineRGBAToPlanar(const unsigned char *src, int src_width,
+	int src_height, int src_pitch, const float *transform,
+	const TensorNormalization &norm, float *dst, int dst_pitch,
+	PlanarWarpKernel kernel) {
+	return WarpAffineRGBAToPlanarWith(PlanarRowFuncOf(kernel), src,
+		src_width, src_height, src_pitch, transform, norm, dst, dst_pitch);
+}
+
+}
@@ -0,0 +1,113 @@
+#ifndef _FACE_ALIGNER_KERNELS_H_
+#define _FACE_ALIGNER_KERNELS_H_
+
+/*
+ * Allocation-free building blocks of the face aligner. Nothing in here
+ * depends on OpenCV so that the kernels can be used directly on mapped
+ * NvBufSurface memory and on the network input slots.
+ */
+
+namespace mirror {
+
+/* Number of facial landmarks used for alignment. */
+static const int kNumLandmarks = 5;
+
+/* Resolution of the aligned face crop. */
+static const int kAlignedFaceSize = 112;
+
+/*
+ * Estimates the 2D similarity transforms (rotation, uniform scale and
+ * translation) mapping each set of 5 landmarks onto the aligned face
+ * template. This is the closed form of Umeyama's least-squares estimator for
+ * the 2D case, so no SVD is required.
+ *
+ * Landmarks are passed as SoA arrays: point k of face f is
+ * (src_x[f * kNumLandmarks + k], src_y[f * kNumLandmarks + k]).
+ * For every face a row-major 2x3 affine matrix is written to
+ * transforms[f * 6 .. f * 6 + 5].
+ *
+ * Faces whose landmarks are degenerate (all points coincide, or the best fit
+ * collapses the face to a point) get an all-zero matrix. Returns the number of
+ * such faces.
+ */
+int EstimateSimilarityBatch(const float *src_x, const float *src_y,
+	int num_faces, float *transforms);
+
+/*
+ * Rewrites a transform estimated in full-frame coordinates so that it applies
+ * to a crop of the frame whose top-left corner is at (left, top) and which was
+ * resized by scale, i.e. crop = (frame - (left, top)) * scale.
+ */
+void ComposeCropTransform(const float *transform, float left, float top,
+	float scale, float *crop_transform);
+
+/*
+ * Computes the smallest rectangle of a frame_width x frame_height frame that
+ * holds every pixel read when warping with transform: the inverse image of the
+ * aligned face plus the bilinear neighbourhood. The rectangle is clipped to
+ * the frame and returned as [left, right) x [top, bottom). Returns false if the
+ * transform is not invertible or the aligned face lies outside of the frame.
+ */
+bool ComputeAlignmentSourceRect(const float *transform, int frame_width,
+	int frame_height, int *left, int *top, int *right, int *bottom);
+
+/*
+ * Warps a packed RGBA image into a kAlignedFaceSize x kAlignedFaceSize packed
+ * image with dst_channels (3 for RGB, 4 for RGBA) channels. transform maps
+ * source pixels onto the aligned face, as returned by EstimateSimilarityBatch.
+ * Sampling is bilinear and pixels mapped from outside of the source are black,
+ * which matches cv::warpAffine with INTER_LINEAR and BORDER_CONSTANT.
+ * Pitches are in bytes. Returns false if the transform is not invertible.
+ */
+bool WarpAffineRGBA(const unsigned char *src, int src_width, int src_height,
+	int src_pitch, const float *transform, unsigned char *dst, int dst_pitch,
+	int dst_channels);
+
+/*
+ * Per-channel normalisation applied by WarpAffineRGBAToPlanar. Output plane c
+ * holds scale * (source channel channel_map[c] - means[c]), with the source
+ * channels numbered R = 0, G = 1, B = 2.
+ */
+struct TensorNormalization {
+	float scale;
+	float means[3];
+	int channel_map[3];
+};
+
+/*
+ * Fused form of WarpAffineRGBA followed by the planar float conversion of the
+ * network input. It warps a packed RGBA image with bilinear sampling, reorders
+ * and normalises the channels and writes a 3 x kAlignedFaceSize x
+ * kAlignedFaceSize planar float tensor in a single pass. Row r of plane c
+ * starts at byte offset (c * kAlignedFaceSize + r) * dst_pitch of dst.
+ * Uses AVX2 or NEON when the CPU supports it. Returns false if the transform
+ * is not invertible, in which case the whole tensor holds the normalised
+ * black border.
+ */
+bool WarpAffineRGBAToPlanar(const unsigned char *src, int src_width,
+	int src_height, int src_pitch, const float *transform,
+	const TensorNormalization &norm, float *dst, int dst_pitch);
+
+/* Row kernels of WarpAffineRGBAToPlanar. */
+enum PlanarWarpKernel {
+	kPlanarWarpAuto,
+	kPlanarWarpScalar,
+	kPlanarWarpAVX2,
+	kPlanarWarpNEON
+};
+
+/* Returns true if kernel is built in and runs on this CPU. */
+bool PlanarWarpKernelSupported(PlanarWarpKernel kernel);
+
+/*
+ * WarpAffineRGBAToPlanar with the given kernel rather than the fastest one,
+ * to check the kernels against each other. The kernel must be supported.
+ */
+bool WarpAffineRGBAToPlanar(const unsigned char *src, int src_width,
+	int src_height, int src_pitch, const float *transform,
+	const TensorNormalization &norm, float *dst, int dst_pitch,
+	PlanarWarpKernel kernel);
+
+}
+
+#endif // !_FACE_ALIGNER_KERNELS_H_
@@ -0,0 +1,1024 @@
+#include "embedding_kernels.h"
+#include <math.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace mirror {
+
+typedef float (*SquaredNormFunc)(const float *src, int n);
+typedef void (*ScaleFunc)(const float *src, float *dst, int n, float scale);
+typedef void (*FloatToHalfFunc)(const float *src, uint16_t *dst, int n);
+typedef float (*MaxAbsFunc)(const float *src, int n);
+typedef void (*QuantizeFunc)(const float *src, int8_t *dst, int n,
+	float inv_scale);
+typedef void (*DotF32Func)(const float *query, const float *rows, int dim,
+	int count, float *scores);
+typedef void (*DotF16Func)(const float *query, const uint16_t *rows, int dim,
+	int count, float *scores);
+typedef void (*DotInt8Func)(const float *query, const int8_t *rows,
+	const float *scales, int dim, int count, float *scores);
+typedef void (*HalfToFloatFunc)(const uint16_t *src, float *dst, int n);
+typedef void (*DequantizeFunc)(const int8_t *src, float scale, float *dst,
+	int n);
+typedef void (*DotBatchF32Func)(const float *queries, int num_queries,
+	const float *rows, int dim, int count, float *scores);
+typedef void (*ScanPqFunc)(const float *lut, const uint8_t *codes,
+	int num_subquantizers, int num_blocks, float *scores);
+
+static float SquaredNormScalar(const float *src, int n) {
+	float sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += src[i] * src[i];
+	return sum;
+}
+
+static void ScaleScalar(const float *src, float *dst, int n, float scale) {
+	for (int i = 0; i < n; i++)
+		dst[i] = src[i] * scale;
+}
+
+static uint16_t FloatToHalfScalar(float value) {
+	uint32_t f;
+	memcpy(&f, &value, sizeof(f));
+	uint32_t sign = (f >> 16) & 0x8000;
+	uint32_t abs = f & 0x7fffffff;
+
+	/* NaN keeps a quiet payload, overflow and infinity saturate to
+	 * infinity. */
+	if (abs > 0x7f800000)
+		return sign | 0x7e00;
+	if (abs >= 0x477ff000)
+		return sign | 0x7c00;
+
+	/* Normal halves: drop 13 mantissa bits with round to nearest even. A
+	 * carry into the exponent is the correct result. */
+	if (abs >= 0x38800000) {
+		uint32_t h = (abs - 0x38000000) >> 13;
+		uint32_t rest = abs & 0x1fff;
+		if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+			h++;
+		return sign | h;
+	}
+
+	/* Subnormal halves and underflow to zero. */
+	if (abs < 0x33000000)
+		return sign;
+	uint32_t exponent = abs >> 23;
+	uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+	uint32_t shift = 126 - exponent;
+	uint32_t h = mantissa >> shift;
+	uint32_t rest = mantissa & ((1u << shift) - 1);
+	uint32_t half = 1u << (shift - 1);
+	if (rest > half || (rest == half && (h & 1)))
+		h++;
+	return sign | h;
+}
+
+static float HalfToFloatScalar(uint16_t value) {
+	uint32_t sign = (uint32_t) (value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1f;
+	uint32_t mantissa = value & 0x3ff;
+	uint32_t f;
+
+	if (exponent == 0x1f) {
+		f = sign | 0x7f800000 | (mantissa << 13);
+	} else if (exponent != 0) {
+		f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	} else if (mantissa == 0) {
+		f = sign;
+	} else {
+		/* Subnormal half, normalise the mantissa. */
+		exponent = 113;
+		while (!(mantissa & 0x400)) {
+			mantissa <<= 1;
+			exponent--;
+		}
+		f = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+	}
+
+	float result;
+	memcpy(&result, &f, sizeof(result));
+	return result;
+}
+
+static void FloatToHalfRowScalar(const float *src, uint16_t *dst, int n) {
+	for (int i = 0; i < n; i++)
+		dst[i] = FloatToHalfScalar(src[i]);
+}
+
+static void HalfToFloatRowScalar(const uint16_t *src, float *dst, int n) {
+	for (int i = 0; i < n; i++)
+		dst[i] = HalfToFloatScalar(src[i]);
+}
+
+static void DequantizeScalar(const int8_t *src, float scale, float *dst,
+	int n) {
+	for (int i = 0; i < n; i++)
+		dst[i] = src[i] * scale;
+}
+
+static float MaxAbsScalar(const float *src, int n) {
+	float max_abs = 0;
+	for (int i = 0; i < n; i++)
+		max_abs = fmaxf(max_abs, fabsf(src[i]));
+	return max_abs;
+}
+
+static void QuantizeScalar(const float *src, int8_t *dst, int n,
+	float inv_scale) {
+	for (int i = 0; i < n; i++) {
+		long q = lrintf(src[i] * inv_scale);
+		dst[i] = (int8_t) (q > 127 ? 127 : (q < -127 ? -127 : q));
+	}
+}
+
+static void DotF32Scalar(const float *query, const float *rows, int dim,
+	int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const float *row = rows + (size_t) r * dim;
+		float sum = 0;
+		for (int i = 0; i < dim; i++)
+			sum += query[i] * row[i];
+		scores[r] = sum;
+	}
+}
+
+static void DotF16Scalar(const float *query, const uint16_t *rows, int dim,
+	int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const uint16_t *row = rows + (size_t) r * dim;
+		float sum = 0;
+		for (int i = 0; i < dim; i++)
+			sum += query[i] * HalfToFloatScalar(row[i]);
+		scores[r] = sum;
+	}
+}
+
+static void DotInt8Scalar(const float *query, const int8_t *rows,
+	const float *scales, int dim, int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const int8_t *row = rows + (size_t) r * dim;
+		float sum = 0;
+		for (int i = 0; i < dim; i++)
+			sum += query[i] * row[i];
+		scores[r] = sum * scales[r];
+	}
+}
+
+static void DotBatchF32Scalar(const float *queries, int num_queries,
+	const float *rows, int dim, int count, float *scores) {
+	for (int q = 0; q < num_queries; q++)
+		DotF32Scalar(queries + (size_t) q * dim, rows, dim, count,
+			scores + (size_t) q * count);
+}
+
+static void ScanPqScalar(const float *lut, const uint8_t *codes,
+	int num_subquantizers, int num_blocks, float *scores) {
+	for (int b = 0; b < num_blocks; b++) {
+		float *block_scores = scores + b * PQ_CODE_BLOCK;
+		for (int j = 0; j < PQ_CODE_BLOCK; j++)
+			block_scores[j] = 0;
+		for (int m = 0; m < num_subquantizers; m++) {
+			const float *table = lut + m * 256;
+			for (int j = 0; j < PQ_CODE_BLOCK; j++)
+				block_scores[j] += table[codes[j]];
+			codes += PQ_CODE_BLOCK;
+		}
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+static float SquaredNormAVX2(const float *src, int n) {
+	/* Two accumulators hide the latency of the fused multiply-add. */
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256 a = _mm256_loadu_ps(src + i);
+		__m256 b = _mm256_loadu_ps(src + i + 8);
+		acc0 = _mm256_fmadd_ps(a, a, acc0);
+		acc1 = _mm256_fmadd_ps(b, b, acc1);
+	}
+	for (; i + 8 <= n; i += 8) {
+		__m256 a = _mm256_loadu_ps(src + i);
+		acc0 = _mm256_fmadd_ps(a, a, acc0);
+	}
+
+	__m256 acc = _mm256_add_ps(acc0, acc1);
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+		_mm256_extractf128_ps(acc, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+	return _mm_cvtss_f32(sum) + SquaredNormScalar(src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void ScaleAVX2(const float *src, float *dst, int n, float scale) {
+	__m256 s = _mm256_set1_ps(scale);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), s));
+	ScaleScalar(src + i, dst + i, n - i, scale);
+}
+
+__attribute__((target("avx,f16c")))
+static void FloatToHalfRowF16C(const float *src, uint16_t *dst, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+			_MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i *) (dst + i), h);
+	}
+	FloatToHalfRowScalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static float MaxAbsAVX2(const float *src, int n) {
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	__m256 acc = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		acc = _mm256_max_ps(acc,
+			_mm256_andnot_ps(sign, _mm256_loadu_ps(src + i)));
+
+	float lanes[8];
+	_mm256_storeu_ps(lanes, acc);
+	float max_abs = MaxAbsScalar(src + i, n - i);
+	for (int k = 0; k < 8; k++)
+		max_abs = fmaxf(max_abs, lanes[k]);
+	return max_abs;
+}
+
+/* Eight values per iteration. The conversion rounds to nearest even like
+ * lrintf() and the saturating packs clamp to the int8 range. */
+__attribute__((target("avx2")))
+static void QuantizeAVX2(const float *src, int8_t *dst, int n,
+	float inv_scale) {
+	__m256 s = _mm256_set1_ps(inv_scale);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i q = _mm256_cvtps_epi32(
+			_mm256_mul_ps(_mm256_loadu_ps(src + i), s));
+		__m128i q16 = _mm_packs_epi32(_mm256_castsi256_si128(q),
+			_mm256_extracti128_si256(q, 1));
+		_mm_storel_epi64((__m128i *) (dst + i), _mm_packs_epi16(q16, q16));
+	}
+	QuantizeScalar(src + i, dst + i, n - i, inv_scale);
+}
+
+/* The dot product kernels stream the rows once per query, so they are
+ * bound by memory bandwidth; two accumulators are enough to hide the
+ * latency of the fused multiply-add. Every CPU with AVX2 has F16C. */
+__attribute__((target("avx2,fma")))
+static inline float HorizontalSumAVX2(__m256 v) {
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v),
+		_mm256_extractf128_ps(v, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+	return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static void DotF32AVX2(const float *query, const float *rows, int dim,
+	int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const float *row = rows + (size_t) r * dim;
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		int i = 0;
+		for (; i + 16 <= dim; i += 16) {
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i),
+				_mm256_loadu_ps(row + i), acc0);
+			acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8),
+				_mm256_loadu_ps(row + i + 8), acc1);
+		}
+		for (; i + 8 <= dim; i += 8)
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i),
+				_mm256_loadu_ps(row + i), acc0);
+		float sum = HorizontalSumAVX2(_mm256_add_ps(acc0, acc1));
+		for (; i < dim; i++)
+			sum += query[i] * row[i];
+		scores[r] = sum;
+	}
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static void DotF16AVX2(const float *query, const uint16_t *rows, int dim,
+	int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const uint16_t *row = rows + (size_t) r * dim;
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		int i = 0;
+		for (; i + 16 <= dim; i += 16) {
+			__m256 a = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (row + i)));
+			__m256 b = _mm256_cvtph_ps(
+				_mm_loadu_si128((const __m128i *) (row + i + 8)));
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), a, acc0);
+			acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8), b, acc1);
+		}
+		float sum = HorizontalSumAVX2(_mm256_add_ps(acc0, acc1));
+		for (; i < dim; i++)
+			sum += query[i] * HalfToFloatScalar(row[i]);
+		scores[r] = sum;
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void DotInt8AVX2(const float *query, const int8_t *rows,
+	const float *scales, int dim, int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const int8_t *row = rows + (size_t) r * dim;
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		int i = 0;
+		for (; i + 16 <= dim; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) (row + i));
+			__m256 a = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(v));
+			__m256 b = _mm256_cvtepi32_ps(
+				_mm256_cvtepi8_epi32(_mm_srli_si128(v, 8)));
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), a, acc0);
+			acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8), b, acc1);
+		}
+		float sum = HorizontalSumAVX2(_mm256_add_ps(acc0, acc1));
+		for (; i < dim; i++)
+			sum += query[i] * row[i];
+		scores[r] = sum * scales[r];
+	}
+}
+
+__attribute__((target("avx512f")))
+static void DotF32AVX512(const float *query, const float *rows, int dim,
+	int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const float *row = rows + (size_t) r * dim;
+		__m512 acc0 = _mm512_setzero_ps();
+		__m512 acc1 = _mm512_setzero_ps();
+		int i = 0;
+		for (; i + 32 <= dim; i += 32) {
+			acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i),
+				_mm512_loadu_ps(row + i), acc0);
+			acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i + 16),
+				_mm512_loadu_ps(row + i + 16), acc1);
+		}
+		for (; i + 16 <= dim; i += 16)
+			acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i),
+				_mm512_loadu_ps(row + i), acc0);
+		float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+		for (; i < dim; i++)
+			sum += query[i] * row[i];
+		scores[r] = sum;
+	}
+}
+
+__attribute__((target("avx512f")))
+static void DotF16AVX512(const float *query, const uint16_t *rows, int dim,
+	int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const uint16_t *row = rows + (size_t) r * dim;
+		__m512 acc0 = _mm512_setzero_ps();
+		__m512 acc1 = _mm512_setzero_ps();
+		int i = 0;
+		for (; i + 32 <= dim; i += 32) {
+			__m512 a = _mm512_cvtph_ps(
+				_mm256_loadu_si256((const __m256i *) (row + i)));
+			__m512 b = _mm512_cvtph_ps(
+				_mm256_loadu_si256((const __m256i *) (row + i + 16)));
+			acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), a, acc0);
+			acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i + 16), b, acc1);
+		}
+		float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+		for (; i < dim; i++)
+			sum += query[i] * HalfToFloatScalar(row[i]);
+		scores[r] = sum;
+	}
+}
+
+__attribute__((target("avx512f")))
+static void DotInt8AVX512(const float *query, const int8_t *rows,
+	const float *scales, int dim, int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const int8_t *row = rows + (size_t) r * dim;
+		__m512 acc0 = _mm512_setzero_ps();
+		__m512 acc1 = _mm512_setzero_ps();
+		int i = 0;
+		for (; i + 32 <= dim; i += 32) {
+			__m512 a = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(
+				_mm_loadu_si128((const __m128i *) (row + i))));
+			__m512 b = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(
+				_mm_loadu_si128((const __m128i *) (row + i + 16))));
+			acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), a, acc0);
+			acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i + 16), b, acc1);
+		}
+		float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+		for (; i < dim; i++)
+			sum += query[i] * row[i];
+		scores[r] = sum * scales[r];
+	}
+}
+__attribute__((target("avx,f16c")))
+static void HalfToFloatRowF16C(const uint16_t *src, float *dst, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i,
+			_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (src + i))));
+	HalfToFloatRowScalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void DequantizeAVX2(const int8_t *src, float scale, float *dst,
+	int n) {
+	__m256 s = _mm256_set1_ps(scale);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) (src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), s));
+	}
+	DequantizeScalar(src + i, scale, dst + i, n - i);
+}
+
+/* Four queries times two rows per tile, eight accumulators. Queries and
+ * rows left over are done one by one. */
+__attribute__((target("avx2,fma")))
+static void DotBatchF32AVX2(const float *queries, int num_queries,
+	const float *rows, int dim, int count, float *scores) {
+	int q = 0;
+	for (; q + 4 <= num_queries; q += 4) {
+		const float *q0 = queries + (size_t) q * dim;
+		const float *q1 = q0 + dim, *q2 = q1 + dim, *q3 = q2 + dim;
+		float *s0 = scores + (size_t) q * count;
+		float *s1 = s0 + count, *s2 = s1 + count, *s3 = s2 + count;
+
+		int r = 0;
+		for (; r + 2 <= count; r += 2) {
+			const float *r0 = rows + (size_t) r * dim, *r1 = r0 + dim;
+			__m256 a00 = _mm256_setzero_ps(), a01 = _mm256_setzero_ps();
+			__m256 a10 = _mm256_setzero_ps(), a11 = _mm256_setzero_ps();
+			__m256 a20 = _mm256_setzero_ps(), a21 = _mm256_setzero_ps();
+			__m256 a30 = _mm256_setzero_ps(), a31 = _mm256_setzero_ps();
+			int i = 0;
+			for (; i + 8 <= dim; i += 8) {
+				__m256 v0 = _mm256_loadu_ps(r0 + i);
+				__m256 v1 = _mm256_loadu_ps(r1 + i);
+				__m256 u = _mm256_loadu_ps(q0 + i);
+				a00 = _mm256_fmadd_ps(u, v0, a00);
+				a01 = _mm256_fmadd_ps(u, v1, a01);
+				u = _mm256_loadu_ps(q1 + i);
+				a10 = _mm256_fmadd_ps(u, v0, a10);
+				a11 = _mm256_fmadd_ps(u, v1, a11);
+				u = _mm256_loadu_ps(q2 + i);
+				a20 = _mm256_fmadd_ps(u, v0, a20);
+				a21 = _mm256_fmadd_ps(u, v1, a21);
+				u = _mm256_loadu_ps(q3 + i);
+				a30 = _mm256_fmadd_ps(u, v0, a30);
+				a31 = _mm256_fmadd_ps(u, v1, a31);
+			}
+			float t00 = HorizontalSumAVX2(a00), t01 = HorizontalSumAVX2(a01);
+			float t10 = HorizontalSumAVX2(a10), t11 = HorizontalSumAVX2(a11);
+			float t20 = HorizontalSumAVX2(a20), t21 = HorizontalSumAVX2(a21);
+			float t30 = HorizontalSumAVX2(a30), t31 = HorizontalSumAVX2(a31);
+			for (; i < dim; i++) {
+				t00 += q0[i] * r0[i];
+				t01 += q0[i] * r1[i];
+				t10 += q1[i] * r0[i];
+				t11 += q1[i] * r1[i];
+				t20 += q2[i] * r0[i];
+				t21 += q2[i] * r1[i];
+				t30 += q3[i] * r0[i];
+				t31 += q3[i] * r1[i];
+			}
+			s0[r] = t00; s0[r + 1] = t01;
+			s1[r] = t10; s1[r + 1] = t11;
+			s2[r] = t20; s2[r + 1] = t21;
+			s3[r] = t30; s3[r + 1] = t31;
+		}
+		if (r < count) {
+			const float *row = rows + (size_t) r * dim;
+			DotF32AVX2(q0, row, dim, 1, s0 + r);
+			DotF32AVX2(q1, row, dim, 1, s1 + r);
+			DotF32AVX2(q2, row, dim, 1, s2 + r);
+			DotF32AVX2(q3, row, dim, 1, s3 + r);
+		}
+	}
+	for (; q < num_queries; q++)
+		DotF32AVX2(queries + (size_t) q * dim, rows, dim, count,
+			scores + (size_t) q * count);
+}
+
+__attribute__((target("avx512f")))
+static void DotBatchF32AVX512(const float *queries, int num_queries,
+	const float *rows, int dim, int count, float *scores) {
+	int q = 0;
+	for (; q + 4 <= num_queries; q += 4) {
+		const float *q0 = queries + (size_t) q * dim;
+		const float *q1 = q0 + dim, *q2 = q1 + dim, *q3 = q2 + dim;
+		float *s0 = scores + (size_t) q * count;
+		float *s1 = s0 + count, *s2 = s1 + count, *s3 = s2 + count;
+
+		int r = 0;
+		for (; r + 2 <= count; r += 2) {
+			const float *r0 = rows + (size_t) r * dim, *r1 = r0 + dim;
+			__m512 a00 = _mm512_setzero_ps(), a01 = _mm512_setzero_ps();
+			__m512 a10 = _mm512_setzero_ps(), a11 = _mm512_setzero_ps();
+			__m512 a20 = _mm512_setzero_ps(), a21 = _mm512_setzero_ps();
+			__m512 a30 = _mm512_setzero_ps(), a31 = _mm512_setzero_ps();
+			int i = 0;
+			for (; i + 16 <= dim; i += 16) {
+				__m512 v0 = _mm512_loadu_ps(r0 + i);
+				__m512 v1 = _mm512_loadu_ps(r1 + i);
+				__m512 u = _mm512_loadu_ps(q0 + i);
+				a00 = _mm512_fmadd_ps(u, v0, a00);
+				a01 = _mm512_fmadd_ps(u, v1, a01);
+				u = _mm512_loadu_ps(q1 + i);
+				a10 = _mm512_fmadd_ps(u, v0, a10);
+				a11 = _mm512_fmadd_ps(u, v1, a11);
+				u = _mm512_loadu_ps(q2 + i);
+				a20 = _mm512_fmadd_ps(u, v0, a20);
+				a21 = _mm512_fmadd_ps(u, v1, a21);
+				u = _mm512_loadu_ps(q3 + i);
+				a30 = _mm512_fmadd_ps(u, v0, a30);
+				a31 = _mm512_fmadd_ps(u, v1, a31);
+			}
+			float t00 = _mm512_reduce_add_ps(a00), t01 = _mm512_reduce_add_ps(a01);
+			float t10 = _mm512_reduce_add_ps(a10), t11 = _mm512_reduce_add_ps(a11);
+			float t20 = _mm512_reduce_add_ps(a20), t21 = _mm512_reduce_add_ps(a21);
+			float t30 = _mm512_reduce_add_ps(a30), t31 = _mm512_reduce_add_ps(a31);
+			for (; i < dim; i++) {
+				t00 += q0[i] * r0[i];
+				t01 += q0[i] * r1[i];
+				t10 += q1[i] * r0[i];
+				t11 += q1[i] * r1[i];
+				t20 += q2[i] * r0[i];
+				t21 += q2[i] * r1[i];
+				t30 += q3[i] * r0[i];
+				t31 += q3[i] * r1[i];
+			}
+			s0[r] = t00; s0[r + 1] = t01;
+			s1[r] = t10; s1[r + 1] = t11;
+			s2[r] = t20; s2[r + 1] = t21;
+			s3[r] = t30; s3[r + 1] = t31;
+		}
+		if (r < count) {
+			const float *row = rows + (size_t) r * dim;
+			DotF32AVX512(q0, row, dim, 1, s0 + r);
+			DotF32AVX512(q1, row, dim, 1, s1 + r);
+			DotF32AVX512(q2, row, dim, 1, s2 + r);
+			DotF32AVX512(q3, row, dim, 1, s3 + r);
+		}
+	}
+	for (; q < num_queries; q++)
+		DotF32AVX512(queries + (size_t) q * dim, rows, dim, count,
+			scores + (size_t) q * count);
+}
+
+/* One gather of the codes of a subquantizer for all vectors of a block. Two
+ * accumulators hide the latency of the additions. */
+__attribute__((target("avx2")))
+static void ScanPqAVX2(const float *lut, const uint8_t *codes,
+	int num_subquantizers, int num_blocks, float *scores) {
+	for (int b = 0; b < num_blocks; b++) {
+		__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+		int m = 0;
+		for (; m + 2 <= num_subquantizers; m += 2) {
+			__m256i i0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) codes));
+			__m256i i1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (codes + PQ_CODE_BLOCK)));
+			acc0 = _mm256_add_ps(acc0, _mm256_i32gather_ps(lut + m * 256, i0, 4));
+			acc1 = _mm256_add_ps(acc1, _mm256_i32gather_ps(lut + (m + 1) * 256, i1, 4));
+			codes += 2 * PQ_CODE_BLOCK;
+		}
+		if (m < num_subquantizers) {
+			__m256i i0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) codes));
+			acc0 = _mm256_add_ps(acc0, _mm256_i32gather_ps(lut + m * 256, i0, 4));
+			codes += PQ_CODE_BLOCK;
+		}
+		_mm256_storeu_ps(scores + b * PQ_CODE_BLOCK, _mm256_add_ps(acc0, acc1));
+	}
+}
+
+/* Two blocks per gather. The codes of a subquantizer of both blocks are
+ * num_subquantizers * PQ_CODE_BLOCK bytes apart. */
+__attribute__((target("avx512f")))
+static void ScanPqAVX512(const float *lut, const uint8_t *codes,
+	int num_subquantizers, int num_blocks, float *scores) {
+	size_t stride = (size_t) num_subquantizers * PQ_CODE_BLOCK;
+	int b = 0;
+	for (; b + 2 <= num_blocks; b += 2) {
+		const uint8_t *block0 = codes + b * stride, *block1 = block0 + stride;
+		__m512 acc = _mm512_setzero_ps();
+		for (int m = 0; m < num_subquantizers; m++) {
+			__m128i c = _mm_unpacklo_epi64(
+				_mm_loadl_epi64((const __m128i *) (block0 + m * PQ_CODE_BLOCK)),
+				_mm_loadl_epi64((const __m128i *) (block1 + m * PQ_CODE_BLOCK)));
+			acc = _mm512_add_ps(acc, _mm512_i32gather_ps(_mm512_cvtepu8_epi32(c),
+				lut + m * 256, 4));
+		}
+		_mm512_storeu_ps(scores + b * PQ_CODE_BLOCK, acc);
+	}
+	if (b < num_blocks)
+		ScanPqScalar(lut, codes + b * stride, num_subquantizers, 1,
+			scores + b * PQ_CODE_BLOCK);
+}
+#endif
+
+#if defined(__aarch64__)
+static float SquaredNormNEON(const float *src, int n) {
+	float32x4_t acc0 = vdupq_n_f32(0);
+	float32x4_t acc1 = vdupq_n_f32(0);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		float32x4_t a = vld1q_f32(src + i);
+		float32x4_t b = vld1q_f32(src + i + 4);
+		acc0 = vfmaq_f32(acc0, a, a);
+		acc1 = vfmaq_f32(acc1, b, b);
+	}
+	return vaddvq_f32(vaddq_f32(acc0, acc1)) +
+		SquaredNormScalar(src + i, n - i);
+}
+
+static void ScaleNEON(const float *src, float *dst, int n, float scale) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dst + i, vmulq_n_f32(vld1q_f32(src + i), scale));
+	ScaleScalar(src + i, dst + i, n - i, scale);
+}
+
+static void FloatToHalfRowNEON(const float *src, uint16_t *dst, int n) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1_u16(dst + i,
+			vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+	FloatToHalfRowScalar(src + i, dst + i, n - i);
+}
+
+static float MaxAbsNEON(const float *src, int n) {
+	float32x4_t acc = vdupq_n_f32(0);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		acc = vmaxq_f32(acc, vabsq_f32(vld1q_f32(src + i)));
+	return fmaxf(vmaxvq_f32(acc), MaxAbsScalar(src + i, n - i));
+}
+
+static void QuantizeNEON(const float *src, int8_t *dst, int n,
+	float inv_scale) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		int32x4_t a = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), inv_scale));
+		int32x4_t b = vcvtnq_s32_f32(
+			vmulq_n_f32(vld1q_f32(src + i + 4), inv_scale));
+		vst1_s8(dst + i, vqmovn_s16(vcombine_s16(vqmovn_s32(a), vqmovn_s32(b))));
+	}
+	QuantizeScalar(src + i, dst + i, n - i, inv_scale);
+}
+
+static void DotF32NEON(const float *query, const float *rows, int dim,
+	int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const float *row = rows + (size_t) r * dim;
+		float32x4_t acc0 = vdupq_n_f32(0);
+		float32x4_t acc1 = vdupq_n_f32(0);
+		int i = 0;
+		for (; i + 8 <= dim; i += 8) {
+			acc0 = vfmaq_f32(acc0, vld1q_f32(query + i), vld1q_f32(row + i));
+			acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4),
+				vld1q_f32(row + i + 4));
+		}
+		float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+		for (; i < dim; i++)
+			sum += query[i] * row[i];
+		scores[r] = sum;
+	}
+}
+
+static void DotF16NEON(const float *query, const uint16_t *rows, int dim,
+	int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const uint16_t *row = rows + (size_t) r * dim;
+		float32x4_t acc0 = vdupq_n_f32(0);
+		float32x4_t acc1 = vdupq_n_f32(0);
+		int i = 0;
+		for (; i + 8 <= dim; i += 8) {
+			float32x4_t a = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row + i)));
+			float32x4_t b =
+				vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row + i + 4)));
+			acc0 = vfmaq_f32(acc0, vld1q_f32(query + i), a);
+			acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4), b);
+		}
+		float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+		for (; i < dim; i++)
+			sum += query[i] * HalfToFloatScalar(row[i]);
+		scores[r] = sum;
+	}
+}
+
+static void DotInt8NEON(const float *query, const int8_t *rows,
+	const float *scales, int dim, int count, float *scores) {
+	for (int r = 0; r < count; r++) {
+		const int8_t *row = rows + (size_t) r * dim;
+		float32x4_t acc0 = vdupq_n_f32(0);
+		float32x4_t acc1 = vdupq_n_f32(0);
+		int i = 0;
+		for (; i + 8 <= dim; i += 8) {
+			int16x8_t v = vmovl_s8(vld1_s8(row + i));
+			float32x4_t a = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+			float32x4_t b = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+			acc0 = vfmaq_f32(acc0, vld1q_f32(query + i), a);
+			acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4), b);
+		}
+		float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+		for (; i < dim; i++)
+			sum += query[i] * row[i];
+		scores[r] = sum * scales[r];
+	}
+}
+static void HalfToFloatRowNEON(const uint16_t *src, float *dst, int n) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+	HalfToFloatRowScalar(src + i, dst + i, n - i);
+}
+
+static void DequantizeNEON(const int8_t *src, float scale, float *dst,
+	int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t v = vmovl_s8(vld1_s8(src + i));
+		vst1q_f32(dst + i,
+			vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+		vst1q_f32(dst + i + 4,
+			vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+	}
+	DequantizeScalar(src + i, scale, dst + i, n - i);
+}
+
+static void DotBatchF32NEON(const float *queries, int num_queries,
+	const float *rows, int dim, int count, float *scores) {
+	int q = 0;
+	for (; q + 4 <= num_queries; q += 4) {
+		const float *q0 = queries + (size_t) q * dim;
+		const float *q1 = q0 + dim, *q2 = q1 + dim, *q3 = q2 + dim;
+		float *s0 = scores + (size_t) q * count;
+		float *s1 = s0 + count, *s2 = s1 + count, *s3 = s2 + count;
+
+		int r = 0;
+		for (; r + 2 <= count; r += 2) {
+			const float *r0 = rows + (size_t) r * dim, *r1 = r0 + dim;
+			float32x4_t a00 = vdupq_n_f32(0), a01 = vdupq_n_f32(0);
+			float32x4_t a10 = vdupq_n_f32(0), a11 = vdupq_n_f32(0);
+			float32x4_t a20 = vdupq_n_f32(0), a21 = vdupq_n_f32(0);
+			float32x4_t a30 = vdupq_n_f32(0), a31 = vdupq_n_f32(0);
+			int i = 0;
+			for (; i + 4 <= dim; i += 4) {
+				float32x4_t v0 = vld1q_f32(r0 + i);
+				float32x4_t v1 = vld1q_f32(r1 + i);
+				float32x4_t u = vld1q_f32(q0 + i);
+				a00 = vfmaq_f32(a00, u, v0);
+				a01 = vfmaq_f32(a01, u, v1);
+				u = vld1q_f32(q1 + i);
+				a10 = vfmaq_f32(a10, u, v0);
+				a11 = vfmaq_f32(a11, u, v1);
+				u = vld1q_f32(q2 + i);
+				a20 = vfmaq_f32(a20, u, v0);
+				a21 = vfmaq_f32(a21, u, v1);
+				u = vld1q_f32(q3 + i);
+				a30 = vfmaq_f32(a30, u, v0);
+				a31 = vfmaq_f32(a31, u, v1);
+			}
+			float t00 = vaddvq_f32(a00), t01 = vaddvq_f32(a01);
+			float t10 = vaddvq_f32(a10), t11 = vaddvq_f32(a11);
+			float t20 = vaddvq_f32(a20), t21 = vaddvq_f32(a21);
+			float t30 = vaddvq_f32(a30), t31 = vaddvq_f32(a31);
+			for (; i < dim; i++) {
+				t00 += q0[i] * r0[i];
+				t01 += q0[i] * r1[i];
+				t10 += q1[i] * r0[i];
+				t11 += q1[i] * r1[i];
+				t20 += q2[i] * r0[i];
+				t21 += q2[i] * r1[i];
+				t30 += q3[i] * r0[i];
+				t31 += q3[i] * r1[i];
+			}
+			s0[r] = t00; s0[r + 1] = t01;
+			s1[r] = t10; s1[r + 1] = t11;
+			s2[r] = t20; s2[r + 1] = t21;
+			s3[r] = t30; s3[r + 1] = t31;
+		}
+		if (r < count) {
+			const float *row = rows + (size_t) r * dim;
+			DotF32NEON(q0, row, dim, 1, s0 + r);
+			DotF32NEON(q1, row, dim, 1, s1 + r);
+			DotF32NEON(q2, row, dim, 1, s2 + r);
+			DotF32NEON(q3, row, dim, 1, s3 + r);
+		}
+	}
+	for (; q < num_queries; q++)
+		DotF32NEON(queries + (size_t) q * dim, rows, dim, count,
+			scores + (size_t) q * count);
+}
+#endif
+
+static SquaredNormFunc SelectSquaredNormFunc() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return SquaredNormAVX2;
+#elif defined(__aarch64__)
+	return SquaredNormNEON;
+#endif
+	return SquaredNormScalar;
+}
+
+static ScaleFunc SelectScaleFunc() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		return ScaleAVX2;
+#elif defined(__aarch64__)
+	return ScaleNEON;
+#endif
+	return ScaleScalar;
+}
+
+static FloatToHalfFunc SelectFloatToHalfFunc() {
+#if defined(__x86_64__) || defined(__i386__)
+	/* Every CPU with AVX2 has F16C. */
+	if (__builtin_cpu_supports("avx2"))
+		return FloatToHalfRowF16C;
+#elif defined(__aarch64__)
+	return FloatToHalfRowNEON;
+#endif
+	return FloatToHalfRowScalar;
+}
+
+static MaxAbsFunc SelectMaxAbsFunc() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		return MaxAbsAVX2;
+#elif defined(__aarch64__)
+	return MaxAbsNEON;
+#endif
+	return MaxAbsScalar;
+}
+
+static QuantizeFunc SelectQuantizeFunc() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		return QuantizeAVX2;
+#elif defined(__aarch64__)
+	return QuantizeNEON;
+#endif
+	return QuantizeScalar;
+}
+
+static DotF32Func SelectDotF32Func() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx512f"))
+		return DotF32AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return DotF32AVX2;
+#elif defined(__aarch64__)
+	return DotF32NEON;
+#endif
+	return DotF32Scalar;
+}
+
+static DotF16Func SelectDotF16Func() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx512f"))
+		return DotF16AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return DotF16AVX2;
+#elif defined(__aarch64__)
+	return DotF16NEON;
+#endif
+	return DotF16Scalar;
+}
+
+static DotInt8Func SelectDotInt8Func() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx512f"))
+		return DotInt8AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return DotInt8AVX2;
+#elif defined(__aarch64__)
+	return DotInt8NEON;
+#endif
+	return DotInt8Scalar;
+}
+
+static HalfToFloatFunc SelectHalfToFloatFunc() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		return HalfToFloatRowF16C;
+#elif defined(__aarch64__)
+	return HalfToFloatRowNEON;
+#endif
+	return HalfToFloatRowScalar;
+}
+
+static DequantizeFunc SelectDequantizeFunc() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		return DequantizeAVX2;
+#elif defined(__aarch64__)
+	return DequantizeNEON;
+#endif
+	return DequantizeScalar;
+}
+
+static DotBatchF32Func SelectDotBatchF32Func() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx512f"))
+		return DotBatchF32AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return DotBatchF32AVX2;
+#elif defined(__aarch64__)
+	return DotBatchF32NEON;
+#endif
+	return DotBatchF32Scalar;
+}
+
+static ScanPqFunc SelectScanPqFunc() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx512f"))
+		return ScanPqAVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return ScanPqAVX2;
+#endif
+	return ScanPqScalar;
+}
+
+float L2Normalize(const float *src, float *dst, int n) {
+	static const SquaredNormFunc norm_func = SelectSquaredNormFunc();
+	static const ScaleFunc scale_func = SelectScaleFunc();
+
+	float norm = sqrtf(norm_func(src, n));
+	if (norm > 0)
+		scale_func(src, dst, n, 1.0f / norm);
+	else if (dst != src)
+		memcpy(dst, src, n * sizeof(float));
+	return norm;
+}
+
+void FloatToHalf(const float *src, uint16_t *dst, int n) {
+	static const FloatToHalfFunc half_func = SelectFloatToHalfFunc();
+	half_func(src, dst, n);
+}
+
+void HalfToFloat(const uint16_t *src, float *dst, int n) {
+	static const HalfToFloatFunc half_func = SelectHalfToFloatFunc();
+	half_func(src, dst, n);
+}
+
+void DequantizeInt8(const int8_t *src, float scale, float *dst, int n) {
+	static const DequantizeFunc dequantize_func = SelectDequantizeFunc();
+	dequantize_func(src, scale, dst, n);
+}
+
+float QuantizeInt8(const float *src, int8_t *dst, int n) {
+	static const MaxAbsFunc max_func = SelectMaxAbsFunc();
+	static const QuantizeFunc quantize_func = SelectQuantizeFunc();
+
+	float scale = max_func(src, n) / 127.0f;
+	if (scale > 0) {
+		quantize_func(src, dst, n, 1.0f / scale);
+	} else {
+		memset(dst, 0, n);
+		scale = 0;
+	}
+	return scale;
+}
+
+void DotProductsF32(const float *query, const float *rows, int dim,
+	int count, float *scores) {
+	static const DotF32Func dot_func = SelectDotF32Func();
+	dot_func(query, rows, dim, count, scores);
+}
+
+void DotProductsF16(const float *query, const uint16_t *rows, int dim,
+	int count, float *scores) {
+	static const DotF16Func dot_func = SelectDotF16Func();
+	dot_func(query, rows, dim, count, scores);
+}
+
+void DotProductsInt8(const float *query, const int8_t *rows,
+	const float *scales, int dim, int count, float *scores) {
+	static const DotInt8Func dot_func = SelectDotInt8Func();
+	dot_func(query, rows, scales, dim, count, scores);
+}
+
+void DotProductsBatchF32(const float *queries, int num_queries,
+	const float *rows, int dim, int count, float *scores) {
+	static const DotBatchF32Func dot_func = SelectDotBatchF32Func();
+	dot_func(queries, num_queries, rows, dim, count, scores);
+}
+
+void ScanPqCodes(const float *lut, const uint8_t *codes,
+	int num_subquantizers, int num_blocks, float *scores) {
+	static const ScanPqFunc scan_func = SelectScanPqFunc();
+	scan_func(lut, codes, num_subquantizers, num_blocks, scores);
+}
+
+}
@@ -0,0 +1,85 @@
+#ifndef _EMBEDDING_KERNELS_H_
+#define _EMBEDDING_KERNELS_H_
+
+/*
+ * Kernels for post-processing the feature vectors of recognition models.
+ * Like the aligner kernels, nothing in here depends on OpenCV or allocates
+ * memory.
+ */
+
+#include <stdint.h>
+
+namespace mirror {
+
+/*
+ * Writes src scaled to unit L2 norm to dst and returns the norm of src. dst
+ * may be src. A vector with a zero norm is copied unchanged. Uses AVX2 or
+ * NEON when the CPU supports it.
+ */
+float L2Normalize(const float *src, float *dst, int n);
+
+/*
+ * Converts n floats to IEEE 754 half precision, rounding to nearest even.
+ * Values beyond the half range become infinities. Uses F16C or NEON when the
+ * CPU supports it.
+ */
+void FloatToHalf(const float *src, uint16_t *dst, int n);
+
+/* Converts n IEEE 754 half precision values to floats. Uses F16C or NEON
+ * when the CPU supports it. */
+void HalfToFloat(const uint16_t *src, float *dst, int n);
+
+/* Writes dst[i] = src[i] * scale for n int8 values. */
+void DequantizeInt8(const int8_t *src, float scale, float *dst, int n);
+
+/*
+ * Quantizes n floats symmetrically to int8 with a single scale,
+ * dst[i] = round(src[i] / scale) with scale = max |src[i]| / 127, and returns
+ * the scale. An all-zero vector gets a scale of 0. Uses AVX2 or NEON when the
+ * CPU supports it.
+ */
+float QuantizeInt8(const float *src, int8_t *dst, int n);
+
+/*
+ * Dot products of a float query of length dim with count rows stored back to
+ * back: scores[r] = sum_i query[i] * rows[r * dim + i]. The F16 variant
+ * reads IEEE 754 half precision rows, the Int8 variant multiplies the
+ * product of row r with scales[r]. Use AVX-512, AVX2 or NEON when the CPU
+ * supports it.
+ */
+void DotProductsF32(const float *query, const float *rows, int dim,
+	int count, float *scores);
+void DotProductsF16(const float *query, const uint16_t *rows, int dim,
+	int count, float *scores);
+void DotProductsInt8(const float *query, const int8_t *rows,
+	const float *scales, int dim, int count, float *scores);
+
+/*
+ * Dot products of num_queries float queries with count float rows, both
+ * stored back to back: scores[q * count + r] is the product of query q and
+ * row r. Tiles of four queries and two rows are multiplied at a time so
+ * that every element loaded is used more than once. The rows are streamed
+ * once per four queries, so callers should pass blocks of rows that fit in
+ * the L2 cache. Uses AVX-512, AVX2 or NEON when the CPU supports it.
+ */
+void DotProductsBatchF32(const float *queries, int num_queries,
+	const float *rows, int dim, int count, float *scores);
+
+/* Number of vectors per block of ScanPqCodes(). */
+#define PQ_CODE_BLOCK 8
+
+/*
+ * Scores of product quantized vectors by table lookup. Every vector has one
+ * byte code per subquantizer and scores sum_m lut[m * 256 + code m]. The
+ * codes are stored in blocks of PQ_CODE_BLOCK vectors, code m of vector j of
+ * block b at codes[(b * num_subquantizers + m) * PQ_CODE_BLOCK + j], so that
+ * the codes of a subquantizer can be loaded together. Writes
+ * num_blocks * PQ_CODE_BLOCK scores. Uses AVX-512 or AVX2 gathers when the
+ * CPU supports them.
+ */
+void ScanPqCodes(const float *lut, const uint8_t *codes,
+	int num_subquantizers, int num_blocks, float *scores);
+
+}
+
+#endif // !_EMBEDDING_KERNELS_H_
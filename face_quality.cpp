@@ -0,0 +1,201 @@
+#include "face_quality.h"
+#include <math.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace mirror {
+
+/* Nose tip height between eye line and mouth line in the aligned face
+ * template. */
+static const float kTemplateNoseHeight = 0.495f;
+
+/* Below this distance (in squared units) the eyes are treated as one point. */
+static const float kMinSquaredEyeDistance = 1e-6f;
+
+bool MeasureFaceGeometry(const float *x, const float *y,
+	FaceGeometry *geometry) {
+	float dx = x[1] - x[0];
+	float dy = y[1] - y[0];
+	float d2 = dx * dx + dy * dy;
+	if (d2 < kMinSquaredEyeDistance)
+		return false;
+
+	float iod = sqrtf(d2);
+	/* Face axes: u along the eye line, v towards the mouth. */
+	float ux = dx / iod, uy = dy / iod;
+	float vx = -uy, vy = ux;
+
+	float eye_x = (x[0] + x[1]) * 0.5f;
+	float eye_y = (y[0] + y[1]) * 0.5f;
+	float nose_x = x[2] - eye_x;
+	float nose_y = y[2] - eye_y;
+	float mouth_x = (x[3] + x[4]) * 0.5f - eye_x;
+	float mouth_y = (y[3] + y[4]) * 0.5f - eye_y;
+
+	float mouth_height = mouth_x * vx + mouth_y * vy;
+	if (mouth_height <= 0)
+		return false;
+
+	geometry->inter_ocular = iod;
+	geometry->roll = atan2f(dy, dx) * (float) (180.0 / M_PI);
+	geometry->yaw = (nose_x * ux + nose_y * uy) / (iod * 0.5f);
+	geometry->pitch = (nose_x * vx + nose_y * vy) / mouth_height -
+		kTemplateNoseHeight;
+	return true;
+}
+
+/* Pitch proxy at which a face is scored 0. The nose moves between the eye
+ * and mouth lines over a smaller range than it moves sideways. */
+static const float kMaxScoredPitch = 0.5f;
+
+float FaceQualityScore(const FaceGeometry &geometry) {
+	float yaw = 1.0f - fabsf(geometry.yaw);
+	float pitch = 1.0f - fabsf(geometry.pitch) / kMaxScoredPitch;
+	if (yaw <= 0 || pitch <= 0)
+		return 0;
+	return geometry.inter_ocular * yaw * pitch;
+}
+
+typedef void (*LaplacianRowFunc)(const unsigned char *above,
+	const unsigned char *row, const unsigned char *below, int width,
+	long long *luma_sum, long long *laplacian_sum);
+
+/* Approximate BT.601 luma, (R + 2G + B) / 4. */
+static inline int Luma(const unsigned char *p) {
+	return (p[0] + 2 * p[1] + p[2]) >> 2;
+}
+
+static inline void LaplacianPixel(const unsigned char *above,
+	const unsigned char *row, const unsigned char *below, int x,
+	long long *luma_sum, long long *laplacian_sum) {
+	int c = Luma(row + x * 4);
+	int l = Luma(above + x * 4) + Luma(below + x * 4) +
+		Luma(row + (x - 1) * 4) + Luma(row + (x + 1) * 4) - 4 * c;
+	*luma_sum += c;
+	*laplacian_sum += l * l;
+}
+
+static void LaplacianRowScalar(const unsigned char *above,
+	const unsigned char *row, const unsigned char *below, int width,
+	long long *luma_sum, long long *laplacian_sum) {
+	for (int x = 1; x < width - 1; x++)
+		LaplacianPixel(above, row, below, x, luma_sum, laplacian_sum);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static inline __m256i LumaAVX2(const unsigned char *p) {
+	const __m256i byte_mask = _mm256_set1_epi32(0xff);
+	__m256i v = _mm256_loadu_si256((const __m256i *) p);
+	__m256i r = _mm256_and_si256(v, byte_mask);
+	__m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 8), byte_mask);
+	__m256i b = _mm256_and_si256(_mm256_srli_epi32(v, 16), byte_mask);
+	return _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(r, b),
+		_mm256_slli_epi32(g, 1)), 2);
+}
+
+/* Eight pixels per iteration. A row is at most a few thousand pixels wide,
+ * so the 32-bit lane sums cannot overflow. */
+__attribute__((target("avx2")))
+static void LaplacianRowAVX2(const unsigned char *above,
+	const unsigned char *row, const unsigned char *below, int width,
+	long long *luma_sum, long long *laplacian_sum) {
+	__m256i luma_acc = _mm256_setzero_si256();
+	__m256i lap_acc = _mm256_setzero_si256();
+
+	int x = 1;
+	for (; x + 8 <= width - 1; x += 8) {
+		__m256i c = LumaAVX2(row + x * 4);
+		__m256i n = _mm256_add_epi32(
+			_mm256_add_epi32(LumaAVX2(above + x * 4), LumaAVX2(below + x * 4)),
+			_mm256_add_epi32(LumaAVX2(row + (x - 1) * 4),
+				LumaAVX2(row + (x + 1) * 4)));
+		__m256i l = _mm256_sub_epi32(n, _mm256_slli_epi32(c, 2));
+		luma_acc = _mm256_add_epi32(luma_acc, c);
+		lap_acc = _mm256_add_epi32(lap_acc, _mm256_mullo_epi32(l, l));
+	}
+
+	int lumas[8], laps[8];
+	_mm256_storeu_si256((__m256i *) lumas, luma_acc);
+	_mm256_storeu_si256((__m256i *) laps, lap_acc);
+	for (int i = 0; i < 8; i++) {
+		*luma_sum += lumas[i];
+		*laplacian_sum += (unsigned int) laps[i];
+	}
+	for (; x < width - 1; x++)
+		LaplacianPixel(above, row, below, x, luma_sum, laplacian_sum);
+}
+#endif
+
+#if defined(__aarch64__)
+static inline int32x4_t LumaNEON(const unsigned char *p) {
+	const uint32x4_t byte_mask = vdupq_n_u32(0xff);
+	uint32x4_t v = vld1q_u32((const uint32_t *) p);
+	uint32x4_t r = vandq_u32(v, byte_mask);
+	uint32x4_t g = vandq_u32(vshrq_n_u32(v, 8), byte_mask);
+	uint32x4_t b = vandq_u32(vshrq_n_u32(v, 16), byte_mask);
+	return vreinterpretq_s32_u32(
+		vshrq_n_u32(vaddq_u32(vaddq_u32(r, b), vshlq_n_u32(g, 1)), 2));
+}
+
+/* Four pixels per iteration. */
+static void LaplacianRowNEON(const unsigned char *above,
+	const unsigned char *row, const unsigned char *below, int width,
+	long long *luma_sum, long long *laplacian_sum) {
+	int32x4_t luma_acc = vdupq_n_s32(0);
+	uint32x4_t lap_acc = vdupq_n_u32(0);
+
+	int x = 1;
+	for (; x + 4 <= width - 1; x += 4) {
+		int32x4_t c = LumaNEON(row + x * 4);
+		int32x4_t n = vaddq_s32(
+			vaddq_s32(LumaNEON(above + x * 4), LumaNEON(below + x * 4)),
+			vaddq_s32(LumaNEON(row + (x - 1) * 4), LumaNEON(row + (x + 1) * 4)));
+		int32x4_t l = vsubq_s32(n, vshlq_n_s32(c, 2));
+		luma_acc = vaddq_s32(luma_acc, c);
+		lap_acc = vaddq_u32(lap_acc, vreinterpretq_u32_s32(vmulq_s32(l, l)));
+	}
+
+	*luma_sum += vaddvq_s32(luma_acc);
+	*laplacian_sum += vaddlvq_u32(lap_acc);
+	for (; x < width - 1; x++)
+		LaplacianPixel(above, row, below, x, luma_sum, laplacian_sum);
+}
+#endif
+
+static LaplacianRowFunc SelectLaplacianRowFunc() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		return LaplacianRowAVX2;
+#elif defined(__aarch64__)
+	return LaplacianRowNEON;
+#endif
+	return LaplacianRowScalar;
+}
+
+void MeasureFaceImage(const unsigned char *src, int width, int height,
+	int pitch, FaceImageStats *stats) {
+	static const LaplacianRowFunc row_func = SelectLaplacianRowFunc();
+
+	stats->brightness = 0;
+	stats->sharpness = 0;
+	if (width < 3 || height < 3)
+		return;
+
+	long long luma_sum = 0, laplacian_sum = 0;
+	for (int y = 1; y < height - 1; y++) {
+		const unsigned char *row = src + (size_t) y * pitch;
+		row_func(row - pitch, row, row + pitch, width, &luma_sum,
+			&laplacian_sum);
+	}
+
+	double count = (double) (width - 2) * (height - 2);
+	stats->brightness = (float) (luma_sum / count);
+	stats->sharpness = (float) (laplacian_sum / count);
+}
+
+}
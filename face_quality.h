@@ -0,0 +1,68 @@
+#ifndef _FACE_QUALITY_H_
+#define _FACE_QUALITY_H_
+
+/*
+ * Cheap face quality measures used to skip faces that the recognition model
+ * cannot match anyway. Like the aligner kernels, nothing in here depends on
+ * OpenCV or allocates memory.
+ */
+
+namespace mirror {
+
+/*
+ * Pose and size proxies derived from the 5 landmarks of a face, given in the
+ * order of the aligned face template (left eye, right eye, nose tip, left and
+ * right mouth corner).
+ */
+struct FaceGeometry {
+	/* Distance between the eyes, in the units of the landmarks. */
+	float inter_ocular;
+	/* Angle of the eye line against the horizontal, in degrees. */
+	float roll;
+	/* Horizontal offset of the nose tip from the eye midpoint in units of
+	 * half the inter-ocular distance. 0 for a frontal face, around +-1 once
+	 * the nose is in line with one of the eyes. */
+	float yaw;
+	/* Vertical offset of the nose tip between the eye line (0) and the mouth
+	 * line (1), relative to its position in the template. 0 for a frontal
+	 * face, negative when looking up and positive when looking down. */
+	float pitch;
+};
+
+/*
+ * Measures the geometry of the face with landmarks (x[k], y[k]). Returns
+ * false if the landmarks do not form a face: coinciding eyes or a mouth that
+ * is not below the eyes.
+ */
+bool MeasureFaceGeometry(const float *x, const float *y,
+	FaceGeometry *geometry);
+
+/*
+ * Ranks faces of one track by how well they lend themselves to recognition:
+ * the inter-ocular distance, discounted for yaw and pitch. Roll is ignored
+ * since alignment removes it. Frontal faces score their inter-ocular
+ * distance, faces in profile score 0.
+ */
+float FaceQualityScore(const FaceGeometry &geometry);
+
+/* Photometric measures of a face crop. */
+struct FaceImageStats {
+	/* Mean luma, 0 to 255. */
+	float brightness;
+	/* Mean squared response of the 4-neighbour Laplacian of the luma.
+	 * Drops quickly with blur. */
+	float sharpness;
+};
+
+/*
+ * Measures brightness and sharpness of a width x height packed RGBA image
+ * with a pitch of pitch bytes. Only interior pixels are measured; images
+ * smaller than 3x3 get all-zero stats. Uses AVX2 or NEON when the CPU
+ * supports it.
+ */
+void MeasureFaceImage(const unsigned char *src, int width, int height,
+	int pitch, FaceImageStats *stats);
+
+}
+
+#endif // !_FACE_QUALITY_H_
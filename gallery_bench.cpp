@@ -0,0 +1,221 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+/*
+ * Recall and latency of the HNSW and IVF-PQ gallery indexes against the
+ * exact search, on a synthetic gallery of clustered random vectors. The
+ * queries are noisy copies of gallery vectors, like a face seen again under
+ * other conditions.
+ *
+ *   gallery_bench [count [dim [precision [m [ef_construction [lists
+ *       [subquantizers]]]]]]]
+ *
+ * precision is 0 for FP32, 1 for FP16 and 2 for INT8. subquantizers
+ * defaults to dim / 8. The gallery and its indexes are written to the
+ * current directory and removed afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "embedding_kernels.h"
+#include "gstnvinfer_gallery.h"
+#include "gstnvinfer_hnsw.h"
+#include "gstnvinfer_ivfpq.h"
+
+using namespace gstnvinfer;
+
+#define BENCH_QUERIES 1000
+#define BENCH_TOP_K 10
+#define BENCH_CLUSTERS 1000
+#define BENCH_BATCH 16
+
+static double
+seconds_since (std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double> (std::chrono::steady_clock::now () -
+      start).count ();
+}
+
+int
+main (int argc, char *argv[])
+{
+  guint count = argc > 1 ? atoi (argv[1]) : 100000;
+  guint dim = argc > 2 ? atoi (argv[2]) : 512;
+  guint precision = argc > 3 ? atoi (argv[3]) : 0;
+  guint m = argc > 4 ? atoi (argv[4]) : 16;
+  guint ef_construction = argc > 5 ? atoi (argv[5]) : 200;
+  guint num_lists = argc > 6 ? atoi (argv[6]) : 256;
+  guint num_subquantizers = argc > 7 ? atoi (argv[7]) : MAX (1u, dim / 8);
+  std::string gallery_path = "gallery_bench.gal";
+  std::string index_path = gallery_path + ".hnsw";
+  std::string ivfpq_path = gallery_path + ".ivfpq";
+  std::string error;
+
+  if (count == 0 || dim == 0 || precision > 2) {
+    fprintf (stderr, "usage: %s [count [dim [precision [m [ef_construction "
+        "[lists [subquantizers]]]]]]]\n", argv[0]);
+    return 1;
+  }
+
+  /* Vectors around random cluster centres, so that the gallery has the
+   * structure of real embeddings rather than being uniformly spread. */
+  std::mt19937 rng (1);
+  std::normal_distribution<gfloat> normal (0.0f, 1.0f);
+  std::vector<gfloat> centres ((gsize) BENCH_CLUSTERS * dim);
+  for (gfloat & v : centres)
+    v = normal (rng);
+  std::vector<gfloat> vectors ((gsize) count * dim);
+  std::vector<guint32> ids (count);
+  std::vector<std::string> labels (count);
+  for (guint i = 0; i < count; i++) {
+    const gfloat *centre = &centres[(gsize) (rng () % BENCH_CLUSTERS) * dim];
+    for (guint j = 0; j < dim; j++)
+      vectors[(gsize) i * dim + j] = centre[j] + 0.5f * normal (rng);
+    ids[i] = i;
+    labels[i] = "id" + std::to_string (i);
+  }
+
+  if (!Gallery::write (gallery_path, (Gallery::Precision) precision, dim,
+          count, vectors.data (), ids.data (), labels, error)) {
+    fprintf (stderr, "%s\n", error.c_str ());
+    return 1;
+  }
+  std::unique_ptr<Gallery> gallery = Gallery::open (gallery_path, error);
+  if (!gallery) {
+    fprintf (stderr, "%s\n", error.c_str ());
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now ();
+  if (!HnswIndex::build (*gallery, index_path, m, ef_construction, error)) {
+    fprintf (stderr, "%s\n", error.c_str ());
+    return 1;
+  }
+  printf ("%u vectors of %u, precision %u: built index with m %u, "
+      "ef_construction %u in %.1f s\n", count, dim, precision, m,
+      ef_construction, seconds_since (start));
+  std::unique_ptr<HnswIndex> index =
+      HnswIndex::open (index_path, *gallery, error);
+  if (!index) {
+    fprintf (stderr, "%s\n", error.c_str ());
+    return 1;
+  }
+
+  std::vector<gfloat> queries ((gsize) BENCH_QUERIES * dim);
+  for (guint q = 0; q < BENCH_QUERIES; q++) {
+    gfloat *query = &queries[(gsize) q * dim];
+    const gfloat *source = &vectors[(gsize) (rng () % count) * dim];
+    for (guint j = 0; j < dim; j++)
+      query[j] = source[j] + 0.2f * normal (rng);
+    mirror::L2Normalize (query, query, dim);
+  }
+
+  /* The exact matches, one query at a time like a stream of single faces. */
+  std::vector<Gallery::Match> exact ((gsize) BENCH_QUERIES * BENCH_TOP_K);
+  start = std::chrono::steady_clock::now ();
+  for (guint q = 0; q < BENCH_QUERIES; q++)
+    gallery->search (&queries[(gsize) q * dim], BENCH_TOP_K, -1.0f,
+        &exact[(gsize) q * BENCH_TOP_K]);
+  printf ("exact search: %9.1f us per query\n",
+      seconds_since (start) * 1e6 / BENCH_QUERIES);
+
+  printf ("%6s %12s %10s %10s\n", "ef", "us/query", "recall@1",
+      "recall@" G_STRINGIFY (BENCH_TOP_K));
+  Gallery::Match found[BENCH_TOP_K];
+  for (guint ef : {10, 20, 40, 80, 160, 320, 640}) {
+    guint hits_1 = 0, hits_k = 0;
+    double elapsed = 0;
+    for (guint q = 0; q < BENCH_QUERIES; q++) {
+      const Gallery::Match *truth = &exact[(gsize) q * BENCH_TOP_K];
+      start = std::chrono::steady_clock::now ();
+      guint num_found = index->search (&queries[(gsize) q * dim],
+          BENCH_TOP_K, ef, -1.0f, found);
+      elapsed += seconds_since (start);
+
+      hits_1 += num_found > 0 && found[0].index == truth[0].index;
+      for (guint i = 0; i < num_found; i++) {
+        for (guint j = 0; j < BENCH_TOP_K; j++)
+          hits_k += found[i].index == truth[j].index;
+      }
+    }
+    printf ("%6u %12.1f %10.4f %10.4f\n", ef, elapsed * 1e6 / BENCH_QUERIES,
+        (double) hits_1 / BENCH_QUERIES,
+        (double) hits_k / (BENCH_QUERIES * BENCH_TOP_K));
+  }
+
+  start = std::chrono::steady_clock::now ();
+  if (!IvfPqIndex::build (*gallery, ivfpq_path, num_lists, num_subquantizers,
+          error)) {
+    fprintf (stderr, "%s\n", error.c_str ());
+    return 1;
+  }
+  printf ("built IVF-PQ index with %u lists, %u subquantizers in %.1f s\n",
+      num_lists, num_subquantizers, seconds_since (start));
+  std::unique_ptr<IvfPqIndex> ivfpq = IvfPqIndex::open (ivfpq_path, error);
+  if (!ivfpq) {
+    fprintf (stderr, "%s\n", error.c_str ());
+    return 1;
+  }
+  struct stat gallery_st, ivfpq_st;
+  stat (gallery_path.c_str (), &gallery_st);
+  stat (ivfpq_path.c_str (), &ivfpq_st);
+  printf ("bytes per identity: gallery %.1f, IVF-PQ %.1f\n",
+      (double) gallery_st.st_size / count, (double) ivfpq_st.st_size / count);
+
+  /* The batched search shares the tables of a batch, as in the plugin. */
+  printf ("%6s %6s %12s %10s %10s\n", "nprobe", "rerank", "us/query",
+      "recall@1", "recall@" G_STRINGIFY (BENCH_TOP_K));
+  std::vector<Gallery::Match> batch_found (
+      (gsize) BENCH_QUERIES * BENCH_TOP_K);
+  std::vector<guint> num_found (BENCH_QUERIES);
+  for (guint rerank : {0, 100}) {
+    for (guint nprobe : {1, 4, 16, 64}) {
+      start = std::chrono::steady_clock::now ();
+      for (guint q = 0; q < BENCH_QUERIES; q += BENCH_BATCH)
+        ivfpq->searchBatch (&queries[(gsize) q * dim],
+            MIN (BENCH_BATCH, BENCH_QUERIES - q), BENCH_TOP_K, nprobe, rerank,
+            -1.0f, rerank ? gallery.get () : nullptr,
+            &batch_found[(gsize) q * BENCH_TOP_K], &num_found[q]);
+      double elapsed = seconds_since (start);
+
+      guint hits_1 = 0, hits_k = 0;
+      for (guint q = 0; q < BENCH_QUERIES; q++) {
+        const Gallery::Match *truth = &exact[(gsize) q * BENCH_TOP_K];
+        const Gallery::Match *result = &batch_found[(gsize) q * BENCH_TOP_K];
+        hits_1 += num_found[q] > 0 && result[0].index == truth[0].index;
+        for (guint i = 0; i < num_found[q]; i++) {
+          for (guint j = 0; j < BENCH_TOP_K; j++)
+            hits_k += result[i].index == truth[j].index;
+        }
+      }
+      printf ("%6u %6u %12.1f %10.4f %10.4f\n", nprobe, rerank,
+          elapsed * 1e6 / BENCH_QUERIES, (double) hits_1 / BENCH_QUERIES,
+          (double) hits_k / (BENCH_QUERIES * BENCH_TOP_K));
+    }
+  }
+
+  ivfpq.reset ();
+  index.reset ();
+  gallery.reset ();
+  unlink (ivfpq_path.c_str ());
+  unlink (index_path.c_str ());
+  unlink (gallery_path.c_str ());
+  return 0;
+}
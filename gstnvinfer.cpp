@@ -10,14 +10,18 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
+#include <math.h>
 #include <sstream>
 #include <sys/time.h>
+#include <algorithm>
 #include <cassert>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <list>
 #include <thread>
+#include <unordered_set>
 
 #include "gst-nvevent.h"
 #include "gstnvdsmeta.h"
@@ -27,6 +31,8 @@
 #include "gstnvinfer_meta_utils.h"
 #include "gstnvinfer_property_parser.h"
 #include "gstnvinfer_impl.h"
+#include "aligner_kernels.h"
+#include "gstnvinfer_face_meta.h"
 
 using namespace gstnvinfer;
 using namespace nvdsinfer;
@@ -35,6 +41,20 @@ GST_DEBUG_CATEGORY (gst_nvinfer_debug);
 #define GST_CAT_DEFAULT gst_nvinfer_debug
 
 #define INTERNAL_BUF_POOL_SIZE 3
+/* Capacity of the queues between the streaming, input queue and output
+ * threads. A full queue holds back the streaming thread. */
+#define BATCH_QUEUE_SIZE 64
+/* Number of locks the object histories are spread over. */
+#define HISTORY_LOCK_STRIPES 64
+/* Batch accumulation. Tag of the open batch while the streaming thread adds
+ * objects to it. Batches are at least pointer aligned. */
+#define ACCUMULATE_FILLING ((guintptr) 1)
+/* Inference budget. Default priority weights: new tracks come first, then
+ * the stalest, larger and better faces break ties. */
+#define DEFAULT_PRIORITY_WEIGHT_NEW 2.0
+#define DEFAULT_PRIORITY_WEIGHT_STALENESS 1.0
+#define DEFAULT_PRIORITY_WEIGHT_SIZE 0.5
+#define DEFAULT_PRIORITY_WEIGHT_QUALITY 0.5
 #define RGB_BYTES_PER_PIXEL 3
 
 
@@ -61,6 +81,10 @@ GST_DEBUG_CATEGORY (gst_nvinfer_debug);
 #define MIN_INPUT_OBJECT_WIDTH 16
 #define MIN_INPUT_OBJECT_HEIGHT 16
 
+/* In alignment mode large faces are scaled down before warping so that no
+ * more than this many source pixels are converted per aligned face pixel. */
+#define ALIGN_MAX_SOURCE_PIXELS_PER_FACE_PIXEL 2
+
 extern const int DEFAULT_REINFER_INTERVAL = G_MAXINT;
 
 #define DS_NVINFER_IMPL(gst_nvinfer) reinterpret_cast<DsNvInferImpl*>((gst_nvinfer)->impl)
@@ -71,6 +95,8 @@ extern const int DEFAULT_REINFER_INTERVAL = G_MAXINT;
   (DS_NVINFER_IMPL(nvinfer)->m_InitParams->networkType == NvDsInferNetworkType_Classifier)
 #define IS_SEGMENTATION_INSTANCE(nvinfer) \
   (DS_NVINFER_IMPL(nvinfer)->m_InitParams->networkType == NvDsInferNetworkType_Segmentation)
+#define IS_EMBEDDING_INSTANCE(nvinfer) \
+  (DS_NVINFER_IMPL(nvinfer)->m_InitParams->networkType == NvDsInferNetworkType_Embedding)
 
 static GQuark _dsmeta_quark = 0;
 
@@ -87,6 +113,24 @@ static GQuark _dsmeta_quark = 0;
 #define DEFAULT_GPU_DEVICE_ID 0
 #define DEFAULT_OUTPUT_WRITE_TO_FILE FALSE
 #define DEFAULT_OUTPUT_TENSOR_META FALSE
+#define DEFAULT_ALIGN_WORKERS 0
+#define MAX_ALIGN_WORKERS 64
+#define DEFAULT_BEST_SHOT_STABLE_FRAMES 15
+#define DEFAULT_BEST_SHOT_TIMEOUT 150
+#define DEFAULT_BEST_SHOT_LOST_FRAMES 30
+#define DEFAULT_EMBEDDING_AGGREGATE_MIN_COUNT 5
+#define DEFAULT_GALLERY_TOP_K 1
+#define DEFAULT_GALLERY_MIN_SCORE 0
+#define DEFAULT_GALLERY_WORKERS 0
+#define DEFAULT_GALLERY_HNSW_M 0
+#define DEFAULT_GALLERY_HNSW_EF_CONSTRUCTION 200
+#define DEFAULT_GALLERY_HNSW_EF 64
+#define DEFAULT_GALLERY_IVFPQ_LISTS 0
+#define DEFAULT_GALLERY_IVFPQ_SUBQUANTIZERS 64
+#define DEFAULT_GALLERY_IVFPQ_NPROBE 16
+#define DEFAULT_GALLERY_IVFPQ_RERANK 0
+#define DEFAULT_GALLERY_LOCK_CONFIRMATIONS 3
+#define DEFAULT_GALLERY_LOCK_VERIFY_INTERVAL 300
 
 /* By default NVIDIA Hardware allocated memory flows through the pipeline. We
  * will be processing on this type of memory only. */
@@ -130,6 +174,7 @@ static gpointer gst_nvinfer_input_queue_loop (gpointer data);
 static gpointer gst_nvinfer_output_loop (gpointer data);
 
 static void gst_nvinfer_reset_init_params (GstNvInferOnnx * nvinfer);
+static void close_open_batch (GstNvInferOnnx * nvinfer);
 
 /* Create enum type for the process mode property. */
 #define GST_TYPE_NVDSINFER_PROCESS_MODE (gst_nvinfer_process_mode_get_type ())
@@ -306,6 +351,63 @@ gst_nvinfer_class_init (GstNvInferOnnxClass * klass)
           (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
               GST_PARAM_MUTABLE_READY)));
 
+  g_object_class_install_property (gobject_class, PROP_ALIGN_WORKERS,
+      g_param_spec_uint ("align-workers", "Align Workers",
+          "Number of threads aligning the faces of a batch in parallel.\n"
+          "\t\t\tSet to 0 to align in the streaming thread.",
+          0, MAX_ALIGN_WORKERS, DEFAULT_ALIGN_WORKERS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_ALIGN_WORKER_CPUS,
+      g_param_spec_string ("align-worker-cpus", "Align Worker CPUs",
+          "CPUs to pin the alignment workers to, assigned round-robin\n"
+          "\t\t\tUse string with CPU ids (int) to set the property.\n"
+          "\t\t\t e.g. 2;3;4;5",
+          "",
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_DEBUG_DUMP,
+      g_param_spec_boolean ("debug-dump", "Debug Dump",
+          "Dump the aligned faces to the debug-dump-dir of the config file.\n"
+          "\t\t\tCan be toggled while playing",
+          FALSE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_PLAYING)));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Counters of the face alignment path:\n"
+          "\t\t\tfaces-inferred, faces-rejected-geometry, faces-rejected-image,\n"
+          "\t\t\tbest-shots-captured, best-shots-recognised,\n"
+          "\t\t\talign-cache-hits, align-cache-misses, align-cache-hit-rate,\n"
+          "\t\t\tof the object history locks:\n"
+          "\t\t\thistory-lock-acquisitions, history-lock-waits,\n"
+          "\t\t\thistory-lock-wait-ns,\n"
+          "\t\t\tand of the inference budget:\n"
+          "\t\t\tobjects-scheduled, objects-deferred,\n"
+          "\t\t\tsource-<pad index>-served, source-<pad index>-deferred",
+          GST_TYPE_STRUCTURE,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property (gobject_class, PROP_GALLERY_FILE,
+      g_param_spec_string ("gallery-file", "Gallery File",
+          "Absolute path to the face gallery of an embedding network.\n"
+          "\t\t\tSetting it while playing reloads the gallery in the background",
+          "",
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_PLAYING)));
+
+  g_object_class_install_property (gobject_class, PROP_GALLERY_DELTA_FILE,
+      g_param_spec_string ("gallery-delta-file", "Gallery Delta File",
+          "Absolute path to a gallery of enrolments to apply to the face gallery\n"
+          "\t\t\twhile playing. Entries replace the identities with the same id\n"
+          "\t\t\tor are added, entries with an empty label remove them",
+          "",
+          (GParamFlags) (G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_PLAYING)));
+
   /** install signal MODEL_UPDATED */
   gst_nvinfer_signals[SIGNAL_MODEL_UPDATED] =
       g_signal_new ("model-updated",
@@ -315,6 +417,15 @@ gst_nvinfer_class_init (GstNvInferOnnxClass * klass)
       NULL, NULL, NULL,
       G_TYPE_NONE, 2, G_TYPE_INT, G_TYPE_STRING);
 
+  /** install signal GALLERY_UPDATED */
+  gst_nvinfer_signals[SIGNAL_GALLERY_UPDATED] =
+      g_signal_new ("gallery-updated",
+      G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (GstNvInferOnnxClass, gallery_updated),
+      NULL, NULL, NULL,
+      G_TYPE_NONE, 2, G_TYPE_BOOLEAN, G_TYPE_STRING);
+
   /* Set sink and src pad capabilities */
   gst_element_class_add_pad_template (gstelement_class,
       gst_static_pad_template_get (&gst_nvinfer_src_template));
@@ -351,6 +462,61 @@ gst_nvinfer_init (GstNvInferOnnx * nvinfer)
   nvinfer->operate_on_class_ids = new std::vector < gboolean >;
   nvinfer->filter_out_class_ids = new std::set<uint>;
   nvinfer->output_tensor_meta = DEFAULT_OUTPUT_TENSOR_META;
+  nvinfer->align_workers = DEFAULT_ALIGN_WORKERS;
+  nvinfer->align_worker_cpus = new std::vector < gint >;
+  nvinfer->face_stats = new GstNvInferOnnxFaceStats ();
+  nvinfer->history_locks = new gstnvinfer::StripedLock (HISTORY_LOCK_STRIPES);
+  nvinfer->batch_accumulate_us = 0;
+  nvinfer->accumulate_open = new std::atomic<gpointer> (nullptr);
+  nvinfer->accumulate_spot = new gstnvinfer::ParkingSpot ();
+  nvinfer->infer_budget.per_buffer = 0;
+  nvinfer->infer_budget.per_second = 0;
+  nvinfer->infer_budget.weight_new = DEFAULT_PRIORITY_WEIGHT_NEW;
+  nvinfer->infer_budget.weight_staleness = DEFAULT_PRIORITY_WEIGHT_STALENESS;
+  nvinfer->infer_budget.weight_size = DEFAULT_PRIORITY_WEIGHT_SIZE;
+  nvinfer->infer_budget.weight_quality = DEFAULT_PRIORITY_WEIGHT_QUALITY;
+  nvinfer->infer_budget.source_weights = new std::vector<gdouble>;
+  nvinfer->infer_budget.source_min_objects = new std::vector<guint>;
+  nvinfer->scheduler = new gstnvinfer::ObjectScheduler ();
+
+  /* The face quality gate is disabled by default. */
+  nvinfer->face_quality.min_inter_ocular = 0;
+  nvinfer->face_quality.max_yaw = G_MAXFLOAT;
+  nvinfer->face_quality.max_pitch = G_MAXFLOAT;
+  nvinfer->face_quality.max_roll = G_MAXFLOAT;
+  nvinfer->face_quality.min_sharpness = 0;
+  nvinfer->face_quality.min_brightness = 0;
+  nvinfer->face_quality.max_brightness = G_MAXFLOAT;
+
+  /* Best-shot mode is disabled by default. */
+  nvinfer->best_shot_count = 0;
+  nvinfer->best_shot_stable_frames = DEFAULT_BEST_SHOT_STABLE_FRAMES;
+  nvinfer->best_shot_timeout = DEFAULT_BEST_SHOT_TIMEOUT;
+  nvinfer->best_shot_lost_frames = DEFAULT_BEST_SHOT_LOST_FRAMES;
+  nvinfer->align_cache_max_displacement = 0;
+  nvinfer->debug_dump = FALSE;
+  nvinfer->debug_dump_params = new gstnvinfer::DebugDump::Params ();
+  nvinfer->embedding_precision = NVDS_EMBEDDING_FP32;
+  nvinfer->embedding_aggregate = FALSE;
+  nvinfer->embedding_aggregate_max_variance = 0;
+  nvinfer->embedding_aggregate_min_count = DEFAULT_EMBEDDING_AGGREGATE_MIN_COUNT;
+  nvinfer->gallery_file = nullptr;
+  nvinfer->gallery_top_k = DEFAULT_GALLERY_TOP_K;
+  nvinfer->gallery_min_score = DEFAULT_GALLERY_MIN_SCORE;
+  nvinfer->gallery_workers = DEFAULT_GALLERY_WORKERS;
+  nvinfer->gallery_pool = nullptr;
+  nvinfer->gallery_hnsw_m = DEFAULT_GALLERY_HNSW_M;
+  nvinfer->gallery_hnsw_ef_construction = DEFAULT_GALLERY_HNSW_EF_CONSTRUCTION;
+  nvinfer->gallery_hnsw_ef = DEFAULT_GALLERY_HNSW_EF;
+  nvinfer->gallery_ivfpq_lists = DEFAULT_GALLERY_IVFPQ_LISTS;
+  nvinfer->gallery_ivfpq_subquantizers = DEFAULT_GALLERY_IVFPQ_SUBQUANTIZERS;
+  nvinfer->gallery_ivfpq_nprobe = DEFAULT_GALLERY_IVFPQ_NPROBE;
+  nvinfer->gallery_ivfpq_rerank = DEFAULT_GALLERY_IVFPQ_RERANK;
+  nvinfer->gallery_loader = nullptr;
+  nvinfer->gallery_shared = FALSE;
+  nvinfer->gallery_lock_margin = 0;
+  nvinfer->gallery_lock_confirmations = DEFAULT_GALLERY_LOCK_CONFIRMATIONS;
+  nvinfer->gallery_lock_verify_interval = DEFAULT_GALLERY_LOCK_VERIFY_INTERVAL;
 
   nvinfer->max_batch_size = impl->m_InitParams->maxBatchSize =
       DEFAULT_BATCH_SIZE;
@@ -365,9 +531,8 @@ gst_nvinfer_init (GstNvInferOnnx * nvinfer)
   nvinfer->transform_config_params.compute_mode = NvBufSurfTransformCompute_Default;
   nvinfer->transform_params.transform_filter = NvBufSurfTransformInter_Default;
 
-  /* Create processing lock and condition for synchronization.*/
+  /* Create processing lock for synchronization.*/
   g_mutex_init (&nvinfer->process_lock);
-  g_cond_init (&nvinfer->process_cond);
 
   /* This quark is required to identify NvDsMeta when iterating through
    * the buffer metadatas */
@@ -382,14 +547,23 @@ gst_nvinfer_finalize (GObject * object)
   GstNvInferOnnx *nvinfer = GST_NVINFER (object);
 
   g_mutex_clear (&nvinfer->process_lock);
-  g_cond_clear (&nvinfer->process_cond);
 
   delete nvinfer->perClassDetectionFilterParams;
   delete nvinfer->perClassColorParams;
   delete nvinfer->is_prop_set;
   g_free (nvinfer->config_file_path);
+  g_free (nvinfer->gallery_file);
   delete nvinfer->operate_on_class_ids;
   delete nvinfer->filter_out_class_ids;
+  delete nvinfer->align_worker_cpus;
+  delete nvinfer->face_stats;
+  delete nvinfer->history_locks;
+  delete nvinfer->accumulate_open;
+  delete nvinfer->accumulate_spot;
+  delete nvinfer->scheduler;
+  delete nvinfer->infer_budget.source_weights;
+  delete nvinfer->infer_budget.source_min_objects;
+  delete nvinfer->debug_dump_params;
 
   delete DS_NVINFER_IMPL(nvinfer);
 
@@ -511,6 +685,51 @@ gst_nvinfer_set_property (GObject * object, guint prop_id,
     case PROP_OUTPUT_TENSOR_META:
       nvinfer->output_tensor_meta = g_value_get_boolean (value);
       break;
+    case PROP_ALIGN_WORKERS:
+      nvinfer->align_workers = g_value_get_uint (value);
+      break;
+    case PROP_DEBUG_DUMP:
+      g_atomic_int_set (&nvinfer->debug_dump, g_value_get_boolean (value));
+      break;
+    case PROP_GALLERY_FILE:
+      {
+        LockGMutex lock (nvinfer->process_lock);
+        if (nvinfer->gallery_loader) {
+          /* The gallery is being searched. Trigger a reload. */
+          nvinfer->gallery_loader->queue (
+              gstnvinfer::GalleryLoader::LoadType::FILE,
+              g_value_get_string (value));
+          break;
+        }
+        g_free (nvinfer->gallery_file);
+        nvinfer->gallery_file = g_value_dup_string (value);
+      }
+      break;
+    case PROP_GALLERY_DELTA_FILE:
+      {
+        LockGMutex lock (nvinfer->process_lock);
+        if (!nvinfer->gallery_loader) {
+          GST_WARNING_OBJECT (nvinfer, "No face gallery is loaded, ignoring "
+              "gallery delta %s", g_value_get_string (value));
+          break;
+        }
+        nvinfer->gallery_loader->queue (
+            gstnvinfer::GalleryLoader::LoadType::DELTA,
+            g_value_get_string (value));
+      }
+      break;
+    case PROP_ALIGN_WORKER_CPUS:
+    {
+      std::stringstream str (g_value_get_string (value));
+      nvinfer->align_worker_cpus->clear ();
+      while (str.peek () != EOF) {
+        gint cpu;
+        str >> cpu;
+        nvinfer->align_worker_cpus->push_back (cpu);
+        str.get ();
+      }
+    }
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -585,6 +804,67 @@ gst_nvinfer_get_property (GObject * object, guint prop_id,
     case PROP_OUTPUT_TENSOR_META:
       g_value_set_boolean (value, nvinfer->output_tensor_meta);
       break;
+    case PROP_ALIGN_WORKERS:
+      g_value_set_uint (value, nvinfer->align_workers);
+      break;
+    case PROP_DEBUG_DUMP:
+      g_value_set_boolean (value, g_atomic_int_get (&nvinfer->debug_dump));
+      break;
+    case PROP_GALLERY_FILE:
+      {
+        LockGMutex lock (nvinfer->process_lock);
+        g_value_set_string (value, nvinfer->gallery_file);
+      }
+      break;
+    case PROP_STATS:
+    {
+      GstNvInferOnnxFaceStats *stats = nvinfer->face_stats;
+      gstnvinfer::StripedLock::Stats lock_stats =
+          nvinfer->history_locks->stats ();
+      gstnvinfer::ObjectScheduler::Stats budget_stats =
+          nvinfer->scheduler->stats ();
+      guint64 cache_hits = stats->align_cache_hits;
+      guint64 cache_lookups = cache_hits + stats->align_cache_misses;
+      GstStructure *structure = gst_structure_new ("nvinfer-stats",
+              "faces-inferred", G_TYPE_UINT64,
+              (guint64) stats->faces_inferred,
+              "faces-rejected-geometry", G_TYPE_UINT64,
+              (guint64) stats->faces_rejected_geometry,
+              "faces-rejected-image", G_TYPE_UINT64,
+              (guint64) stats->faces_rejected_image,
+              "best-shots-captured", G_TYPE_UINT64,
+              (guint64) stats->best_shots_captured,
+              "best-shots-recognised", G_TYPE_UINT64,
+              (guint64) stats->best_shots_recognised,
+              "align-cache-hits", G_TYPE_UINT64, cache_hits,
+              "align-cache-misses", G_TYPE_UINT64, cache_lookups - cache_hits,
+              "align-cache-hit-rate", G_TYPE_DOUBLE,
+              cache_lookups ? (gdouble) cache_hits / cache_lookups : 0.0,
+              "history-lock-acquisitions", G_TYPE_UINT64,
+              lock_stats.acquisitions,
+              "history-lock-waits", G_TYPE_UINT64, lock_stats.waits,
+              "history-lock-wait-ns", G_TYPE_UINT64, lock_stats.wait_ns,
+              "objects-scheduled", G_TYPE_UINT64, budget_stats.scheduled,
+              "objects-deferred", G_TYPE_UINT64, budget_stats.deferred,
+              nullptr);
+      for (const auto & source : budget_stats.sources) {
+        std::string prefix = "source-" + std::to_string (source.first);
+        gst_structure_set (structure,
+            (prefix + "-served").c_str (), G_TYPE_UINT64, source.second.served,
+            (prefix + "-deferred").c_str (), G_TYPE_UINT64,
+            source.second.deferred, nullptr);
+      }
+      g_value_take_boxed (value, structure);
+    }
+      break;
+    case PROP_ALIGN_WORKER_CPUS:
+    {
+      std::stringstream str;
+      for (const auto cpu : *nvinfer->align_worker_cpus)
+        str << cpu << ";";
+      g_value_set_string (value, str.str ().c_str ());
+    }
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -660,6 +940,11 @@ gst_nvinfer_sink_event (GstBaseTransform * trans, GstEvent * event)
       break;
   }
 
+  /* Objects of the buffers before a serialized event are not held back for
+   * the buffers after it. */
+  if (GST_EVENT_IS_SERIALIZED (event) && !ignore_serialized_event)
+    close_open_batch (nvinfer);
+
   /* Serialize events. Wait for pending buffers to be processed and pushed
    * downstream. No need to wait in case of classifier async mode since all
    * the buffers are already pushed downstream. */
@@ -668,20 +953,13 @@ gst_nvinfer_sink_event (GstBaseTransform * trans, GstEvent * event)
     GstNvInferOnnxBatch *batch = new GstNvInferOnnxBatch;
     batch->event_marker = TRUE;
 
-    g_mutex_lock (&nvinfer->process_lock);
     /* Push the event marker batch in the processing queue. */
-    g_queue_push_tail (nvinfer->input_queue, batch);
-    g_cond_broadcast (&nvinfer->process_cond);
+    nvinfer->input_queue->push (batch);
 
     /* Wait for all the remaining batches in the queue including the event
      * marker to be processed. */
-    while (!g_queue_is_empty (nvinfer->input_queue)) {
-      g_cond_wait (&nvinfer->process_cond, &nvinfer->process_lock);
-    }
-    while (!g_queue_is_empty (nvinfer->process_queue)) {
-      g_cond_wait (&nvinfer->process_cond, &nvinfer->process_lock);
-    }
-    g_mutex_unlock (&nvinfer->process_lock);
+    nvinfer->input_queue->waitEmpty ();
+    nvinfer->process_queue->waitEmpty ();
   }
 
   if ((GstNvEventType) GST_EVENT_TYPE (event) == GST_NVEVENT_PAD_ADDED) {
@@ -715,6 +993,154 @@ gst_nvinfer_sink_event (GstBaseTransform * trans, GstEvent * event)
   return GST_BASE_TRANSFORM_CLASS (parent_class)->sink_event (trans, event);
 }
 
+/* Release the alignment workers and their conversion resources. */
+static void
+stop_align_workers (GstNvInferOnnx * nvinfer)
+{
+  delete nvinfer->align_pool;
+  nvinfer->align_pool = nullptr;
+
+  if (nvinfer->align_scratch) {
+    for (auto & scratch : *nvinfer->align_scratch) {
+      if (scratch.convert_stream)
+        cudaStreamDestroy (scratch.convert_stream);
+      if (scratch.inter_buf)
+        NvBufSurfaceDestroy (scratch.inter_buf);
+    }
+    delete nvinfer->align_scratch;
+    nvinfer->align_scratch = nullptr;
+  }
+}
+
+/* Allocate an intermediate buffer and a cuda stream for every alignment
+ * worker, or for the streaming thread if there are no workers, and start
+ * the workers. */
+static gboolean
+start_align_workers (GstNvInferOnnx * nvinfer)
+{
+  NvBufSurfaceCreateParams create_params;
+  cudaError_t cudaReturn;
+
+  create_params.gpuId = nvinfer->gpu_id;
+  create_params.width = nvinfer->processing_width;
+  create_params.height = nvinfer->processing_height;
+  create_params.size = 0;
+  create_params.colorFormat = NVBUF_COLOR_FORMAT_RGBA;
+  create_params.layout = NVBUF_LAYOUT_PITCH;
+#ifdef __aarch64__
+  create_params.memType = NVBUF_MEM_DEFAULT;
+#else
+  create_params.memType = NVBUF_MEM_CUDA_UNIFIED;
+#endif
+
+  nvinfer->align_scratch = new std::vector < GstNvInferOnnxAlignScratch >;
+  for (guint i = 0; i < MAX (1, nvinfer->align_workers); i++) {
+    nvinfer->align_scratch->push_back ({nullptr, nullptr});
+    GstNvInferOnnxAlignScratch & scratch = nvinfer->align_scratch->back ();
+
+    if (NvBufSurfaceCreate (&scratch.inter_buf, 1, &create_params) != 0) {
+      GST_ELEMENT_ERROR (nvinfer, RESOURCE, FAILED,
+          ("Failed to allocate alignment buffer"), (nullptr));
+      stop_align_workers (nvinfer);
+      return FALSE;
+    }
+    cudaReturn = cudaStreamCreateWithFlags (&scratch.convert_stream,
+        cudaStreamNonBlocking);
+    if (cudaReturn != cudaSuccess) {
+      GST_ELEMENT_ERROR (nvinfer, RESOURCE, FAILED,
+          ("Failed to create cuda stream"),
+          ("cudaStreamCreateWithFlags failed with error %s",
+              cudaGetErrorName (cudaReturn)));
+      stop_align_workers (nvinfer);
+      return FALSE;
+    }
+  }
+
+  if (nvinfer->align_workers > 0)
+    nvinfer->align_pool = new gstnvinfer::WorkerPool (nvinfer->align_workers,
+        *nvinfer->align_worker_cpus);
+  return TRUE;
+}
+
+/* Called from the gallery load thread once a reload or delta is done. The
+ * application is notified like of model updates. */
+static void
+gallery_load_done (GstNvInferOnnx * nvinfer,
+    gstnvinfer::GalleryLoader::LoadType type, const std::string & path,
+    bool ok, const std::string & error)
+{
+  if (ok) {
+    GST_INFO_OBJECT (nvinfer, "[UID %d]: Updated face gallery from %s",
+        nvinfer->unique_id, path.c_str ());
+    if (type != gstnvinfer::GalleryLoader::LoadType::DELTA) {
+      LockGMutex lock (nvinfer->process_lock);
+      g_free (nvinfer->gallery_file);
+      nvinfer->gallery_file = g_strdup (path.c_str ());
+    }
+  } else {
+    GST_ELEMENT_WARNING (nvinfer, RESOURCE, OPEN_READ,
+        ("[UID %d]: Update of face gallery from %s failed, reason: %s",
+            nvinfer->unique_id, path.c_str (),
+            (error.empty () ? "unknown" : error.c_str ())), (nullptr));
+  }
+  g_signal_emit (nvinfer, gst_nvinfer_signals[SIGNAL_GALLERY_UPDATED], 0,
+      (gboolean) ok, path.c_str ());
+}
+
+/* Load the face gallery and its index and start the thread keeping them up
+ * to date. Its vectors must have the length of the network output. */
+static gboolean
+open_gallery (GstNvInferOnnx * nvinfer)
+{
+  gstnvinfer::GalleryLoader::Params params;
+  std::string error;
+
+  if (nvinfer->gallery_hnsw_m > 0 && nvinfer->gallery_ivfpq_lists > 0) {
+    GST_ELEMENT_ERROR (nvinfer, LIBRARY, SETTINGS,
+        ("Face gallery can use either an HNSW or an IVF-PQ index"),
+        (nullptr));
+    return FALSE;
+  }
+
+  params.path = nvinfer->gallery_file;
+  params.dim = nvinfer->output_layers_info->empty () ? 0 :
+      (*nvinfer->output_layers_info)[0].inferDims.numElements;
+  params.hnsw_m = nvinfer->gallery_hnsw_m;
+  params.hnsw_ef_construction = nvinfer->gallery_hnsw_ef_construction;
+  params.ivfpq_lists = nvinfer->gallery_ivfpq_lists;
+  params.ivfpq_subquantizers = nvinfer->gallery_ivfpq_subquantizers;
+  if (nvinfer->gallery_shared) {
+    gchar *resolved = realpath (nvinfer->gallery_file, nullptr);
+    gchar *name = g_strdup_printf ("/nvinfer-gallery-%08x",
+        g_str_hash (resolved ? resolved : nvinfer->gallery_file));
+    params.shared_name = name;
+    g_free (name);
+    free (resolved);
+  }
+
+  std::unique_ptr<gstnvinfer::GalleryLoader> loader (
+      new gstnvinfer::GalleryLoader (params,
+          [nvinfer] (gstnvinfer::GalleryLoader::LoadType type,
+              const std::string & path, bool ok, const std::string & error) {
+            gallery_load_done (nvinfer, type, path, ok, error);
+          }));
+  if (!loader->start (error)) {
+    GST_ELEMENT_ERROR (nvinfer, RESOURCE, OPEN_READ,
+        ("Could not load face gallery"), ("%s", error.c_str ()));
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (nvinfer, "Loaded face gallery %s with %u identities",
+      loader->current ()->path.c_str (),
+      loader->current ()->gallery->size ());
+  nvinfer->gallery_loader = loader.release ();
+
+  if (nvinfer->gallery_workers > 0)
+    nvinfer->gallery_pool = new gstnvinfer::WorkerPool (
+        nvinfer->gallery_workers, std::vector<gint> (), "nvinfer-gallery");
+  return TRUE;
+}
+
 /**
  * Initialize all resources and start the output thread
  */
@@ -853,8 +1279,9 @@ gst_nvinfer_start (GstBaseTransform * btrans)
   /* Create process queue and input queue to transfer data between threads.
    * We will be using this queue to maintain the list of frames/objects
    * currently given to the algorithm for processing. */
-  nvinfer->process_queue = g_queue_new ();
-  nvinfer->input_queue = g_queue_new ();
+  nvinfer->process_queue =
+      new gstnvinfer::SpscRing<gpointer> (BATCH_QUEUE_SIZE);
+  nvinfer->input_queue = new gstnvinfer::SpscRing<gpointer> (BATCH_QUEUE_SIZE);
 
   /* Create a buffer pool for internal memory required for scaling frames to
    * network resolution / cropping objects. The pool allocates
@@ -893,13 +1320,80 @@ gst_nvinfer_start (GstBaseTransform * btrans)
       return FALSE;
   }
 
+  /* Alignment mode writes the aligned faces from the CPU directly into the
+   * network input memory at the aligned face resolution. */
+  nvinfer->align_to_tensor = FALSE;
+  if (nvinfer->align_faces) {
+    if (init_params->networkInputFormat != NvDsInferFormat_RGB &&
+        init_params->networkInputFormat != NvDsInferFormat_BGR) {
+      GST_ELEMENT_ERROR (nvinfer, LIBRARY, SETTINGS,
+          ("Face alignment requires an RGB or BGR network input"), (nullptr));
+      return FALSE;
+    }
+    if (nvinfer->process_full_frame) {
+      GST_ELEMENT_ERROR (nvinfer, LIBRARY, SETTINGS,
+          ("Face alignment requires process-mode=2 (objects)"), (nullptr));
+      return FALSE;
+    }
+    if (nvinfer->network_width != mirror::kAlignedFaceSize ||
+        nvinfer->network_height != mirror::kAlignedFaceSize) {
+      GST_ELEMENT_ERROR (nvinfer, LIBRARY, SETTINGS,
+          ("Face alignment requires a %dx%d network input, got %dx%d",
+              mirror::kAlignedFaceSize, mirror::kAlignedFaceSize,
+              nvinfer->network_width, nvinfer->network_height), (nullptr));
+      return FALSE;
+    }
+
+    /* Warp, convert and normalise in one pass on the CPU. Only a mean image
+     * file still needs the NvDsInferContext input conversion. */
+    if (strlen (init_params->meanImageFilePath) == 0) {
+      mirror::TensorNormalization *norm = &nvinfer->face_normalization;
+      gboolean bgr = init_params->networkInputFormat == NvDsInferFormat_BGR;
+
+      norm->scale = init_params->networkScaleFactor;
+      for (guint c = 0; c < 3; c++) {
+        norm->means[c] =
+            (init_params->numOffsets == 3) ? init_params->offsets[c] : 0;
+        norm->channel_map[c] = bgr ? 2 - c : c;
+      }
+      nvinfer->align_to_tensor = TRUE;
+    }
+  }
+
+  /* Only measure what the face quality gate has limits for. */
+  GstNvInferOnnxFaceQualityParams *quality = &nvinfer->face_quality;
+  quality->check_geometry = quality->min_inter_ocular > 0 ||
+      quality->max_yaw < G_MAXFLOAT || quality->max_pitch < G_MAXFLOAT ||
+      quality->max_roll < G_MAXFLOAT;
+  quality->check_image = quality->min_sharpness > 0 ||
+      quality->min_brightness > 0 || quality->max_brightness < G_MAXFLOAT;
+  nvinfer->face_stats->faces_inferred = 0;
+  nvinfer->face_stats->faces_rejected_geometry = 0;
+  nvinfer->face_stats->faces_rejected_image = 0;
+  nvinfer->face_stats->best_shots_captured = 0;
+  nvinfer->face_stats->best_shots_recognised = 0;
+  nvinfer->face_stats->align_cache_hits = 0;
+  nvinfer->face_stats->align_cache_misses = 0;
+  nvinfer->history_locks->resetStats ();
+  nvinfer->scheduler->configure (nvinfer->infer_budget.per_buffer,
+      nvinfer->infer_budget.per_second, *nvinfer->infer_budget.source_weights,
+      *nvinfer->infer_budget.source_min_objects);
+
+  guint pool_width = nvinfer->network_width;
+  guint pool_height = nvinfer->network_height;
+  if (nvinfer->align_to_tensor) {
+    /* A single byte plane holds the three float planes of the tensor. */
+    pool_width = nvinfer->network_width * sizeof (float);
+    pool_height = nvinfer->network_height * 3;
+    color_format = NVBUF_COLOR_FORMAT_GRAY8;
+  }
+
   /* Create a new GstNvInferOnnxAllocator instance. Allocator has methods to allocate
    * and free custom memories. */
   auto allocator_deleter = [](GstAllocator *a) { if (a) gst_object_unref (a); };
   std::unique_ptr<GstAllocator, decltype(allocator_deleter)> allocator_ptr (
-      gst_nvinfer_allocator_new (nvinfer->network_width,
-      nvinfer->network_height, color_format, nvinfer->max_batch_size,
-      nvinfer->gpu_id),
+      gst_nvinfer_allocator_new (pool_width, pool_height, color_format,
+      nvinfer->max_batch_size, nvinfer->gpu_id, nvinfer->align_faces),
       allocator_deleter);
   memset (&allocation_params, 0, sizeof (allocation_params));
   gst_buffer_pool_config_set_allocator (config_ptr.get (), allocator_ptr.get (),
@@ -942,6 +1436,23 @@ gst_nvinfer_start (GstBaseTransform * btrans)
   nvinfer->transform_config_params.gpu_id = nvinfer->gpu_id;
   nvinfer->transform_config_params.cuda_stream = nvinfer->convertStream;
 
+  if (nvinfer->align_faces && !start_align_workers (nvinfer))
+    return FALSE;
+
+  /* The dump writer runs whenever a directory is configured so that the
+   * dump can be switched on while playing. */
+  if (!nvinfer->debug_dump_params->directory.empty ()) {
+    if (g_mkdir_with_parents (nvinfer->debug_dump_params->directory.c_str (),
+            0755) != 0) {
+      GST_ELEMENT_ERROR (nvinfer, RESOURCE, OPEN_WRITE,
+          ("Could not create debug dump directory %s",
+              nvinfer->debug_dump_params->directory.c_str ()), (nullptr));
+      return FALSE;
+    }
+    nvinfer->debug_dumper = new gstnvinfer::DebugDump (
+        *nvinfer->debug_dump_params, nvinfer->face_normalization);
+  }
+
   /* Create the intermediate NvBufSurface structure for holding an array of input
    * NvBufSurfaceParams for batched transforms. */
   nvinfer->tmp_surf.surfaceList = new NvBufSurfaceParams[nvinfer->max_batch_size];
@@ -973,6 +1484,45 @@ gst_nvinfer_start (GstBaseTransform * btrans)
     }
   }
 
+  if (nvinfer->best_shot_count > 0 && (!nvinfer->align_faces ||
+          !(IS_CLASSIFIER_INSTANCE (nvinfer) ||
+              IS_EMBEDDING_INSTANCE (nvinfer)))) {
+    GST_ELEMENT_WARNING (nvinfer, LIBRARY, SETTINGS,
+        ("NvInfer best-shot mode is applicable for face alignment"
+            " classifiers and embedding networks only. Turning off best-shot"
+            " mode"), (nullptr));
+    nvinfer->best_shot_count = 0;
+  }
+
+  /* Best-shot mode infers on a track once, there is nothing to aggregate or
+   * to lock in. */
+  if (nvinfer->best_shot_count > 0 && (nvinfer->embedding_aggregate ||
+          nvinfer->gallery_lock_margin > 0)) {
+    GST_ELEMENT_WARNING (nvinfer, LIBRARY, SETTINGS,
+        ("NvInfer embedding aggregation and identity lock-in do not apply in"
+            " best-shot mode. Turning them off"), (nullptr));
+    nvinfer->embedding_aggregate = FALSE;
+    nvinfer->gallery_lock_margin = 0;
+  }
+
+  if (nvinfer->embedding_aggregate && (nvinfer->process_full_frame ||
+          !IS_EMBEDDING_INSTANCE (nvinfer))) {
+    GST_ELEMENT_WARNING (nvinfer, LIBRARY, SETTINGS,
+        ("NvInfer embedding aggregation is applicable for secondary embedding"
+            " networks only. Turning off embedding aggregation"), (nullptr));
+    nvinfer->embedding_aggregate = FALSE;
+  }
+
+  if (nvinfer->gallery_file) {
+    if (!IS_EMBEDDING_INSTANCE (nvinfer)) {
+      GST_ELEMENT_WARNING (nvinfer, LIBRARY, SETTINGS,
+          ("NvInfer face gallery is applicable for embedding networks only."
+              " Ignoring the gallery"), (nullptr));
+    } else if (!open_gallery (nvinfer)) {
+      return FALSE;
+    }
+  }
+
   /* Start a thread which will pop output from the algorithm, form NvDsMeta and
    * push buffers to the next element. */
   nvinfer->output_thread =
@@ -1012,26 +1562,21 @@ gst_nvinfer_stop (GstBaseTransform * btrans)
   GstNvInferOnnx *nvinfer = GST_NVINFER (btrans);
   DsNvInferImpl *impl = DS_NVINFER_IMPL (nvinfer);
 
-  LockGMutex locker (nvinfer->process_lock);
   /* Wait till all the items in the two queues are handled. */
-  while (!g_queue_is_empty (nvinfer->input_queue)) {
-    locker.wait (nvinfer->process_cond);
-  }
-  while (!g_queue_is_empty (nvinfer->process_queue)) {
-    locker.wait (nvinfer->process_cond);
-  }
-  nvinfer->stop = TRUE;
+  close_open_batch (nvinfer);
+  nvinfer->input_queue->waitEmpty ();
+  nvinfer->process_queue->waitEmpty ();
 
-  g_cond_broadcast (&nvinfer->process_cond);
-  locker.unlock ();
+  /* Wake the threads waiting for batches, they exit once the queues are
+   * closed. */
+  nvinfer->input_queue->close ();
+  nvinfer->process_queue->close ();
 
   impl->stop ();
 
   g_thread_join (nvinfer->input_queue_thread);
   g_thread_join (nvinfer->output_thread);
 
-  nvinfer->stop = FALSE;
-
   delete nvinfer->source_info;
   delete nvinfer->layers_info;
   delete nvinfer->output_layers_info;
@@ -1042,14 +1587,30 @@ gst_nvinfer_stop (GstBaseTransform * btrans)
 
   cudaSetDevice (nvinfer->gpu_id);
 
+  stop_align_workers (nvinfer);
+
+  delete nvinfer->debug_dumper;
+  nvinfer->debug_dumper = nullptr;
+
+  delete nvinfer->gallery_pool;
+  nvinfer->gallery_pool = nullptr;
+
+  /* Joining the load thread waits for a load in progress, which must not
+   * hold up set_property meanwhile. */
+  LockGMutex locker (nvinfer->process_lock);
+  gstnvinfer::GalleryLoader *gallery_loader = nvinfer->gallery_loader;
+  nvinfer->gallery_loader = nullptr;
+  locker.unlock ();
+  delete gallery_loader;
+
   if (nvinfer->convertStream)
     cudaStreamDestroy (nvinfer->convertStream);
 
   /* Free up the memory allocated by pool. */
   gst_object_unref (nvinfer->pool);
 
-  g_queue_free (nvinfer->process_queue);
-  g_queue_free (nvinfer->input_queue);
+  delete nvinfer->process_queue;
+  delete nvinfer->input_queue;
     if (nvinfer->inter_buf)
         NvBufSurfaceDestroy(nvinfer->inter_buf);
     nvinfer->inter_buf = NULL;
@@ -1058,6 +1619,65 @@ gst_nvinfer_stop (GstBaseTransform * btrans)
 }
 
 
+/**
+ * Crop src_rect out of the frame at batch_id in src_surf and scale it to
+ * dest_width x dest_height at the top-left corner of the intermediate RGBA
+ * buffer inter_buf, using convert_stream. The rest of the intermediate buffer
+ * is left untouched.
+ */
+static GstFlowReturn
+transform_to_inter_buf (GstNvInferOnnx * nvinfer, NvBufSurface * src_surf,
+    guint batch_id, NvBufSurfTransformRect src_rect, NvBufSurface * inter_buf,
+    cudaStream_t convert_stream, guint dest_width, guint dest_height)
+{
+    NvBufSurfTransform_Error err;
+    NvBufSurfTransformConfigParams transform_config_params;
+    NvBufSurfTransformParams transform_params;
+    NvBufSurfTransformRect dst_rect;
+    NvBufSurface ip_surf;
+    ip_surf = *src_surf;
+
+    ip_surf.numFilled = ip_surf.batchSize = 1;
+    ip_surf.surfaceList = &(src_surf->surfaceList[batch_id]);
+
+    /* Configure transform session parameters for the transformation */
+    transform_config_params.compute_mode = NvBufSurfTransformCompute_Default;
+    transform_config_params.gpu_id = nvinfer->gpu_id;
+    transform_config_params.cuda_stream = convert_stream;
+
+    /* Set the transform session parameters for the conversions executed in this
+     * thread. */
+    err = NvBufSurfTransformSetSessionParams (&transform_config_params);
+    if (err != NvBufSurfTransformError_Success) {
+        GST_ELEMENT_ERROR (nvinfer, STREAM, FAILED,
+                           ("NvBufSurfTransformSetSessionParams failed with error %d", err), (NULL));
+        return GST_FLOW_ERROR;
+    }
+
+    /* Set the transform ROI for destination */
+    dst_rect = {0, 0, dest_width, dest_height};
+
+    /* Set the transform parameters */
+    transform_params.src_rect = &src_rect;
+    transform_params.dst_rect = &dst_rect;
+    transform_params.transform_flag =
+            NVBUFSURF_TRANSFORM_FILTER | NVBUFSURF_TRANSFORM_CROP_SRC |
+            NVBUFSURF_TRANSFORM_CROP_DST;
+    transform_params.transform_filter = NvBufSurfTransformInter_Default;
+
+    GST_DEBUG_OBJECT (nvinfer, "Scaling and converting input buffer\n");
+
+    /* Transformation scaling+format conversion if any. */
+    err = NvBufSurfTransform (&ip_surf, inter_buf, &transform_params);
+    if (err != NvBufSurfTransformError_Success) {
+        GST_ELEMENT_ERROR (nvinfer, STREAM, FAILED,
+                           ("NvBufSurfTransform failed with error %d while converting buffer", err),
+                           (NULL));
+        return GST_FLOW_ERROR;
+    }
+    return GST_FLOW_OK;
+}
+
 /**
  * Scale the entire frame to the processing resolution maintaining aspect ratio.
  * Or crop and scale objects to the processing resolution maintaining the aspect
@@ -1066,29 +1686,23 @@ gst_nvinfer_stop (GstBaseTransform * btrans)
  * padded data and/or can work with RGBA.
  */
 static GstFlowReturn
-get_converted_mat (GstNvInferOnnx * nvinfer, NvBufSurface *src_surf, gint idx,
+get_converted_mat (GstNvInferOnnx * nvinfer, NvBufSurface *src_surf, guint batch_id,
                    NvOSD_RectParams * crop_rect_params, gdouble & ratio, gint input_width,
                    gint input_height)
 {
-    NvBufSurfTransform_Error err;
-    NvBufSurfTransformConfigParams transform_config_params;
-    NvBufSurfTransformParams transform_params;
     NvBufSurfTransformRect src_rect;
-    NvBufSurfTransformRect dst_rect;
-    NvBufSurface ip_surf;
     cv::Mat in_mat;
-    ip_surf = *src_surf;
-
-    ip_surf.numFilled = ip_surf.batchSize = 1;
-    ip_surf.surfaceList = &(src_surf->surfaceList[idx]);
 
     gint src_left = GST_ROUND_UP_2((unsigned int)crop_rect_params->left);
     gint src_top = GST_ROUND_UP_2((unsigned int)crop_rect_params->top);
     gint src_width = GST_ROUND_DOWN_2((unsigned int)crop_rect_params->width);
     gint src_height = GST_ROUND_DOWN_2((unsigned int)crop_rect_params->height);
 
-    nvinfer->processing_height = input_height;
-    nvinfer->processing_width = input_width;
+    /* The ROI is scaled down if it does not fit the intermediate buffer. */
+    nvinfer->processing_height =
+        MIN (input_height, (gint) nvinfer->inter_buf->surfaceList[0].height);
+    nvinfer->processing_width =
+        MIN (input_width, (gint) nvinfer->inter_buf->surfaceList[0].width);
     /* Maintain aspect ratio */
     double hdest = nvinfer->processing_width * src_height / (double) src_width;
     double wdest = nvinfer->processing_height * src_width / (double) src_height;
@@ -1102,20 +1716,6 @@ get_converted_mat (GstNvInferOnnx * nvinfer, NvBufSurface *src_surf, gint idx,
         dest_height = nvinfer->processing_height;
     }
 
-    /* Configure transform session parameters for the transformation */
-    transform_config_params.compute_mode = NvBufSurfTransformCompute_Default;
-    transform_config_params.gpu_id = nvinfer->gpu_id;
-    transform_config_params.cuda_stream = nvinfer->convertStream;
-
-    /* Set the transform session parameters for the conversions executed in this
-     * thread. */
-    err = NvBufSurfTransformSetSessionParams (&transform_config_params);
-    if (err != NvBufSurfTransformError_Success) {
-        GST_ELEMENT_ERROR (nvinfer, STREAM, FAILED,
-                           ("NvBufSurfTransformSetSessionParams failed with error %d", err), (NULL));
-        goto error;
-    }
-
     /* Calculate scaling ratio while maintaining aspect ratio */
     ratio = MIN (1.0 * dest_width/ src_width, 1.0 * dest_height / src_height);
 
@@ -1131,29 +1731,12 @@ get_converted_mat (GstNvInferOnnx * nvinfer, NvBufSurface *src_surf, gint idx,
     goto error;
   }
 #endif
-    /* Set the transform ROIs for source and destination */
+    /* Set the transform ROI for source */
     src_rect = {(guint)src_top, (guint)src_left, (guint)src_width, (guint)src_height};
-    dst_rect = {0, 0, (guint)dest_width, (guint)dest_height};
-
-    /* Set the transform parameters */
-    transform_params.src_rect = &src_rect;
-    transform_params.dst_rect = &dst_rect;
-    transform_params.transform_flag =
-            NVBUFSURF_TRANSFORM_FILTER | NVBUFSURF_TRANSFORM_CROP_SRC |
-            NVBUFSURF_TRANSFORM_CROP_DST;
-    transform_params.transform_filter = NvBufSurfTransformInter_Default;
-
-    /* Memset the memory */
-    NvBufSurfaceMemSet (nvinfer->inter_buf, 0, 0, 0);
 
-    GST_DEBUG_OBJECT (nvinfer, "Scaling and converting input buffer\n");
-
-    /* Transformation scaling+format conversion if any. */
-    err = NvBufSurfTransform (&ip_surf, nvinfer->inter_buf, &transform_params);
-    if (err != NvBufSurfTransformError_Success) {
-        GST_ELEMENT_ERROR (nvinfer, STREAM, FAILED,
-                           ("NvBufSurfTransform failed with error %d while converting buffer", err),
-                           (NULL));
+    if (transform_to_inter_buf (nvinfer, src_surf, batch_id, src_rect,
+            nvinfer->inter_buf, nvinfer->convertStream, dest_width,
+            dest_height) != GST_FLOW_OK) {
         goto error;
     }
     /* Map the buffer so that it can be accessed by CPU */
@@ -1165,11 +1748,15 @@ get_converted_mat (GstNvInferOnnx * nvinfer, NvBufSurface *src_surf, gint idx,
     NvBufSurfaceSyncForCpu (nvinfer->inter_buf, 0, 0);
 
     /* Use openCV to remove padding and convert RGBA to BGR. Can be skipped if
-     * algorithm can handle padded RGBA data. */
+     * algorithm can handle padded RGBA data. Only the converted ROI is read and
+     * cvmat is resized to it without reallocating host_rgb_buf. */
     in_mat =
-            cv::Mat (nvinfer->processing_height, nvinfer->processing_width,
+            cv::Mat (dest_height, dest_width,
                      CV_8UC4, nvinfer->inter_buf->surfaceList[0].mappedAddr.addr[0],
                      nvinfer->inter_buf->surfaceList[0].pitch);
+    *nvinfer->cvmat =
+            cv::Mat (dest_height, dest_width, CV_8UC3, nvinfer->host_rgb_buf,
+                     dest_width * RGB_BYTES_PER_PIXEL);
 #if (CV_MAJOR_VERSION >= 4)
     cv::cvtColor (in_mat, *nvinfer->cvmat, cv::COLOR_RGBA2BGR);
 #else
@@ -1197,9 +1784,8 @@ get_converted_mat (GstNvInferOnnx * nvinfer, NvBufSurface *src_surf, gint idx,
   }
 #endif
 
-    /* We will first convert only the Region of Interest (the entire frame or the
-     * object bounding box) to RGB and then scale the converted RGB frame to
-     * processing resolution. */
+    /* Only the Region of Interest (the entire frame, the object bounding box
+     * or the source footprint of an aligned face) is scaled and converted. */
     return GST_FLOW_OK;
 
     error:
@@ -1207,28 +1793,323 @@ get_converted_mat (GstNvInferOnnx * nvinfer, NvBufSurface *src_surf, gint idx,
 }
 
 /**
- * Calls the one of the required conversion functions based on the network
- * input format.
+ * Alignment mode. Convert the source footprint of the face (crop_rect_params,
+ * as computed by get_face_alignment) to RGBA, warp it onto the aligned face
+ * template and write the result directly into the network input memory at
+ * index idx of the conversion buffer. Only touches the resources in scratch
+ * and slot idx, so faces can be aligned concurrently with different scratch
+ * resources. Sets rejected and leaves the slot untouched if the converted
+ * face fails the image quality gate.
  */
 static GstFlowReturn
-get_converted_buffer (GstNvInferOnnx * nvinfer, NvBufSurface * src_surf,
-    NvBufSurfaceParams * src_frame, NvOSD_RectParams * crop_rect_params,
-    NvBufSurface * dest_surf, NvBufSurfaceParams * dest_frame,
-    gdouble & ratio_x, gdouble & ratio_y, void *destCudaPtr)
+get_aligned_face (GstNvInferOnnx * nvinfer, GstNvInferOnnxAlignScratch * scratch,
+    NvBufSurface * src_surf, guint batch_id,
+    const NvOSD_RectParams * crop_rect_params, const gfloat * face_transform,
+    GstNvInferOnnxMemory * memory, guint idx, gboolean * rejected)
 {
-  guint src_left = GST_ROUND_UP_2 ((unsigned int)crop_rect_params->left);
-  guint src_top = GST_ROUND_UP_2 ((unsigned int)crop_rect_params->top);
-  guint src_width = GST_ROUND_DOWN_2 ((unsigned int)crop_rect_params->width);
-  guint src_height = GST_ROUND_DOWN_2 ((unsigned int)crop_rect_params->height);
+  guint src_left = crop_rect_params->left;
+  guint src_top = crop_rect_params->top;
+  guint src_width = crop_rect_params->width;
+  guint src_height = crop_rect_params->height;
+  NvBufSurfaceParams *inter_frame = scratch->inter_buf->surfaceList;
+  NvBufSurfaceParams *dest_frame = memory->surf->surfaceList + idx;
+  gfloat crop_transform[6];
+  gdouble scale;
   guint dest_width, dest_height;
+  gboolean warped;
 
-  if (nvinfer->maintain_aspect_ratio) {
-    /* Calculate the destination width and height required to maintain
-     * the aspect ratio. */
-    double hdest = dest_frame->width * src_height / (double) src_width;
-    double wdest = dest_frame->height * src_width / (double) src_height;
-    int pixel_size;
-    cudaError_t cudaReturn;
+  if (src_width == 0 || src_height == 0) {
+    GST_ERROR_OBJECT (nvinfer, "Face source rectangle dimensions are zero");
+    return GST_FLOW_ERROR;
+  }
+
+  /* Close-up faces need far fewer source pixels than they cover. Scale the
+   * footprint down as long as the warp keeps enough detail. */
+  scale = ALIGN_MAX_SOURCE_PIXELS_PER_FACE_PIXEL *
+      sqrt (face_transform[0] * face_transform[0] +
+          face_transform[3] * face_transform[3]);
+  scale = MIN (scale, MIN ((gdouble) inter_frame->width / src_width,
+          (gdouble) inter_frame->height / src_height));
+  scale = MIN (1.0, scale);
+  dest_width = MAX (1, (guint) (src_width * scale + 0.5));
+  dest_height = MAX (1, (guint) (src_height * scale + 0.5));
+
+  if (transform_to_inter_buf (nvinfer, src_surf, batch_id,
+          {src_top, src_left, src_width, src_height}, scratch->inter_buf,
+          scratch->convert_stream, dest_width, dest_height) != GST_FLOW_OK) {
+    return GST_FLOW_ERROR;
+  }
+
+  /* Map the buffer so that it can be accessed by CPU */
+  if (NvBufSurfaceMap (scratch->inter_buf, 0, 0, NVBUF_MAP_READ) != 0) {
+    GST_ERROR_OBJECT (nvinfer, "Failed to map intermediate buffer");
+    return GST_FLOW_ERROR;
+  }
+  NvBufSurfaceSyncForCpu (scratch->inter_buf, 0, 0);
+
+  *rejected = FALSE;
+  if (nvinfer->face_quality.check_image) {
+    const GstNvInferOnnxFaceQualityParams *quality = &nvinfer->face_quality;
+    mirror::FaceImageStats stats;
+
+    mirror::MeasureFaceImage (
+        (const unsigned char *) inter_frame->mappedAddr.addr[0], dest_width,
+        dest_height, inter_frame->pitch, &stats);
+    if (stats.sharpness < quality->min_sharpness ||
+        stats.brightness < quality->min_brightness ||
+        stats.brightness > quality->max_brightness) {
+      *rejected = TRUE;
+      NvBufSurfaceUnMap (scratch->inter_buf, 0, 0);
+      return GST_FLOW_OK;
+    }
+  }
+
+  /* The landmarks are in frame coordinates, the warp reads the crop. */
+  mirror::ComposeCropTransform (face_transform, src_left, src_top, scale,
+      crop_transform);
+  if (nvinfer->align_to_tensor) {
+    warped = mirror::WarpAffineRGBAToPlanar (
+        (const unsigned char *) inter_frame->mappedAddr.addr[0], dest_width,
+        dest_height, inter_frame->pitch, crop_transform,
+        nvinfer->face_normalization, (gfloat *) memory->frame_host_ptrs[idx],
+        dest_frame->planeParams.pitch[0]);
+  } else {
+    warped = mirror::WarpAffineRGBA (
+        (const unsigned char *) inter_frame->mappedAddr.addr[0], dest_width,
+        dest_height, inter_frame->pitch, crop_transform,
+        (unsigned char *) memory->frame_host_ptrs[idx],
+        dest_frame->planeParams.pitch[0],
+        dest_frame->colorFormat == NVBUF_COLOR_FORMAT_RGBA ? 4 : 3);
+  }
+
+  NvBufSurfaceUnMap (scratch->inter_buf, 0, 0);
+#ifdef IS_TEGRA
+  /* Flush the CPU writes so that the conversion for inference sees them. */
+  NvBufSurfaceSyncForDevice (memory->surf, idx, 0);
+#endif
+
+  if (!warped) {
+    GST_ERROR_OBJECT (nvinfer, "Face alignment transform is not invertible");
+    return GST_FLOW_ERROR;
+  }
+  return GST_FLOW_OK;
+}
+
+/** Holds a face queued for alignment into slot idx of the conversion buffer. */
+typedef struct
+{
+  guint batch_id;
+  guint idx;
+  NvOSD_RectParams face_rect;
+  gfloat face_transform[6];
+  /** Set if the face was dropped by the image quality gate. */
+  gboolean rejected;
+  /** Inference history of the object before the face was queued. Restored
+   * if the face is dropped. */
+  gulong prev_inferred_frame_num;
+  NvOSD_RectParams prev_inferred_coords;
+  /** Best-shot mode. Set if the aligned face is only captured into the
+   * object history with its score instead of being inferred on. */
+  gboolean capture;
+  gfloat score;
+  /** Best-shot mode / alignment cache. Crop copied into the slot instead of
+   * aligning the face. */
+  std::shared_ptr<std::vector<guint8>> crop;
+  /** Alignment cache. Set if the aligned face should be cached in the
+   * object history. */
+  gboolean cache_crop;
+} GstNvInferOnnxAlignJob;
+
+/* Hand the aligned face in slot idx of the conversion buffer to the debug
+ * dump. */
+static void
+dump_aligned_face (GstNvInferOnnx * nvinfer, GstNvInferOnnxMemory * memory,
+    guint idx, const GstNvInferOnnxFrame & frame)
+{
+  NvBufSurfaceParams *slot = memory->surf->surfaceList + idx;
+  gstnvinfer::DebugDump::Image image = {
+    frame.source_id, frame.object_id, frame.frame_num,
+    mirror::kAlignedFaceSize, mirror::kAlignedFaceSize,
+    (gint) slot->planeParams.pitch[0],
+    gstnvinfer::DebugDump::Layout::PLANAR_FLOAT, memory->frame_host_ptrs[idx] };
+
+  if (!nvinfer->align_to_tensor) {
+    image.layout = (slot->colorFormat == NVBUF_COLOR_FORMAT_RGBA) ?
+        gstnvinfer::DebugDump::Layout::RGBA : gstnvinfer::DebugDump::Layout::RGB;
+  }
+  nvinfer->debug_dumper->submit (image);
+}
+
+/* Best-shot mode. Keep the aligned face in slot idx of the conversion buffer
+ * among the best crops of the object. */
+static void
+store_best_shot (GstNvInferOnnx * nvinfer, GstNvInferOnnxObjectHistory * history,
+    GstNvInferOnnxMemory * memory, guint idx, gfloat score, gulong frame_num)
+{
+  std::vector<GstNvInferOnnxBestShot> &shots = history->best_shots;
+  const guint8 *data = (const guint8 *) memory->frame_host_ptrs[idx];
+  auto pos = std::find_if (shots.begin (), shots.end (),
+      [score] (const GstNvInferOnnxBestShot &shot) {
+        return shot.score < score;
+      });
+
+  if (shots.empty ())
+    history->best_shot_first_frame_num = frame_num;
+  if (pos == shots.begin ())
+    history->best_shot_frame_num = frame_num;
+
+  shots.insert (pos, GstNvInferOnnxBestShot { score,
+        std::make_shared<std::vector<guint8>> (data,
+            data + memory->surf->surfaceList[idx].dataSize)});
+  if (shots.size () > nvinfer->best_shot_count)
+    shots.pop_back ();
+  nvinfer->face_stats->best_shots_captured++;
+}
+
+/**
+ * Align the faces queued for the current batch. The faces are spread over
+ * the alignment workers if there are any. Every face is written to its own
+ * slot so the order of the batch is kept. Faces dropped by the image quality
+ * gate are then removed from the batch and the following slots are moved up,
+ * which may leave room in the batch for more objects. Consumes the jobs.
+ */
+static GstFlowReturn
+align_batch_faces (GstNvInferOnnx * nvinfer, NvBufSurface * in_surf,
+    GstNvInferOnnxBatch * batch, GstNvInferOnnxMemory * memory,
+    std::vector<GstNvInferOnnxAlignJob> & jobs)
+{
+  gboolean ok = TRUE;
+  auto align = [&] (guint worker, guint job) {
+    GstNvInferOnnxAlignJob &j = jobs[job];
+    if (j.crop) {
+      memcpy (memory->frame_host_ptrs[j.idx], j.crop->data (),
+          MIN (j.crop->size (), memory->surf->surfaceList[j.idx].dataSize));
+#ifdef IS_TEGRA
+      NvBufSurfaceSyncForDevice (memory->surf, j.idx, 0);
+#endif
+      return true;
+    }
+    return get_aligned_face (nvinfer, &nvinfer->align_scratch->at (worker),
+        in_surf, j.batch_id, &j.face_rect, j.face_transform, memory,
+        j.idx, &j.rejected) == GST_FLOW_OK;
+  };
+
+  if (nvinfer->align_pool) {
+    ok = nvinfer->align_pool->run (jobs.size (),
+        [&] (guint worker, guint job) {
+          cudaSetDevice (nvinfer->gpu_id);
+          return align (worker, job);
+        });
+  } else {
+    for (guint i = 0; ok && i < jobs.size (); i++)
+      ok = align (0, i);
+  }
+
+  if (!ok) {
+    jobs.clear ();
+    GST_ELEMENT_ERROR (nvinfer, STREAM, FAILED,
+        ("Face alignment failed"), (NULL));
+    return GST_FLOW_ERROR;
+  }
+
+  /* The queued faces are the last frames of the batch. */
+  guint kept = jobs.empty () ? batch->frames.size () : jobs.front ().idx;
+  for (auto & job : jobs) {
+    GstNvInferOnnxFrame frame = batch->frames[job.idx];
+
+    /* Captured faces leave the batch as well. Their history was not touched
+     * when they were queued. */
+    if (job.capture) {
+      std::shared_ptr<GstNvInferOnnxObjectHistory> history =
+          frame.history.lock ();
+      if (job.rejected) {
+        nvinfer->face_stats->faces_rejected_image++;
+      } else if (history) {
+        gstnvinfer::StripeGuard locker (*nvinfer->history_locks,
+            history.get ());
+        store_best_shot (nvinfer, history.get (), memory, job.idx, job.score,
+            frame.frame_num);
+      }
+      continue;
+    }
+
+    if (job.rejected) {
+      nvinfer->face_stats->faces_rejected_image++;
+
+      /* Roll back the object history so that the object is tried again on
+       * its next frames. Meanwhile it keeps its previous results. */
+      std::shared_ptr<GstNvInferOnnxObjectHistory> history =
+          frame.history.lock ();
+      if (history) {
+        gstnvinfer::StripeGuard locker (*nvinfer->history_locks,
+            history.get ());
+        history->under_inference = FALSE;
+        history->last_inferred_frame_num = job.prev_inferred_frame_num;
+        history->last_inferred_coords = job.prev_inferred_coords;
+        if (IS_CLASSIFIER_INSTANCE (nvinfer) && frame.obj_meta &&
+            !history->cached_info.attributes.empty ())
+          batch->objs_pending_meta_attach.emplace_back (history,
+              frame.obj_meta);
+      }
+      continue;
+    }
+
+    if (job.cache_crop) {
+      std::shared_ptr<GstNvInferOnnxObjectHistory> history =
+          frame.history.lock ();
+      const guint8 *data = (const guint8 *) memory->frame_host_ptrs[job.idx];
+      if (history) {
+        gstnvinfer::StripeGuard locker (*nvinfer->history_locks,
+            history.get ());
+        history->align_cache_crop = std::make_shared<std::vector<guint8>> (data,
+            data + memory->surf->surfaceList[job.idx].dataSize);
+      }
+    }
+
+    if (g_atomic_int_get (&nvinfer->debug_dump) && nvinfer->debug_dumper)
+      dump_aligned_face (nvinfer, memory, job.idx, frame);
+
+    if (kept != job.idx) {
+      memcpy (memory->frame_host_ptrs[kept], memory->frame_host_ptrs[job.idx],
+          memory->surf->surfaceList[job.idx].dataSize);
+#ifdef IS_TEGRA
+      NvBufSurfaceSyncForDevice (memory->surf, kept, 0);
+#endif
+      frame.converted_frame_ptr = memory->frame_memory_ptrs[kept];
+      batch->frames[kept] = frame;
+    }
+    nvinfer->face_stats->faces_inferred++;
+    kept++;
+  }
+  batch->frames.resize (kept);
+  jobs.clear ();
+
+  return GST_FLOW_OK;
+}
+
+/**
+ * Calls the one of the required conversion functions based on the network
+ * input format.
+ */
+static GstFlowReturn
+get_converted_buffer (GstNvInferOnnx * nvinfer, NvBufSurface * src_surf,
+    NvBufSurfaceParams * src_frame, NvOSD_RectParams * crop_rect_params,
+    NvBufSurface * dest_surf, NvBufSurfaceParams * dest_frame,
+    gdouble & ratio_x, gdouble & ratio_y, void *destCudaPtr)
+{
+  guint src_left = GST_ROUND_UP_2 ((unsigned int)crop_rect_params->left);
+  guint src_top = GST_ROUND_UP_2 ((unsigned int)crop_rect_params->top);
+  guint src_width = GST_ROUND_DOWN_2 ((unsigned int)crop_rect_params->width);
+  guint src_height = GST_ROUND_DOWN_2 ((unsigned int)crop_rect_params->height);
+  guint dest_width, dest_height;
+
+  if (nvinfer->maintain_aspect_ratio) {
+    /* Calculate the destination width and height required to maintain
+     * the aspect ratio. */
+    double hdest = dest_frame->width * src_height / (double) src_width;
+    double wdest = dest_frame->height * src_width / (double) src_height;
+    int pixel_size;
+    cudaError_t cudaReturn;
 
     if (hdest <= dest_frame->height) {
       dest_width = dest_frame->width;
@@ -1303,6 +2184,36 @@ get_converted_buffer (GstNvInferOnnx * nvinfer, NvBufSurface * src_surf,
   return GST_FLOW_OK;
 }
 
+/* Batch accumulation. Wait until the streaming thread closes the open batch,
+ * closing it when its deadline passes while nobody adds to it. */
+static void
+wait_open_batch (GstNvInferOnnx *nvinfer, GstNvInferOnnxBatch *batch)
+{
+  std::atomic<gpointer> &open = *nvinfer->accumulate_open;
+  gpointer filling = (gpointer) ((guintptr) batch | ACCUMULATE_FILLING);
+
+  while (TRUE) {
+    gpointer state = open.load (std::memory_order_acquire);
+    if (state != batch && state != filling)
+      return;
+
+    auto changed = [&] {
+      return open.load (std::memory_order_acquire) != state;
+    };
+    if (state == filling) {
+      nvinfer->accumulate_spot->wait (changed);
+    } else if (std::chrono::steady_clock::now () >=
+        batch->accumulate_deadline) {
+      if (open.compare_exchange_strong (state, nullptr,
+              std::memory_order_acquire))
+        return;
+    } else {
+      nvinfer->accumulate_spot->waitUntil (changed,
+          batch->accumulate_deadline);
+    }
+  }
+}
+
 /* Helper function to queue a batch for inferencing and push it to the element's
  * processing queue. */
 static gpointer
@@ -1318,9 +2229,10 @@ gst_nvinfer_input_queue_loop (gpointer data)
   eventAttrib.color = 0xFFFF0000;
   eventAttrib.messageType = NVTX_MESSAGE_TYPE_ASCII;
 
-  LockGMutex locker (nvinfer->process_lock);
-
-  while (nvinfer->stop == FALSE) {
+  /* The queues need no lock. The context is only replaced while both queues
+   * are empty and this thread waits for a batch, which the push of the next
+   * batch orders after the replacement. */
+  while (TRUE) {
     GstNvInferOnnxBatch *batch;
     GstNvInferOnnxMemory *mem;
     NvDsInferContextBatchInput input_batch;
@@ -1328,12 +2240,16 @@ gst_nvinfer_input_queue_loop (gpointer data)
     unsigned int i;
     NvDsInferStatus status;
 
-    /* Wait if input queue is empty. */
-    if (g_queue_is_empty (nvinfer->input_queue)) {
-      locker.wait (nvinfer->process_cond);
-      continue;
-    }
-    batch = (GstNvInferOnnxBatch *) g_queue_pop_head (nvinfer->input_queue);
+    /* Wait if input queue is empty. The batch is popped only once it is
+     * handed on, so that an empty input queue means that every batch has
+     * reached the process queue. */
+    batch = (GstNvInferOnnxBatch *) nvinfer->input_queue->front ();
+    if (!batch)
+      break;
+    /* Batch accumulation. The streaming thread may still be adding objects
+     * to the batch. */
+    if (batch->accumulate)
+      wait_open_batch (nvinfer, batch);
     NvDsInferContextPtr nvdsinfer_ctx = impl->m_InferCtx;
 
     /* Check if this is a push buffer or event marker batch. If yes, no need to
@@ -1352,20 +2268,25 @@ gst_nvinfer_input_queue_loop (gpointer data)
     input_batch.inputFrames = input_frames.data ();
     input_batch.numInputFrames = input_frames.size ();
 
-    switch (mem->surf->surfaceList[0].colorFormat) {
-      case NVBUF_COLOR_FORMAT_RGBA:
-        input_batch.inputFormat = NvDsInferFormat_RGBA;
-        break;
-      case NVBUF_COLOR_FORMAT_RGB:
-        input_batch.inputFormat = NvDsInferFormat_RGB;
-        break;
-      case NVBUF_COLOR_FORMAT_GRAY8:
-      case NVBUF_COLOR_FORMAT_NV12:
-        input_batch.inputFormat = NvDsInferFormat_GRAY;
-        break;
-      default:
-        input_batch.inputFormat = NvDsInferFormat_Unknown;
-        break;
+    if (nvinfer->align_to_tensor) {
+      /* Aligned faces are already normalised planar tensors. */
+      input_batch.inputFormat = NvDsInferFormat_Tensor;
+    } else {
+      switch (mem->surf->surfaceList[0].colorFormat) {
+        case NVBUF_COLOR_FORMAT_RGBA:
+          input_batch.inputFormat = NvDsInferFormat_RGBA;
+          break;
+        case NVBUF_COLOR_FORMAT_RGB:
+          input_batch.inputFormat = NvDsInferFormat_RGB;
+          break;
+        case NVBUF_COLOR_FORMAT_GRAY8:
+        case NVBUF_COLOR_FORMAT_NV12:
+          input_batch.inputFormat = NvDsInferFormat_GRAY;
+          break;
+        default:
+          input_batch.inputFormat = NvDsInferFormat_Unknown;
+          break;
+      }
     }
     input_batch.inputPitch = mem->surf->surfaceList[0].planeParams.pitch[0];
 
@@ -1373,8 +2294,6 @@ gst_nvinfer_input_queue_loop (gpointer data)
         (NvDsInferContextReturnInputAsyncFunc) gst_buffer_unref;
     input_batch.returnFuncData = batch->conv_buf;
 
-    locker.unlock ();
-
     nvtx_str = "queueInput batch_num=" + std::to_string(nvinfer->current_batch_num);
     eventAttrib.message.ascii = nvtx_str.c_str();
     nvtxDomainRangePushEx(nvinfer->nvtx_domain, &eventAttrib);
@@ -1383,27 +2302,28 @@ gst_nvinfer_input_queue_loop (gpointer data)
 
     nvtxDomainRangePop(nvinfer->nvtx_domain);
 
-    locker.lock ();
-
     if (status != NVDSINFER_SUCCESS) {
       GST_ELEMENT_ERROR (nvinfer, STREAM, FAILED,
           ("Failed to queue input batch for inferencing"), (nullptr));
+      nvinfer->input_queue->pop ();
       continue;
     }
 
 queue_batch:
-    /* Push the batch info structure in the processing queue and notify the
-     * output thread that a new batch has been queued. */
-    g_queue_push_tail (nvinfer->process_queue, batch);
-    g_cond_broadcast (&nvinfer->process_cond);
+    /* Push the batch info structure in the processing queue. The output
+     * thread is woken only if it is waiting. */
+    nvinfer->process_queue->push (batch);
+    nvinfer->input_queue->pop ();
   }
 
   return NULL;
 }
 
+/* Convert the frames added to the batch since it was last converted. They
+ * are the last frames of the batch and the frames of tmp_surf. */
 static gboolean
-convert_batch_and_push_to_input_thread (GstNvInferOnnx *nvinfer,
-    GstNvInferOnnxBatch *batch, GstNvInferOnnxMemory *mem)
+convert_batch (GstNvInferOnnx *nvinfer, GstNvInferOnnxBatch *batch,
+    GstNvInferOnnxMemory *mem)
 {
   NvBufSurfTransform_Error err = NvBufSurfTransformError_Success;
   std::string nvtx_str;
@@ -1428,10 +2348,24 @@ convert_batch_and_push_to_input_thread (GstNvInferOnnx *nvinfer,
 
   nvtxDomainRangePushEx(nvinfer->nvtx_domain, &eventAttrib);
 
-  if (batch->frames.size() > 0) {
-    /* Batched tranformation. */
-    err = NvBufSurfTransform (&nvinfer->tmp_surf, mem->surf,
-              &nvinfer->transform_params);
+  /* In alignment mode the frames are already written to the batch memory and
+   * there is nothing to transform. */
+  if (batch->frames.size() > batch->num_converted &&
+      nvinfer->tmp_surf.numFilled > 0) {
+    if (batch->num_converted == 0) {
+      /* Batched tranformation. */
+      err = NvBufSurfTransform (&nvinfer->tmp_surf, mem->surf,
+                &nvinfer->transform_params);
+    } else {
+      /* A batch accumulated over several input buffers. Transform into the
+       * slots after the frames of the previous buffers. */
+      NvBufSurface dst = *mem->surf;
+      dst.surfaceList += batch->num_converted;
+      dst.batchSize -= batch->num_converted;
+      dst.numFilled = nvinfer->tmp_surf.numFilled;
+      err = NvBufSurfTransform (&nvinfer->tmp_surf, &dst,
+                &nvinfer->transform_params);
+    }
   }
 
   nvtxDomainRangePop (nvinfer->nvtx_domain);
@@ -1443,11 +2377,78 @@ convert_batch_and_push_to_input_thread (GstNvInferOnnx *nvinfer,
     return FALSE;
   }
 
-  LockGMutex locker (nvinfer->process_lock);
-  /* Push the batch info structure in the processing queue and notify the output
-   * thread that a new batch has been queued. */
-  g_queue_push_tail (nvinfer->input_queue, batch);
-  g_cond_broadcast (&nvinfer->process_cond);
+  /* tmp_surf refers to the surfaces of the current input buffer. */
+  batch->num_converted = batch->frames.size ();
+  nvinfer->tmp_surf.numFilled = 0;
+
+  return TRUE;
+}
+
+static gboolean
+convert_batch_and_push_to_input_thread (GstNvInferOnnx *nvinfer,
+    GstNvInferOnnxBatch *batch, GstNvInferOnnxMemory *mem)
+{
+  if (!convert_batch (nvinfer, batch, mem))
+    return FALSE;
+
+  /* Push the batch info structure in the processing queue. The input queue
+   * thread is woken only if it is waiting. */
+  nvinfer->input_queue->push (batch);
+
+  return TRUE;
+}
+
+/* Batch accumulation. Take back the batch left open by the previous input
+ * buffers to add the objects of the current one. Returns nullptr if there is
+ * none or the input queue thread has closed it. */
+static GstNvInferOnnxBatch *
+take_open_batch (GstNvInferOnnx *nvinfer)
+{
+  gpointer open = nvinfer->accumulate_open->load (std::memory_order_acquire);
+  if (!open || !nvinfer->accumulate_open->compare_exchange_strong (open,
+          (gpointer) ((guintptr) open | ACCUMULATE_FILLING),
+          std::memory_order_acquire))
+    return nullptr;
+  return (GstNvInferOnnxBatch *) open;
+}
+
+/* Batch accumulation. Let the input queue thread process the open batch
+ * without waiting for its deadline. Streaming thread only. */
+static void
+close_open_batch (GstNvInferOnnx *nvinfer)
+{
+  if (nvinfer->accumulate_open->exchange (nullptr, std::memory_order_acq_rel))
+    nvinfer->accumulate_spot->notify ();
+}
+
+/* Convert the batch and queue it for inferencing. With keep_open the batch
+ * stays open for the objects of the next input buffers until its deadline.
+ * A batch that was queued open is handed back to the input queue thread
+ * instead of being queued again. Either way the batch belongs to the input
+ * queue thread once this returns TRUE. */
+static gboolean
+queue_object_batch (GstNvInferOnnx *nvinfer, GstNvInferOnnxBatch *batch,
+    GstNvInferOnnxMemory *mem, gboolean keep_open)
+{
+  if (!convert_batch (nvinfer, batch, mem))
+    return FALSE;
+
+  if (batch->accumulate) {
+    nvinfer->accumulate_open->store (keep_open ? batch : nullptr,
+        std::memory_order_release);
+    nvinfer->accumulate_spot->notify ();
+    return TRUE;
+  }
+
+  if (keep_open) {
+    /* Published before the push so the input queue thread never finds the
+     * batch closed while it can still be taken back. */
+    batch->accumulate = TRUE;
+    batch->accumulate_deadline = std::chrono::steady_clock::now () +
+        std::chrono::microseconds (nvinfer->batch_accumulate_us);
+    nvinfer->accumulate_open->store (batch, std::memory_order_release);
+  }
+  nvinfer->input_queue->push (batch);
 
   return TRUE;
 }
@@ -1457,7 +2458,6 @@ convert_batch_and_push_to_input_thread (GstNvInferOnnx *nvinfer,
 static void
 cleanup_history_map (GstNvInferOnnx * nvinfer, GstBuffer * inbuf)
 {
-  LockGMutex locker (nvinfer->process_lock);
   /* Find the history map for each source whose frames are present in the batch
    * and trim the map. */
   for (auto &source_iter : *(nvinfer->source_info)) {
@@ -1472,6 +2472,7 @@ cleanup_history_map (GstNvInferOnnx * nvinfer, GstBuffer * inbuf)
     auto iterator = source_info.object_history_map.begin ();
     while (iterator != source_info.object_history_map.end ()) {
       auto history = iterator->second;
+      gstnvinfer::StripeGuard locker (*nvinfer->history_locks, history.get ());
       if (!history->under_inference &&
           source_info.last_seen_frame_num - history->last_accessed_frame_num >
           CLEANUP_ACCESS_CRITERIA) {
@@ -1516,6 +2517,23 @@ should_infer_object (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
     return FALSE;
   }
 
+  /* Best-shot mode. Objects are looked at until they are recognised once. */
+  if (history && nvinfer->best_shot_count > 0)
+    return !history->best_shot_done;
+
+  /* Identity lock-in. Locked tracks are only inferred on to be verified. */
+  if (history && IS_EMBEDDING_INSTANCE (nvinfer) && history->identity_locked)
+    return nvinfer->gallery_lock_verify_interval > 0 &&
+        !history->under_inference &&
+        frame_num - history->identity_locked_frame_num >=
+        nvinfer->gallery_lock_verify_interval;
+
+  /* Embedding aggregation. Tracks are inferred on until their aggregate is
+   * stable. */
+  if (history && IS_EMBEDDING_INSTANCE (nvinfer) &&
+      nvinfer->embedding_aggregate)
+    return !history->embedding_done;
+
   /* History is irrevelavant for detectors. */
   if (history && IS_CLASSIFIER_INSTANCE (nvinfer)) {
     gboolean should_reinfer = FALSE;
@@ -1539,6 +2557,482 @@ should_infer_object (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
 }
 #define NVDS_USER_FRAME_META_EXAMPLE (nvds_get_user_meta_type("NVIDIA.NVINFER.USER_META"))
 
+/* Index of the nose tip in the landmarks of a face. */
+#define FACE_LANDMARK_NOSE 2
+
+static_assert (NVDS_FACE_NUM_LANDMARKS == mirror::kNumLandmarks,
+    "Landmark meta and aligner disagree on the number of landmarks");
+
+/* Collect the landmarks attached at frame level in the legacy format: one
+ * NVDS_USER_FRAME_META_EXAMPLE user meta holding 5 gint16 (x, y) pairs per
+ * face. Done once per frame so that objects do not each walk the frame meta. */
+static void
+collect_frame_landmarks (NvDsFrameMeta * frame_meta, NvDsMetaType meta_type,
+    std::vector<NvDsFaceLandmarksMeta> & faces)
+{
+  faces.clear ();
+  for (NvDsMetaList * l_user_meta = frame_meta->frame_user_meta_list;
+      l_user_meta != NULL; l_user_meta = l_user_meta->next) {
+    NvDsUserMeta *user_meta = (NvDsUserMeta *) (l_user_meta->data);
+    if (user_meta->base_meta.meta_type != meta_type)
+      continue;
+
+    NvDsFaceLandmarksMeta face;
+    gint16 *points = (gint16 *) user_meta->user_meta_data;
+    for (gint i = 0; i < NVDS_FACE_NUM_LANDMARKS; i++) {
+      face.x[i] = points[i * 2];
+      face.y[i] = points[i * 2 + 1];
+    }
+    face.confidence = -1;
+    faces.push_back (face);
+  }
+}
+
+/* Find the facial landmarks of the face in object_meta. Landmarks attached to
+ * the object itself are preferred. Otherwise the first frame-level face whose
+ * nose tip lies inside the object's box is used. Returns FALSE if the object
+ * has no landmarks. */
+static gboolean
+find_face_landmarks (NvDsObjectMeta * object_meta, NvDsMetaType meta_type,
+    const std::vector<NvDsFaceLandmarksMeta> & frame_faces,
+    gfloat * landmarks_x, gfloat * landmarks_y)
+{
+  const NvDsFaceLandmarksMeta *face =
+      nvds_get_face_landmarks_meta (object_meta, meta_type);
+
+  if (!face) {
+    NvOSD_RectParams *rect = &object_meta->rect_params;
+    for (const auto & frame_face : frame_faces) {
+      gfloat nose_x = frame_face.x[FACE_LANDMARK_NOSE];
+      gfloat nose_y = frame_face.y[FACE_LANDMARK_NOSE];
+      if (nose_x >= rect->left && nose_x < rect->left + rect->width &&
+          nose_y >= rect->top && nose_y < rect->top + rect->height) {
+        face = &frame_face;
+        break;
+      }
+    }
+    if (!face)
+      return FALSE;
+  }
+
+  memcpy (landmarks_x, face->x, sizeof (face->x));
+  memcpy (landmarks_y, face->y, sizeof (face->y));
+  return TRUE;
+}
+
+/* Estimate the transform aligning the face with the given landmarks and the
+ * smallest rectangle of the frame that the alignment reads. The rectangle is
+ * expanded to even co-ordinates as required for the hardware conversion.
+ * Returns FALSE if the face cannot be aligned. */
+static gboolean
+get_face_alignment (NvBufSurfaceParams * frame, const gfloat * landmarks_x,
+    const gfloat * landmarks_y, gfloat * face_transform,
+    NvOSD_RectParams * face_rect)
+{
+  gint left, top, right, bottom;
+
+  if (mirror::EstimateSimilarityBatch (landmarks_x, landmarks_y, 1,
+          face_transform) != 0)
+    return FALSE;
+
+  if (!mirror::ComputeAlignmentSourceRect (face_transform, frame->width,
+          frame->height, &left, &top, &right, &bottom))
+    return FALSE;
+
+  left = GST_ROUND_DOWN_2 (left);
+  top = GST_ROUND_DOWN_2 (top);
+  right = MIN (GST_ROUND_UP_2 (right), (gint) GST_ROUND_DOWN_2 (frame->width));
+  bottom =
+      MIN (GST_ROUND_UP_2 (bottom), (gint) GST_ROUND_DOWN_2 (frame->height));
+  if (right <= left || bottom <= top)
+    return FALSE;
+
+  face_rect->left = left;
+  face_rect->top = top;
+  face_rect->width = right - left;
+  face_rect->height = bottom - top;
+  return TRUE;
+}
+
+/* Alignment cache. Returns TRUE if the object has a cached crop and none of
+ * its landmarks moved by more than align-cache-max-displacement pixels since
+ * the crop was aligned. */
+static gboolean
+align_cache_usable (GstNvInferOnnx * nvinfer,
+    GstNvInferOnnxObjectHistory * history, const gfloat * landmarks_x,
+    const gfloat * landmarks_y)
+{
+  gfloat max_d2 = nvinfer->align_cache_max_displacement *
+      nvinfer->align_cache_max_displacement;
+
+  if (!history->align_cache_crop)
+    return FALSE;
+
+  for (int i = 0; i < mirror::kNumLandmarks; i++) {
+    gfloat dx = landmarks_x[i] - history->align_cache_x[i];
+    gfloat dy = landmarks_y[i] - history->align_cache_y[i];
+    if (dx * dx + dy * dy > max_d2)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Face quality gate on the landmark geometry. Returns FALSE for faces that
+ * are too small or turned too far away from the camera to be recognised. */
+static gboolean
+face_geometry_acceptable (GstNvInferOnnx * nvinfer, const gfloat * landmarks_x,
+    const gfloat * landmarks_y)
+{
+  const GstNvInferOnnxFaceQualityParams *quality = &nvinfer->face_quality;
+  mirror::FaceGeometry geometry;
+
+  if (!mirror::MeasureFaceGeometry (landmarks_x, landmarks_y, &geometry))
+    return FALSE;
+
+  return geometry.inter_ocular >= quality->min_inter_ocular &&
+      fabsf (geometry.yaw) <= quality->max_yaw &&
+      fabsf (geometry.pitch) <= quality->max_pitch &&
+      fabsf (geometry.roll) <= quality->max_roll;
+}
+
+/* What best-shot mode does with a tracked face. */
+typedef enum
+{
+  BEST_SHOT_NONE,
+  BEST_SHOT_CAPTURE,
+  BEST_SHOT_RECOGNISE,
+} GstNvInferOnnxBestShotAction;
+
+/* Best-shot mode. Returns TRUE once the best crop of the object has not
+ * improved for best_shot_stable_frames frames or the capture timeout has
+ * expired. */
+static gboolean
+best_shot_ready (GstNvInferOnnx * nvinfer,
+    GstNvInferOnnxObjectHistory * history, gulong frame_num)
+{
+  if (history->best_shots.empty ())
+    return FALSE;
+
+  if (frame_num - history->best_shot_frame_num >=
+      nvinfer->best_shot_stable_frames)
+    return TRUE;
+
+  return nvinfer->best_shot_timeout > 0 &&
+      frame_num - history->best_shot_first_frame_num >=
+      nvinfer->best_shot_timeout;
+}
+
+/* What becomes of an object that is due for inference. */
+typedef enum
+{
+  /** Inferred on. In best-shot mode, recognised on its best shot. */
+  OBJECT_INFER,
+  /** Best-shot mode. Aligned and kept as a best shot, not inferred on. */
+  OBJECT_CAPTURE,
+  /** Best-shot mode. Not better than the best shots so far, which are not
+   * ready for recognition yet. */
+  OBJECT_HOLD,
+  /** Alignment mode. No landmarks or no usable alignment transform. */
+  OBJECT_NO_FACE,
+  /** Alignment mode. Rejected by the landmark geometry gate. */
+  OBJECT_REJECTED_GEOMETRY,
+} GstNvInferOnnxObjectAction;
+
+/* Face of an object due for inference and its alignment, as worked out by
+ * plan_object. */
+typedef struct
+{
+  gfloat landmarks_x[mirror::kNumLandmarks];
+  gfloat landmarks_y[mirror::kNumLandmarks];
+  /** Landmarks were found and, unless align_cached, the face can be aligned
+   * with face_transform from face_rect of the frame. */
+  gboolean have_face;
+  gfloat face_transform[6];
+  NvOSD_RectParams face_rect;
+  /** Alignment cache. The crop of the object is to be cached, and the
+   * cached crop can be reused. */
+  gboolean align_cache;
+  gboolean align_cached;
+  /** Best-shot mode. Quality score of the face. */
+  gfloat best_shot_score;
+} GstNvInferOnnxObjectPlan;
+
+/* Decide what becomes of an object that should_infer_object found due for
+ * inference, filling plan. Only OBJECT_INFER objects are inferred on, so
+ * only they are given a share of the inference budget. Called with the lock
+ * of history held. Changes nothing, so that the scheduler and
+ * gst_nvinfer_process_objects come to the same decision. */
+static GstNvInferOnnxObjectAction
+plan_object (GstNvInferOnnx * nvinfer, NvBufSurfaceParams * frame,
+    NvDsObjectMeta * object_meta, gulong frame_num,
+    NvDsMetaType landmarks_meta_type,
+    const std::vector<NvDsFaceLandmarksMeta> & frame_faces,
+    GstNvInferOnnxObjectHistory * history, gboolean tracked,
+    GstNvInferOnnxObjectPlan * plan)
+{
+  plan->have_face = find_face_landmarks (object_meta, landmarks_meta_type,
+      frame_faces, plan->landmarks_x, plan->landmarks_y);
+  plan->align_cache = nvinfer->align_faces && plan->have_face &&
+      nvinfer->align_cache_max_displacement > 0 &&
+      nvinfer->best_shot_count == 0 && tracked;
+  plan->align_cached = plan->align_cache && history &&
+      align_cache_usable (nvinfer, history, plan->landmarks_x,
+          plan->landmarks_y);
+  plan->have_face = plan->have_face && (plan->align_cached ||
+      get_face_alignment (frame, plan->landmarks_x, plan->landmarks_y,
+          plan->face_transform, &plan->face_rect));
+  plan->best_shot_score = 0;
+
+  if (nvinfer->align_faces && !plan->have_face)
+    return OBJECT_NO_FACE;
+  if (nvinfer->align_faces && nvinfer->face_quality.check_geometry &&
+      !face_geometry_acceptable (nvinfer, plan->landmarks_x,
+          plan->landmarks_y))
+    return OBJECT_REJECTED_GEOMETRY;
+
+  /* Best-shot mode. Tracked faces are captured while their score improves
+   * and recognised once on the best of them. */
+  if (nvinfer->best_shot_count > 0 && tracked) {
+    mirror::FaceGeometry geometry;
+    if (mirror::MeasureFaceGeometry (plan->landmarks_x, plan->landmarks_y,
+            &geometry))
+      plan->best_shot_score = mirror::FaceQualityScore (geometry);
+
+    if (history && best_shot_ready (nvinfer, history, frame_num))
+      return OBJECT_INFER;
+    if (plan->best_shot_score > 0 && (!history ||
+            history->best_shots.size () < nvinfer->best_shot_count ||
+            plan->best_shot_score > history->best_shots.back ().score))
+      return OBJECT_CAPTURE;
+    return OBJECT_HOLD;
+  }
+
+  return OBJECT_INFER;
+}
+
+/* Best-shot mode. Hand out the best crop of the object for recognition. The
+ * object is not captured or inferred on again. */
+static GstNvInferOnnxBestShot
+take_best_shot (GstNvInferOnnx * nvinfer, GstNvInferOnnxObjectHistory * history)
+{
+  GstNvInferOnnxBestShot shot = history->best_shots.front ();
+
+  history->best_shots.clear ();
+  history->best_shot_done = TRUE;
+  nvinfer->face_stats->best_shots_recognised++;
+  return shot;
+}
+
+/* Best-shot mode. Give back a best crop handed out by take_best_shot for a
+ * batch that could not be queued, so that the track is recognised later. */
+static void
+put_back_best_shot (GstNvInferOnnx * nvinfer,
+    GstNvInferOnnxObjectHistory * history, const GstNvInferOnnxBestShot & shot)
+{
+  history->best_shots.assign (1, shot);
+  history->best_shot_done = FALSE;
+  history->under_inference = FALSE;
+  nvinfer->face_stats->best_shots_recognised--;
+}
+
+/* Best-shot mode. Tracks that have not been seen for best_shot_lost_frames
+ * frames are recognised on their best crop. These crops are not part of any
+ * input buffer and are sent in batches of their own, without metadata to
+ * attach to. A track is only taken out of best_shot_pending once its crop
+ * has a slot in a conversion buffer, so a track whose batch fails is tried
+ * again with the next buffer. */
+static GstFlowReturn
+recognise_lost_best_shots (GstNvInferOnnx * nvinfer)
+{
+  std::vector<GstNvInferOnnxFrame> lost_frames;
+  std::vector<std::shared_ptr<GstNvInferOnnxObjectHistory>> lost_histories;
+
+  for (auto &source_iter : *(nvinfer->source_info)) {
+    GstNvInferOnnxSourceInfo &source_info = source_iter.second;
+    auto iterator = source_info.best_shot_pending.begin ();
+    while (iterator != source_info.best_shot_pending.end ()) {
+      GstNvInferOnnxObjectHistory *history = iterator->second.get ();
+      gstnvinfer::StripeGuard locker (*nvinfer->history_locks, history);
+      if (source_info.last_seen_frame_num - history->last_accessed_frame_num <=
+          nvinfer->best_shot_lost_frames) {
+        ++iterator;
+        continue;
+      }
+
+      if (history->best_shots.empty ()) {
+        iterator = source_info.best_shot_pending.erase (iterator);
+        continue;
+      }
+
+      GstNvInferOnnxFrame frame;
+      frame.history = iterator->second;
+      frame.best_shot = TRUE;
+      frame.best_shot_lost = TRUE;
+      frame.source_id = source_iter.first;
+      frame.object_id = iterator->first;
+      lost_frames.push_back (frame);
+      lost_histories.push_back (iterator->second);
+      ++iterator;
+    }
+  }
+
+  for (guint start = 0; start < lost_frames.size ();
+      start += nvinfer->max_batch_size) {
+    std::unique_ptr<GstNvInferOnnxBatch> batch (new GstNvInferOnnxBatch);
+    std::vector<GstNvInferOnnxBestShot> shots;
+    GstBuffer *conv_gst_buf = nullptr;
+    GstNvInferOnnxMemory *memory;
+    GstFlowReturn flow_ret;
+
+    batch->push_buffer = FALSE;
+    batch->inbuf = nullptr;
+    batch->inbuf_batch_num = nvinfer->current_batch_num;
+
+    flow_ret = gst_buffer_pool_acquire_buffer (nvinfer->pool, &conv_gst_buf,
+        nullptr);
+    if (flow_ret != GST_FLOW_OK) {
+      return flow_ret;
+    }
+    memory = gst_nvinfer_buffer_get_memory (conv_gst_buf);
+    if (!memory) {
+      gst_buffer_unref (conv_gst_buf);
+      return GST_FLOW_ERROR;
+    }
+    batch->conv_buf = conv_gst_buf;
+
+    for (guint i = start;
+        i < lost_frames.size () && batch->frames.size () < nvinfer->max_batch_size;
+        i++) {
+      GstNvInferOnnxFrame &frame = lost_frames[i];
+      GstNvInferOnnxObjectHistory *history = lost_histories[i].get ();
+      guint idx = batch->frames.size ();
+
+      {
+        gstnvinfer::StripeGuard locker (*nvinfer->history_locks, history);
+        shots.push_back (take_best_shot (nvinfer, history));
+        history->under_inference = TRUE;
+        history->last_inferred_frame_num = history->last_accessed_frame_num;
+        frame.frame_num = history->last_accessed_frame_num;
+      }
+      (*nvinfer->source_info)[frame.source_id].best_shot_pending.erase
+          (frame.object_id);
+
+      std::vector<guint8> &crop = *shots.back ().crop;
+      memcpy (memory->frame_host_ptrs[idx], crop.data (),
+          MIN (crop.size (), memory->surf->surfaceList[idx].dataSize));
+#ifdef IS_TEGRA
+      NvBufSurfaceSyncForDevice (memory->surf, idx, 0);
+#endif
+      frame.best_shot_score = shots.back ().score;
+      frame.converted_frame_ptr = memory->frame_memory_ptrs[idx];
+      batch->frames.push_back (frame);
+    }
+
+    if (!convert_batch_and_push_to_input_thread (nvinfer, batch.get (), memory)) {
+      for (guint i = 0; i < batch->frames.size (); i++) {
+        GstNvInferOnnxFrame &frame = batch->frames[i];
+        std::shared_ptr<GstNvInferOnnxObjectHistory> &history =
+            lost_histories[start + i];
+        {
+          gstnvinfer::StripeGuard locker (*nvinfer->history_locks,
+              history.get ());
+          put_back_best_shot (nvinfer, history.get (), shots[i]);
+        }
+        (*nvinfer->source_info)[frame.source_id].best_shot_pending.emplace
+            (frame.object_id, history);
+      }
+      gst_buffer_unref (conv_gst_buf);
+      return GST_FLOW_ERROR;
+    }
+    batch.release ();
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* Inference budget. Rank the objects of the buffer that will be inferred on
+ * by priority and collect the ones within the budget in scheduled. See
+ * GstNvInferOnnxInferBudget. */
+static void
+schedule_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
+    NvDsBatchMeta * batch_meta, NvBufSurface * in_surf,
+    std::unordered_set<const void *> & scheduled)
+{
+  const GstNvInferOnnxInferBudget &budget = nvinfer->infer_budget;
+  std::vector<gstnvinfer::ObjectScheduler::Candidate> candidates;
+  std::vector<NvDsFaceLandmarksMeta> frame_faces;
+  NvDsMetaType landmarks_meta_type = NVDS_FACE_LANDMARKS_META;
+  NvDsMetaType frame_landmarks_meta_type = NVDS_USER_FRAME_META_EXAMPLE;
+  gfloat interval = MAX (nvinfer->secondary_reinfer_interval, 1);
+
+  for (NvDsMetaList * l_frame = batch_meta->frame_meta_list; l_frame != NULL;
+      l_frame = l_frame->next) {
+    NvDsFrameMeta *frame_meta = (NvDsFrameMeta *) (l_frame->data);
+    auto iter = nvinfer->source_info->find (frame_meta->pad_index);
+    if (iter == nvinfer->source_info->end ())
+      continue;
+    GstNvInferOnnxSourceInfo &source_info = iter->second;
+    NvBufSurfaceParams *surf = in_surf->surfaceList + frame_meta->batch_id;
+    gfloat frame_area = (gfloat) surf->width * surf->height;
+
+    collect_frame_landmarks (frame_meta, frame_landmarks_meta_type,
+        frame_faces);
+
+    for (NvDsMetaList * l_obj = frame_meta->obj_meta_list; l_obj != NULL;
+        l_obj = l_obj->next) {
+      NvDsObjectMeta *object_meta = (NvDsObjectMeta *) (l_obj->data);
+      std::shared_ptr<GstNvInferOnnxObjectHistory> history;
+      gulong frame_num = frame_meta->frame_num;
+      GstNvInferOnnxObjectPlan plan;
+
+      if (object_meta->object_id != UNTRACKED_OBJECT_ID) {
+        auto search = source_info.object_history_map.find (
+            object_meta->object_id);
+        if (search != source_info.object_history_map.end ())
+          history = search->second;
+      } else if (nvinfer->classifier_async_mode) {
+        continue;
+      }
+      gstnvinfer::StripeGuard locker (*nvinfer->history_locks, history.get ());
+
+      if (!should_infer_object (nvinfer, inbuf, object_meta, frame_num,
+              history.get ()) ||
+          plan_object (nvinfer, surf, object_meta, frame_num,
+              landmarks_meta_type, frame_faces, history.get (),
+              object_meta->object_id != UNTRACKED_OBJECT_ID,
+              &plan) != OBJECT_INFER)
+        continue;
+
+      /* Tracks never inferred on count as due for one reinfer interval. */
+      gulong last_inferred = history ? history->last_inferred_frame_num : 0;
+      gfloat priority = history ? 0 : budget.weight_new;
+      priority += budget.weight_staleness * (last_inferred ?
+          (frame_num - last_inferred) / interval : 1);
+      locker.unlock ();
+
+      if (budget.weight_size > 0 && frame_area > 0)
+        priority += budget.weight_size * sqrtf (object_meta->rect_params.width *
+            object_meta->rect_params.height / frame_area);
+
+      mirror::FaceGeometry geometry;
+      if (budget.weight_quality > 0 && object_meta->rect_params.width > 0 &&
+          plan.have_face &&
+          mirror::MeasureFaceGeometry (plan.landmarks_x, plan.landmarks_y,
+              &geometry))
+        priority += budget.weight_quality * MIN (1.0f,
+            mirror::FaceQualityScore (geometry) /
+            object_meta->rect_params.width);
+
+      candidates.push_back ({object_meta, priority, frame_meta->pad_index});
+    }
+  }
+
+  size_t count = nvinfer->scheduler->select (candidates,
+      g_get_monotonic_time ());
+  for (size_t i = 0; i < count; i++)
+    scheduled.insert (candidates[i].key);
+}
+
 /* Process on objects detected by upstream detectors.
  *
  * Secondary classifiers can work in asynchronous mode as well. In this mode,
@@ -1552,12 +3046,30 @@ static GstFlowReturn
 gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
     NvBufSurface * in_surf)
 {
-  std::unique_ptr<GstNvInferOnnxBatch> batch (nullptr);
+  /* A batch taken back from the input queue is closed, not freed, if it is
+   * not queued again. */
+  auto release_batch = [nvinfer] (GstNvInferOnnxBatch * b) {
+    if (b->accumulate)
+      close_open_batch (nvinfer);
+    else
+      delete b;
+  };
+  std::unique_ptr<GstNvInferOnnxBatch, decltype (release_batch)>
+      batch (nullptr, release_batch);
   GstBuffer *conv_gst_buf = nullptr;
   GstNvInferOnnxMemory *memory = nullptr;
   GstFlowReturn flow_ret;
   gdouble scale_ratio_x, scale_ratio_y;
   gboolean warn_untracked_object = FALSE;
+  /* Faces of the current batch waiting to be aligned. */
+  std::vector<GstNvInferOnnxAlignJob> align_jobs;
+  /* Landmarks of the current frame attached at frame level. */
+  std::vector<NvDsFaceLandmarksMeta> frame_faces;
+  NvDsMetaType landmarks_meta_type = NVDS_FACE_LANDMARKS_META;
+  NvDsMetaType frame_landmarks_meta_type = NVDS_USER_FRAME_META_EXAMPLE;
+  /* Inference budget. Objects picked to be inferred on in this buffer. */
+  std::unordered_set<const void *> scheduled;
+  gboolean use_budget = nvinfer->scheduler->enabled ();
 
   NvDsBatchMeta *batch_meta = gst_buffer_get_nvds_batch_meta (inbuf);
   if (batch_meta == nullptr) {
@@ -1566,6 +3078,20 @@ gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
     return GST_FLOW_ERROR;
   }
 
+  if (use_budget)
+    schedule_objects (nvinfer, inbuf, batch_meta, in_surf, scheduled);
+
+  /* Batch accumulation. Continue the batch of the previous input buffers if
+   * it is still open. It keeps their input buffer as inbuf, which is not
+   * pushed downstream before the batch is processed. */
+  if (nvinfer->batch_accumulate_us > 0) {
+    batch.reset (take_open_batch (nvinfer));
+    if (batch) {
+      conv_gst_buf = batch->conv_buf;
+      memory = gst_nvinfer_buffer_get_memory (conv_gst_buf);
+    }
+  }
+
   for (NvDsMetaList * l_frame = batch_meta->frame_meta_list; l_frame != NULL;
       l_frame = l_frame->next) {
     NvDsFrameMeta *frame_meta = (NvDsFrameMeta *) (l_frame->data);
@@ -1584,6 +3110,9 @@ gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
     }
     source_info->last_seen_frame_num = frame_meta->frame_num;
 
+    collect_frame_landmarks (frame_meta, frame_landmarks_meta_type,
+        frame_faces);
+
     /* Iterate through all the objects. */
     for (NvDsMetaList * l_obj = frame_meta->obj_meta_list; l_obj != NULL;
         l_obj = l_obj->next) {
@@ -1591,6 +3120,15 @@ gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
       guint idx;
       std::shared_ptr<GstNvInferOnnxObjectHistory> obj_history;
       gulong frame_num = frame_meta->frame_num;
+      GstNvInferOnnxObjectPlan plan;
+      GstNvInferOnnxObjectAction action = OBJECT_INFER;
+      gboolean tracked = source_info != nullptr &&
+          object_meta->object_id != UNTRACKED_OBJECT_ID;
+      gulong prev_inferred_frame_num = 0;
+      NvOSD_RectParams prev_inferred_coords = {0};
+      GstNvInferOnnxBestShotAction best_shot = BEST_SHOT_NONE;
+      GstNvInferOnnxBestShot best_shot_crop = { 0 };
+      gfloat embedding_weight = 1;
 
       /* Cannot infer on untracked objects in asynchronous mode. */
       if (nvinfer->classifier_async_mode && object_meta->object_id == UNTRACKED_OBJECT_ID) {
@@ -1608,9 +3146,9 @@ gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
         continue;
       }
 
-      LockGMutex locker (nvinfer->process_lock);
-
-      /* Find the object history if it exists only when tracking id is valid. */
+      /* Find the object history if it exists only when tracking id is valid.
+       * The map is only used by this thread, the history is shared with the
+       * output thread and is only used with its lock held. */
       if (source_info != nullptr && object_meta->object_id != UNTRACKED_OBJECT_ID) {
         auto search =
             source_info->object_history_map.find (object_meta->object_id);
@@ -1618,13 +3156,33 @@ gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
           obj_history = search->second;
         }
       }
+      gstnvinfer::StripeGuard locker (*nvinfer->history_locks,
+          obj_history.get ());
 
       bool needs_infer = should_infer_object (nvinfer, inbuf, object_meta, frame_num,
               obj_history.get());
+      if (needs_infer)
+        action = plan_object (nvinfer, in_surf->surfaceList +
+            frame_meta->batch_id, object_meta, frame_num,
+            landmarks_meta_type, frame_faces, obj_history.get (), tracked,
+            &plan);
+      /* Inference budget. Objects over the budget are handled like the ones
+       * not due, they keep their previous results until a later frame. Only
+       * objects to be inferred on are scheduled. */
+      if (needs_infer && action == OBJECT_INFER && use_budget &&
+          !scheduled.count (object_meta))
+        needs_infer = false;
       if (!needs_infer) {
         /* Should not infer again. */
 
-        if (IS_CLASSIFIER_INSTANCE (nvinfer) && obj_history != nullptr) {
+        /* Stable, locked and best-shot recognised tracks keep their
+         * aggregate and their matches. */
+        gboolean has_results = IS_EMBEDDING_INSTANCE (nvinfer) &&
+            obj_history != nullptr && (!obj_history->embedding_mean.empty () ||
+            obj_history->identity_locked || obj_history->best_shot_done);
+
+        if ((IS_CLASSIFIER_INSTANCE (nvinfer) && obj_history != nullptr) ||
+            has_results) {
           /* Working in synchronous mode. Defer attachment of classifier metadata
            * in the object history to the output thread. */
           if (!nvinfer->classifier_async_mode) {
@@ -1675,6 +3233,39 @@ gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
         continue;
       }
 
+      /* In alignment mode objects can only be inferred on if their landmarks
+       * are available, yield a usable alignment transform and pass the
+       * geometry gate. */
+      if (action == OBJECT_NO_FACE) {
+        continue;
+      }
+      if (action == OBJECT_REJECTED_GEOMETRY) {
+        nvinfer->face_stats->faces_rejected_geometry++;
+        continue;
+      }
+
+      /* Embedding aggregation. Aligned faces weigh in with their quality
+       * score. */
+      if (nvinfer->embedding_aggregate && nvinfer->align_faces) {
+        mirror::FaceGeometry geometry;
+        embedding_weight = mirror::MeasureFaceGeometry (plan.landmarks_x,
+            plan.landmarks_y, &geometry) ?
+            mirror::FaceQualityScore (geometry) : 0;
+      }
+
+      /* Best-shot mode. Tracked faces are captured while their score improves
+       * and recognised once on the best of them. */
+      if (nvinfer->best_shot_count > 0 && tracked) {
+        best_shot_crop.score = plan.best_shot_score;
+        if (action == OBJECT_HOLD) {
+          if (obj_history)
+            obj_history->last_accessed_frame_num = frame_num;
+          continue;
+        }
+        best_shot = action == OBJECT_CAPTURE ? BEST_SHOT_CAPTURE :
+            BEST_SHOT_RECOGNISE;
+      }
+
       /* Object has a valid tracking id but does not have any history. Create
        * an entry in the map for the object. */
       if (source_info != nullptr && object_meta->object_id != UNTRACKED_OBJECT_ID &&
@@ -1683,10 +3274,37 @@ gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
             source_info->object_history_map.emplace (object_meta->object_id,
             std::make_shared<GstNvInferOnnxObjectHistory> ());
         obj_history = ret_iter.first->second;
+        locker.lock (obj_history.get ());
+      }
+
+      /* Best-shot mode. Captures leave the inference history alone. */
+      if (best_shot == BEST_SHOT_CAPTURE) {
+        obj_history->last_accessed_frame_num = frame_num;
+        source_info->best_shot_pending.emplace (object_meta->object_id,
+            obj_history);
+      } else if (best_shot == BEST_SHOT_RECOGNISE) {
+        best_shot_crop = take_best_shot (nvinfer, obj_history.get ());
+        source_info->best_shot_pending.erase (object_meta->object_id);
+      }
+
+      /* Alignment cache. Reuse the cached crop, or realign and remember the
+       * landmarks the new crop is computed from. */
+      if (plan.align_cached) {
+        best_shot_crop.crop = obj_history->align_cache_crop;
+        nvinfer->face_stats->align_cache_hits++;
+      } else if (plan.align_cache) {
+        memcpy (obj_history->align_cache_x, plan.landmarks_x,
+            sizeof (plan.landmarks_x));
+        memcpy (obj_history->align_cache_y, plan.landmarks_y,
+            sizeof (plan.landmarks_y));
+        obj_history->align_cache_crop.reset ();
+        nvinfer->face_stats->align_cache_misses++;
       }
 
       /* Update the object history if it is found. */
-      if (obj_history != nullptr) {
+      if (obj_history != nullptr && best_shot != BEST_SHOT_CAPTURE) {
+        prev_inferred_frame_num = obj_history->last_inferred_frame_num;
+        prev_inferred_coords = obj_history->last_inferred_coords;
         obj_history->under_inference = TRUE;
         obj_history->last_inferred_frame_num = frame_num;
         obj_history->last_accessed_frame_num = frame_num;
@@ -1716,39 +3334,63 @@ gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
         batch->conv_buf = conv_gst_buf;
       }
       idx = batch->frames.size ();
+      if (nvinfer->align_faces) {
+        /* Queue the face to be warped straight into the network input memory
+         * once the batch is complete. */
+        GstNvInferOnnxAlignJob job;
+        job.batch_id = frame_meta->batch_id;
+        job.idx = idx;
+        job.face_rect = plan.face_rect;
+        memcpy (job.face_transform, plan.face_transform,
+            sizeof (job.face_transform));
+        job.rejected = FALSE;
+        job.prev_inferred_frame_num = prev_inferred_frame_num;
+        job.prev_inferred_coords = prev_inferred_coords;
+        job.capture = best_shot == BEST_SHOT_CAPTURE;
+        job.score = best_shot_crop.score;
+        job.crop = best_shot_crop.crop;
+        job.cache_crop = plan.align_cache && !plan.align_cached;
+        align_jobs.push_back (job);
+
+        scale_ratio_x =
+            (gdouble) nvinfer->network_width / object_meta->rect_params.width;
+        scale_ratio_y =
+            (gdouble) nvinfer->network_height / object_meta->rect_params.height;
+      } else {
+        /* Outside of alignment mode faces are only aligned (with OpenCV) to
+         * be dumped. */
         gdouble ratio = 1;
-        gint width = object_meta->rect_params.width;
-        gint height = object_meta->rect_params.height;
-        if (get_converted_mat (nvinfer,in_surf, idx, &object_meta->rect_params,ratio, width,height) != GST_FLOW_OK) {
-            continue;
+        if (plan.have_face && g_atomic_int_get (&nvinfer->debug_dump) &&
+            nvinfer->debug_dumper && get_converted_mat (nvinfer, in_surf,
+                frame_meta->batch_id, &plan.face_rect, ratio,
+                plan.face_rect.width, plan.face_rect.height) == GST_FLOW_OK) {
+          std::vector<cv::Point2f> landmarks;
+          for (int i = 0; i < mirror::kNumLandmarks; i++) {
+            landmarks.emplace_back (
+                (plan.landmarks_x[i] - plan.face_rect.left) * ratio,
+                (plan.landmarks_y[i] - plan.face_rect.top) * ratio);
+          }
+          cv::Mat faceAligned;
+          if (nvinfer->aligner.AlignFace (*nvinfer->cvmat, landmarks,
+                  &faceAligned) == 0) {
+            gstnvinfer::DebugDump::Image image = {
+              frame_meta->pad_index, object_meta->object_id, frame_num,
+              faceAligned.cols, faceAligned.rows, (gint) faceAligned.step,
+              gstnvinfer::DebugDump::Layout::BGR, faceAligned.data };
+            nvinfer->debug_dumper->submit (image);
+          }
         }
-        NvDsUserMeta *user_meta = NULL;
-        gint16 *user_meta_data = NULL;
-        std::vector<cv::Point2f> landmarks;
-        for (NvDsMetaList *l_user_meta = frame_meta->frame_user_meta_list; l_user_meta != NULL; l_user_meta = l_user_meta->next) {
-            user_meta = (NvDsUserMeta *) (l_user_meta->data);
-            if(user_meta->base_meta.meta_type == NVDS_USER_FRAME_META_EXAMPLE)
-            {
-                user_meta_data = (gint16 *)user_meta->user_meta_data;
-                for(int i = 0; i < 5; i++) {
-                    cv::Point2f p1 = cv::Point(cv::Point((float)user_meta_data[i*2] - object_meta->rect_params.left, (float)user_meta_data[i*2+1] - object_meta->rect_params.top));
-                    landmarks.emplace_back(p1);
-                    cv::circle(*nvinfer->cvmat, cv::Point((float)user_meta_data[i*2] - object_meta->rect_params.left, (float)user_meta_data[i*2+1] - object_meta->rect_params.top), 2, cv::Scalar(255, 0, 0), 2);
-                }
-            }
+
+        /* Crop, scale and convert the buffer. */
+        if (get_converted_buffer (nvinfer, in_surf,
+                in_surf->surfaceList + frame_meta->batch_id,
+                &object_meta->rect_params, memory->surf,
+                memory->surf->surfaceList + idx, scale_ratio_x, scale_ratio_y,
+                memory->frame_memory_ptrs[idx]) != GST_FLOW_OK) {
+          GST_ELEMENT_ERROR (nvinfer, STREAM, FAILED,
+              ("Buffer conversion failed"), (NULL));
+          return GST_FLOW_ERROR;
         }
-        cv::Mat faceAligned;
-        nvinfer->aligner.AlignFace(*nvinfer->cvmat, landmarks, &faceAligned);
-        cv::imwrite("/mnt/hdd/CLionProjects/face_ds/a.png", faceAligned);
-      /* Crop, scale and convert the buffer. */
-      if (get_converted_buffer (nvinfer, in_surf,
-              in_surf->surfaceList + frame_meta->batch_id,
-              &object_meta->rect_params, memory->surf,
-              memory->surf->surfaceList + idx, scale_ratio_x, scale_ratio_y,
-              memory->frame_memory_ptrs[idx]) != GST_FLOW_OK) {
-        GST_ELEMENT_ERROR (nvinfer, STREAM, FAILED,
-            ("Buffer conversion failed"), (NULL));
-        return GST_FLOW_ERROR;
       }
 
       /* Adding a frame to the current batch. Set the frames members. */
@@ -1764,18 +3406,31 @@ gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
       frame.input_surf_params =
           (nvinfer->classifier_async_mode) ? nullptr : (in_surf->surfaceList +
           frame_meta->batch_id);
+      frame.source_id = frame_meta->pad_index;
+      frame.object_id = object_meta->object_id;
+      frame.embedding_weight = embedding_weight;
+      if (best_shot == BEST_SHOT_RECOGNISE) {
+        frame.best_shot = TRUE;
+        frame.best_shot_score = best_shot_crop.score;
+      }
       batch->frames.push_back (frame);
 
       /* Submit batch if the batch size has reached max_batch_size. */
       if (batch->frames.size () == nvinfer->max_batch_size) {
-      if (!convert_batch_and_push_to_input_thread (nvinfer, batch.get(), memory)) {
+      if (align_batch_faces (nvinfer, in_surf, batch.get (), memory,
+              align_jobs) != GST_FLOW_OK) {
+        return GST_FLOW_ERROR;
+      }
+      /* Faces dropped by the quality gate made room for more objects. */
+      if (batch->frames.size () < nvinfer->max_batch_size)
+        continue;
+      if (!queue_object_batch (nvinfer, batch.get (), memory, FALSE)) {
         return GST_FLOW_ERROR;
       }
       /* Batch submitted. Set batch to nullptr so that a new GstNvInferOnnxBatch
        * structure can be allocated if required. */
       batch.release ();
       conv_gst_buf = nullptr;
-      nvinfer->tmp_surf.numFilled = 0;
       }
     }
   }
@@ -1785,15 +3440,33 @@ gst_nvinfer_process_objects (GstNvInferOnnx * nvinfer, GstBuffer * inbuf,
     /* No frames to infer in this batch. It might contain objects that
      * have been deferred for classification metadata attachment. Return
      * intermediate memory to pool. */
+    if (align_batch_faces (nvinfer, in_surf, batch.get (), memory,
+            align_jobs) != GST_FLOW_OK) {
+      return GST_FLOW_ERROR;
+    }
+
     if (batch->frames.size() == 0)
       gst_buffer_unref (batch->conv_buf);
 
-    if (!convert_batch_and_push_to_input_thread (nvinfer, batch.get(), memory)) {
+    /* Batch accumulation. Leave room for the objects of the next input
+     * buffers until the deadline of the batch. */
+    gboolean keep_open = nvinfer->batch_accumulate_us > 0 &&
+        batch->frames.size () > 0 &&
+        batch->frames.size () < nvinfer->max_batch_size &&
+        (!batch->accumulate ||
+            std::chrono::steady_clock::now () < batch->accumulate_deadline);
+
+    if (!queue_object_batch (nvinfer, batch.get (), memory, keep_open)) {
       return GST_FLOW_ERROR;
     }
     conv_gst_buf = nullptr;
     batch.release ();
-    nvinfer->tmp_surf.numFilled = 0;
+  }
+
+  if (nvinfer->best_shot_count > 0) {
+    flow_ret = recognise_lost_best_shots (nvinfer);
+    if (flow_ret != GST_FLOW_OK)
+      return flow_ret;
   }
 
   if (nvinfer->current_batch_num -
@@ -1897,10 +3570,7 @@ gst_nvinfer_submit_input_buffer (GstBaseTransform * btrans,
     buf_push_batch->push_buffer = TRUE;
     buf_push_batch->nvtx_complete_buf_range = buf_process_range;
 
-    g_mutex_lock (&nvinfer->process_lock);
-    g_queue_push_tail (nvinfer->input_queue, buf_push_batch);
-    g_cond_broadcast (&nvinfer->process_cond);
-    g_mutex_unlock (&nvinfer->process_lock);
+    nvinfer->input_queue->push (buf_push_batch);
   }
 
   return GST_FLOW_OK;
@@ -1973,6 +3643,235 @@ gst_nvinfer_tensoroutput_free (GstMiniObject * obj)
   delete output_obj;
 }
 
+/* Embedding aggregation. Add the embedding of every tracked object of the
+ * batch to the aggregate of its track and return the normalised aggregate as
+ * the embedding of the object in embeddings[i], stored in aggregates.
+ * Frames without a history or without any weighted embedding yet keep
+ * their own embedding. Takes the lock of every history. */
+static void
+aggregate_embeddings (GstNvInferOnnx * nvinfer, GstNvInferOnnxBatch * batch,
+    NvDsInferContextBatchOutput * batch_output,
+    std::vector<gfloat> & aggregates,
+    std::vector<NvDsInferEmbeddingOutput> & embeddings)
+{
+  guint num_frames = batch->frames.size ();
+  guint length = num_frames ?
+      batch_output->frames[0].embeddingOutput.length : 0;
+
+  aggregates.resize ((gsize) num_frames * length);
+  for (guint i = 0; i < num_frames; i++) {
+    GstNvInferOnnxFrame & frame = batch->frames[i];
+    NvDsInferEmbeddingOutput &output = batch_output->frames[i].embeddingOutput;
+    auto history = frame.history.lock ();
+    gstnvinfer::StripeGuard locker (*nvinfer->history_locks, history.get ());
+
+    embeddings[i] = output;
+    if (!history || output.length != length)
+      continue;
+
+    /* First embedding of the track, or the network output size changed with
+     * a model update. */
+    if (history->embedding_sum.size () != length) {
+      history->embedding_sum.assign (length, 0);
+      history->embedding_weight = 0;
+      history->embedding_count = 0;
+    }
+
+    if (frame.embedding_weight > 0) {
+      for (guint j = 0; j < length; j++)
+        history->embedding_sum[j] += frame.embedding_weight * output.vector[j];
+      history->embedding_weight += frame.embedding_weight;
+      history->embedding_count++;
+    }
+    if (history->embedding_weight <= 0)
+      continue;
+
+    /* The variance of unit vectors around their mean m is 1 - |m|^2. */
+    gfloat *mean = aggregates.data () + (gsize) i * length;
+    for (guint j = 0; j < length; j++)
+      mean[j] = history->embedding_sum[j] / history->embedding_weight;
+    history->embedding_norm = mirror::L2Normalize (mean, mean, length);
+    history->embedding_mean.assign (mean, mean + length);
+    history->embedding_done = nvinfer->embedding_aggregate_max_variance > 0 &&
+        history->embedding_count >= nvinfer->embedding_aggregate_min_count &&
+        1 - history->embedding_norm * history->embedding_norm <=
+        nvinfer->embedding_aggregate_max_variance;
+
+    embeddings[i].vector = mean;
+    embeddings[i].norm = history->embedding_norm;
+  }
+}
+
+/* Search the face gallery for the embedding of every frame of the batch.
+ * The matches of frame i are returned in matches[i] as classification
+ * results: one attribute per match, best first, with the identity as the
+ * value and the cosine similarity as the confidence. Without an index, all
+ * embeddings are searched in one pass over the gallery. For identity lock-in,
+ * margins[i] is set to how far the best match of frame i beats the
+ * runner-up, or gallery-min-score when there is no runner-up. */
+static void
+match_gallery (GstNvInferOnnx * nvinfer,
+    const gstnvinfer::GalleryLoader::VersionPtr & gallery,
+    const std::vector<NvDsInferEmbeddingOutput> & embeddings,
+    std::vector<GstNvInferOnnxObjectInfo> & matches,
+    std::vector<gfloat> & margins)
+{
+  guint num_frames = embeddings.size ();
+  guint dim = gallery->gallery->dim ();
+  guint top_k = nvinfer->gallery_top_k;
+  /* The runner-up is needed for the margin even if it is not attached. */
+  guint search_k = nvinfer->gallery_lock_margin > 0 ? MAX (top_k, 2) : top_k;
+  std::vector<gfloat> queries ((gsize) num_frames * dim, 0);
+  std::vector<gstnvinfer::Gallery::Match> found ((gsize) num_frames * search_k);
+  std::vector<guint> num_found (num_frames);
+
+  for (guint i = 0; i < num_frames; i++) {
+    memcpy (queries.data () + (gsize) i * dim, embeddings[i].vector,
+        MIN (embeddings[i].length, dim) * sizeof (gfloat));
+  }
+
+  if (gallery->hnsw) {
+    /* The index visits few vectors per query, there is nothing to share
+     * between the frames. */
+    auto search_frame = [&] (guint, guint i) -> bool {
+      num_found[i] = gallery->hnsw->search (
+          queries.data () + (gsize) i * dim, search_k,
+          nvinfer->gallery_hnsw_ef, nvinfer->gallery_min_score,
+          found.data () + (gsize) i * search_k);
+      return true;
+    };
+    if (nvinfer->gallery_pool) {
+      nvinfer->gallery_pool->run (num_frames, search_frame);
+    } else {
+      for (guint i = 0; i < num_frames; i++)
+        search_frame (0, i);
+    }
+  } else if (gallery->ivfpq) {
+    gallery->ivfpq->searchBatch (queries.data (), num_frames, search_k,
+        nvinfer->gallery_ivfpq_nprobe, nvinfer->gallery_ivfpq_rerank,
+        nvinfer->gallery_min_score,
+        nvinfer->gallery_ivfpq_rerank ? gallery->gallery.get () : nullptr,
+        found.data (), num_found.data (), nvinfer->gallery_pool);
+  } else {
+    gallery->gallery->searchBatch (queries.data (), num_frames, search_k,
+        nvinfer->gallery_min_score, found.data (), num_found.data (),
+        nvinfer->gallery_pool);
+  }
+
+  matches.resize (num_frames);
+  margins.resize (num_frames);
+  for (guint i = 0; i < num_frames; i++) {
+    GstNvInferOnnxObjectInfo &info = matches[i];
+    const gstnvinfer::Gallery::Match *frame_found =
+        found.data () + (gsize) i * search_k;
+    info.attributes.clear ();
+    info.label.clear ();
+    info.gallery = gallery;
+
+    margins[i] = 0;
+    if (num_found[i] > 0) {
+      margins[i] = frame_found[0].score - (num_found[i] > 1 ?
+          frame_found[1].score : nvinfer->gallery_min_score);
+    }
+
+    for (guint k = 0; k < MIN (num_found[i], top_k); k++) {
+      NvDsInferAttribute attr;
+      attr.attributeIndex = k;
+      attr.attributeValue = frame_found[k].id;
+      attr.attributeConfidence = frame_found[k].score;
+      attr.attributeLabel = frame_found[k].label;
+      info.attributes.push_back (attr);
+    }
+    if (num_found[i] > 0)
+      info.label = frame_found[0].label;
+  }
+}
+
+/* Identity lock-in. Count the inferences in a row on which the track
+ * matched the same identity by at least gallery-lock-margin, lock the track
+ * once there are gallery-lock-confirmations of them and unlock it on the
+ * first inference that does not confirm the identity. Must be called with
+ * the lock of the history held. */
+static void
+update_identity_lock (GstNvInferOnnx * nvinfer,
+    GstNvInferOnnxObjectHistory * history,
+    const GstNvInferOnnxObjectInfo & matches, gfloat margin, gulong frame_num)
+{
+  if (matches.attributes.empty () || margin < nvinfer->gallery_lock_margin) {
+    history->identity_confirmations = 0;
+    history->identity_locked = FALSE;
+    return;
+  }
+
+  guint32 id = matches.attributes[0].attributeValue;
+  if (history->identity_confirmations > 0 && history->identity_id == id) {
+    history->identity_confirmations++;
+  } else {
+    history->identity_id = id;
+    history->identity_confirmations = 1;
+    history->identity_locked = FALSE;
+  }
+
+  if (history->identity_confirmations >= nvinfer->gallery_lock_confirmations) {
+    history->identity_locked = TRUE;
+    history->identity_locked_frame_num = frame_num;
+  }
+}
+
+/* Best-shot mode. Message announcing that a track was recognised on its
+ * best crop. Embedding networks have no classifier label, their message
+ * carries the best gallery match instead, if any. */
+static GstMessage *
+new_best_shot_message (GstNvInferOnnx * nvinfer,
+    const GstNvInferOnnxFrame & frame, const gchar * label,
+    const GstNvInferOnnxObjectInfo * match)
+{
+  GstStructure *structure = gst_structure_new ("nvinfer-best-shot",
+      "source-id", G_TYPE_UINT, frame.source_id,
+      "object-id", G_TYPE_UINT64, frame.object_id,
+      "label", G_TYPE_STRING, label,
+      "score", G_TYPE_FLOAT, frame.best_shot_score,
+      "lost", G_TYPE_BOOLEAN, frame.best_shot_lost, nullptr);
+
+  if (match && !match->attributes.empty ()) {
+    const NvDsInferAttribute &best = match->attributes[0];
+    gst_structure_set (structure,
+        "gallery-id", G_TYPE_UINT, best.attributeValue,
+        "gallery-label", G_TYPE_STRING, match->label.c_str (),
+        "gallery-score", G_TYPE_FLOAT, best.attributeConfidence, nullptr);
+  }
+  return gst_message_new_element (GST_OBJECT (nvinfer), structure);
+}
+
+/* Attach the latest available results to the objects of the batch that
+ * were not inferred on: the cached classification of classifiers, or the
+ * aggregated embedding and the cached gallery matches of embedding
+ * networks. */
+static void
+attach_pending_metadata (GstNvInferOnnx * nvinfer, GstNvInferOnnxBatch * batch)
+{
+  for (auto &hist : batch->objs_pending_meta_attach) {
+    GstNvInferOnnxFrame frame;
+    frame.obj_meta = hist.second;
+    auto obj_history = hist.first.lock ();
+    gstnvinfer::StripeGuard locker (*nvinfer->history_locks,
+        obj_history.get ());
+
+    if (IS_EMBEDDING_INSTANCE (nvinfer)) {
+      NvDsInferEmbeddingOutput aggregate = {
+        obj_history->embedding_mean.data (),
+        (unsigned int) obj_history->embedding_mean.size (),
+        obj_history->embedding_norm };
+      if (!obj_history->embedding_mean.empty ())
+        attach_metadata_embedding (nvinfer, frame, aggregate);
+      if (!nvinfer->gallery_loader)
+        continue;
+    }
+    attach_metadata_classifier (nvinfer, nullptr, frame,
+        obj_history->cached_info);
+  }
+}
+
 /**
  * Output loop used to pop output from inference, attach the output to the
  * buffer in form of NvDsMeta and push the buffer to downstream element.
@@ -1990,24 +3889,28 @@ gst_nvinfer_output_loop (gpointer data)
   eventAttrib.color = 0xFFFF0000;
   eventAttrib.messageType = NVTX_MESSAGE_TYPE_ASCII;
   std::string nvtx_str;
+  std::vector<GstMessage *> best_shot_msgs;
+  std::vector<GstNvInferOnnxObjectInfo> gallery_matches;
+  std::vector<gfloat> gallery_margins;
+  std::vector<gfloat> embedding_aggregates;
+  std::vector<NvDsInferEmbeddingOutput> embeddings;
 
   nvtx_str = "gst-nvinfer_output-loop_uid=" + std::to_string(nvinfer->unique_id);
 
-  LockGMutex locker (nvinfer->process_lock);
-  /* Run till signalled to stop. */
-  while (!nvinfer->stop) {
+  /* Run till the process queue is closed. The object histories are shared
+   * with the streaming thread and are only used with their lock held. */
+  while (TRUE) {
     std::unique_ptr<GstNvInferOnnxBatch> batch = nullptr;
     NvDsInferContextBatchOutput *batch_output = nullptr;
 
-    /* Wait if processing queue is empty. */
-    if (g_queue_is_empty (nvinfer->process_queue)) {
-      locker.wait (nvinfer->process_cond);
-      continue;
-    }
+    /* Wait for a batch. */
+    batch.reset ((GstNvInferOnnxBatch *) nvinfer->process_queue->front ());
+    if (batch)
+      nvinfer->process_queue->pop ();
 
-    /* Pop a batch from the element's process queue. */
-    batch.reset ((GstNvInferOnnxBatch *) g_queue_pop_head (nvinfer->process_queue));
-    g_cond_broadcast (&nvinfer->process_cond);
+    /* The queue is closed and empty, the element is stopping. */
+    if (!batch)
+      break;
 
     /* Event marker used for synchronization. No need to process further. */
     if (batch->event_marker) {
@@ -2017,18 +3920,10 @@ gst_nvinfer_output_loop (gpointer data)
     /* Attach latest available classification metadata for objects that have
      * not been inferred on in the current frame. */
     if (batch->frames.size() == 0 && !batch->push_buffer) {
-      for (auto &hist : batch->objs_pending_meta_attach) {
-        GstNvInferOnnxFrame frame;
-        frame.obj_meta = hist.second;
-        std::weak_ptr<GstNvInferOnnxObjectHistory> obj_history = hist.first;
-        attach_metadata_classifier (nvinfer, nullptr, frame,
-            obj_history.lock()->cached_info);
-      }
+      attach_pending_metadata (nvinfer, batch.get ());
       continue;
     }
 
-    locker.unlock ();
-
     /* Need to only push buffer to downstream element. This batch was not
      * actually submitted for inferencing. */
     if (batch->push_buffer) {
@@ -2056,7 +3951,6 @@ gst_nvinfer_output_loop (gpointer data)
         }
       }
       nvinfer->last_flow_ret = flow_ret;
-      locker.lock ();
       continue;
     }
 
@@ -2081,7 +3975,30 @@ gst_nvinfer_output_loop (gpointer data)
     /* Dequeue inferencing output from NvDsInferContext */
     status = nvdsinfer_ctx->dequeueOutputBatch (*batch_output);
 
-    locker.lock ();
+    /* Tracked objects are recognised on the aggregate of their track. */
+    if (status == NVDSINFER_SUCCESS && IS_EMBEDDING_INSTANCE (nvinfer)) {
+      embeddings.resize (batch->frames.size ());
+      if (nvinfer->embedding_aggregate) {
+        aggregate_embeddings (nvinfer, batch.get (), batch_output,
+            embedding_aggregates, embeddings);
+      } else {
+        for (guint i = 0; i < batch->frames.size (); i++)
+          embeddings[i] = batch_output->frames[i].embeddingOutput;
+      }
+    }
+
+    /* The batch is matched against the gallery version current now. A
+     * version published meanwhile, by this process or by another one sharing
+     * the gallery, is only used from the next batch on. */
+    gstnvinfer::GalleryLoader::VersionPtr gallery;
+    if (nvinfer->gallery_loader) {
+      nvinfer->gallery_loader->poll ();
+      gallery = nvinfer->gallery_loader->current ();
+    }
+
+    if (status == NVDSINFER_SUCCESS && gallery)
+      match_gallery (nvinfer, gallery, embeddings, gallery_matches,
+          gallery_margins);
 
     if (status != NVDSINFER_SUCCESS) {
       GST_ELEMENT_ERROR (nvinfer, STREAM, FAILED,
@@ -2119,6 +4036,8 @@ gst_nvinfer_output_loop (gpointer data)
       GstNvInferOnnxFrame & frame = batch->frames[i];
       NvDsInferFrameOutput &frame_output = batch_output->frames[i];
       auto obj_history = frame.history.lock ();
+      gstnvinfer::StripeGuard locker (*nvinfer->history_locks,
+          obj_history.get ());
 
       /* If we have an object's history and the buffer PTS is same as last
        * inferred PTS mark the object as not being inferred. This check could be
@@ -2153,31 +4072,58 @@ gst_nvinfer_output_loop (gpointer data)
          * the GstBuffer and the associated metadata are not valid here, since
          * the buffer is already pushed downstream. The metadata will be updated
          * in the input thread. */
-        if (nvinfer->classifier_async_mode == FALSE) {
+        if (nvinfer->classifier_async_mode == FALSE && frame.obj_meta) {
           attach_metadata_classifier (nvinfer, GST_MINI_OBJECT (tensor_out_object.get()),
                   frame, info);
         }
+
+        if (frame.best_shot) {
+          best_shot_msgs.push_back (new_best_shot_message (nvinfer, frame,
+                  info.label.c_str (), nullptr));
+        }
       } else if (IS_SEGMENTATION_INSTANCE (nvinfer)) {
         attach_metadata_segmentation (nvinfer, GST_MINI_OBJECT (tensor_out_object.get()),
             frame, frame_output.segmentationOutput);
+      } else if (IS_EMBEDDING_INSTANCE (nvinfer)) {
+        attach_metadata_embedding (nvinfer, frame, embeddings[i]);
+        /* Stable, locked and best-shot recognised tracks are attached these
+         * matches from now on. */
+        if (gallery && obj_history) {
+          if (nvinfer->embedding_aggregate || nvinfer->gallery_lock_margin > 0 ||
+              frame.best_shot)
+            obj_history->cached_info = gallery_matches[i];
+          if (nvinfer->gallery_lock_margin > 0)
+            update_identity_lock (nvinfer, obj_history.get (),
+                gallery_matches[i], gallery_margins[i], frame.frame_num);
+        }
+        if (gallery && (frame.obj_meta || nvinfer->process_full_frame)) {
+          attach_metadata_classifier (nvinfer, GST_MINI_OBJECT (tensor_out_object.get()),
+              frame, gallery_matches[i]);
+        }
+        if (frame.best_shot) {
+          best_shot_msgs.push_back (new_best_shot_message (nvinfer, frame, "",
+                  gallery ? &gallery_matches[i] : nullptr));
+        }
       }
     }
 
     /* Attach latest available classification metadata for objects that have
      * not been inferred on in the current frame. */
-    for (auto &hist : batch->objs_pending_meta_attach) {
-      GstNvInferOnnxFrame frame;
-      frame.obj_meta = hist.second;
-      std::weak_ptr<GstNvInferOnnxObjectHistory> obj_history = hist.first;
-      attach_metadata_classifier (nvinfer, nullptr, frame,
-          obj_history.lock()->cached_info);
-    }
+    attach_pending_metadata (nvinfer, batch.get ());
 
-    if (nvinfer->output_tensor_meta && !nvinfer->classifier_async_mode) {
+    /* Batches of lost best-shot tracks have no buffer to attach meta to. */
+    if (nvinfer->output_tensor_meta && !nvinfer->classifier_async_mode &&
+        batch->inbuf) {
       /* Attach the tensor output as meta. */
       attach_tensor_output_meta (nvinfer, GST_MINI_OBJECT(tensor_out_object.get()),
           batch.get(), batch_output);
     }
+
+    /* Post the results of best-shot recognition once no history lock is
+     * held, bus handlers may call back into the element. */
+    for (GstMessage *msg : best_shot_msgs)
+      gst_element_post_message (GST_ELEMENT (nvinfer), msg);
+    best_shot_msgs.clear ();
     nvtxDomainRangePop (nvinfer->nvtx_domain);
 
   }
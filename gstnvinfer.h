@@ -16,6 +16,7 @@
 #include <gst/video/video.h>
 #include <opencv2/opencv.hpp>
 
+#include <atomic>
 #include <set>
 #include <unordered_map>
 #include <vector>
@@ -31,6 +32,18 @@
 
 #include "nvtx3/nvToolsExt.h"
 #include "aligner.h"
+#include "aligner_kernels.h"
+#include "gstnvinfer_worker_pool.h"
+#include "gstnvinfer_debug_dump.h"
+#include "face_quality.h"
+#include "gstnvinfer_embedding_meta.h"
+#include "gstnvinfer_gallery.h"
+#include "gstnvinfer_gallery_loader.h"
+#include "gstnvinfer_hnsw.h"
+#include "gstnvinfer_ivfpq.h"
+#include "gstnvinfer_scheduler.h"
+#include "gstnvinfer_spsc_ring.h"
+#include "gstnvinfer_striped_lock.h"
 
 /* Package and library details required for plugin_init */
 #define PACKAGE "nvinferonnx"
@@ -76,6 +89,12 @@ enum
   PROP_OUTPUT_CALLBACK,
   PROP_OUTPUT_CALLBACK_USERDATA,
   PROP_OUTPUT_TENSOR_META,
+  PROP_ALIGN_WORKERS,
+  PROP_ALIGN_WORKER_CPUS,
+  PROP_STATS,
+  PROP_DEBUG_DUMP,
+  PROP_GALLERY_FILE,
+  PROP_GALLERY_DELTA_FILE,
   PROP_LAST
 };
 
@@ -84,6 +103,9 @@ enum {
   /* Signal emitted to notify app about model update completion with
    * success/error messages. */
   SIGNAL_MODEL_UPDATED,
+  /* Signal emitted to notify app about the completion of a gallery reload
+   * or delta. */
+  SIGNAL_GALLERY_UPDATED,
   LAST_SIGNAL,
 };
 
@@ -120,8 +142,24 @@ typedef struct {
   std::vector<NvDsInferAttribute> attributes;
   /** Cached string label. */
   std::string label;
+  /** Gallery version the attribute labels of gallery matches point into.
+   * Keeps the version alive while the matches are cached. */
+  gstnvinfer::GalleryLoader::VersionPtr gallery;
 } GstNvInferOnnxObjectInfo;
 
+/**
+ * Holds one aligned face crop kept in best-shot mode, in the layout of a
+ * network input slot.
+ */
+typedef struct
+{
+  /** Quality score of the face, see mirror::FaceQualityScore(). */
+  gfloat score;
+  /** Contents of the network input slot the face was aligned into. Shared
+   * with the batch the crop is recognised in. */
+  std::shared_ptr<std::vector<guint8>> crop;
+} GstNvInferOnnxBestShot;
+
 /**
  * Holds the inference information/history for one object based on it's
  * tracking id.
@@ -140,8 +178,125 @@ typedef struct _GstNvInferOnnxObjectHistory
   gulong last_accessed_frame_num;
   /** Cached object information. */
   GstNvInferOnnxObjectInfo cached_info;
+  /** Best-shot mode. Best aligned crops of the track so far, best first. */
+  std::vector<GstNvInferOnnxBestShot> best_shots;
+  /** Numbers of the frames the first crop was captured on and the current
+   * best crop was captured on. */
+  gulong best_shot_first_frame_num;
+  gulong best_shot_frame_num;
+  /** Boolean indicating if the track was recognised on its best shot. */
+  gboolean best_shot_done;
+  /** Alignment cache. Landmarks of the face when it was last aligned and
+   * the resulting crop, in the layout of a network input slot. The crop is
+   * NULL until the alignment succeeded. */
+  gfloat align_cache_x[mirror::kNumLandmarks];
+  gfloat align_cache_y[mirror::kNumLandmarks];
+  std::shared_ptr<std::vector<guint8>> align_cache_crop;
+  /** Embedding aggregation. Quality-weighted sum of the normalised
+   * embeddings of the track, the sum of their weights and their number. The
+   * mean is kept normalised along with its norm before normalisation, which
+   * is 1 for identical embeddings and drops as they spread. */
+  std::vector<gfloat> embedding_sum;
+  gfloat embedding_weight;
+  guint embedding_count;
+  std::vector<gfloat> embedding_mean;
+  gfloat embedding_norm;
+  /** Boolean indicating if the aggregate is stable and the track is no
+   * longer inferred on. */
+  gboolean embedding_done;
+  /** Identity lock-in. Gallery identity the track last matched with a clear
+   * margin, the number of such matches in a row, and whether the track is
+   * locked to the identity, since identity_locked_frame_num. */
+  guint32 identity_id;
+  guint identity_confirmations;
+  gboolean identity_locked;
+  gulong identity_locked_frame_num;
 } GstNvInferOnnxObjectHistory;
 
+/**
+ * Holds the resources one face alignment worker needs for converting the
+ * source rectangle of a face.
+ */
+typedef struct
+{
+  /** Intermediate RGBA buffer the face source rectangle is converted into. */
+  NvBufSurface *inter_buf;
+  /** Cuda stream used for the conversion. */
+  cudaStream_t convert_stream;
+} GstNvInferOnnxAlignScratch;
+
+/**
+ * Holds the thresholds of the face quality gate. Faces outside of any of the
+ * limits are not inferred on. See mirror::FaceGeometry and
+ * mirror::FaceImageStats for the measures.
+ */
+typedef struct
+{
+  /** Minimum distance between the eyes, in frame pixels. */
+  gfloat min_inter_ocular;
+  /** Maximum absolute yaw and pitch proxies and roll angle (degrees). */
+  gfloat max_yaw;
+  gfloat max_pitch;
+  gfloat max_roll;
+  /** Limits on the sharpness and brightness of the converted face source
+   * rectangle. */
+  gfloat min_sharpness;
+  gfloat min_brightness;
+  gfloat max_brightness;
+  /** Booleans indicating if any of the geometry / image limits are set. */
+  gboolean check_geometry;
+  gboolean check_image;
+} GstNvInferOnnxFaceQualityParams;
+
+/**
+ * Holds the inference budget of object processing mode. When more objects of
+ * an input buffer are due for inference than the budget allows, the ones of
+ * highest priority are inferred on and the others deferred to later frames.
+ * Faces without a usable alignment, rejected by the geometry gate or only
+ * captured in best-shot mode are not inferred on and take no budget.
+ * The priority is the weighted sum of: being a new track, the frames since
+ * the last inference in reinfer intervals, the square root of the object's
+ * share of the frame area and, for faces with landmarks, the quality score
+ * relative to the object width. Deferred tracks grow stale and so rise in
+ * priority. The budget is shared fairly between the sources, see
+ * gstnvinfer::ObjectScheduler.
+ */
+typedef struct
+{
+  /** Maximum objects inferred on per input buffer and per second; 0 for no
+   * limit. */
+  guint per_buffer;
+  guint per_second;
+  /** Weights of the priority terms. */
+  gfloat weight_new;
+  gfloat weight_staleness;
+  gfloat weight_size;
+  gfloat weight_quality;
+  /** Share of the budget and objects guaranteed per buffer of each source,
+   * indexed by pad_index. Sources past the end have weight 1 and no
+   * guarantee. A source of weight 0 gets only its guarantee. */
+  std::vector<gdouble> *source_weights;
+  std::vector<guint> *source_min_objects;
+} GstNvInferOnnxInferBudget;
+
+/** Counters of the face alignment path, reported by the "stats" property. */
+typedef struct
+{
+  /** Faces queued for inference. */
+  std::atomic<guint64> faces_inferred;
+  /** Faces dropped by the landmark geometry gate. */
+  std::atomic<guint64> faces_rejected_geometry;
+  /** Faces dropped by the image quality gate. */
+  std::atomic<guint64> faces_rejected_image;
+  /** Best-shot mode. Crops captured and tracks recognised on their best
+   * crop. */
+  std::atomic<guint64> best_shots_captured;
+  std::atomic<guint64> best_shots_recognised;
+  /** Tracked faces that reused / could not reuse their cached crop. */
+  std::atomic<guint64> align_cache_hits;
+  std::atomic<guint64> align_cache_misses;
+} GstNvInferOnnxFaceStats;
+
 /** Map type for maintaing inference history for objects based on their tracking ids.*/
 typedef std::unordered_map<guint64, std::shared_ptr<GstNvInferOnnxObjectHistory>> GstNvInferOnnxObjectHistoryMap;
 
@@ -156,6 +311,10 @@ typedef struct
   gulong last_cleanup_frame_num;
   /** Frame number of the frame which . */
   gulong last_seen_frame_num;
+  /** Best-shot mode. Tracks with captured crops that have not been
+   * recognised yet. Also keeps the histories alive once the tracks are gone
+   * from the history map. */
+  GstNvInferOnnxObjectHistoryMap best_shot_pending;
 } GstNvInferOnnxSourceInfo;
 
 /**
@@ -186,19 +345,20 @@ struct _GstNvInferOnnx
    * cropping object. */
   GstBufferPool *pool;
 
-  /** Processing Queue and related synchronization structures. */
-  GQueue *process_queue;
+  /** Batches handed from the streaming thread to the input queue thread and
+   * from there to the output thread. Each queue has one producer and one
+   * consumer and is used without process_lock. */
+  gstnvinfer::SpscRing<gpointer> *input_queue;
+  gstnvinfer::SpscRing<gpointer> *process_queue;
+
+  /** Lock for the configuration, model and gallery file while they are
+   * replaced. */
   GMutex process_lock;
-  GCond process_cond;
-  GQueue *input_queue;
 
   /** Output thread. */
   GThread *output_thread;
   GThread *input_queue_thread;
 
-  /** Boolean to signal output thread to stop. */
-  gboolean stop;
-
   /** Network input resolution. */
   gint network_width;
   gint network_height;
@@ -236,6 +396,18 @@ struct _GstNvInferOnnx
   /** Frame interval after which objects should be reinferred on. */
   guint secondary_reinfer_interval;
 
+  /** Batch accumulation. Microseconds a batch of objects that is not full
+   * at the end of an input buffer is kept open for the objects of the next
+   * buffers. 0 submits the batch at the end of every buffer. */
+  guint batch_accumulate_us;
+
+  /** The open batch, which the streaming thread can still add objects to,
+   * or NULL. Tagged with ACCUMULATE_FILLING while the streaming thread
+   * adds objects. The input queue thread closes the batch at its deadline
+   * by swapping in NULL and waits on accumulate_spot meanwhile. */
+  std::atomic<gpointer> *accumulate_open;
+  gstnvinfer::ParkingSpot *accumulate_spot;
+
   /** Input object size-based filtering parameters for object processing mode. */
   guint min_input_object_width;
   guint min_input_object_height;
@@ -294,6 +466,145 @@ struct _GstNvInferOnnx
    * GstBuffers. */
   gboolean output_tensor_meta;
 
+  /** Boolean indicating if objects should be aligned using their facial
+   * landmarks and written directly into the network input instead of being
+   * cropped and scaled. */
+  gboolean align_faces;
+
+  /** Boolean indicating if alignment mode also normalises the aligned faces
+   * into planar float tensors, bypassing the NvDsInferContext input
+   * conversion. */
+  gboolean align_to_tensor;
+
+  /** Channel order and normalisation used when align_to_tensor is set. */
+  mirror::TensorNormalization face_normalization;
+
+  /** Number of threads aligning the faces of a batch in parallel. With 0 the
+   * faces are aligned in the streaming thread. */
+  guint align_workers;
+
+  /** CPUs the alignment workers are pinned to, assigned round-robin. Empty
+   * if the workers should not be pinned. */
+  std::vector<gint> *align_worker_cpus;
+
+  /** Pool of alignment workers and their conversion resources. The scratch
+   * vector holds one entry per worker, or a single entry for the streaming
+   * thread if there are no workers. */
+  gstnvinfer::WorkerPool *align_pool;
+  std::vector<GstNvInferOnnxAlignScratch> *align_scratch;
+
+  /** Face quality gate applied in alignment mode. */
+  GstNvInferOnnxFaceQualityParams face_quality;
+
+  /** Face alignment counters. */
+  GstNvInferOnnxFaceStats *face_stats;
+
+  /** Locks of the object histories, which the streaming thread and the
+   * output thread both update. A history is only read or written with its
+   * stripe held, see gstnvinfer::StripeGuard. The history maps themselves
+   * are only used by the streaming thread and need no lock. */
+  gstnvinfer::StripedLock *history_locks;
+
+  /** Inference budget of object processing mode and the scheduler applying
+   * it. */
+  GstNvInferOnnxInferBudget infer_budget;
+  gstnvinfer::ObjectScheduler *scheduler;
+
+  /** Best-shot mode. Number of best crops kept per track; 0 disables the
+   * mode. A track is recognised once on its best crop when the best crop
+   * has not improved for best_shot_stable_frames frames, when
+   * best_shot_timeout frames have passed since the first crop (0 for no
+   * timeout) or when the track has not been seen for best_shot_lost_frames
+   * frames. Applies to face alignment classifiers and embedding networks,
+   * the latter without embedding aggregation or identity lock-in. */
+  guint best_shot_count;
+  guint best_shot_stable_frames;
+  guint best_shot_timeout;
+  guint best_shot_lost_frames;
+
+  /** Alignment cache. A tracked face whose landmarks all moved less than
+   * this many frame pixels since it was last aligned is inferred on its
+   * cached crop. 0 disables the cache. */
+  gfloat align_cache_max_displacement;
+
+  /** Boolean indicating if aligned faces are dumped to disk. Can be toggled
+   * while playing, so it is read with g_atomic_int_get(). */
+  gboolean debug_dump;
+
+  /** Where and how much to dump, and the dump writer. The writer only exists
+   * while the element is started with a dump directory configured. */
+  gstnvinfer::DebugDump::Params *debug_dump_params;
+  gstnvinfer::DebugDump *debug_dumper;
+
+  /** Storage of the vectors attached by embedding networks. */
+  NvDsEmbeddingPrecision embedding_precision;
+
+  /** Embedding aggregation. Tracked objects are recognised on the
+   * quality-weighted mean of all their embeddings so far, which is also the
+   * vector attached to them. Faces are weighted by their quality score in
+   * alignment mode and equally otherwise. A track is no longer inferred on
+   * once it has embedding_aggregate_min_count embeddings and their variance
+   * around the mean is at most embedding_aggregate_max_variance (0 to keep
+   * inferring). */
+  gboolean embedding_aggregate;
+  gfloat embedding_aggregate_max_variance;
+  guint embedding_aggregate_min_count;
+
+  /** Face gallery. Embedding instances match every vector against the
+   * gallery mapped from gallery_file and attach the gallery_top_k best
+   * matches scoring at least gallery_min_score as classifier meta. */
+  gchar *gallery_file;
+  guint gallery_top_k;
+  gfloat gallery_min_score;
+
+  /** Number of threads splitting the gallery search of a batch. With 0 the
+   * output thread searches the gallery alone. */
+  guint gallery_workers;
+  gstnvinfer::WorkerPool *gallery_pool;
+
+  /** HNSW index of the gallery, searched instead of scanning the gallery
+   * when gallery_hnsw_m is not 0. The index is kept in gallery_file with
+   * the suffix ".hnsw" and is built with gallery_hnsw_m links per node and
+   * gallery_hnsw_ef_construction if it is missing or out of date. Searches
+   * explore gallery_hnsw_ef nodes. */
+  guint gallery_hnsw_m;
+  guint gallery_hnsw_ef_construction;
+  guint gallery_hnsw_ef;
+
+  /** Compressed IVF-PQ copy of the gallery, searched instead of the gallery
+   * when gallery_ivfpq_lists is not 0. It is kept in gallery_file with the
+   * suffix ".ivfpq" and is rebuilt with gallery_ivfpq_lists lists and
+   * gallery_ivfpq_subquantizers subquantizers if it is missing or out of
+   * date. Searches scan gallery_ivfpq_nprobe lists and score the best
+   * gallery_ivfpq_rerank candidates exactly. The gallery vectors are only
+   * read for re-ranking. */
+  guint gallery_ivfpq_lists;
+  guint gallery_ivfpq_subquantizers;
+  guint gallery_ivfpq_nprobe;
+  guint gallery_ivfpq_rerank;
+
+  /** Loads the gallery and its index and reloads them while playing when
+   * the "gallery-file" property is set or the "gallery-delta-file"
+   * property hands in enrolments. Only exists while the element is started
+   * with a gallery. */
+  gstnvinfer::GalleryLoader *gallery_loader;
+
+  /** Share gallery reloads with the other processes on the host that are
+   * configured with the same gallery_file, through a shared memory header
+   * named after it. A process started later uses the version they use. */
+  gboolean gallery_shared;
+
+  /** Identity lock-in. A track whose best match beats the runner-up by at
+   * least gallery_lock_margin on gallery_lock_confirmations inferences in a
+   * row is locked to the identity. Locked tracks are not inferred on and
+   * keep their cached matches, except for a verification every
+   * gallery_lock_verify_interval frames (0 for never). A verification that
+   * does not confirm the identity unlocks the track. 0 for
+   * gallery_lock_margin disables lock-in. */
+  gfloat gallery_lock_margin;
+  guint gallery_lock_confirmations;
+  guint gallery_lock_verify_interval;
+
   /** PTS of input buffer when nvinfer last posted the warning about untracked
    * object. */
   GstClockTime untracked_object_warn_pts;
@@ -327,6 +638,12 @@ struct _GstNvInferOnnxClass {
     * cfg_file: update cfg file.
     */
   void (*model_updated) (GstNvInferOnnx *, gint err, const gchar *cfg_file);
+  /** signal : gallery-updated
+    * success: boolean, whether the gallery was reloaded.
+    * file: gallery or delta file.
+    */
+  void (*gallery_updated) (GstNvInferOnnx *, gboolean success,
+      const gchar *file);
 };
 
 GType gst_nvinfer_get_type (void);
@@ -43,6 +43,7 @@ struct _GstNvInferOnnxAllocator
   guint height;
   NvBufSurfaceColorFormat color_format;
   guint gpu_id;
+  gboolean host_accessible;
 };
 
 struct _GstNvInferOnnxAllocatorClass
@@ -94,7 +95,13 @@ gst_nvinfer_allocator_alloc (GstAllocator * allocator, gsize size,
   create_params.isContiguous = 1;
   create_params.colorFormat = inferallocator->color_format;
   create_params.layout = NVBUF_LAYOUT_PITCH;
+#ifdef IS_TEGRA
   create_params.memType = NVBUF_MEM_DEFAULT;
+#else
+  /* Unified memory lets the CPU write directly into the frame memories. */
+  create_params.memType = inferallocator->host_accessible ?
+      NVBUF_MEM_CUDA_UNIFIED : NVBUF_MEM_DEFAULT;
+#endif
 
   if (NvBufSurfaceCreate (&tmem->surf, inferallocator->batch_size,
           &create_params) != 0) {
@@ -109,12 +116,21 @@ gst_nvinfer_allocator_alloc (GstAllocator * allocator, gsize size,
   }
 #endif
 
+#ifdef IS_TEGRA
+  if (inferallocator->host_accessible &&
+      NvBufSurfaceMap (tmem->surf, -1, 0, NVBUF_MAP_READ_WRITE) != 0) {
+    GST_ERROR ("Error: Could not map NvBufSurface for CPU access for nvinfer");
+    return nullptr;
+  }
+#endif
+
 #ifdef IS_TEGRA
   tmem->egl_frames.resize (inferallocator->batch_size);
   tmem->cuda_resources.resize (inferallocator->batch_size);
 #endif
 
   tmem->frame_memory_ptrs.assign (inferallocator->batch_size, nullptr);
+  tmem->frame_host_ptrs.assign (inferallocator->batch_size, nullptr);
 
   for (guint i = 0; i < inferallocator->batch_size; i++) {
 #ifdef IS_TEGRA
@@ -131,10 +147,15 @@ gst_nvinfer_allocator_alloc (GstAllocator * allocator, gsize size,
       return nullptr;
     }
     tmem->frame_memory_ptrs[i] = (char *) tmem->egl_frames[i].frame.pPitch[0];
+    if (inferallocator->host_accessible)
+      tmem->frame_host_ptrs[i] =
+          (char *) tmem->surf->surfaceList[i].mappedAddr.addr[0];
 #else
     /* Calculate pointers to individual frame memories in the batch memory and
      * insert in the vector. */
     tmem->frame_memory_ptrs[i] = (char *) tmem->surf->surfaceList[i].dataPtr;
+    if (inferallocator->host_accessible)
+      tmem->frame_host_ptrs[i] = tmem->frame_memory_ptrs[i];
 #endif
   }
 
@@ -157,6 +178,8 @@ gst_nvinfer_allocator_free (GstAllocator * allocator, GstMemory * memory)
   for (size_t i = 0; i < inferallocator->batch_size; i++) {
     cuGraphicsUnregisterResource (tmem->cuda_resources[i]);
   }
+  if (inferallocator->host_accessible)
+    NvBufSurfaceUnMap (tmem->surf, -1, 0);
 #endif
 
   NvBufSurfaceUnMapEglImage (tmem->surf, -1);
@@ -206,7 +229,8 @@ gst_nvinfer_allocator_init (GstNvInferOnnxAllocator * allocator)
  * members. */
 GstAllocator *
 gst_nvinfer_allocator_new (guint width, guint height,
-    NvBufSurfaceColorFormat color_format, guint batch_size, guint gpu_id)
+    NvBufSurfaceColorFormat color_format, guint batch_size, guint gpu_id,
+    gboolean host_accessible)
 {
   GstNvInferOnnxAllocator *allocator = (GstNvInferOnnxAllocator *)
       g_object_new (GST_TYPE_NVINFER_ALLOCATOR,
@@ -217,6 +241,7 @@ gst_nvinfer_allocator_new (guint width, guint height,
   allocator->batch_size = batch_size;
   allocator->gpu_id = gpu_id;
   allocator->color_format = color_format;
+  allocator->host_accessible = host_accessible;
 
   return (GstAllocator *) allocator;
 }
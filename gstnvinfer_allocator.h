@@ -44,6 +44,9 @@ typedef struct
 #endif
   /** Vector of pointer to individual frame memories in the batch memory */
   std::vector<void *> frame_memory_ptrs;
+  /** Vector of CPU accessible pointers to the individual frame memories. Only
+   * filled if the allocator was created with host_accessible set. */
+  std::vector<void *> frame_host_ptrs;
 } GstNvInferOnnxMemory;
 
 /**
@@ -64,10 +67,13 @@ GstNvInferOnnxMemory *gst_nvinfer_buffer_get_memory (GstBuffer * buffer);
  * @param color_format Color format of the buffers in the pool.
  * @param batch_size Max size of batch that will be inferred.
  * @param gpu_id ID of the gpu where the batch memory will be allocated.
+ * @param host_accessible Boolean indicating if the frame memories should also
+ *        be writable from the CPU.
  *
  * @return Pointer to the GstNvInferOnnxAllocator structure cast as GstAllocator
  */
 GstAllocator *gst_nvinfer_allocator_new (guint width, guint height,
-    NvBufSurfaceColorFormat color_format, guint batch_size, guint gpu_id);
+    NvBufSurfaceColorFormat color_format, guint batch_size, guint gpu_id,
+    gboolean host_accessible);
 
 #endif
@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "gstnvinfer_debug_dump.h"
+
+/* The per-object counts are reset once this many objects are tracked, so
+ * that the map does not grow with the length of the stream. */
+#define MAX_COUNTED_OBJECTS 4096
+
+namespace gstnvinfer
+{
+
+DebugDump::DebugDump (const Params &params,
+    const mirror::TensorNormalization &norm)
+  : m_Params (params), m_Norm (norm), m_Ring (MAX (params.queue_size, 1u))
+{
+  if (m_Params.interval == 0)
+    m_Params.interval = 1;
+  sem_init (&m_Ready, 0, 0);
+  m_Writer = std::thread (&DebugDump::writerLoop, this);
+}
+
+DebugDump::~DebugDump ()
+{
+  m_Stop = true;
+  sem_post (&m_Ready);
+  m_Writer.join ();
+  sem_destroy (&m_Ready);
+}
+
+bool
+DebugDump::submit (const Image &image)
+{
+  if (m_Submitted++ % m_Params.interval != 0)
+    return false;
+
+  guint64 tail = m_Tail.load (std::memory_order_relaxed);
+  if (tail - m_Head.load (std::memory_order_acquire) >= m_Ring.size ())
+    return false;
+
+  size_t rows = (image.layout == Layout::PLANAR_FLOAT) ? 3 * image.height :
+      image.height;
+  size_t size = rows * image.pitch;
+  if (m_Params.max_bytes && m_Bytes + size > m_Params.max_bytes)
+    return false;
+
+  guint64 key = ((guint64) image.source_id << 48) ^ image.object_id;
+  if (m_Params.max_per_object) {
+    if (m_PerObject.size () >= MAX_COUNTED_OBJECTS)
+      m_PerObject.clear ();
+    guint &count = m_PerObject[key];
+    if (count >= m_Params.max_per_object)
+      return false;
+    count++;
+  }
+
+  /* The slot keeps its allocation from earlier images. */
+  Entry &entry = m_Ring[tail % m_Ring.size ()];
+  entry.image = image;
+  entry.sequence = tail;
+  entry.data.assign ((const guint8 *) image.data,
+      (const guint8 *) image.data + size);
+  entry.image.data = nullptr;
+  m_Bytes += size;
+
+  m_Tail.store (tail + 1, std::memory_order_release);
+  sem_post (&m_Ready);
+  return true;
+}
+
+void
+DebugDump::writerLoop ()
+{
+  pthread_setname_np (pthread_self (), "nvinfer-dump");
+
+  while (true) {
+    while (sem_wait (&m_Ready) != 0)
+      continue;
+
+    guint64 head = m_Head.load (std::memory_order_relaxed);
+    if (head != m_Tail.load (std::memory_order_acquire)) {
+      write (m_Ring[head % m_Ring.size ()]);
+      m_Head.store (head + 1, std::memory_order_release);
+      continue;
+    }
+
+    /* Only the stop request leaves the ring empty after a wake up. */
+    if (m_Stop)
+      return;
+  }
+}
+
+bool
+DebugDump::write (const Entry &entry)
+{
+  const Image &image = entry.image;
+  guint8 *data = const_cast<guint8 *> (entry.data.data ());
+  cv::Mat bgr;
+
+  switch (image.layout) {
+    case Layout::BGR:
+      bgr = cv::Mat (image.height, image.width, CV_8UC3, data, image.pitch);
+      break;
+    case Layout::RGB:
+      cv::cvtColor (cv::Mat (image.height, image.width, CV_8UC3, data,
+              image.pitch), bgr, cv::COLOR_RGB2BGR);
+      break;
+    case Layout::RGBA:
+      cv::cvtColor (cv::Mat (image.height, image.width, CV_8UC4, data,
+              image.pitch), bgr, cv::COLOR_RGBA2BGR);
+      break;
+    case Layout::PLANAR_FLOAT:
+      /* Undo the normalisation: plane c holds
+       * scale * (channel channel_map[c] - means[c]). */
+      bgr.create (image.height, image.width, CV_8UC3);
+      for (gint c = 0; c < 3; c++) {
+        gint out = 2 - m_Norm.channel_map[c];
+        for (gint y = 0; y < image.height; y++) {
+          const float *src = (const float *) (data +
+              (size_t) (c * image.height + y) * image.pitch);
+          guint8 *dst = bgr.ptr<guint8> (y);
+          for (gint x = 0; x < image.width; x++)
+            dst[x * 3 + out] = cv::saturate_cast<guint8> (
+                src[x] / m_Norm.scale + m_Norm.means[c]);
+        }
+      }
+      break;
+  }
+
+  char name[128];
+  snprintf (name, sizeof (name), "%08lu_src%u_obj%lu_frame%lu.png",
+      (gulong) entry.sequence, image.source_id, (gulong) image.object_id,
+      image.frame_num);
+  std::string path = m_Params.directory + G_DIR_SEPARATOR_S + name;
+
+  if (!cv::imwrite (path, bgr)) {
+    /* Most likely every further image fails the same way. */
+    if (!m_WriteFailed)
+      g_warning ("Could not write debug dump %s", path.c_str ());
+    m_WriteFailed = true;
+    return false;
+  }
+  return true;
+}
+
+}
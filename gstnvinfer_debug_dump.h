@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#ifndef __GSTNVINFER_DEBUG_DUMP_H__
+#define __GSTNVINFER_DEBUG_DUMP_H__
+
+#include <glib.h>
+#include <semaphore.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "aligner_kernels.h"
+
+namespace gstnvinfer {
+
+/**
+ * Writes images of the processing path to disk for debugging without
+ * stalling the path. submit() copies the image into a fixed ring of
+ * preallocated slots and returns; a background thread drains the ring into
+ * PNG files. Images are dropped instead of waited for when the ring is full.
+ * submit() takes no locks but must only be called from one thread at a
+ * time.
+ */
+class DebugDump
+{
+public:
+  /** Pixel layout of a submitted image. */
+  enum class Layout
+  {
+    /** Packed 8-bit BGR, RGB or RGBA. */
+    BGR,
+    RGB,
+    RGBA,
+    /** Three float planes normalised as described by the
+     * mirror::TensorNormalization given to the constructor. */
+    PLANAR_FLOAT,
+  };
+
+  struct Params
+  {
+    /** Directory the images are written to. */
+    std::string directory;
+    /** Only every interval-th submitted image is dumped. */
+    guint interval = 1;
+    /** Maximum number of images dumped per object, 0 for no limit. */
+    guint max_per_object = 0;
+    /** Maximum number of bytes of image data dumped, 0 for no limit. */
+    guint64 max_bytes = 0;
+    /** Number of images the ring holds. */
+    guint queue_size = 32;
+  };
+
+  struct Image
+  {
+    guint source_id;
+    guint64 object_id;
+    gulong frame_num;
+    gint width;
+    gint height;
+    /** Bytes between rows, of a plane for Layout::PLANAR_FLOAT. */
+    gint pitch;
+    Layout layout;
+    const void *data;
+  };
+
+  DebugDump (const Params &params, const mirror::TensorNormalization &norm);
+  ~DebugDump ();
+
+  /** Queue a copy of image for writing. Returns false if the image was
+   * skipped by the sampling interval or a limit, or dropped because the
+   * writer is behind. */
+  bool submit (const Image &image);
+
+private:
+  struct Entry
+  {
+    Image image;
+    guint64 sequence;
+    std::vector<guint8> data;
+  };
+
+  void writerLoop ();
+  bool write (const Entry &entry);
+
+  Params m_Params;
+  mirror::TensorNormalization m_Norm;
+
+  /* Producer state, only touched by submit(). */
+  guint64 m_Submitted = 0;
+  guint64 m_Bytes = 0;
+  std::unordered_map<guint64, guint> m_PerObject;
+
+  /* Single producer / single consumer ring. m_Tail is only written by the
+   * producer and m_Head only by the writer thread. m_Ready counts the
+   * queued entries so that the writer sleeps while the ring is empty. */
+  std::vector<Entry> m_Ring;
+  std::atomic<guint64> m_Head {0};
+  std::atomic<guint64> m_Tail {0};
+  sem_t m_Ready;
+  std::atomic<bool> m_Stop {false};
+  std::thread m_Writer;
+
+  /* Writer state. */
+  bool m_WriteFailed = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+/**
+ * Feature vector metadata attached by gst-nvinfer instances with
+ * network-type=3 (embedding).
+ *
+ * Every inferred object (or frame, when operating on full frames) gets one
+ * NvDsEmbeddingMeta holding the L2-normalized output vector of the network
+ * in the precision chosen with the embedding-precision config key. The
+ * functions are header-only so that consumers do not need to link against
+ * the plugin.
+ */
+
+#ifndef __GSTNVINFER_EMBEDDING_META_H__
+#define __GSTNVINFER_EMBEDDING_META_H__
+
+#include <glib.h>
+#include <string.h>
+
+#include "nvdsmeta.h"
+
+G_BEGIN_DECLS
+
+/** Descriptor of the embedding user meta type. */
+#define NVDS_EMBEDDING_META_DESCRIPTOR "NVIDIA.NVINFER.EMBEDDING"
+
+/** User meta type of NvDsEmbeddingMeta. */
+#define NVDS_EMBEDDING_META \
+  (nvds_get_user_meta_type ((gchar *) NVDS_EMBEDDING_META_DESCRIPTOR))
+
+/** Storage of the vector elements. */
+typedef enum
+{
+  /** 32-bit floats. */
+  NVDS_EMBEDDING_FP32,
+  /** IEEE 754 half precision floats, stored as guint16. */
+  NVDS_EMBEDDING_FP16,
+  /** gint8, element i is data[i] * scale. */
+  NVDS_EMBEDDING_INT8,
+} NvDsEmbeddingPrecision;
+
+/**
+ * Holds the feature vector of one object or frame. This meta is added as
+ * NvDsUserMeta with the meta_type set to NVDS_EMBEDDING_META. The vector is
+ * stored in the same allocation, right behind the structure.
+ */
+typedef struct
+{
+  /** Unique ID of the gst-nvinfer instance which attached this meta. */
+  guint unique_id;
+  /** Storage of the elements in data. */
+  NvDsEmbeddingPrecision precision;
+  /** Number of elements. */
+  guint length;
+  /** Scale of the elements for NVDS_EMBEDDING_INT8, 1 otherwise. */
+  gfloat scale;
+  /** L2 norm of the network output before normalization. */
+  gfloat norm;
+  /** The L2-normalized vector. */
+  gpointer data;
+} NvDsEmbeddingMeta;
+
+/** Size in bytes of one element stored with precision. */
+static inline gsize
+nvds_embedding_element_size (NvDsEmbeddingPrecision precision)
+{
+  switch (precision) {
+    case NVDS_EMBEDDING_FP16:
+      return 2;
+    case NVDS_EMBEDDING_INT8:
+      return 1;
+    default:
+      return 4;
+  }
+}
+
+/**
+ * Allocate an NvDsEmbeddingMeta with room for length elements of precision.
+ * Free it with g_free().
+ */
+static inline NvDsEmbeddingMeta *
+nvds_alloc_embedding_meta (NvDsEmbeddingPrecision precision, guint length)
+{
+  gsize header = (sizeof (NvDsEmbeddingMeta) + 15) & ~(gsize) 15;
+  NvDsEmbeddingMeta *meta = (NvDsEmbeddingMeta *)
+      g_malloc (header + length * nvds_embedding_element_size (precision));
+
+  meta->unique_id = 0;
+  meta->precision = precision;
+  meta->length = length;
+  meta->scale = 1.0f;
+  meta->norm = 0.0f;
+  meta->data = (guint8 *) meta + header;
+  return meta;
+}
+
+static inline gpointer
+nvds_copy_embedding_meta (gpointer data, gpointer user_data)
+{
+  NvDsUserMeta *src_user_meta = (NvDsUserMeta *) data;
+  NvDsEmbeddingMeta *src_meta =
+      (NvDsEmbeddingMeta *) src_user_meta->user_meta_data;
+  NvDsEmbeddingMeta *meta =
+      nvds_alloc_embedding_meta (src_meta->precision, src_meta->length);
+  gpointer vector = meta->data;
+
+  memcpy (meta, src_meta, sizeof (NvDsEmbeddingMeta));
+  meta->data = vector;
+  memcpy (meta->data, src_meta->data,
+      meta->length * nvds_embedding_element_size (meta->precision));
+  return meta;
+}
+
+static inline void
+nvds_release_embedding_meta (gpointer data, gpointer user_data)
+{
+  NvDsUserMeta *user_meta = (NvDsUserMeta *) data;
+
+  g_free (user_meta->user_meta_data);
+  user_meta->user_meta_data = NULL;
+}
+
+/**
+ * Get the embedding attached by the gst-nvinfer instance with unique_id to
+ * a user meta list (obj_user_meta_list or frame_user_meta_list), or NULL if
+ * there is none. meta_type is the value of NVDS_EMBEDDING_META.
+ */
+static inline const NvDsEmbeddingMeta *
+nvds_get_embedding_meta (NvDsMetaList * user_meta_list,
+    NvDsMetaType meta_type, guint unique_id)
+{
+  NvDsMetaList *l_user_meta;
+
+  for (l_user_meta = user_meta_list; l_user_meta != NULL;
+      l_user_meta = l_user_meta->next) {
+    NvDsUserMeta *user_meta = (NvDsUserMeta *) (l_user_meta->data);
+    if (user_meta->base_meta.meta_type == meta_type &&
+        ((NvDsEmbeddingMeta *) user_meta->user_meta_data)->unique_id ==
+        unique_id)
+      return (const NvDsEmbeddingMeta *) user_meta->user_meta_data;
+  }
+  return NULL;
+}
+
+static inline gfloat
+nvds_embedding_half_to_float (guint16 value)
+{
+  guint32 sign = (guint32) (value & 0x8000) << 16;
+  guint32 exponent = (value >> 10) & 0x1f;
+  guint32 mantissa = value & 0x3ff;
+  guint32 bits;
+  gfloat result;
+
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    bits = sign;
+  } else {
+    exponent = 113;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      exponent--;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+  memcpy (&result, &bits, sizeof (result));
+  return result;
+}
+
+/** Write the meta->length elements of the vector as floats to out. */
+static inline void
+nvds_embedding_meta_get_vector (const NvDsEmbeddingMeta * meta, gfloat * out)
+{
+  guint i;
+
+  switch (meta->precision) {
+    case NVDS_EMBEDDING_FP16:
+      for (i = 0; i < meta->length; i++)
+        out[i] = nvds_embedding_half_to_float (((const guint16 *) meta->data)[i]);
+      break;
+    case NVDS_EMBEDDING_INT8:
+      for (i = 0; i < meta->length; i++)
+        out[i] = ((const gint8 *) meta->data)[i] * meta->scale;
+      break;
+    default:
+      memcpy (out, meta->data, meta->length * sizeof (gfloat));
+      break;
+  }
+}
+
+G_END_DECLS
+
+#endif
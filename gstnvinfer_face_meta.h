@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+/**
+ * Per-object facial landmark metadata consumed by the face alignment mode of
+ * gst-nvinfer.
+ *
+ * Upstream face detectors (custom parsers or pad probes) attach the five
+ * landmarks of every detected face to its NvDsObjectMeta with
+ * nvds_add_face_landmarks_meta(). The functions are header-only so that
+ * producers do not need to link against the plugin.
+ */
+
+#ifndef __GSTNVINFER_FACE_META_H__
+#define __GSTNVINFER_FACE_META_H__
+
+#include <glib.h>
+#include <string.h>
+
+#include "nvdsmeta.h"
+
+G_BEGIN_DECLS
+
+/** Descriptor of the landmark user meta type. */
+#define NVDS_FACE_LANDMARKS_META_DESCRIPTOR "NVIDIA.NVINFER.FACE_LANDMARKS"
+
+/** User meta type of NvDsFaceLandmarksMeta. */
+#define NVDS_FACE_LANDMARKS_META \
+  (nvds_get_user_meta_type ((gchar *) NVDS_FACE_LANDMARKS_META_DESCRIPTOR))
+
+/** Number of landmarks per face. */
+#define NVDS_FACE_NUM_LANDMARKS 5
+
+/**
+ * Holds the landmarks of one face. This meta is added as NvDsUserMeta to the
+ * obj_user_meta_list of the face object with the meta_type set to
+ * NVDS_FACE_LANDMARKS_META.
+ */
+typedef struct
+{
+  /** Landmark co-ordinates in pixels of the input frame, in the order left
+   * eye, right eye, nose tip, left mouth corner, right mouth corner (left and
+   * right as seen in the image). */
+  gfloat x[NVDS_FACE_NUM_LANDMARKS];
+  gfloat y[NVDS_FACE_NUM_LANDMARKS];
+  /** Confidence of the landmarks as reported by the detector, or -1 if not
+   * available. */
+  gfloat confidence;
+} NvDsFaceLandmarksMeta;
+
+static inline gpointer
+nvds_copy_face_landmarks_meta (gpointer data, gpointer user_data)
+{
+  NvDsUserMeta *src_user_meta = (NvDsUserMeta *) data;
+  NvDsFaceLandmarksMeta *meta = g_new (NvDsFaceLandmarksMeta, 1);
+
+  memcpy (meta, src_user_meta->user_meta_data, sizeof (NvDsFaceLandmarksMeta));
+  return meta;
+}
+
+static inline void
+nvds_release_face_landmarks_meta (gpointer data, gpointer user_data)
+{
+  NvDsUserMeta *user_meta = (NvDsUserMeta *) data;
+
+  g_free (user_meta->user_meta_data);
+  user_meta->user_meta_data = NULL;
+}
+
+/**
+ * Attach the landmarks of a face to its object meta. x and y hold
+ * NVDS_FACE_NUM_LANDMARKS co-ordinates each, in frame pixels. Returns the
+ * attached meta or NULL if no user meta could be acquired.
+ */
+static inline NvDsFaceLandmarksMeta *
+nvds_add_face_landmarks_meta (NvDsBatchMeta * batch_meta,
+    NvDsObjectMeta * obj_meta, const gfloat * x, const gfloat * y,
+    gfloat confidence)
+{
+  NvDsUserMeta *user_meta = nvds_acquire_user_meta_from_pool (batch_meta);
+  NvDsFaceLandmarksMeta *meta;
+
+  if (!user_meta)
+    return NULL;
+
+  meta = g_new (NvDsFaceLandmarksMeta, 1);
+  memcpy (meta->x, x, sizeof (meta->x));
+  memcpy (meta->y, y, sizeof (meta->y));
+  meta->confidence = confidence;
+
+  user_meta->user_meta_data = meta;
+  user_meta->base_meta.meta_type = NVDS_FACE_LANDMARKS_META;
+  user_meta->base_meta.copy_func = nvds_copy_face_landmarks_meta;
+  user_meta->base_meta.release_func = nvds_release_face_landmarks_meta;
+  nvds_add_user_meta_to_obj (obj_meta, user_meta);
+  return meta;
+}
+
+/**
+ * Get the landmarks attached to an object, or NULL if it has none. meta_type
+ * is the value of NVDS_FACE_LANDMARKS_META, passed in so that callers looking
+ * up many objects resolve it only once.
+ */
+static inline const NvDsFaceLandmarksMeta *
+nvds_get_face_landmarks_meta (NvDsObjectMeta * obj_meta,
+    NvDsMetaType meta_type)
+{
+  NvDsMetaList *l_user_meta;
+
+  for (l_user_meta = obj_meta->obj_user_meta_list; l_user_meta != NULL;
+      l_user_meta = l_user_meta->next) {
+    NvDsUserMeta *user_meta = (NvDsUserMeta *) (l_user_meta->data);
+    if (user_meta->base_meta.meta_type == meta_type)
+      return (const NvDsFaceLandmarksMeta *) user_meta->user_meta_data;
+  }
+  return NULL;
+}
+
+G_END_DECLS
+
+#endif
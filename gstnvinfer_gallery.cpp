@@ -0,0 +1,551 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <unordered_map>
+
+#include "embedding_kernels.h"
+#include "gstnvinfer_gallery.h"
+#include "gstnvinfer_worker_pool.h"
+
+#define GALLERY_MAGIC "NVGALRY1"
+#define GALLERY_VERSION 1
+
+/* Upper bound of the vector length, keeps the size computations of a
+ * corrupt header from overflowing. */
+#define GALLERY_MAX_DIM 65536
+
+/* Rows scored per call of the dot product kernels. Small enough for the
+ * scores to stay in L1. */
+#define GALLERY_SEARCH_BLOCK 256
+
+/* Bytes of float rows scored per call of the batched kernel. Every block is
+ * multiplied with all queries of a batch, so it has to stay in L2. */
+#define GALLERY_BATCH_BLOCK_BYTES (128 * 1024)
+#define GALLERY_BATCH_MIN_BLOCK 16
+
+namespace gstnvinfer
+{
+
+namespace
+{
+
+struct GalleryFileHeader
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 precision;
+  guint32 dim;
+  guint32 count;
+  guint64 vectors_offset;
+  guint64 scales_offset;
+  guint64 ids_offset;
+  guint64 labels_offset;
+  guint64 strings_offset;
+  guint64 strings_size;
+};
+
+static_assert (sizeof (GalleryFileHeader) == 72,
+    "gallery header layout must not depend on the compiler");
+
+gsize
+element_size (Gallery::Precision precision)
+{
+  switch (precision) {
+    case Gallery::Precision::FP16:
+      return 2;
+    case Gallery::Precision::INT8:
+      return 1;
+    default:
+      return 4;
+  }
+}
+
+/* Whether [offset, offset + size) lies within a file of file_size bytes. */
+bool
+in_file (guint64 offset, guint64 size, guint64 file_size)
+{
+  return offset <= file_size && size <= file_size - offset;
+}
+
+guint64
+align_up (guint64 value, guint64 alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+/* Add the rows first_index .. first_index + rows with the given scores to
+ * matches[0 .. found), which is kept sorted, best first, with at most top_k
+ * entries. Rows scoring below min_score or not above the current k-th match
+ * are skipped. Almost all rows lose against the k-th match, so the insertion
+ * is rarely reached. */
+void
+collect_matches (const gfloat *scores, guint rows, guint first_index,
+    guint top_k, gfloat min_score, Gallery::Match *matches, guint &found)
+{
+  gfloat threshold = (found == top_k) ? matches[top_k - 1].score : min_score;
+  for (guint r = 0; r < rows; r++) {
+    if (scores[r] < threshold || (found == top_k && scores[r] == threshold))
+      continue;
+
+    guint pos = (found < top_k) ? found++ : top_k - 1;
+    while (pos > 0 && matches[pos - 1].score < scores[r]) {
+      matches[pos] = matches[pos - 1];
+      pos--;
+    }
+    matches[pos].index = first_index + r;
+    matches[pos].score = scores[r];
+    if (found == top_k)
+      threshold = matches[top_k - 1].score;
+  }
+}
+
+}
+
+bool
+write_file_atomically (const std::string &path, const void *data, gsize size,
+    std::string &error)
+{
+  static std::atomic<guint> counter (0);
+  std::string tmp_path;
+  int fd = -1;
+
+  /* Every writer has a temporary file of its own, so that processes and
+   * threads writing the same path at the same time do not write into each
+   * other's file. Whichever rename comes last leaves a complete file. A name
+   * left over by a process that had the same pid is skipped. */
+  for (guint attempt = 0; fd < 0 && attempt < 100; attempt++) {
+    tmp_path = path + ".tmp." + std::to_string (getpid ()) + "." +
+        std::to_string (counter++);
+    fd = ::open (tmp_path.c_str (), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+        0666);
+    if (fd < 0 && errno != EEXIST)
+      break;
+  }
+  if (fd < 0) {
+    error = "Could not create " + tmp_path + ": " + strerror (errno);
+    return false;
+  }
+
+  FILE *file = fdopen (fd, "wb");
+  if (!file) {
+    error = "Could not create " + tmp_path + ": " + strerror (errno);
+    close (fd);
+    unlink (tmp_path.c_str ());
+    return false;
+  }
+  bool written = fwrite (data, 1, size, file) == size;
+  written = (fclose (file) == 0) && written;
+  if (!written || rename (tmp_path.c_str (), path.c_str ()) != 0) {
+    error = "Could not write " + path + ": " + strerror (errno);
+    unlink (tmp_path.c_str ());
+    return false;
+  }
+  return true;
+}
+
+Gallery::~Gallery ()
+{
+  if (m_Map)
+    munmap (m_Map, m_MapSize);
+}
+
+std::unique_ptr<Gallery>
+Gallery::open (const std::string &path, std::string &error, bool prefetch)
+{
+  int fd = ::open (path.c_str (), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    error = "Could not open " + path + ": " + strerror (errno);
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat (fd, &st) != 0 || st.st_size < (off_t) sizeof (GalleryFileHeader)) {
+    error = "Gallery " + path + " is truncated";
+    ::close (fd);
+    return nullptr;
+  }
+
+  void *map = mmap (nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close (fd);
+  if (map == MAP_FAILED) {
+    error = "Could not map " + path + ": " + strerror (errno);
+    return nullptr;
+  }
+
+  std::unique_ptr<Gallery> gallery (new Gallery);
+  gallery->m_Map = map;
+  gallery->m_MapSize = st.st_size;
+  gallery->m_FileTime = (gint64) st.st_mtim.tv_sec * 1000000000 +
+      st.st_mtim.tv_nsec;
+
+  const guint8 *base = (const guint8 *) map;
+  guint64 file_size = st.st_size;
+  GalleryFileHeader header;
+  memcpy (&header, base, sizeof (header));
+
+  if (memcmp (header.magic, GALLERY_MAGIC, sizeof (header.magic)) != 0 ||
+      header.version != GALLERY_VERSION) {
+    error = path + " is not a version " G_STRINGIFY (GALLERY_VERSION)
+        " gallery";
+    return nullptr;
+  }
+  if (header.precision > (guint32) Precision::INT8 || header.dim == 0 ||
+      header.dim > GALLERY_MAX_DIM) {
+    error = "Gallery " + path + " has an invalid precision or dimension";
+    return nullptr;
+  }
+
+  Precision precision = (Precision) header.precision;
+  guint64 count = header.count;
+  guint64 vectors_size = count * header.dim * element_size (precision);
+
+  if (header.vectors_offset % 64 || header.ids_offset % 4 ||
+      header.labels_offset % 4 || header.scales_offset % 4 ||
+      !in_file (header.vectors_offset, vectors_size, file_size) ||
+      !in_file (header.ids_offset, count * 4, file_size) ||
+      !in_file (header.labels_offset, count * 4, file_size) ||
+      !in_file (header.strings_offset, header.strings_size, file_size) ||
+      (precision == Precision::INT8 &&
+          !in_file (header.scales_offset, count * 4, file_size))) {
+    error = "Gallery " + path + " has sections outside of the file";
+    return nullptr;
+  }
+
+  /* Every label must be a NUL-terminated string within the strings. */
+  const gchar *strings = (const gchar *) base + header.strings_offset;
+  const guint32 *label_offsets =
+      (const guint32 *) (base + header.labels_offset);
+  if (count > 0 && (header.strings_size == 0 ||
+          strings[header.strings_size - 1] != '\0')) {
+    error = "Gallery " + path + " has unterminated labels";
+    return nullptr;
+  }
+  for (guint64 i = 0; i < count; i++) {
+    if (label_offsets[i] >= header.strings_size) {
+      error = "Gallery " + path + " has labels outside of the strings";
+      return nullptr;
+    }
+  }
+
+  gallery->m_Precision = precision;
+  gallery->m_Dim = header.dim;
+  gallery->m_Count = header.count;
+  gallery->m_Vectors = base + header.vectors_offset;
+  gallery->m_Scales = (precision == Precision::INT8) ?
+      (const gfloat *) (base + header.scales_offset) : nullptr;
+  gallery->m_Ids = (const guint32 *) (base + header.ids_offset);
+  gallery->m_LabelOffsets = label_offsets;
+  gallery->m_Strings = strings;
+
+  /* Every search scans all vectors. Start reading them in now instead of
+   * faulting them in during the first searches. */
+  guint64 page_offset = header.vectors_offset % sysconf (_SC_PAGESIZE);
+  madvise ((void *) (base + header.vectors_offset - page_offset),
+      vectors_size + page_offset, prefetch ? MADV_WILLNEED : MADV_RANDOM);
+
+  return gallery;
+}
+
+bool
+Gallery::write (const std::string &path, Precision precision, guint dim,
+    guint count, const gfloat *vectors, const guint32 *ids,
+    const std::vector<std::string> &labels, std::string &error)
+{
+  if (dim == 0 || dim > GALLERY_MAX_DIM || labels.size () != count) {
+    error = "Invalid gallery dimension or label count";
+    return false;
+  }
+
+  GalleryFileHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, GALLERY_MAGIC, sizeof (header.magic));
+  header.version = GALLERY_VERSION;
+  header.precision = (guint32) precision;
+  header.dim = dim;
+  header.count = count;
+
+  std::vector<guint32> label_offsets (count);
+  std::string strings;
+  for (guint i = 0; i < count; i++) {
+    label_offsets[i] = strings.size ();
+    strings.append (labels[i]).push_back ('\0');
+  }
+
+  guint64 vectors_size = (guint64) count * dim * element_size (precision);
+  header.vectors_offset = align_up (sizeof (header), 64);
+  guint64 offset = align_up (header.vectors_offset + vectors_size, 4);
+  if (precision == Precision::INT8) {
+    header.scales_offset = offset;
+    offset += (guint64) count * 4;
+  }
+  header.ids_offset = offset;
+  header.labels_offset = header.ids_offset + (guint64) count * 4;
+  header.strings_offset = header.labels_offset + (guint64) count * 4;
+  header.strings_size = strings.size ();
+
+  std::vector<guint8> data (header.strings_offset + header.strings_size);
+  memcpy (data.data (), &header, sizeof (header));
+
+  std::vector<gfloat> normalized (dim);
+  for (guint i = 0; i < count; i++) {
+    mirror::L2Normalize (vectors + (gsize) i * dim, normalized.data (), dim);
+    guint8 *row = data.data () + header.vectors_offset +
+        (gsize) i * dim * element_size (precision);
+    switch (precision) {
+      case Precision::FP16:
+        mirror::FloatToHalf (normalized.data (), (uint16_t *) row, dim);
+        break;
+      case Precision::INT8: {
+        gfloat scale = mirror::QuantizeInt8 (normalized.data (),
+            (int8_t *) row, dim);
+        memcpy (data.data () + header.scales_offset + i * 4, &scale, 4);
+        break;
+      }
+      default:
+        memcpy (row, normalized.data (), dim * sizeof (gfloat));
+        break;
+    }
+  }
+  memcpy (data.data () + header.ids_offset, ids, (gsize) count * 4);
+  memcpy (data.data () + header.labels_offset, label_offsets.data (),
+      (gsize) count * 4);
+  memcpy (data.data () + header.strings_offset, strings.data (),
+      strings.size ());
+
+  return write_file_atomically (path, data.data (), data.size (), error);
+}
+
+bool
+Gallery::applyDelta (const Gallery &base, const Gallery &delta,
+    const std::string &path, std::string &error)
+{
+  if (delta.dim () != base.dim ()) {
+    error = "Gallery delta holds vectors of " + std::to_string (delta.dim ()) +
+        " elements, the gallery " + std::to_string (base.dim ());
+    return false;
+  }
+
+  /* The last entry of an identity in the delta wins. */
+  std::unordered_map<guint32, guint> delta_rows;
+  for (guint i = 0; i < delta.size (); i++)
+    delta_rows[delta.id (i)] = i;
+
+  guint dim = base.dim ();
+  std::vector<gfloat> vectors;
+  std::vector<guint32> ids;
+  std::vector<std::string> labels;
+  vectors.reserve ((gsize) (base.size () + delta_rows.size ()) * dim);
+
+  auto add = [&] (const Gallery &gallery, guint index) {
+    vectors.resize (vectors.size () + dim);
+    gallery.row (index, vectors.data () + vectors.size () - dim);
+    ids.push_back (gallery.id (index));
+    labels.emplace_back (gallery.label (index));
+  };
+
+  for (guint i = 0; i < base.size (); i++) {
+    if (delta_rows.find (base.id (i)) == delta_rows.end ())
+      add (base, i);
+  }
+  for (guint i = 0; i < delta.size (); i++) {
+    if (delta_rows[delta.id (i)] == i && delta.label (i)[0] != '\0')
+      add (delta, i);
+  }
+
+  return write (path, base.precision (), dim, ids.size (), vectors.data (),
+      ids.data (), labels, error);
+}
+
+gfloat
+Gallery::score (const gfloat *query, guint index) const
+{
+  gsize offset = (gsize) index * m_Dim;
+  gfloat score;
+
+  switch (m_Precision) {
+    case Precision::FP16:
+      mirror::DotProductsF16 (query, (const uint16_t *) m_Vectors + offset,
+          m_Dim, 1, &score);
+      break;
+    case Precision::INT8:
+      mirror::DotProductsInt8 (query, (const int8_t *) m_Vectors + offset,
+          m_Scales + index, m_Dim, 1, &score);
+      break;
+    default:
+      mirror::DotProductsF32 (query, (const gfloat *) m_Vectors + offset,
+          m_Dim, 1, &score);
+      break;
+  }
+  return score;
+}
+
+void
+Gallery::row (guint index, gfloat *dst) const
+{
+  gsize offset = (gsize) index * m_Dim;
+
+  switch (m_Precision) {
+    case Precision::FP16:
+      mirror::HalfToFloat ((const uint16_t *) m_Vectors + offset, dst, m_Dim);
+      break;
+    case Precision::INT8:
+      mirror::DequantizeInt8 ((const int8_t *) m_Vectors + offset,
+          m_Scales[index], dst, m_Dim);
+      break;
+    default:
+      memcpy (dst, (const gfloat *) m_Vectors + offset,
+          m_Dim * sizeof (gfloat));
+      break;
+  }
+}
+
+guint
+Gallery::search (const gfloat *query, guint top_k, gfloat min_score,
+    Match *matches) const
+{
+  top_k = MIN (top_k, MAX_TOP_K);
+  if (top_k == 0)
+    return 0;
+
+  /* matches[0 .. found) is kept sorted, best first. */
+  guint found = 0;
+  gfloat scores[GALLERY_SEARCH_BLOCK];
+
+  for (guint start = 0; start < m_Count; start += GALLERY_SEARCH_BLOCK) {
+    guint rows = MIN ((guint) GALLERY_SEARCH_BLOCK, m_Count - start);
+    gsize offset = (gsize) start * m_Dim;
+
+    switch (m_Precision) {
+      case Precision::FP16:
+        mirror::DotProductsF16 (query, (const uint16_t *) m_Vectors + offset,
+            m_Dim, rows, scores);
+        break;
+      case Precision::INT8:
+        mirror::DotProductsInt8 (query, (const int8_t *) m_Vectors + offset,
+            m_Scales + start, m_Dim, rows, scores);
+        break;
+      default:
+        mirror::DotProductsF32 (query, (const gfloat *) m_Vectors + offset,
+            m_Dim, rows, scores);
+        break;
+    }
+
+    collect_matches (scores, rows, start, top_k, min_score, matches, found);
+  }
+
+  for (guint i = 0; i < found; i++) {
+    matches[i].id = m_Ids[matches[i].index];
+    matches[i].label = m_Strings + m_LabelOffsets[matches[i].index];
+  }
+  return found;
+}
+
+void
+Gallery::searchBatch (const gfloat *queries, guint num_queries, guint top_k,
+    gfloat min_score, Match *matches, guint *num_found,
+    WorkerPool *pool) const
+{
+  guint k = MIN (top_k, MAX_TOP_K);
+  for (guint q = 0; q < num_queries; q++)
+    num_found[q] = 0;
+  if (num_queries == 0 || k == 0 || m_Count == 0)
+    return;
+
+  guint block = MAX ((guint) GALLERY_BATCH_MIN_BLOCK,
+      (guint) (GALLERY_BATCH_BLOCK_BYTES / (m_Dim * sizeof (gfloat))));
+  guint num_blocks = (m_Count + block - 1) / block;
+  guint num_parts = pool ? MAX (1u, MIN (pool->size (), num_blocks)) : 1;
+
+  /* Every part scans a range of whole blocks and keeps its own matches,
+   * merged below once all parts are done. */
+  std::vector<Match> part_matches ((gsize) num_parts * num_queries * k);
+  std::vector<guint> part_found ((gsize) num_parts * num_queries, 0);
+
+  auto search_part = [&] (guint, guint part) -> bool {
+    guint begin = (guint) ((guint64) num_blocks * part / num_parts) * block;
+    guint end = MIN ((guint64) m_Count,
+        (guint64) num_blocks * (part + 1) / num_parts * block);
+    Match *part_match = part_matches.data () + (gsize) part * num_queries * k;
+    guint *found = part_found.data () + (gsize) part * num_queries;
+
+    std::vector<gfloat> scores ((gsize) num_queries * block);
+    std::vector<gfloat> converted;
+    if (m_Precision != Precision::FP32)
+      converted.resize ((gsize) block * m_Dim);
+
+    for (guint start = begin; start < end; start += block) {
+      guint rows = MIN (block, end - start);
+      gsize offset = (gsize) start * m_Dim;
+      const gfloat *block_rows = converted.data ();
+
+      /* The batched kernel takes floats. Converting a block once and
+       * scoring it against all queries is cheaper than converting every
+       * row for every query. */
+      switch (m_Precision) {
+        case Precision::FP16:
+          mirror::HalfToFloat ((const uint16_t *) m_Vectors + offset,
+              converted.data (), rows * m_Dim);
+          break;
+        case Precision::INT8:
+          for (guint r = 0; r < rows; r++)
+            mirror::DequantizeInt8 ((const int8_t *) m_Vectors + offset +
+                (gsize) r * m_Dim, m_Scales[start + r],
+                converted.data () + (gsize) r * m_Dim, m_Dim);
+          break;
+        default:
+          block_rows = (const gfloat *) m_Vectors + offset;
+          break;
+      }
+
+      mirror::DotProductsBatchF32 (queries, num_queries, block_rows, m_Dim,
+          rows, scores.data ());
+      for (guint q = 0; q < num_queries; q++)
+        collect_matches (scores.data () + (gsize) q * rows, rows, start, k,
+            min_score, part_match + (gsize) q * k, found[q]);
+    }
+    return true;
+  };
+
+  if (num_parts > 1)
+    pool->run (num_parts, search_part);
+  else
+    search_part (0, 0);
+
+  /* The parts cover increasing rows, so merging them in order keeps the
+   * lower row first among equal scores, as search() does. */
+  for (guint q = 0; q < num_queries; q++) {
+    Match *query_matches = matches + (gsize) q * top_k;
+    for (guint part = 0; part < num_parts; part++) {
+      const Match *part_match =
+          part_matches.data () + ((gsize) part * num_queries + q) * k;
+      guint found = part_found[(gsize) part * num_queries + q];
+      for (guint i = 0; i < found; i++)
+        collect_matches (&part_match[i].score, 1, part_match[i].index, k,
+            min_score, query_matches, num_found[q]);
+    }
+    for (guint i = 0; i < num_found[q]; i++) {
+      guint index = query_matches[i].index;
+      query_matches[i].id = m_Ids[index];
+      query_matches[i].label = m_Strings + m_LabelOffsets[index];
+    }
+  }
+}
+
+}
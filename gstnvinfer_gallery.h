@@ -0,0 +1,163 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#ifndef __GSTNVINFER_GALLERY_H__
+#define __GSTNVINFER_GALLERY_H__
+
+#include <glib.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gstnvinfer {
+
+class WorkerPool;
+
+/** Write size bytes of data to a temporary file and rename it to path, so
+ * that readers never map a partially written file. Returns false and sets
+ * error on failure. */
+bool write_file_atomically (const std::string &path, const void *data,
+    gsize size, std::string &error);
+
+/**
+ * A gallery of known identities, each with one L2-normalized feature
+ * vector, searched by cosine similarity.
+ *
+ * The gallery is memory-mapped from a file and searched in place, so opening
+ * it does not copy the vectors. All integers of the file are little endian:
+ *
+ *   offset  size  field
+ *        0     8  magic "NVGALRY1"
+ *        8     4  version, 1
+ *       12     4  precision, a Gallery::Precision
+ *       16     4  dim, elements per vector
+ *       20     4  count, number of identities
+ *       24     8  vectors_offset, count * dim elements
+ *       32     8  scales_offset, count floats for INT8 and 0 otherwise
+ *       40     8  ids_offset, count uint32
+ *       48     8  labels_offset, count uint32 offsets into the strings
+ *       56     8  strings_offset, NUL-terminated labels
+ *       64     8  strings_size, in bytes
+ *
+ * vectors_offset is a multiple of 64, the other offsets of 4. Gallery::write()
+ * creates such a file.
+ */
+class Gallery
+{
+public:
+  /** Storage of the vector elements, same values as NvDsEmbeddingPrecision. */
+  enum class Precision
+  {
+    FP32 = 0,
+    FP16 = 1,
+    /** gint8 with one scale per vector. */
+    INT8 = 2,
+  };
+
+  struct Match
+  {
+    /** Row of the identity in the gallery. */
+    guint index;
+    guint32 id;
+    const gchar *label;
+    /** Cosine similarity with the query. */
+    gfloat score;
+  };
+
+  /** Maximum number of matches search() returns. */
+  static const guint MAX_TOP_K = 32;
+
+  ~Gallery ();
+
+  /** Map the gallery in path. Returns NULL and sets error if the file cannot
+   * be mapped or is not a valid gallery. With prefetch, reading in all
+   * vectors starts right away; without, only the vectors used are read. */
+  static std::unique_ptr<Gallery> open (const std::string &path,
+      std::string &error, bool prefetch = true);
+
+  /** Write a gallery of count vectors of dim floats to path, normalizing and
+   * converting them to precision. Returns false and sets error on
+   * failure. */
+  static bool write (const std::string &path, Precision precision, guint dim,
+      guint count, const gfloat *vectors, const guint32 *ids,
+      const std::vector<std::string> &labels, std::string &error);
+
+  /** Write to path the gallery base with the enrolments of delta applied. An
+   * entry of delta replaces the entry of base with the same identity or is
+   * added, an entry with an empty label removes the identity. The result
+   * keeps the precision of base. Returns false and sets error on
+   * failure. */
+  static bool applyDelta (const Gallery &base, const Gallery &delta,
+      const std::string &path, std::string &error);
+
+  Precision precision () const { return m_Precision; }
+  guint dim () const { return m_Dim; }
+  guint size () const { return m_Count; }
+
+  /** Size and modification time in nanoseconds of the mapped file. Rewriting
+   * the gallery changes them, which lets derived files detect that they are
+   * out of date. */
+  guint64 fileSize () const { return m_MapSize; }
+  gint64 fileTime () const { return m_FileTime; }
+
+  /** Identity and label of row index. */
+  guint32 id (guint index) const { return m_Ids[index]; }
+  const gchar *label (guint index) const
+  {
+    return m_Strings + m_LabelOffsets[index];
+  }
+
+  /** Cosine similarity of the L2-normalized query of dim() floats with row
+   * index. */
+  gfloat score (const gfloat *query, guint index) const;
+
+  /** Write row index to dst as dim() floats. */
+  void row (guint index, gfloat *dst) const;
+
+  /** Find the up to top_k identities most similar to the L2-normalized
+   * query of dim() floats, best first, skipping those scoring below
+   * min_score. Returns the number of matches written to matches. Safe to
+   * call from several threads. */
+  guint search (const gfloat *query, guint top_k, gfloat min_score,
+      Match *matches) const;
+
+  /** Find the matches of num_queries queries of dim() floats stored back to
+   * back, like search(). The matches of query q are written to
+   * matches[q * top_k] and their number to num_found[q]. The gallery is read
+   * once for all queries, one block of rows at a time, so a batch costs
+   * little more than a single search. With a pool, the blocks are split
+   * among its workers. Safe to call from several threads with different
+   * pools. */
+  void searchBatch (const gfloat *queries, guint num_queries, guint top_k,
+      gfloat min_score, Match *matches, guint *num_found,
+      WorkerPool *pool = nullptr) const;
+
+private:
+  Gallery () = default;
+
+  Precision m_Precision = Precision::FP32;
+  guint m_Dim = 0;
+  guint m_Count = 0;
+
+  void *m_Map = nullptr;
+  gsize m_MapSize = 0;
+  gint64 m_FileTime = 0;
+  const void *m_Vectors = nullptr;
+  const gfloat *m_Scales = nullptr;
+  const guint32 *m_Ids = nullptr;
+  const guint32 *m_LabelOffsets = nullptr;
+  const gchar *m_Strings = nullptr;
+};
+
+}
+
+#endif
@@ -0,0 +1,356 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+
+#include "gstnvinfer_gallery_loader.h"
+
+namespace gstnvinfer
+{
+
+/* Version header shared by the loaders of all processes on the host that
+ * use the same gallery. Works as a sequence lock: generation is odd while a
+ * loader writes path and is raised past it when done, so a reader that sees
+ * the same even generation before and after copying path has a consistent
+ * copy. Generation 0 means no loader has published yet. */
+struct GalleryLoader::SharedHeader
+{
+  std::atomic<guint64> generation;
+  gchar path[PATH_MAX];
+};
+
+/* A writer holds the header for a copy of path. One that holds it longer
+ * than this has died while writing, and the header is taken over. */
+static const std::chrono::seconds kSharedWriterTimeout (1);
+
+GalleryLoader::GalleryLoader (const Params & params, Callback callback)
+  : m_Params (params), m_Callback (std::move (callback))
+{
+}
+
+/** Stop and join the load thread. A load in progress is finished first.
+ * The shared header stays for the other processes and later runs. */
+GalleryLoader::~GalleryLoader ()
+{
+  if (m_Thread.joinable ()) {
+    m_PendingLoads.push (LoadItem ("", LoadType::STOP));
+    m_Thread.join ();
+  }
+  m_PendingLoads.clear ();
+
+  if (m_Shared)
+    munmap (m_Shared, sizeof (SharedHeader));
+}
+
+bool
+GalleryLoader::start (std::string & error)
+{
+  std::string path = m_Params.path;
+
+  /* Start from the version the other processes on the host are using. A
+   * header being written is waited for up to the writer timeout. */
+  if (!m_Params.shared_name.empty ()) {
+    if (!openShared (error))
+      return false;
+
+    auto deadline = std::chrono::steady_clock::now () + kSharedWriterTimeout;
+    guint64 generation = 0;
+    std::string shared_path;
+    while (!readShared (generation, shared_path) &&
+        std::chrono::steady_clock::now () < deadline)
+      std::this_thread::sleep_for (std::chrono::milliseconds (1));
+    if (generation > 0 && !(generation & 1) && !shared_path.empty ()) {
+      path = shared_path;
+      m_SeenGeneration = generation;
+    }
+  }
+
+  VersionPtr version = load (path, error);
+  if (!version)
+    return false;
+
+  std::atomic_store (&m_Current, version);
+  m_Thread = std::thread (&GalleryLoader::Run, this);
+  return true;
+}
+
+bool
+GalleryLoader::queue (LoadType type, const std::string & path)
+{
+  if (!m_Thread.joinable ())
+    return false;
+  m_PendingLoads.push (LoadItem (path, type));
+  return true;
+}
+
+void
+GalleryLoader::poll ()
+{
+  if (!m_Shared)
+    return;
+
+  guint64 generation = m_Shared->generation.load (std::memory_order_acquire);
+  if ((generation & 1) || generation == m_SeenGeneration)
+    return;
+
+  /* A header being rewritten is read again on the next poll. */
+  std::string path;
+  if (!readShared (generation, path) || path.empty ())
+    return;
+  m_SeenGeneration = generation;
+  queue (LoadType::SHARED, path);
+}
+
+/* Open the shared header, creating it zeroed if this is the first process
+ * to use it. */
+bool
+GalleryLoader::openShared (std::string & error)
+{
+  const char *name = m_Params.shared_name.c_str ();
+  int fd = shm_open (name, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    error = "Could not open shared memory " + m_Params.shared_name + ": " +
+        strerror (errno);
+    return false;
+  }
+
+  /* Only grows a new, empty object. Extending past the size is harmless if
+   * two processes race here, ftruncate() zero fills. */
+  struct stat st;
+  bool ok = fstat (fd, &st) == 0;
+  if (ok && st.st_size == 0)
+    ok = ftruncate (fd, sizeof (SharedHeader)) == 0;
+  else if (ok && st.st_size < (off_t) sizeof (SharedHeader)) {
+    errno = EINVAL;
+    ok = false;
+  }
+
+  void *header = MAP_FAILED;
+  if (ok)
+    header = mmap (nullptr, sizeof (SharedHeader), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED) {
+    error = "Could not map shared memory " + m_Params.shared_name + ": " +
+        strerror (errno);
+    close (fd);
+    return false;
+  }
+  close (fd);
+
+  m_Shared = static_cast<SharedHeader *> (header);
+  return true;
+}
+
+/* Copy the published path. Returns false if a writer holds the header or
+ * published while it was copied. */
+bool
+GalleryLoader::readShared (guint64 & generation, std::string & path) const
+{
+  generation = m_Shared->generation.load (std::memory_order_acquire);
+  if (generation & 1)
+    return false;
+
+  gchar copy[PATH_MAX];
+  memcpy (copy, m_Shared->path, sizeof (copy));
+  std::atomic_thread_fence (std::memory_order_acquire);
+  if (m_Shared->generation.load (std::memory_order_relaxed) != generation)
+    return false;
+
+  path.assign (copy, strnlen (copy, sizeof (copy)));
+  return true;
+}
+
+/* Publish path as the version every process should use. Called from the
+ * load thread only. */
+void
+GalleryLoader::publishShared (const std::string & path)
+{
+  if (!m_Shared)
+    return;
+
+  /* The other processes may run in other directories. */
+  gchar resolved[PATH_MAX];
+  std::string shared_path = path;
+  if (realpath (path.c_str (), resolved))
+    shared_path = resolved;
+  if (shared_path.size () >= sizeof (m_Shared->path))
+    return;
+
+  /* Take the header by making generation odd. An odd generation that does
+   * not move for the writer timeout belongs to a dead writer and is
+   * taken over by moving it to the next odd value. */
+  guint64 generation = m_Shared->generation.load (std::memory_order_relaxed);
+  auto held_since = std::chrono::steady_clock::now ();
+  while (true) {
+    if (!(generation & 1)) {
+      if (m_Shared->generation.compare_exchange_weak (generation,
+              generation + 1, std::memory_order_acquire)) {
+        generation += 1;
+        break;
+      }
+      held_since = std::chrono::steady_clock::now ();
+      continue;
+    }
+    if (std::chrono::steady_clock::now () - held_since >
+        kSharedWriterTimeout) {
+      if (m_Shared->generation.compare_exchange_strong (generation,
+              generation + 2, std::memory_order_acquire)) {
+        generation += 2;
+        break;
+      }
+      held_since = std::chrono::steady_clock::now ();
+      continue;
+    }
+    std::this_thread::sleep_for (std::chrono::milliseconds (1));
+    guint64 now = m_Shared->generation.load (std::memory_order_relaxed);
+    if (now != generation) {
+      generation = now;
+      held_since = std::chrono::steady_clock::now ();
+    }
+  }
+
+  std::atomic_thread_fence (std::memory_order_release);
+  memset (m_Shared->path, 0, sizeof (m_Shared->path));
+  memcpy (m_Shared->path, shared_path.data (), shared_path.size ());
+
+  /* This process already has the version, poll() must not load it again. */
+  m_SeenGeneration = generation + 1;
+  m_Shared->generation.store (generation + 1, std::memory_order_release);
+}
+
+/* Map the gallery in path and open its index, building the index if it is
+ * missing or stale. */
+GalleryLoader::VersionPtr
+GalleryLoader::load (const std::string & path, std::string & error) const
+{
+  std::shared_ptr<Version> version = std::make_shared<Version> ();
+  version->path = path;
+
+  /* With IVF-PQ the gallery vectors are only read for re-ranking, do not
+   * make them all resident. */
+  version->gallery = Gallery::open (path, error, m_Params.ivfpq_lists == 0);
+  if (!version->gallery)
+    return nullptr;
+
+  const Gallery & gallery = *version->gallery;
+  if (gallery.dim () != m_Params.dim) {
+    error = "Gallery " + path + " holds vectors of " +
+        std::to_string (gallery.dim ()) + " elements, the network outputs " +
+        std::to_string (m_Params.dim);
+    return nullptr;
+  }
+
+  /* The loaders of other processes sharing the gallery may build the same
+   * index at the same time, and the last one to finish replaces the file.
+   * Any index found at the path afterwards is as good as ours, so building
+   * only fails if there is no usable one. */
+  if (m_Params.hnsw_m > 0) {
+    std::string index_path = path + ".hnsw";
+    auto usable = [&] (const std::unique_ptr<HnswIndex> & index) {
+      return index && index->m () == m_Params.hnsw_m &&
+          index->efConstruction () == m_Params.hnsw_ef_construction;
+    };
+    std::unique_ptr<HnswIndex> index =
+        HnswIndex::open (index_path, gallery, error);
+    if (!usable (index)) {
+      std::string build_error;
+      bool built = HnswIndex::build (gallery, index_path, m_Params.hnsw_m,
+          m_Params.hnsw_ef_construction, build_error);
+      index = HnswIndex::open (index_path, gallery, error);
+      if (!usable (index)) {
+        if (!built)
+          error = build_error;
+        else if (index)
+          error = "Index " + index_path + " was replaced with other parameters";
+        return nullptr;
+      }
+    }
+    version->hnsw = std::move (index);
+  }
+
+  if (m_Params.ivfpq_lists > 0) {
+    std::string index_path = path + ".ivfpq";
+    auto usable = [&] (const std::unique_ptr<IvfPqIndex> & index) {
+      return index && index->builtFrom (gallery) &&
+          index->numLists () == m_Params.ivfpq_lists &&
+          index->numSubquantizers () == m_Params.ivfpq_subquantizers;
+    };
+    std::unique_ptr<IvfPqIndex> index = IvfPqIndex::open (index_path, error);
+    if (!usable (index)) {
+      std::string build_error;
+      bool built = IvfPqIndex::build (gallery, index_path,
+          m_Params.ivfpq_lists, m_Params.ivfpq_subquantizers, build_error);
+      index = IvfPqIndex::open (index_path, error);
+      if (!usable (index)) {
+        if (!built)
+          error = build_error;
+        else if (index)
+          error = "Index " + index_path + " was replaced with other parameters";
+        return nullptr;
+      }
+    }
+    version->ivfpq = std::move (index);
+  }
+
+  error.clear ();
+  return version;
+}
+
+/** Callable function for the thread. */
+void
+GalleryLoader::Run ()
+{
+  while (true) {
+    /* Pop a pending load. This is a blocking call. */
+    LoadItem item = m_PendingLoads.pop ();
+    std::string path;
+    LoadType type;
+    std::tie (path, type) = item;
+
+    if (type == LoadType::STOP)
+      break;
+
+    if (path.empty ())
+      continue;
+
+    std::string error;
+    VersionPtr version;
+    if (type == LoadType::DELTA) {
+      /* Only this thread publishes versions, the current one stays. */
+      VersionPtr current = std::atomic_load (&m_Current);
+      std::unique_ptr<Gallery> delta = Gallery::open (path, error);
+      if (delta && Gallery::applyDelta (*current->gallery, *delta,
+              current->path, error))
+        version = load (current->path, error);
+    } else {
+      version = load (path, error);
+    }
+
+    /* Searches still running on the previous version keep it alive. Loads
+     * of this process are published to the others, what another process
+     * published is only followed. */
+    if (version) {
+      std::atomic_store (&m_Current, version);
+      if (type != LoadType::SHARED)
+        publishShared (version->path);
+    }
+    m_Callback (type, path, version != nullptr, error);
+  }
+}
+
+}
@@ -0,0 +1,137 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#ifndef __GSTNVINFER_GALLERY_LOADER_H__
+#define __GSTNVINFER_GALLERY_LOADER_H__
+
+#include <glib.h>
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "nvdsinfer_func_utils.h"
+#include "gstnvinfer_gallery.h"
+#include "gstnvinfer_hnsw.h"
+#include "gstnvinfer_ivfpq.h"
+
+namespace gstnvinfer {
+
+/**
+ * Keeps the face gallery and its index up to date while the pipeline runs.
+ * The gallery is reloaded from a file or has a delta of enrolments applied
+ * in a thread of its own, the way DsNvInferImpl loads new models. Every
+ * load produces a new Version that is published by swapping a shared
+ * pointer: searches take a reference to the current version and never wait
+ * for a load, and an old version is freed once its last reference is
+ * dropped.
+ *
+ * Processes on one host that load the same gallery can share its reloads.
+ * The gallery files are mapped read-only, so the page cache holds one copy
+ * of them per host. With a shared name, a loader publishes the path of
+ * every version it loads in a small POSIX shared memory header, and the
+ * loaders of the other processes follow it on their next poll().
+ */
+class GalleryLoader
+{
+public:
+  struct Params
+  {
+    /** Gallery loaded by start(). */
+    std::string path;
+    /** Number of vector elements the network outputs. */
+    guint dim = 0;
+    /** Index settings, see GstNvInferOnnx. An index is built if it is
+     * missing, out of date or was built with other settings. */
+    guint hnsw_m = 0;
+    guint hnsw_ef_construction = 0;
+    guint ivfpq_lists = 0;
+    guint ivfpq_subquantizers = 0;
+    /** Name of the shared memory version header, empty to not share
+     * reloads with other processes. */
+    std::string shared_name;
+  };
+
+  /** One loaded state of the gallery. Read-only once published. */
+  struct Version
+  {
+    std::string path;
+    std::unique_ptr<Gallery> gallery;
+    std::unique_ptr<HnswIndex> hnsw;
+    std::unique_ptr<IvfPqIndex> ivfpq;
+  };
+  using VersionPtr = std::shared_ptr<const Version>;
+
+  enum class LoadType
+  {
+    /** Replace the gallery with the one in a file. */
+    FILE,
+    /** Apply the enrolments of a delta gallery, see Gallery::applyDelta(),
+     * and write the result back to the current gallery file. */
+    DELTA,
+    /** Follow a reload published by the loader of another process. */
+    SHARED,
+    /** Stop the load thread. */
+    STOP,
+  };
+
+  /** Called from the load thread with the outcome of every queued load. */
+  using Callback = std::function<void (LoadType type, const std::string &path,
+      bool ok, const std::string &error)>;
+
+  GalleryLoader (const Params &params, Callback callback);
+  ~GalleryLoader ();
+
+  /** Load the gallery in params.path in the calling thread and start the
+   * load thread. Returns false and sets error on failure. */
+  bool start (std::string &error);
+
+  /** Queue a load. Returns false if the loader is not started. */
+  bool queue (LoadType type, const std::string &path);
+
+  /** Current version, NULL before start(). */
+  VersionPtr current () const { return std::atomic_load (&m_Current); }
+
+  /** Queue a load of the version another process published, if any. Costs
+   * one atomic load otherwise. Must only be called from one thread at a
+   * time. */
+  void poll ();
+
+private:
+  using LoadItem = std::tuple<std::string, LoadType>;
+  struct SharedHeader;
+
+  VersionPtr load (const std::string &path, std::string &error) const;
+  void Run ();
+
+  bool openShared (std::string &error);
+  bool readShared (guint64 &generation, std::string &path) const;
+  void publishShared (const std::string &path);
+
+  Params m_Params;
+  Callback m_Callback;
+  VersionPtr m_Current;
+  std::thread m_Thread;
+  nvdsinfer::GuardQueue<std::list<LoadItem>> m_PendingLoads;
+
+  /* Shared version header and the generation of it this process has
+   * loaded or published. */
+  SharedHeader *m_Shared = nullptr;
+  std::atomic<guint64> m_SeenGeneration {0};
+};
+
+}
+
+#endif
@@ -0,0 +1,530 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "gstnvinfer_hnsw.h"
+
+#define HNSW_MAGIC "NVHNSW01"
+#define HNSW_VERSION 1
+
+/* Limits of the graph parameters. They keep the link lists small and the
+ * level of a node within a byte. */
+#define HNSW_MIN_M 2
+#define HNSW_MAX_M 128
+#define HNSW_MAX_LEVEL 16
+
+/* Seed of the level assignment, so that building the same gallery twice
+ * gives the same graph. */
+#define HNSW_SEED 42
+
+namespace gstnvinfer
+{
+
+namespace
+{
+
+struct HnswFileHeader
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 m;
+  guint32 ef_construction;
+  guint32 count;
+  guint32 entry_point;
+  guint32 max_level;
+  guint64 gallery_size;
+  gint64 gallery_time;
+  guint64 levels_offset;
+  guint64 level0_offset;
+  guint64 upper_index_offset;
+  guint64 upper_offset;
+  guint64 upper_size;
+};
+
+static_assert (sizeof (HnswFileHeader) == 88,
+    "index header layout must not depend on the compiler");
+
+/* Links of the graph, in the layout of the index file. Building writes to
+ * them, searching a mapped index only reads. */
+struct Graph
+{
+  const Gallery *gallery;
+  guint m;
+  const guint8 *levels;
+  guint32 *level0;
+  const guint32 *upper_index;
+  guint32 *upper;
+
+  /* Number of links of node on level followed by their slots. */
+  guint32 *links (guint node, guint level) const
+  {
+    if (level == 0)
+      return level0 + (gsize) node * (2 * m + 1);
+    return upper + upper_index[node] + (gsize) (level - 1) * (m + 1);
+  }
+
+  guint capacity (guint level) const
+  {
+    return level == 0 ? 2 * m : m;
+  }
+};
+
+struct Candidate
+{
+  gfloat score;
+  guint32 node;
+};
+
+struct BestFirst
+{
+  bool operator() (const Candidate &a, const Candidate &b) const
+  {
+    return a.score < b.score;
+  }
+};
+
+struct WorstFirst
+{
+  bool operator() (const Candidate &a, const Candidate &b) const
+  {
+    return a.score > b.score;
+  }
+};
+
+/* Nodes visited by the current search. Starting a search only bumps the tag
+ * instead of clearing the marks of every node. */
+class VisitedSet
+{
+public:
+  void reset (guint count)
+  {
+    if (m_Marks.size () != count || ++m_Tag == 0) {
+      m_Marks.assign (count, 0);
+      m_Tag = 1;
+    }
+  }
+
+  /* Returns false if node was visited already. */
+  bool insert (guint node)
+  {
+    if (m_Marks[node] == m_Tag)
+      return false;
+    m_Marks[node] = m_Tag;
+    return true;
+  }
+
+private:
+  std::vector<guint32> m_Marks;
+  guint32 m_Tag = 0;
+};
+
+/* Move node to the neighbour on level most similar to query until none is
+ * more similar. */
+void
+greedy_descend (const Graph &graph, const gfloat *query, guint &node,
+    gfloat &score, guint level)
+{
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    const guint32 *links = graph.links (node, level);
+    for (guint j = 1; j <= links[0]; j++) {
+      gfloat s = graph.gallery->score (query, links[j]);
+      if (s > score) {
+        score = s;
+        node = links[j];
+        changed = true;
+      }
+    }
+  }
+}
+
+/* Best-first search of level starting at entry. Returns the up to ef most
+ * similar nodes found in results, best first. */
+void
+search_layer (const Graph &graph, const gfloat *query, guint entry,
+    gfloat entry_score, guint ef, guint level, VisitedSet &visited,
+    std::vector<Candidate> &results)
+{
+  std::priority_queue<Candidate, std::vector<Candidate>, BestFirst> candidates;
+  std::priority_queue<Candidate, std::vector<Candidate>, WorstFirst> found;
+
+  visited.reset (graph.gallery->size ());
+  visited.insert (entry);
+  candidates.push ({entry_score, entry});
+  found.push ({entry_score, entry});
+
+  while (!candidates.empty ()) {
+    Candidate current = candidates.top ();
+    /* Every candidate left is less similar than all found nodes. */
+    if (found.size () >= ef && current.score < found.top ().score)
+      break;
+    candidates.pop ();
+
+    const guint32 *links = graph.links (current.node, level);
+    for (guint j = 1; j <= links[0]; j++) {
+      guint neighbour = links[j];
+      if (!visited.insert (neighbour))
+        continue;
+
+      gfloat s = graph.gallery->score (query, neighbour);
+      if (found.size () < ef || s > found.top ().score) {
+        candidates.push ({s, neighbour});
+        found.push ({s, neighbour});
+        if (found.size () > ef)
+          found.pop ();
+      }
+    }
+  }
+
+  results.resize (found.size ());
+  for (gsize i = results.size (); i > 0; i--) {
+    results[i - 1] = found.top ();
+    found.pop ();
+  }
+}
+
+/* Pick up to max_links of the candidates, which are sorted best first by
+ * their similarity to a base node. A candidate is skipped if it is more
+ * similar to an already picked one than to the base, which keeps links to
+ * distant parts of the graph instead of a clique of near duplicates. */
+void
+select_neighbours (const Graph &graph, const std::vector<Candidate> &candidates,
+    guint max_links, std::vector<gfloat> &row,
+    std::vector<Candidate> &selected)
+{
+  selected.clear ();
+  for (const Candidate &candidate : candidates) {
+    if (selected.size () >= max_links)
+      break;
+
+    graph.gallery->row (candidate.node, row.data ());
+    bool keep = true;
+    for (const Candidate &other : selected) {
+      if (graph.gallery->score (row.data (), other.node) > candidate.score) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep)
+      selected.push_back (candidate);
+  }
+}
+
+/* Link node to the selected nodes on level and back. A node whose links
+ * are full selects its links anew among the old ones and node. */
+void
+connect (const Graph &graph, guint node, guint level,
+    const std::vector<Candidate> &selected, std::vector<gfloat> &base,
+    std::vector<gfloat> &row)
+{
+  guint32 *links = graph.links (node, level);
+  links[0] = selected.size ();
+  for (gsize j = 0; j < selected.size (); j++)
+    links[j + 1] = selected[j].node;
+
+  std::vector<Candidate> candidates, pruned;
+  for (const Candidate &neighbour : selected) {
+    guint32 *other = graph.links (neighbour.node, level);
+    if (other[0] < graph.capacity (level)) {
+      other[++other[0]] = node;
+      continue;
+    }
+
+    graph.gallery->row (neighbour.node, base.data ());
+    candidates.clear ();
+    candidates.push_back ({neighbour.score, node});
+    for (guint j = 1; j <= other[0]; j++)
+      candidates.push_back ({graph.gallery->score (base.data (), other[j]),
+              other[j]});
+    std::sort (candidates.begin (), candidates.end (),
+        [] (const Candidate &a, const Candidate &b) {
+          return a.score > b.score;
+        });
+
+    select_neighbours (graph, candidates, graph.capacity (level), row, pruned);
+    other[0] = pruned.size ();
+    for (gsize j = 0; j < pruned.size (); j++)
+      other[j + 1] = pruned[j].node;
+  }
+}
+
+bool
+in_file (guint64 offset, guint64 size, guint64 file_size)
+{
+  return offset <= file_size && size <= file_size - offset;
+}
+
+}
+
+HnswIndex::~HnswIndex ()
+{
+  if (m_Map)
+    munmap (m_Map, m_MapSize);
+}
+
+bool
+HnswIndex::build (const Gallery &gallery, const std::string &path, guint m,
+    guint ef_construction, std::string &error)
+{
+  if (m < HNSW_MIN_M || m > HNSW_MAX_M || ef_construction == 0) {
+    error = "Invalid HNSW parameters";
+    return false;
+  }
+
+  guint count = gallery.size ();
+  HnswFileHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, HNSW_MAGIC, sizeof (header.magic));
+  header.version = HNSW_VERSION;
+  header.m = m;
+  header.ef_construction = ef_construction;
+  header.count = count;
+  header.gallery_size = gallery.fileSize ();
+  header.gallery_time = gallery.fileTime ();
+
+  /* Node levels follow a geometric distribution, each layer holding about
+   * 1 / m of the nodes of the layer below. */
+  std::vector<guint8> levels (count);
+  std::vector<guint32> upper_index (count);
+  std::mt19937 rng (HNSW_SEED);
+  std::uniform_real_distribution<double> uniform (0.0, 1.0);
+  double level_mult = 1.0 / log ((double) m);
+  guint64 upper_size = 0;
+  for (guint i = 0; i < count; i++) {
+    double level = -log (1.0 - uniform (rng)) * level_mult;
+    levels[i] = (guint8) MIN (level, (double) HNSW_MAX_LEVEL);
+    upper_index[i] = upper_size;
+    upper_size += (guint64) levels[i] * (m + 1);
+    if (upper_size > G_MAXUINT32) {
+      error = "Gallery is too large for an HNSW index";
+      return false;
+    }
+  }
+
+  header.levels_offset = sizeof (header);
+  header.level0_offset = (header.levels_offset + count + 3) / 4 * 4;
+  header.upper_index_offset = header.level0_offset +
+      (guint64) count * (2 * m + 1) * 4;
+  header.upper_offset = header.upper_index_offset + (guint64) count * 4;
+  header.upper_size = upper_size;
+
+  std::vector<guint8> data (header.upper_offset + upper_size * 4);
+  memcpy (data.data () + header.levels_offset, levels.data (), count);
+  memcpy (data.data () + header.upper_index_offset, upper_index.data (),
+      (gsize) count * 4);
+
+  Graph graph;
+  graph.gallery = &gallery;
+  graph.m = m;
+  graph.levels = levels.data ();
+  graph.level0 = (guint32 *) (data.data () + header.level0_offset);
+  graph.upper_index = upper_index.data ();
+  graph.upper = (guint32 *) (data.data () + header.upper_offset);
+
+  /* Insert the nodes one by one: find the closest nodes on every layer of
+   * the new node from the top down and link to a diverse subset of them. */
+  VisitedSet visited;
+  std::vector<Candidate> results, selected;
+  std::vector<gfloat> query (gallery.dim ()), base (gallery.dim ()),
+      row (gallery.dim ());
+  guint entry_point = 0;
+  guint max_level = count > 0 ? levels[0] : 0;
+
+  for (guint i = 1; i < count; i++) {
+    gallery.row (i, query.data ());
+    guint node = entry_point;
+    gfloat score = gallery.score (query.data (), node);
+
+    for (guint level = max_level; level > levels[i]; level--)
+      greedy_descend (graph, query.data (), node, score, level);
+
+    for (gint level = MIN (levels[i], max_level); level >= 0; level--) {
+      search_layer (graph, query.data (), node, score, ef_construction,
+          level, visited, results);
+      select_neighbours (graph, results, m, row, selected);
+      connect (graph, i, level, selected, base, row);
+      node = results[0].node;
+      score = results[0].score;
+    }
+
+    if (levels[i] > max_level) {
+      entry_point = i;
+      max_level = levels[i];
+    }
+  }
+
+  header.entry_point = entry_point;
+  header.max_level = max_level;
+  memcpy (data.data (), &header, sizeof (header));
+
+  return write_file_atomically (path, data.data (), data.size (), error);
+}
+
+std::unique_ptr<HnswIndex>
+HnswIndex::open (const std::string &path, const Gallery &gallery,
+    std::string &error)
+{
+  int fd = ::open (path.c_str (), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    error = "Could not open " + path + ": " + strerror (errno);
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat (fd, &st) != 0 || st.st_size < (off_t) sizeof (HnswFileHeader)) {
+    error = "Index " + path + " is truncated";
+    ::close (fd);
+    return nullptr;
+  }
+
+  void *map = mmap (nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close (fd);
+  if (map == MAP_FAILED) {
+    error = "Could not map " + path + ": " + strerror (errno);
+    return nullptr;
+  }
+
+  std::unique_ptr<HnswIndex> index (new HnswIndex (gallery));
+  index->m_Map = map;
+  index->m_MapSize = st.st_size;
+
+  const guint8 *base = (const guint8 *) map;
+  guint64 file_size = st.st_size;
+  HnswFileHeader header;
+  memcpy (&header, base, sizeof (header));
+
+  if (memcmp (header.magic, HNSW_MAGIC, sizeof (header.magic)) != 0 ||
+      header.version != HNSW_VERSION) {
+    error = path + " is not a version " G_STRINGIFY (HNSW_VERSION)
+        " HNSW index";
+    return nullptr;
+  }
+  if (header.count != gallery.size () ||
+      header.gallery_size != gallery.fileSize () ||
+      header.gallery_time != gallery.fileTime ()) {
+    error = "Index " + path + " was built for another gallery";
+    return nullptr;
+  }
+
+  guint64 count = header.count;
+  guint m = header.m;
+  if (m < HNSW_MIN_M || m > HNSW_MAX_M || header.max_level > HNSW_MAX_LEVEL ||
+      (count > 0 && header.entry_point >= count) ||
+      header.level0_offset % 4 || header.upper_index_offset % 4 ||
+      header.upper_offset % 4 ||
+      !in_file (header.levels_offset, count, file_size) ||
+      !in_file (header.level0_offset, count * (2 * m + 1) * 4, file_size) ||
+      !in_file (header.upper_index_offset, count * 4, file_size) ||
+      header.upper_size > G_MAXUINT32 ||
+      !in_file (header.upper_offset, header.upper_size * 4, file_size)) {
+    error = "Index " + path + " has an invalid header";
+    return nullptr;
+  }
+
+  index->m_M = m;
+  index->m_EfConstruction = header.ef_construction;
+  index->m_EntryPoint = header.entry_point;
+  index->m_MaxLevel = header.max_level;
+  index->m_Levels = base + header.levels_offset;
+  index->m_Level0 = (const guint32 *) (base + header.level0_offset);
+  index->m_UpperIndex = (const guint32 *) (base + header.upper_index_offset);
+  index->m_Upper = (const guint32 *) (base + header.upper_offset);
+
+  /* Searches follow the links without checks, so every link of a corrupt
+   * file must be caught here. */
+  if (count > 0 && index->m_Levels[header.entry_point] != header.max_level) {
+    error = "Index " + path + " has an invalid entry point";
+    return nullptr;
+  }
+  for (guint64 n = 0; n < count; n++) {
+    guint levels = index->m_Levels[n];
+    if (levels > header.max_level || (guint64) index->m_UpperIndex[n] +
+        (guint64) levels * (m + 1) > header.upper_size) {
+      error = "Index " + path + " has nodes outside of the links";
+      return nullptr;
+    }
+    for (guint level = 0; level <= levels; level++) {
+      const guint32 *links = level == 0 ?
+          index->m_Level0 + n * (2 * m + 1) :
+          index->m_Upper + index->m_UpperIndex[n] + (level - 1) * (m + 1);
+      bool valid = links[0] <= (level == 0 ? 2 * m : m);
+      for (guint j = 1; valid && j <= links[0]; j++)
+        valid = links[j] < count && index->m_Levels[links[j]] >= level;
+      if (!valid) {
+        error = "Index " + path + " has invalid links";
+        return nullptr;
+      }
+    }
+  }
+
+  return index;
+}
+
+guint
+HnswIndex::search (const gfloat *query, guint top_k, guint ef,
+    gfloat min_score, Gallery::Match *matches) const
+{
+  top_k = MIN (top_k, Gallery::MAX_TOP_K);
+  if (top_k == 0 || m_Gallery.size () == 0)
+    return 0;
+  ef = MAX (ef, top_k);
+
+  /* Searching never writes to the links. */
+  Graph graph;
+  graph.gallery = &m_Gallery;
+  graph.m = m_M;
+  graph.levels = m_Levels;
+  graph.level0 = (guint32 *) m_Level0;
+  graph.upper_index = m_UpperIndex;
+  graph.upper = (guint32 *) m_Upper;
+
+  static thread_local VisitedSet visited;
+  static thread_local std::vector<Candidate> results;
+
+  guint node = m_EntryPoint;
+  gfloat score = m_Gallery.score (query, node);
+  for (guint level = m_MaxLevel; level > 0; level--)
+    greedy_descend (graph, query, node, score, level);
+  search_layer (graph, query, node, score, ef, 0, visited, results);
+
+  /* Order equal scores like Gallery::search(), lower row first. */
+  std::sort (results.begin (), results.end (),
+      [] (const Candidate &a, const Candidate &b) {
+        return a.score > b.score || (a.score == b.score && a.node < b.node);
+      });
+
+  guint found = 0;
+  for (const Candidate &result : results) {
+    if (found == top_k || result.score < min_score)
+      break;
+    matches[found].index = result.node;
+    matches[found].id = m_Gallery.id (result.node);
+    matches[found].label = m_Gallery.label (result.node);
+    matches[found].score = result.score;
+    found++;
+  }
+  return found;
+}
+
+}
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#ifndef __GSTNVINFER_HNSW_H__
+#define __GSTNVINFER_HNSW_H__
+
+#include <glib.h>
+
+#include <memory>
+#include <string>
+
+#include "gstnvinfer_gallery.h"
+
+namespace gstnvinfer {
+
+/**
+ * Hierarchical navigable small world graph over the vectors of a Gallery,
+ * for approximate searches of galleries too large to scan for every batch.
+ * Every node links to up to m nodes on each of its upper layers and to up to
+ * 2 * m nodes on layer 0. A search descends greedily from the entry point
+ * through the upper layers and then explores about ef nodes on layer 0.
+ *
+ * The graph is stored in a file of its own next to the gallery and is
+ * memory-mapped like it. The file records the size and modification time of
+ * the gallery it was built for, so rewriting the gallery invalidates the
+ * index. All integers of the file are little endian:
+ *
+ *   offset  size  field
+ *        0     8  magic "NVHNSW01"
+ *        8     4  version, 1
+ *       12     4  m
+ *       16     4  ef_construction
+ *       20     4  count, number of nodes, same as the gallery
+ *       24     4  entry_point, node on the top layer
+ *       28     4  max_level, top layer
+ *       32     8  gallery_size
+ *       40     8  gallery_time, in nanoseconds
+ *       48     8  levels_offset, count uint8, top layer of every node
+ *       56     8  level0_offset, count * (2 * m + 1) uint32
+ *       64     8  upper_index_offset, count uint32
+ *       72     8  upper_offset, upper_size uint32
+ *       80     8  upper_size
+ *
+ * The links of a node on a layer are stored as their number followed by the
+ * slots of the layer. Node n uses slots level0_offset + n * (2 * m + 1) on
+ * layer 0 and upper_offset + upper_index[n] + (l - 1) * (m + 1) on layer l.
+ */
+class HnswIndex
+{
+public:
+  ~HnswIndex ();
+
+  /** Build the index of gallery with up to m links per node, exploring
+   * ef_construction nodes per insertion, and write it to path. Returns
+   * false and sets error on failure. Takes a while for large galleries. */
+  static bool build (const Gallery &gallery, const std::string &path,
+      guint m, guint ef_construction, std::string &error);
+
+  /** Map the index in path. Returns NULL and sets error if the file cannot
+   * be mapped or is not a valid index of gallery. The gallery must outlive
+   * the index. */
+  static std::unique_ptr<HnswIndex> open (const std::string &path,
+      const Gallery &gallery, std::string &error);
+
+  guint m () const { return m_M; }
+  guint efConstruction () const { return m_EfConstruction; }
+
+  /** Like Gallery::search(), but only scores about ef of the gallery
+   * vectors, so the matches are not always the best ones. A larger ef finds
+   * more of them at the cost of time; ef is raised to top_k if lower. Safe
+   * to call from several threads. */
+  guint search (const gfloat *query, guint top_k, guint ef, gfloat min_score,
+      Gallery::Match *matches) const;
+
+private:
+  HnswIndex (const Gallery &gallery) : m_Gallery (gallery) {}
+
+  const Gallery &m_Gallery;
+  guint m_M = 0;
+  guint m_EfConstruction = 0;
+  guint m_EntryPoint = 0;
+  guint m_MaxLevel = 0;
+
+  void *m_Map = nullptr;
+  gsize m_MapSize = 0;
+  const guint8 *m_Levels = nullptr;
+  const guint32 *m_Level0 = nullptr;
+  const guint32 *m_UpperIndex = nullptr;
+  const guint32 *m_Upper = nullptr;
+};
+
+}
+
+#endif
@@ -351,19 +351,18 @@ DsNvInferImpl::flushDataUnlock (LockGMutex & lock)
   GstNvInferOnnxBatch *batch = new GstNvInferOnnxBatch;
   batch->event_marker = TRUE;
 
-  /* Push the event marker batch to ensure all data processed. */
-  g_queue_push_tail (m_GstInfer->input_queue, batch);
-  g_cond_broadcast (&m_GstInfer->process_cond);
+  /* Push the event marker batch to ensure all data processed, after closing
+   * a batch left open for accumulation. The output thread takes the lock for
+   * every batch, it must not be held while waiting for the queues. */
+  lock.unlock ();
+  if (m_GstInfer->accumulate_open->exchange (nullptr))
+    m_GstInfer->accumulate_spot->notify ();
+  m_GstInfer->input_queue->push (batch);
 
   /* Wait till all the items in the two queues are handled. */
-  while (!g_queue_is_empty (m_GstInfer->input_queue)) {
-    lock.wait (m_GstInfer->process_cond);
-  }
-  while (!g_queue_is_empty (m_GstInfer->process_queue)) {
-    lock.wait (m_GstInfer->process_cond);
-  }
-
-  g_cond_broadcast (&m_GstInfer->process_cond);
+  m_GstInfer->input_queue->waitEmpty ();
+  m_GstInfer->process_queue->waitEmpty ();
+  lock.lock ();
 
   for (auto & si:*(m_GstInfer->source_info)) {
     si.second.object_history_map.clear ();
@@ -19,6 +19,7 @@
 
 #include <vector>
 #include <list>
+#include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
@@ -72,6 +73,18 @@ typedef struct {
   /** Pointer to the structure holding inference history for the object. Should
    * be NULL when inferencing on frames. */
   std::weak_ptr<GstNvInferOnnxObjectHistory> history;
+  /** Source and tracking id of the object. Not required for frames. */
+  guint source_id = 0;
+  guint64 object_id = 0;
+  /** Best-shot mode. Set if the frame is the best crop of a track, which is
+   * then reported with its score. lost is set if the track was already
+   * gone, in which case there is no obj_meta. */
+  gboolean best_shot = FALSE;
+  gboolean best_shot_lost = FALSE;
+  gfloat best_shot_score = 0;
+  /** Embedding aggregation. Weight of the embedding of the object in the
+   * aggregate of its track. */
+  gfloat embedding_weight = 1;
 
 } GstNvInferOnnxFrame;
 
@@ -104,6 +117,15 @@ typedef struct {
   /** List of objects not inferred on in the current batch but pending
    * attachment of lastest available classification metadata. */
   std::vector <GstNvInferOnnxObjHistory_MetaPair> objs_pending_meta_attach;
+
+  /** Batch accumulation. Set if the batch was queued before it was full, to
+   * be completed with the objects of the next input buffers until
+   * accumulate_deadline. See GstNvInferOnnx::accumulate_open. */
+  gboolean accumulate = FALSE;
+  std::chrono::steady_clock::time_point accumulate_deadline;
+  /** Number of frames already converted into conv_buf. Frames of an input
+   * buffer are converted before the next buffer is processed. */
+  guint num_converted = 0;
 } GstNvInferOnnxBatch;
 
 
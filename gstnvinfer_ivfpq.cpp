@@ -0,0 +1,585 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "embedding_kernels.h"
+#include "gstnvinfer_ivfpq.h"
+#include "gstnvinfer_worker_pool.h"
+
+#define IVFPQ_MAGIC "NVIVFPQ1"
+#define IVFPQ_VERSION 1
+
+#define IVFPQ_MAX_DIM 65536
+#define IVFPQ_MAX_LISTS 65536
+#define IVFPQ_CODEBOOK_SIZE 256
+
+/* Vectors sampled to train the centroids and Lloyd iterations run. */
+#define IVFPQ_TRAIN_SAMPLES 65536
+#define IVFPQ_TRAIN_ITERATIONS 16
+#define IVFPQ_SEED 42
+
+/* Scores computed per call of the batched kernel while training, and rows
+ * encoded at a time. */
+#define IVFPQ_SCORE_BLOCK (1 << 20)
+#define IVFPQ_ENCODE_ROWS 4096
+
+#define IVFPQ_NO_ROW G_MAXUINT32
+
+namespace gstnvinfer
+{
+
+namespace
+{
+
+struct IvfPqFileHeader
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 dim;
+  guint32 count;
+  guint32 num_lists;
+  guint32 num_subquantizers;
+  guint32 num_blocks;
+  guint64 gallery_size;
+  gint64 gallery_time;
+  guint64 centroids_offset;
+  guint64 codebooks_offset;
+  guint64 lists_offset;
+  guint64 codes_offset;
+  guint64 rows_offset;
+  guint64 ids_offset;
+  guint64 labels_offset;
+  guint64 strings_offset;
+  guint64 strings_size;
+};
+
+static_assert (sizeof (IvfPqFileHeader) == 120,
+    "index header layout must not depend on the compiler");
+
+struct Candidate
+{
+  gfloat score;
+  guint32 row;
+};
+
+struct WorstFirst
+{
+  bool operator() (const Candidate &a, const Candidate &b) const
+  {
+    return a.score > b.score;
+  }
+};
+
+bool
+in_file (guint64 offset, guint64 size, guint64 file_size)
+{
+  return offset <= file_size && size <= file_size - offset;
+}
+
+guint64
+align_up (guint64 value, guint64 alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+/* Write the index of the centroid closest to each of the n vectors of data
+ * to labels. The closest centroid by euclidean distance has the largest
+ * x.c - |c|^2 / 2, which for unit centroids is the largest cosine
+ * similarity. */
+void
+assign (const gfloat *data, guint n, guint d, const gfloat *centroids,
+    guint k, guint32 *labels)
+{
+  std::vector<gfloat> half_norms (k);
+  for (guint c = 0; c < k; c++) {
+    const gfloat *centroid = centroids + (gsize) c * d;
+    half_norms[c] = 0.5f * std::inner_product (centroid, centroid + d,
+        centroid, 0.0f);
+  }
+
+  guint block = MAX (1u, IVFPQ_SCORE_BLOCK / k);
+  std::vector<gfloat> scores ((gsize) MIN (block, n) * k);
+  for (guint start = 0; start < n; start += block) {
+    guint rows = MIN (block, n - start);
+    mirror::DotProductsBatchF32 (data + (gsize) start * d, rows, centroids,
+        d, k, scores.data ());
+    for (guint i = 0; i < rows; i++) {
+      const gfloat *s = scores.data () + (gsize) i * k;
+      guint best = 0;
+      for (guint c = 1; c < k; c++) {
+        if (s[c] - half_norms[c] > s[best] - half_norms[best])
+          best = c;
+      }
+      labels[start + i] = best;
+    }
+  }
+}
+
+/* Lloyd's k-means of the n vectors of data into k centroids, starting from
+ * k random vectors. Spherical k-means keeps the centroids at unit length. A
+ * centroid left without vectors keeps its position. */
+void
+train_kmeans (const gfloat *data, guint n, guint d, guint k, bool spherical,
+    std::mt19937 &rng, gfloat *centroids)
+{
+  std::vector<guint> order (n);
+  std::iota (order.begin (), order.end (), 0);
+  std::shuffle (order.begin (), order.end (), rng);
+  for (guint c = 0; c < k; c++)
+    memcpy (centroids + (gsize) c * d, data + (gsize) order[c % n] * d,
+        d * sizeof (gfloat));
+
+  std::vector<guint32> labels (n);
+  std::vector<gfloat> sums ((gsize) k * d);
+  std::vector<guint> sizes (k);
+  for (guint iteration = 0; iteration < IVFPQ_TRAIN_ITERATIONS; iteration++) {
+    assign (data, n, d, centroids, k, labels.data ());
+
+    std::fill (sums.begin (), sums.end (), 0.0f);
+    std::fill (sizes.begin (), sizes.end (), 0);
+    for (guint i = 0; i < n; i++) {
+      gfloat *sum = sums.data () + (gsize) labels[i] * d;
+      const gfloat *x = data + (gsize) i * d;
+      for (guint j = 0; j < d; j++)
+        sum[j] += x[j];
+      sizes[labels[i]]++;
+    }
+    for (guint c = 0; c < k; c++) {
+      if (sizes[c] == 0)
+        continue;
+      gfloat *centroid = centroids + (gsize) c * d;
+      for (guint j = 0; j < d; j++)
+        centroid[j] = sums[(gsize) c * d + j] / sizes[c];
+      if (spherical)
+        mirror::L2Normalize (centroid, centroid, d);
+    }
+  }
+}
+
+/* List and product quantization codes of the n vectors of data. The
+ * vectors are overwritten with their differences to the list centroids. */
+void
+encode (gfloat *data, guint n, guint dim, const gfloat *centroids,
+    guint num_lists, const gfloat *codebooks, guint num_subquantizers,
+    guint32 *lists, guint8 *codes)
+{
+  guint dsub = dim / num_subquantizers;
+  std::vector<gfloat> pieces ((gsize) n * dsub);
+  std::vector<guint32> labels (n);
+
+  assign (data, n, dim, centroids, num_lists, lists);
+  for (guint i = 0; i < n; i++) {
+    const gfloat *centroid = centroids + (gsize) lists[i] * dim;
+    for (guint j = 0; j < dim; j++)
+      data[(gsize) i * dim + j] -= centroid[j];
+  }
+
+  for (guint m = 0; m < num_subquantizers; m++) {
+    for (guint i = 0; i < n; i++)
+      memcpy (pieces.data () + (gsize) i * dsub,
+          data + (gsize) i * dim + m * dsub, dsub * sizeof (gfloat));
+    assign (pieces.data (), n, dsub,
+        codebooks + (gsize) m * IVFPQ_CODEBOOK_SIZE * dsub,
+        IVFPQ_CODEBOOK_SIZE, labels.data ());
+    for (guint i = 0; i < n; i++)
+      codes[(gsize) i * num_subquantizers + m] = labels[i];
+  }
+}
+
+}
+
+IvfPqIndex::~IvfPqIndex ()
+{
+  if (m_Map)
+    munmap (m_Map, m_MapSize);
+}
+
+bool
+IvfPqIndex::build (const Gallery &gallery, const std::string &path,
+    guint num_lists, guint num_subquantizers, std::string &error)
+{
+  guint dim = gallery.dim ();
+  guint count = gallery.size ();
+  if (num_lists == 0 || num_lists > IVFPQ_MAX_LISTS ||
+      num_subquantizers == 0 || dim % num_subquantizers != 0) {
+    error = "Invalid IVF-PQ parameters for vectors of " +
+        std::to_string (dim) + " elements";
+    return false;
+  }
+  if (count == 0) {
+    error = "Cannot train an IVF-PQ index on an empty gallery";
+    return false;
+  }
+  guint dsub = dim / num_subquantizers;
+
+  /* Train on a random sample of the gallery. */
+  std::mt19937 rng (IVFPQ_SEED);
+  std::vector<guint> order (count);
+  std::iota (order.begin (), order.end (), 0);
+  std::shuffle (order.begin (), order.end (), rng);
+  guint num_train = MIN (count, (guint) IVFPQ_TRAIN_SAMPLES);
+  std::vector<gfloat> train ((gsize) num_train * dim);
+  for (guint i = 0; i < num_train; i++)
+    gallery.row (order[i], train.data () + (gsize) i * dim);
+
+  std::vector<gfloat> centroids ((gsize) num_lists * dim);
+  train_kmeans (train.data (), num_train, dim, num_lists, true, rng,
+      centroids.data ());
+
+  std::vector<guint32> train_lists (num_train);
+  assign (train.data (), num_train, dim, centroids.data (), num_lists,
+      train_lists.data ());
+  for (guint i = 0; i < num_train; i++) {
+    const gfloat *centroid = centroids.data () + (gsize) train_lists[i] * dim;
+    for (guint j = 0; j < dim; j++)
+      train[(gsize) i * dim + j] -= centroid[j];
+  }
+
+  std::vector<gfloat> codebooks ((gsize) num_subquantizers *
+      IVFPQ_CODEBOOK_SIZE * dsub);
+  std::vector<gfloat> pieces ((gsize) num_train * dsub);
+  for (guint m = 0; m < num_subquantizers; m++) {
+    for (guint i = 0; i < num_train; i++)
+      memcpy (pieces.data () + (gsize) i * dsub,
+          train.data () + (gsize) i * dim + m * dsub, dsub * sizeof (gfloat));
+    train_kmeans (pieces.data (), num_train, dsub, IVFPQ_CODEBOOK_SIZE, false,
+        rng, codebooks.data () + (gsize) m * IVFPQ_CODEBOOK_SIZE * dsub);
+  }
+  train.clear ();
+  train.shrink_to_fit ();
+
+  /* Encode every vector of the gallery. */
+  std::vector<guint32> row_lists (count);
+  std::vector<guint8> row_codes ((gsize) count * num_subquantizers);
+  std::vector<gfloat> rows ((gsize) MIN (count, (guint) IVFPQ_ENCODE_ROWS) *
+      dim);
+  for (guint start = 0; start < count; start += IVFPQ_ENCODE_ROWS) {
+    guint n = MIN ((guint) IVFPQ_ENCODE_ROWS, count - start);
+    for (guint i = 0; i < n; i++)
+      gallery.row (start + i, rows.data () + (gsize) i * dim);
+    encode (rows.data (), n, dim, centroids.data (), num_lists,
+        codebooks.data (), num_subquantizers, row_lists.data () + start,
+        row_codes.data () + (gsize) start * num_subquantizers);
+  }
+
+  /* Group the codes by list, every list padded to whole blocks. */
+  std::vector<guint32> lists (num_lists + 1, 0);
+  for (guint i = 0; i < count; i++)
+    lists[row_lists[i] + 1]++;
+  for (guint l = 0; l < num_lists; l++)
+    lists[l + 1] = lists[l] + (lists[l + 1] + PQ_CODE_BLOCK - 1) /
+        PQ_CODE_BLOCK;
+  guint num_blocks = lists[num_lists];
+
+  std::vector<guint32> label_offsets (count);
+  std::string strings;
+  for (guint i = 0; i < count; i++) {
+    label_offsets[i] = strings.size ();
+    strings.append (gallery.label (i)).push_back ('\0');
+  }
+
+  IvfPqFileHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, IVFPQ_MAGIC, sizeof (header.magic));
+  header.version = IVFPQ_VERSION;
+  header.dim = dim;
+  header.count = count;
+  header.num_lists = num_lists;
+  header.num_subquantizers = num_subquantizers;
+  header.num_blocks = num_blocks;
+  header.gallery_size = gallery.fileSize ();
+  header.gallery_time = gallery.fileTime ();
+  header.centroids_offset = align_up (sizeof (header), 64);
+  header.codebooks_offset = header.centroids_offset +
+      centroids.size () * sizeof (gfloat);
+  header.lists_offset = header.codebooks_offset +
+      codebooks.size () * sizeof (gfloat);
+  header.codes_offset = header.lists_offset + (guint64) (num_lists + 1) * 4;
+  header.rows_offset = align_up (header.codes_offset +
+      (guint64) num_blocks * num_subquantizers * PQ_CODE_BLOCK, 4);
+  header.ids_offset = header.rows_offset +
+      (guint64) num_blocks * PQ_CODE_BLOCK * 4;
+  header.labels_offset = header.ids_offset + (guint64) count * 4;
+  header.strings_offset = header.labels_offset + (guint64) count * 4;
+  header.strings_size = strings.size ();
+
+  std::vector<guint8> data (header.strings_offset + header.strings_size);
+  memcpy (data.data (), &header, sizeof (header));
+  memcpy (data.data () + header.centroids_offset, centroids.data (),
+      centroids.size () * sizeof (gfloat));
+  memcpy (data.data () + header.codebooks_offset, codebooks.data (),
+      codebooks.size () * sizeof (gfloat));
+  memcpy (data.data () + header.lists_offset, lists.data (),
+      lists.size () * 4);
+
+  guint8 *codes = data.data () + header.codes_offset;
+  guint32 *slots = (guint32 *) (data.data () + header.rows_offset);
+  std::fill (slots, slots + (gsize) num_blocks * PQ_CODE_BLOCK, IVFPQ_NO_ROW);
+  std::vector<guint32> list_sizes (num_lists, 0);
+  for (guint i = 0; i < count; i++) {
+    guint l = row_lists[i];
+    guint slot = lists[l] * PQ_CODE_BLOCK + list_sizes[l]++;
+    guint block = slot / PQ_CODE_BLOCK, j = slot % PQ_CODE_BLOCK;
+    for (guint m = 0; m < num_subquantizers; m++)
+      codes[((gsize) block * num_subquantizers + m) * PQ_CODE_BLOCK + j] =
+          row_codes[(gsize) i * num_subquantizers + m];
+    slots[slot] = i;
+  }
+
+  for (guint i = 0; i < count; i++) {
+    guint32 id = gallery.id (i);
+    memcpy (data.data () + header.ids_offset + (gsize) i * 4, &id, 4);
+  }
+  memcpy (data.data () + header.labels_offset, label_offsets.data (),
+      (gsize) count * 4);
+  memcpy (data.data () + header.strings_offset, strings.data (),
+      strings.size ());
+
+  return write_file_atomically (path, data.data (), data.size (), error);
+}
+
+std::unique_ptr<IvfPqIndex>
+IvfPqIndex::open (const std::string &path, std::string &error)
+{
+  int fd = ::open (path.c_str (), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    error = "Could not open " + path + ": " + strerror (errno);
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat (fd, &st) != 0 || st.st_size < (off_t) sizeof (IvfPqFileHeader)) {
+    error = "Index " + path + " is truncated";
+    ::close (fd);
+    return nullptr;
+  }
+
+  void *map = mmap (nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close (fd);
+  if (map == MAP_FAILED) {
+    error = "Could not map " + path + ": " + strerror (errno);
+    return nullptr;
+  }
+
+  std::unique_ptr<IvfPqIndex> index (new IvfPqIndex);
+  index->m_Map = map;
+  index->m_MapSize = st.st_size;
+
+  const guint8 *base = (const guint8 *) map;
+  guint64 file_size = st.st_size;
+  IvfPqFileHeader header;
+  memcpy (&header, base, sizeof (header));
+
+  if (memcmp (header.magic, IVFPQ_MAGIC, sizeof (header.magic)) != 0 ||
+      header.version != IVFPQ_VERSION) {
+    error = path + " is not a version " G_STRINGIFY (IVFPQ_VERSION)
+        " IVF-PQ index";
+    return nullptr;
+  }
+
+  guint64 dim = header.dim, count = header.count;
+  guint64 num_lists = header.num_lists, num_blocks = header.num_blocks;
+  guint64 num_subquantizers = header.num_subquantizers;
+  if (dim == 0 || dim > IVFPQ_MAX_DIM || num_lists == 0 ||
+      num_lists > IVFPQ_MAX_LISTS || num_subquantizers == 0 ||
+      dim % num_subquantizers != 0 ||
+      num_blocks > (count + num_lists * PQ_CODE_BLOCK) / PQ_CODE_BLOCK) {
+    error = "Index " + path + " has invalid dimensions";
+    return nullptr;
+  }
+  if (header.centroids_offset % 4 || header.codebooks_offset % 4 ||
+      header.lists_offset % 4 || header.rows_offset % 4 ||
+      header.ids_offset % 4 || header.labels_offset % 4 ||
+      !in_file (header.centroids_offset, num_lists * dim * 4, file_size) ||
+      !in_file (header.codebooks_offset, IVFPQ_CODEBOOK_SIZE * dim * 4,
+          file_size) ||
+      !in_file (header.lists_offset, (num_lists + 1) * 4, file_size) ||
+      !in_file (header.codes_offset,
+          num_blocks * num_subquantizers * PQ_CODE_BLOCK, file_size) ||
+      !in_file (header.rows_offset, num_blocks * PQ_CODE_BLOCK * 4,
+          file_size) ||
+      !in_file (header.ids_offset, count * 4, file_size) ||
+      !in_file (header.labels_offset, count * 4, file_size) ||
+      !in_file (header.strings_offset, header.strings_size, file_size)) {
+    error = "Index " + path + " has sections outside of the file";
+    return nullptr;
+  }
+
+  const guint32 *lists = (const guint32 *) (base + header.lists_offset);
+  const guint32 *rows = (const guint32 *) (base + header.rows_offset);
+  const guint32 *label_offsets =
+      (const guint32 *) (base + header.labels_offset);
+  const gchar *strings = (const gchar *) base + header.strings_offset;
+
+  bool valid = lists[0] == 0 && lists[num_lists] == num_blocks;
+  for (guint64 l = 0; valid && l < num_lists; l++)
+    valid = lists[l] <= lists[l + 1];
+  for (guint64 i = 0; valid && i < num_blocks * PQ_CODE_BLOCK; i++)
+    valid = rows[i] < count || rows[i] == IVFPQ_NO_ROW;
+  if (count > 0)
+    valid = valid && header.strings_size > 0 &&
+        strings[header.strings_size - 1] == '\0';
+  for (guint64 i = 0; valid && i < count; i++)
+    valid = label_offsets[i] < header.strings_size;
+  if (!valid) {
+    error = "Index " + path + " has invalid lists or labels";
+    return nullptr;
+  }
+
+  index->m_Dim = dim;
+  index->m_Count = count;
+  index->m_NumLists = num_lists;
+  index->m_NumSubquantizers = num_subquantizers;
+  index->m_GallerySize = header.gallery_size;
+  index->m_GalleryTime = header.gallery_time;
+  index->m_Centroids = (const gfloat *) (base + header.centroids_offset);
+  index->m_Codebooks = (const gfloat *) (base + header.codebooks_offset);
+  index->m_Lists = lists;
+  index->m_Codes = base + header.codes_offset;
+  index->m_Rows = rows;
+  index->m_Ids = (const guint32 *) (base + header.ids_offset);
+  index->m_LabelOffsets = label_offsets;
+  index->m_Strings = strings;
+  return index;
+}
+
+bool
+IvfPqIndex::builtFrom (const Gallery &gallery) const
+{
+  return gallery.size () == m_Count && gallery.dim () == m_Dim &&
+      gallery.fileSize () == m_GallerySize &&
+      gallery.fileTime () == m_GalleryTime;
+}
+
+void
+IvfPqIndex::searchBatch (const gfloat *queries, guint num_queries,
+    guint top_k, guint nprobe, guint rerank, gfloat min_score,
+    const Gallery *gallery, Gallery::Match *matches, guint *num_found,
+    WorkerPool *pool) const
+{
+  guint k = MIN (top_k, Gallery::MAX_TOP_K);
+  for (guint q = 0; q < num_queries; q++)
+    num_found[q] = 0;
+  if (num_queries == 0 || k == 0 || m_Count == 0)
+    return;
+
+  nprobe = CLAMP (nprobe, 1u, m_NumLists);
+  guint num_candidates = gallery ? MAX (rerank, k) : k;
+  guint dsub = m_Dim / m_NumSubquantizers;
+  gsize lut_size = (gsize) m_NumSubquantizers * IVFPQ_CODEBOOK_SIZE;
+
+  /* Similarity of every query with every list centroid, and the lookup
+   * tables of every query: entry m * 256 + c is the similarity of piece m
+   * of the query with centroid c of its codebook. Both are matrix products
+   * over the whole batch. */
+  std::vector<gfloat> coarse ((gsize) num_queries * m_NumLists);
+  mirror::DotProductsBatchF32 (queries, num_queries, m_Centroids, m_Dim,
+      m_NumLists, coarse.data ());
+
+  std::vector<gfloat> luts (num_queries * lut_size);
+  std::vector<gfloat> pieces ((gsize) num_queries * dsub);
+  std::vector<gfloat> piece_scores ((gsize) num_queries * IVFPQ_CODEBOOK_SIZE);
+  for (guint m = 0; m < m_NumSubquantizers; m++) {
+    for (guint q = 0; q < num_queries; q++)
+      memcpy (pieces.data () + (gsize) q * dsub,
+          queries + (gsize) q * m_Dim + m * dsub, dsub * sizeof (gfloat));
+    mirror::DotProductsBatchF32 (pieces.data (), num_queries,
+        m_Codebooks + (gsize) m * IVFPQ_CODEBOOK_SIZE * dsub, dsub,
+        IVFPQ_CODEBOOK_SIZE, piece_scores.data ());
+    for (guint q = 0; q < num_queries; q++)
+      memcpy (luts.data () + q * lut_size + m * IVFPQ_CODEBOOK_SIZE,
+          piece_scores.data () + (gsize) q * IVFPQ_CODEBOOK_SIZE,
+          IVFPQ_CODEBOOK_SIZE * sizeof (gfloat));
+  }
+
+  auto search_query = [&] (guint, guint q) -> bool {
+    const gfloat *query_coarse = coarse.data () + (gsize) q * m_NumLists;
+    std::vector<guint> probes (m_NumLists);
+    std::iota (probes.begin (), probes.end (), 0);
+    std::partial_sort (probes.begin (), probes.begin () + nprobe,
+        probes.end (), [query_coarse] (guint a, guint b) {
+          return query_coarse[a] > query_coarse[b];
+        });
+
+    std::priority_queue<Candidate, std::vector<Candidate>, WorstFirst> best;
+    std::vector<gfloat> scores;
+    for (guint p = 0; p < nprobe; p++) {
+      guint list = probes[p];
+      guint first_block = m_Lists[list];
+      guint num_blocks = m_Lists[list + 1] - first_block;
+      scores.resize ((gsize) num_blocks * PQ_CODE_BLOCK);
+      mirror::ScanPqCodes (luts.data () + q * lut_size,
+          m_Codes + (gsize) first_block * m_NumSubquantizers * PQ_CODE_BLOCK,
+          m_NumSubquantizers, num_blocks, scores.data ());
+
+      const guint32 *rows = m_Rows + (gsize) first_block * PQ_CODE_BLOCK;
+      for (gsize i = 0; i < scores.size (); i++) {
+        gfloat score = scores[i] + query_coarse[list];
+        if (rows[i] == IVFPQ_NO_ROW ||
+            (best.size () >= num_candidates && score <= best.top ().score))
+          continue;
+        best.push ({score, rows[i]});
+        if (best.size () > num_candidates)
+          best.pop ();
+      }
+    }
+
+    std::vector<Candidate> candidates;
+    candidates.reserve (best.size ());
+    for (; !best.empty (); best.pop ()) {
+      Candidate candidate = best.top ();
+      if (gallery)
+        candidate.score = gallery->score (queries + (gsize) q * m_Dim,
+            candidate.row);
+      candidates.push_back (candidate);
+    }
+    /* Order equal scores like Gallery::search(), lower row first. */
+    std::sort (candidates.begin (), candidates.end (),
+        [] (const Candidate &a, const Candidate &b) {
+          return a.score > b.score || (a.score == b.score && a.row < b.row);
+        });
+
+    Gallery::Match *query_matches = matches + (gsize) q * top_k;
+    guint found = 0;
+    for (const Candidate &candidate : candidates) {
+      if (found == k || candidate.score < min_score)
+        break;
+      query_matches[found].index = candidate.row;
+      query_matches[found].id = m_Ids[candidate.row];
+      query_matches[found].label = m_Strings + m_LabelOffsets[candidate.row];
+      query_matches[found].score = candidate.score;
+      found++;
+    }
+    num_found[q] = found;
+    return true;
+  };
+
+  if (pool && num_queries > 1) {
+    pool->run (num_queries, search_query);
+  } else {
+    for (guint q = 0; q < num_queries; q++)
+      search_query (0, q);
+  }
+}
+
+}
@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#ifndef __GSTNVINFER_IVFPQ_H__
+#define __GSTNVINFER_IVFPQ_H__
+
+#include <glib.h>
+
+#include <memory>
+#include <string>
+
+#include "gstnvinfer_gallery.h"
+
+namespace gstnvinfer {
+
+class WorkerPool;
+
+/**
+ * Compressed copy of a Gallery for hosting many large galleries on one
+ * machine. The vectors are split into lists around coarse centroids
+ * (inverted file) and the difference of every vector to its centroid is
+ * product quantized: cut into num_subquantizers pieces, each stored as the
+ * byte index of the closest of 256 centroids of its piece. A 512 element
+ * vector with 64 subquantizers takes 64 bytes instead of 2 KB.
+ *
+ * A search scores the nprobe lists with the closest centroids by table
+ * lookup and can re-rank the best candidates with the exact vectors of the
+ * gallery. Everything else needed for a search, including the identities
+ * and labels, is in a single memory-mapped file. All integers of the file
+ * are little endian:
+ *
+ *   offset  size  field
+ *        0     8  magic "NVIVFPQ1"
+ *        8     4  version, 1
+ *       12     4  dim
+ *       16     4  count, number of identities
+ *       20     4  num_lists
+ *       24     4  num_subquantizers, divides dim
+ *       28     4  num_blocks, of PQ_CODE_BLOCK vectors
+ *       32     8  gallery_size
+ *       40     8  gallery_time, in nanoseconds
+ *       48     8  centroids_offset, num_lists * dim floats
+ *       56     8  codebooks_offset, num_subquantizers * 256 pieces of
+ *                 dim / num_subquantizers floats
+ *       64     8  lists_offset, num_lists + 1 uint32, first block of each
+ *                 list
+ *       72     8  codes_offset, num_blocks * num_subquantizers *
+ *                 PQ_CODE_BLOCK bytes, laid out for mirror::ScanPqCodes()
+ *       80     8  rows_offset, num_blocks * PQ_CODE_BLOCK uint32, gallery
+ *                 row of every code or G_MAXUINT32 for padding
+ *       88     8  ids_offset, count uint32 by gallery row
+ *       96     8  labels_offset, count uint32 offsets into the strings
+ *      104     8  strings_offset, NUL-terminated labels
+ *      112     8  strings_size, in bytes
+ *
+ * gallery_size and gallery_time identify the gallery the index was built
+ * from, like for HnswIndex.
+ */
+class IvfPqIndex
+{
+public:
+  ~IvfPqIndex ();
+
+  /** Train and encode the vectors of gallery and write the index to path.
+   * num_subquantizers must divide gallery.dim(). Returns false and sets
+   * error on failure. Takes a while for large galleries. */
+  static bool build (const Gallery &gallery, const std::string &path,
+      guint num_lists, guint num_subquantizers, std::string &error);
+
+  /** Map the index in path. Returns NULL and sets error if the file cannot
+   * be mapped or is not a valid index. */
+  static std::unique_ptr<IvfPqIndex> open (const std::string &path,
+      std::string &error);
+
+  guint dim () const { return m_Dim; }
+  guint size () const { return m_Count; }
+  guint numLists () const { return m_NumLists; }
+  guint numSubquantizers () const { return m_NumSubquantizers; }
+
+  /** Whether the index was built from gallery in its current state. */
+  bool builtFrom (const Gallery &gallery) const;
+
+  /** Find the matches of num_queries L2-normalized queries of dim() floats
+   * stored back to back, like Gallery::searchBatch(), scanning the nprobe
+   * lists closest to every query. With a gallery, the best
+   * MAX (rerank, top_k) candidates of the scan are scored exactly;
+   * otherwise the scores are approximations. The centroid scores and the
+   * lookup tables are computed for all queries at once. With a pool, the
+   * queries are scanned by its workers. Safe to call from several threads
+   * with different pools. */
+  void searchBatch (const gfloat *queries, guint num_queries, guint top_k,
+      guint nprobe, guint rerank, gfloat min_score, const Gallery *gallery,
+      Gallery::Match *matches, guint *num_found,
+      WorkerPool *pool = nullptr) const;
+
+private:
+  IvfPqIndex () = default;
+
+  guint m_Dim = 0;
+  guint m_Count = 0;
+  guint m_NumLists = 0;
+  guint m_NumSubquantizers = 0;
+  guint64 m_GallerySize = 0;
+  gint64 m_GalleryTime = 0;
+
+  void *m_Map = nullptr;
+  gsize m_MapSize = 0;
+  const gfloat *m_Centroids = nullptr;
+  const gfloat *m_Codebooks = nullptr;
+  const guint32 *m_Lists = nullptr;
+  const guint8 *m_Codes = nullptr;
+  const guint32 *m_Rows = nullptr;
+  const guint32 *m_Ids = nullptr;
+  const guint32 *m_LabelOffsets = nullptr;
+  const gchar *m_Strings = nullptr;
+};
+
+}
+
+#endif
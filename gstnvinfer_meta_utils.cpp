@@ -11,6 +11,7 @@
 
 #include <cstring>
 #include "gstnvinfer_meta_utils.h"
+#include "embedding_kernels.h"
 
 static inline int
 get_element_size (NvDsInferDataType data_type)
@@ -316,6 +317,56 @@ attach_metadata_segmentation (GstNvInferOnnx * nvinfer, GstMiniObject * tensor_o
   }
 }
 
+/**
+ * Attach metadata for an embedding network. The vector is copied out of the
+ * output so that no reference to the tensor output buffers is held.
+ */
+void
+attach_metadata_embedding (GstNvInferOnnx * nvinfer,
+    GstNvInferOnnxFrame & frame, NvDsInferEmbeddingOutput & embedding_output)
+{
+  if (!nvinfer->process_full_frame && !frame.obj_meta)
+    return;
+
+  NvDsBatchMeta *batch_meta = (nvinfer->process_full_frame) ?
+    frame.frame_meta->base_meta.batch_meta : frame.obj_meta->base_meta.batch_meta;
+
+  NvDsUserMeta *user_meta = nvds_acquire_user_meta_from_pool (batch_meta);
+  if (!user_meta)
+    return;
+
+  NvDsEmbeddingMeta *meta = nvds_alloc_embedding_meta (
+      nvinfer->embedding_precision, embedding_output.length);
+  meta->unique_id = nvinfer->unique_id;
+  meta->norm = embedding_output.norm;
+
+  switch (meta->precision) {
+    case NVDS_EMBEDDING_FP16:
+      mirror::FloatToHalf (embedding_output.vector, (uint16_t *) meta->data,
+          meta->length);
+      break;
+    case NVDS_EMBEDDING_INT8:
+      meta->scale = mirror::QuantizeInt8 (embedding_output.vector,
+          (int8_t *) meta->data, meta->length);
+      break;
+    default:
+      memcpy (meta->data, embedding_output.vector,
+          meta->length * sizeof (gfloat));
+      break;
+  }
+
+  user_meta->user_meta_data = meta;
+  user_meta->base_meta.meta_type = NVDS_EMBEDDING_META;
+  user_meta->base_meta.release_func = nvds_release_embedding_meta;
+  user_meta->base_meta.copy_func = nvds_copy_embedding_meta;
+
+  if (nvinfer->process_full_frame) {
+    nvds_add_user_meta_to_frame (frame.frame_meta, user_meta);
+  } else {
+    nvds_add_user_meta_to_obj (frame.obj_meta, user_meta);
+  }
+}
+
 /* Called when NvDsUserMeta for each frame/object is released. Reduce the
  * refcount of the mini_object by 1 and free other memory. */
 static void
@@ -334,14 +385,15 @@ void
 attach_tensor_output_meta (GstNvInferOnnx *nvinfer, GstMiniObject * tensor_out_object,
     GstNvInferOnnxBatch *batch, NvDsInferContextBatchOutput *batch_output)
 {
-  NvDsBatchMeta *batch_meta = (nvinfer->process_full_frame) ?
-      batch->frames[0].frame_meta->base_meta.batch_meta :
-      batch->frames[0].obj_meta->base_meta.batch_meta;
-
   /* Create and attach NvDsInferTensorMeta for each frame/object. Also
-   * increment the refcount of GstNvInferOnnxTensorOutputObject. */
+   * increment the refcount of GstNvInferOnnxTensorOutputObject. An
+   * accumulated batch holds objects of several input buffers, each frame
+   * takes the meta from the batch meta of its own buffer. */
   for (size_t j = 0; j < batch->frames.size(); j++) {
     GstNvInferOnnxFrame &frame = batch->frames[j];
+    NvDsBatchMeta *batch_meta = (nvinfer->process_full_frame) ?
+        frame.frame_meta->base_meta.batch_meta :
+        frame.obj_meta->base_meta.batch_meta;
     NvDsInferTensorMeta *meta = new NvDsInferTensorMeta;
     meta->unique_id = nvinfer->unique_id;
     meta->num_output_layers = nvinfer->output_layers_info->size ();
@@ -24,6 +24,11 @@ void merge_classification_output (GstNvInferOnnxObjectHistory & history,
 void attach_metadata_segmentation (GstNvInferOnnx * nvinfer, GstMiniObject * tensor_out_object,
         GstNvInferOnnxFrame & frame, NvDsInferSegmentationOutput & segmentation_output);
 
+/* Attaches the L2-normalized vector of an embedding network, converted to
+ * nvinfer->embedding_precision. */
+void attach_metadata_embedding (GstNvInferOnnx * nvinfer,
+        GstNvInferOnnxFrame & frame, NvDsInferEmbeddingOutput & embedding_output);
+
 /* Attaches the raw tensor output to the GstBuffer as metadata. */
 void attach_tensor_output_meta (GstNvInferOnnx *nvinfer, GstMiniObject * tensor_out_object,
         GstNvInferOnnxBatch *batch, NvDsInferContextBatchOutput *batch_output);
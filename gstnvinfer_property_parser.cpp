@@ -349,11 +349,453 @@ gst_nvinfer_parse_other_attribute (GstNvInferOnnx * nvinfer,
             CONFIG_GROUP_INFER_OUTPUT_TENSOR_META, &error))
       nvinfer->output_tensor_meta = TRUE;
     CHECK_ERROR (error);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_ALIGN_FACES)) {
+    if (g_key_file_get_boolean (key_file, group_name,
+            CONFIG_GROUP_INFER_ALIGN_FACES, &error))
+      nvinfer->align_faces = TRUE;
+    CHECK_ERROR (error);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_ALIGN_WORKERS)) {
+    if ((*nvinfer->is_prop_set)[PROP_ALIGN_WORKERS])
+      return TRUE;
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_ALIGN_WORKERS, &error);
+    CHECK_ERROR (error);
+    if (val < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_ALIGN_WORKERS, val);
+      goto done;
+    }
+    nvinfer->align_workers = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_ALIGN_WORKER_CPUS)) {
+    if ((*nvinfer->is_prop_set)[PROP_ALIGN_WORKER_CPUS])
+      return TRUE;
+    gsize length;
+    gint *int_list =
+        g_key_file_get_integer_list (key_file, group_name,
+        CONFIG_GROUP_INFER_ALIGN_WORKER_CPUS, &length, &error);
+    CHECK_ERROR (error);
+    nvinfer->align_worker_cpus->assign (int_list, int_list + length);
+    g_free (int_list);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_FACE_MIN_INTER_OCULAR)) {
+    nvinfer->face_quality.min_inter_ocular = g_key_file_get_double (key_file,
+        group_name, CONFIG_GROUP_INFER_FACE_MIN_INTER_OCULAR, &error);
+    CHECK_ERROR (error);
+    if (nvinfer->face_quality.min_inter_ocular < 0) {
+      g_printerr ("Error: Negative value specified for %s(%f)\n",
+          CONFIG_GROUP_INFER_FACE_MIN_INTER_OCULAR, nvinfer->face_quality.min_inter_ocular);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_FACE_MAX_YAW)) {
+    nvinfer->face_quality.max_yaw = g_key_file_get_double (key_file,
+        group_name, CONFIG_GROUP_INFER_FACE_MAX_YAW, &error);
+    CHECK_ERROR (error);
+    if (nvinfer->face_quality.max_yaw < 0) {
+      g_printerr ("Error: Negative value specified for %s(%f)\n",
+          CONFIG_GROUP_INFER_FACE_MAX_YAW, nvinfer->face_quality.max_yaw);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_FACE_MAX_PITCH)) {
+    nvinfer->face_quality.max_pitch = g_key_file_get_double (key_file,
+        group_name, CONFIG_GROUP_INFER_FACE_MAX_PITCH, &error);
+    CHECK_ERROR (error);
+    if (nvinfer->face_quality.max_pitch < 0) {
+      g_printerr ("Error: Negative value specified for %s(%f)\n",
+          CONFIG_GROUP_INFER_FACE_MAX_PITCH, nvinfer->face_quality.max_pitch);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_FACE_MAX_ROLL)) {
+    nvinfer->face_quality.max_roll = g_key_file_get_double (key_file,
+        group_name, CONFIG_GROUP_INFER_FACE_MAX_ROLL, &error);
+    CHECK_ERROR (error);
+    if (nvinfer->face_quality.max_roll < 0) {
+      g_printerr ("Error: Negative value specified for %s(%f)\n",
+          CONFIG_GROUP_INFER_FACE_MAX_ROLL, nvinfer->face_quality.max_roll);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_FACE_MIN_SHARPNESS)) {
+    nvinfer->face_quality.min_sharpness = g_key_file_get_double (key_file,
+        group_name, CONFIG_GROUP_INFER_FACE_MIN_SHARPNESS, &error);
+    CHECK_ERROR (error);
+    if (nvinfer->face_quality.min_sharpness < 0) {
+      g_printerr ("Error: Negative value specified for %s(%f)\n",
+          CONFIG_GROUP_INFER_FACE_MIN_SHARPNESS, nvinfer->face_quality.min_sharpness);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_FACE_MIN_BRIGHTNESS)) {
+    nvinfer->face_quality.min_brightness = g_key_file_get_double (key_file,
+        group_name, CONFIG_GROUP_INFER_FACE_MIN_BRIGHTNESS, &error);
+    CHECK_ERROR (error);
+    if (nvinfer->face_quality.min_brightness < 0) {
+      g_printerr ("Error: Negative value specified for %s(%f)\n",
+          CONFIG_GROUP_INFER_FACE_MIN_BRIGHTNESS, nvinfer->face_quality.min_brightness);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_FACE_MAX_BRIGHTNESS)) {
+    nvinfer->face_quality.max_brightness = g_key_file_get_double (key_file,
+        group_name, CONFIG_GROUP_INFER_FACE_MAX_BRIGHTNESS, &error);
+    CHECK_ERROR (error);
+    if (nvinfer->face_quality.max_brightness < 0) {
+      g_printerr ("Error: Negative value specified for %s(%f)\n",
+          CONFIG_GROUP_INFER_FACE_MAX_BRIGHTNESS, nvinfer->face_quality.max_brightness);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_BEST_SHOT_COUNT)) {
+    nvinfer->best_shot_count = g_key_file_get_integer (key_file,
+        group_name, CONFIG_GROUP_INFER_BEST_SHOT_COUNT, &error);
+    CHECK_ERROR (error);
+    if ((gint) nvinfer->best_shot_count < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_BEST_SHOT_COUNT, nvinfer->best_shot_count);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_BEST_SHOT_STABLE_FRAMES)) {
+    nvinfer->best_shot_stable_frames = g_key_file_get_integer (key_file,
+        group_name, CONFIG_GROUP_INFER_BEST_SHOT_STABLE_FRAMES, &error);
+    CHECK_ERROR (error);
+    if ((gint) nvinfer->best_shot_stable_frames < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_BEST_SHOT_STABLE_FRAMES, nvinfer->best_shot_stable_frames);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_BEST_SHOT_TIMEOUT)) {
+    nvinfer->best_shot_timeout = g_key_file_get_integer (key_file,
+        group_name, CONFIG_GROUP_INFER_BEST_SHOT_TIMEOUT, &error);
+    CHECK_ERROR (error);
+    if ((gint) nvinfer->best_shot_timeout < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_BEST_SHOT_TIMEOUT, nvinfer->best_shot_timeout);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_BEST_SHOT_LOST_FRAMES)) {
+    nvinfer->best_shot_lost_frames = g_key_file_get_integer (key_file,
+        group_name, CONFIG_GROUP_INFER_BEST_SHOT_LOST_FRAMES, &error);
+    CHECK_ERROR (error);
+    if ((gint) nvinfer->best_shot_lost_frames < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_BEST_SHOT_LOST_FRAMES, nvinfer->best_shot_lost_frames);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_ALIGN_CACHE_MAX_DISPLACEMENT)) {
+    nvinfer->align_cache_max_displacement = g_key_file_get_double (key_file,
+        group_name, CONFIG_GROUP_INFER_ALIGN_CACHE_MAX_DISPLACEMENT, &error);
+    CHECK_ERROR (error);
+    if (nvinfer->align_cache_max_displacement < 0) {
+      g_printerr ("Error: Negative value specified for %s(%f)\n",
+          CONFIG_GROUP_INFER_ALIGN_CACHE_MAX_DISPLACEMENT,
+          nvinfer->align_cache_max_displacement);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_DEBUG_DUMP)) {
+    if ((*nvinfer->is_prop_set)[PROP_DEBUG_DUMP])
+      return TRUE;
+    nvinfer->debug_dump = g_key_file_get_boolean (key_file, group_name,
+        CONFIG_GROUP_INFER_DEBUG_DUMP, &error);
+    CHECK_ERROR (error);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_DEBUG_DUMP_DIR)) {
+    gchar *str = g_key_file_get_string (key_file, group_name,
+        CONFIG_GROUP_INFER_DEBUG_DUMP_DIR, &error);
+    CHECK_ERROR (error);
+    nvinfer->debug_dump_params->directory = str;
+    g_free (str);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_DEBUG_DUMP_INTERVAL)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_DEBUG_DUMP_INTERVAL, &error);
+    CHECK_ERROR (error);
+    if (val < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_DEBUG_DUMP_INTERVAL, val);
+      goto done;
+    }
+    nvinfer->debug_dump_params->interval = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_DEBUG_DUMP_MAX_PER_OBJECT)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_DEBUG_DUMP_MAX_PER_OBJECT, &error);
+    CHECK_ERROR (error);
+    if (val < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_DEBUG_DUMP_MAX_PER_OBJECT, val);
+      goto done;
+    }
+    nvinfer->debug_dump_params->max_per_object = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_DEBUG_DUMP_QUEUE_SIZE)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_DEBUG_DUMP_QUEUE_SIZE, &error);
+    CHECK_ERROR (error);
+    if (val < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_DEBUG_DUMP_QUEUE_SIZE, val);
+      goto done;
+    }
+    nvinfer->debug_dump_params->queue_size = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_DEBUG_DUMP_MAX_BYTES)) {
+    nvinfer->debug_dump_params->max_bytes = g_key_file_get_uint64 (key_file,
+        group_name, CONFIG_GROUP_INFER_DEBUG_DUMP_MAX_BYTES, &error);
+    CHECK_ERROR (error);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_EMBEDDING_PRECISION)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_EMBEDDING_PRECISION, &error);
+    CHECK_ERROR (error);
+    switch (val) {
+      case NVDS_EMBEDDING_FP32:
+      case NVDS_EMBEDDING_FP16:
+      case NVDS_EMBEDDING_INT8:
+        nvinfer->embedding_precision = (NvDsEmbeddingPrecision) val;
+        break;
+      default:
+        g_printerr ("Error. Invalid value for '%s':'%d'\n",
+            CONFIG_GROUP_INFER_EMBEDDING_PRECISION, val);
+        goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE)) {
+    nvinfer->embedding_aggregate = g_key_file_get_boolean (key_file,
+        group_name, CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE, &error);
+    CHECK_ERROR (error);
+  } else if (!g_strcmp0 (key,
+          CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE_MAX_VARIANCE)) {
+    nvinfer->embedding_aggregate_max_variance = g_key_file_get_double (key_file,
+        group_name, CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE_MAX_VARIANCE, &error);
+    CHECK_ERROR (error);
+    if (nvinfer->embedding_aggregate_max_variance < 0) {
+      g_printerr ("Error: Negative value specified for %s(%f)\n",
+          CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE_MAX_VARIANCE,
+          nvinfer->embedding_aggregate_max_variance);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE_MIN_COUNT)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE_MIN_COUNT, &error);
+    CHECK_ERROR (error);
+    if (val < 1) {
+      g_printerr ("Error: %s(%d) must be at least 1\n",
+          CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE_MIN_COUNT, val);
+      goto done;
+    }
+    nvinfer->embedding_aggregate_min_count = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_FILE)) {
+    if ((*nvinfer->is_prop_set)[PROP_GALLERY_FILE])
+      return TRUE;
+    gchar abs_path[_PATH_MAX];
+    gchar *str = g_key_file_get_string (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_FILE, &error);
+    CHECK_ERROR (error);
+    if (!get_absolute_file_path (cfg_file_path, str, abs_path)) {
+      g_printerr ("Error: Could not parse gallery file path\n");
+      g_free (str);
+      goto done;
+    }
+    g_free (str);
+    g_free (nvinfer->gallery_file);
+    nvinfer->gallery_file = g_strdup (abs_path);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_TOP_K)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_TOP_K, &error);
+    CHECK_ERROR (error);
+    if (val < 1 || val > (gint) gstnvinfer::Gallery::MAX_TOP_K) {
+      g_printerr ("Error: %s (%d) should be between 1 and %u\n",
+          CONFIG_GROUP_INFER_GALLERY_TOP_K, val,
+          gstnvinfer::Gallery::MAX_TOP_K);
+      goto done;
+    }
+    nvinfer->gallery_top_k = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_MIN_SCORE)) {
+    nvinfer->gallery_min_score = g_key_file_get_double (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_MIN_SCORE, &error);
+    CHECK_ERROR (error);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_WORKERS)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_WORKERS, &error);
+    CHECK_ERROR (error);
+    if (val < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_GALLERY_WORKERS, val);
+      goto done;
+    }
+    nvinfer->gallery_workers = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_HNSW_M)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_HNSW_M, &error);
+    CHECK_ERROR (error);
+    if (val != 0 && (val < 2 || val > 128)) {
+      g_printerr ("Error: %s (%d) should be 0 or between 2 and 128\n",
+          CONFIG_GROUP_INFER_GALLERY_HNSW_M, val);
+      goto done;
+    }
+    nvinfer->gallery_hnsw_m = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_HNSW_EF_CONSTRUCTION)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_HNSW_EF_CONSTRUCTION, &error);
+    CHECK_ERROR (error);
+    if (val < 1) {
+      g_printerr ("Error: %s (%d) should be at least 1\n",
+          CONFIG_GROUP_INFER_GALLERY_HNSW_EF_CONSTRUCTION, val);
+      goto done;
+    }
+    nvinfer->gallery_hnsw_ef_construction = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_HNSW_EF)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_HNSW_EF, &error);
+    CHECK_ERROR (error);
+    if (val < 1) {
+      g_printerr ("Error: %s (%d) should be at least 1\n",
+          CONFIG_GROUP_INFER_GALLERY_HNSW_EF, val);
+      goto done;
+    }
+    nvinfer->gallery_hnsw_ef = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_IVFPQ_LISTS)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_IVFPQ_LISTS, &error);
+    CHECK_ERROR (error);
+    if (val < 0 || val > 65536) {
+      g_printerr ("Error: %s (%d) should be between 0 and 65536\n",
+          CONFIG_GROUP_INFER_GALLERY_IVFPQ_LISTS, val);
+      goto done;
+    }
+    nvinfer->gallery_ivfpq_lists = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_IVFPQ_SUBQUANTIZERS)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_IVFPQ_SUBQUANTIZERS, &error);
+    CHECK_ERROR (error);
+    if (val < 1) {
+      g_printerr ("Error: %s (%d) should be at least 1\n",
+          CONFIG_GROUP_INFER_GALLERY_IVFPQ_SUBQUANTIZERS, val);
+      goto done;
+    }
+    nvinfer->gallery_ivfpq_subquantizers = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_IVFPQ_NPROBE)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_IVFPQ_NPROBE, &error);
+    CHECK_ERROR (error);
+    if (val < 1) {
+      g_printerr ("Error: %s (%d) should be at least 1\n",
+          CONFIG_GROUP_INFER_GALLERY_IVFPQ_NPROBE, val);
+      goto done;
+    }
+    nvinfer->gallery_ivfpq_nprobe = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_IVFPQ_RERANK)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_IVFPQ_RERANK, &error);
+    CHECK_ERROR (error);
+    if (val < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_GALLERY_IVFPQ_RERANK, val);
+      goto done;
+    }
+    nvinfer->gallery_ivfpq_rerank = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_LOCK_MARGIN)) {
+    nvinfer->gallery_lock_margin = g_key_file_get_double (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_LOCK_MARGIN, &error);
+    CHECK_ERROR (error);
+    if (nvinfer->gallery_lock_margin < 0) {
+      g_printerr ("Error: Negative value specified for %s(%f)\n",
+          CONFIG_GROUP_INFER_GALLERY_LOCK_MARGIN, nvinfer->gallery_lock_margin);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_LOCK_CONFIRMATIONS)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_LOCK_CONFIRMATIONS, &error);
+    CHECK_ERROR (error);
+    if (val < 1) {
+      g_printerr ("Error: %s(%d) must be at least 1\n",
+          CONFIG_GROUP_INFER_GALLERY_LOCK_CONFIRMATIONS, val);
+      goto done;
+    }
+    nvinfer->gallery_lock_confirmations = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_LOCK_VERIFY_INTERVAL)) {
+    gint val = g_key_file_get_integer (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_LOCK_VERIFY_INTERVAL, &error);
+    CHECK_ERROR (error);
+    if (val < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_GALLERY_LOCK_VERIFY_INTERVAL, val);
+      goto done;
+    }
+    nvinfer->gallery_lock_verify_interval = val;
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_GALLERY_SHARED)) {
+    nvinfer->gallery_shared = g_key_file_get_boolean (key_file, group_name,
+        CONFIG_GROUP_INFER_GALLERY_SHARED, &error);
+    CHECK_ERROR (error);
   } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_SECONDARY_REINFER_INTERVAL)) {
     nvinfer->secondary_reinfer_interval =
         g_key_file_get_integer (key_file, group_name,
         CONFIG_GROUP_INFER_SECONDARY_REINFER_INTERVAL, &error);
     CHECK_ERROR (error);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_BATCH_ACCUMULATE_US)) {
+    nvinfer->batch_accumulate_us = g_key_file_get_integer (key_file,
+        group_name, CONFIG_GROUP_INFER_BATCH_ACCUMULATE_US, &error);
+    CHECK_ERROR (error);
+    if ((gint) nvinfer->batch_accumulate_us < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_BATCH_ACCUMULATE_US, nvinfer->batch_accumulate_us);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_BUDGET_PER_BUFFER)) {
+    nvinfer->infer_budget.per_buffer = g_key_file_get_integer (key_file,
+        group_name, CONFIG_GROUP_INFER_BUDGET_PER_BUFFER, &error);
+    CHECK_ERROR (error);
+    if ((gint) nvinfer->infer_budget.per_buffer < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_BUDGET_PER_BUFFER,
+          nvinfer->infer_budget.per_buffer);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_BUDGET_PER_SECOND)) {
+    nvinfer->infer_budget.per_second = g_key_file_get_integer (key_file,
+        group_name, CONFIG_GROUP_INFER_BUDGET_PER_SECOND, &error);
+    CHECK_ERROR (error);
+    if ((gint) nvinfer->infer_budget.per_second < 0) {
+      g_printerr ("Error: Negative value specified for %s(%d)\n",
+          CONFIG_GROUP_INFER_BUDGET_PER_SECOND,
+          nvinfer->infer_budget.per_second);
+      goto done;
+    }
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_PRIORITY_WEIGHTS)) {
+    gsize length;
+    gdouble *list = g_key_file_get_double_list (key_file, group_name,
+        CONFIG_GROUP_INFER_PRIORITY_WEIGHTS, &length, &error);
+    CHECK_ERROR (error);
+    if (length != 4 || list[0] < 0 || list[1] < 0 || list[2] < 0 ||
+        list[3] < 0) {
+      g_printerr ("Error: %s should be exactly 4 non-negative weights "
+          "{new-track, staleness, size, quality}\n",
+          CONFIG_GROUP_INFER_PRIORITY_WEIGHTS);
+      g_free (list);
+      goto done;
+    }
+    nvinfer->infer_budget.weight_new = list[0];
+    nvinfer->infer_budget.weight_staleness = list[1];
+    nvinfer->infer_budget.weight_size = list[2];
+    nvinfer->infer_budget.weight_quality = list[3];
+    g_free (list);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_SOURCE_WEIGHTS)) {
+    gsize length;
+    gdouble *list = g_key_file_get_double_list (key_file, group_name,
+        CONFIG_GROUP_INFER_SOURCE_WEIGHTS, &length, &error);
+    CHECK_ERROR (error);
+    for (gsize i = 0; i < length; i++) {
+      if (list[i] < 0) {
+        g_printerr ("Error: Negative weight specified for source %lu in %s\n",
+            (gulong) i, CONFIG_GROUP_INFER_SOURCE_WEIGHTS);
+        g_free (list);
+        goto done;
+      }
+    }
+    nvinfer->infer_budget.source_weights->assign (list, list + length);
+    g_free (list);
+  } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_SOURCE_MIN_OBJECTS)) {
+    gsize length;
+    gint *list = g_key_file_get_integer_list (key_file, group_name,
+        CONFIG_GROUP_INFER_SOURCE_MIN_OBJECTS, &length, &error);
+    CHECK_ERROR (error);
+    for (gsize i = 0; i < length; i++) {
+      if (list[i] < 0) {
+        g_printerr ("Error: Negative minimum specified for source %lu in "
+            "%s\n", (gulong) i, CONFIG_GROUP_INFER_SOURCE_MIN_OBJECTS);
+        g_free (list);
+        goto done;
+      }
+    }
+    nvinfer->infer_budget.source_min_objects->assign (list, list + length);
+    g_free (list);
   } else if (!g_strcmp0 (key, CONFIG_GROUP_INFER_MAINTAIN_ASPECT_RATIO)) {
     if (g_key_file_get_boolean (key_file, group_name,
             CONFIG_GROUP_INFER_MAINTAIN_ASPECT_RATIO, &error))
@@ -671,6 +1113,53 @@ gst_nvinfer_parse_props (GstNvInferOnnx * nvinfer,
           break;
       }
       init_params->networkMode = (NvDsInferNetworkMode) val;
+    } else if (!g_strcmp0 (*key, CONFIG_GROUP_INFER_OUTPUT_DATA_TYPE)) {
+      guint val = g_key_file_get_integer (key_file, CONFIG_GROUP_PROPERTY,
+          CONFIG_GROUP_INFER_OUTPUT_DATA_TYPE, &error);
+      CHECK_ERROR (error);
+
+      switch (val) {
+        case FLOAT:
+        case HALF:
+        case INT8:
+          break;
+        default:
+          g_printerr ("Error. Invalid value for '%s':'%d'\n",
+              CONFIG_GROUP_INFER_OUTPUT_DATA_TYPE, val);
+          goto done;
+          break;
+      }
+      init_params->outputDataType = (NvDsInferDataType) val;
+    } else if (!g_strcmp0 (*key, CONFIG_GROUP_INFER_OUTPUT_TENSOR_ORDER)) {
+      guint val = g_key_file_get_integer (key_file, CONFIG_GROUP_PROPERTY,
+          CONFIG_GROUP_INFER_OUTPUT_TENSOR_ORDER, &error);
+      CHECK_ERROR (error);
+
+      switch (val) {
+        case 0:
+          init_params->outputTensorOrder = NvDsInferTensorOrder_kNCHW;
+          break;
+        case 1:
+          init_params->outputTensorOrder = NvDsInferTensorOrder_kNHWC;
+          break;
+        default:
+          g_printerr ("Error. Invalid value for '%s':'%d'\n",
+              CONFIG_GROUP_INFER_OUTPUT_TENSOR_ORDER, val);
+          goto done;
+          break;
+      }
+    } else if (!g_strcmp0 (*key, CONFIG_GROUP_INFER_OUTPUT_INT8_SCALE)) {
+      init_params->outputInt8Scale =
+          g_key_file_get_double (key_file, CONFIG_GROUP_PROPERTY,
+          CONFIG_GROUP_INFER_OUTPUT_INT8_SCALE, &error);
+      CHECK_ERROR (error);
+
+      if (init_params->outputInt8Scale <= 0) {
+        g_printerr ("Error: %s(%f) should be positive\n",
+            CONFIG_GROUP_INFER_OUTPUT_INT8_SCALE,
+            init_params->outputInt8Scale);
+        goto done;
+      }
     } else if (!g_strcmp0 (*key, CONFIG_GROUP_INFER_MODEL_ENGINE)) {
       if (nvinfer && (*nvinfer->is_prop_set)[PROP_MODEL_ENGINEFILE])
         continue;
@@ -714,6 +1203,7 @@ gst_nvinfer_parse_props (GstNvInferOnnx * nvinfer,
         case NvDsInferNetworkType_Detector:
         case NvDsInferNetworkType_Classifier:
         case NvDsInferNetworkType_Segmentation:
+        case NvDsInferNetworkType_Embedding:
         case NvDsInferNetworkType_Other:
           init_params->networkType = (NvDsInferNetworkType) val;
           break;
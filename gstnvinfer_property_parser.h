@@ -36,6 +36,12 @@
 #define CONFIG_GROUP_INFER_LABEL "labelfile-path"
 #define CONFIG_GROUP_INFER_GPU_ID "gpu-id"
 #define CONFIG_GROUP_INFER_SECONDARY_REINFER_INTERVAL "secondary-reinfer-interval"
+#define CONFIG_GROUP_INFER_BATCH_ACCUMULATE_US "batch-accumulate-us"
+#define CONFIG_GROUP_INFER_BUDGET_PER_BUFFER "infer-budget-per-buffer"
+#define CONFIG_GROUP_INFER_BUDGET_PER_SECOND "infer-budget-per-second"
+#define CONFIG_GROUP_INFER_PRIORITY_WEIGHTS "infer-priority-weights"
+#define CONFIG_GROUP_INFER_SOURCE_WEIGHTS "infer-source-weights"
+#define CONFIG_GROUP_INFER_SOURCE_MIN_OBJECTS "infer-source-min-objects"
 #define CONFIG_GROUP_INFER_OUTPUT_TENSOR_META "output-tensor-meta"
 
 
@@ -55,6 +61,9 @@
 #define CONFIG_GROUP_INFER_NETWORK_TYPE "network-type"
 #define CONFIG_GROUP_INFER_FORCE_IMPLICIT_BATCH_DIM "force-implicit-batch-dim"
 #define CONFIG_GROUP_INFER_INFER_DIMENSIONS "infer-dims"
+#define CONFIG_GROUP_INFER_OUTPUT_DATA_TYPE "output-data-type"
+#define CONFIG_GROUP_INFER_OUTPUT_TENSOR_ORDER "output-tensor-order"
+#define CONFIG_GROUP_INFER_OUTPUT_INT8_SCALE "output-int8-scale"
 
 /** Preprocessing parameters. */
 #define CONFIG_GROUP_INFER_MODEL_COLOR_FORMAT "model-color-format"
@@ -98,6 +107,48 @@
 #define CONFIG_GROUP_INFER_CLASSIFIER_THRESHOLD "classifier-threshold"
 #define CONFIG_GROUP_INFER_CLASSIFIER_ASYNC_MODE "classifier-async-mode"
 
+/** Face alignment parameters. */
+#define CONFIG_GROUP_INFER_ALIGN_FACES "align-faces"
+#define CONFIG_GROUP_INFER_ALIGN_WORKERS "align-workers"
+#define CONFIG_GROUP_INFER_ALIGN_WORKER_CPUS "align-worker-cpus"
+#define CONFIG_GROUP_INFER_FACE_MIN_INTER_OCULAR "face-min-inter-ocular-distance"
+#define CONFIG_GROUP_INFER_FACE_MAX_YAW "face-max-yaw"
+#define CONFIG_GROUP_INFER_FACE_MAX_PITCH "face-max-pitch"
+#define CONFIG_GROUP_INFER_FACE_MAX_ROLL "face-max-roll"
+#define CONFIG_GROUP_INFER_FACE_MIN_SHARPNESS "face-min-sharpness"
+#define CONFIG_GROUP_INFER_FACE_MIN_BRIGHTNESS "face-min-brightness"
+#define CONFIG_GROUP_INFER_FACE_MAX_BRIGHTNESS "face-max-brightness"
+#define CONFIG_GROUP_INFER_BEST_SHOT_COUNT "best-shot-count"
+#define CONFIG_GROUP_INFER_BEST_SHOT_STABLE_FRAMES "best-shot-stable-frames"
+#define CONFIG_GROUP_INFER_BEST_SHOT_TIMEOUT "best-shot-timeout"
+#define CONFIG_GROUP_INFER_BEST_SHOT_LOST_FRAMES "best-shot-lost-frames"
+#define CONFIG_GROUP_INFER_ALIGN_CACHE_MAX_DISPLACEMENT "align-cache-max-displacement"
+#define CONFIG_GROUP_INFER_DEBUG_DUMP "debug-dump"
+#define CONFIG_GROUP_INFER_DEBUG_DUMP_DIR "debug-dump-dir"
+#define CONFIG_GROUP_INFER_DEBUG_DUMP_INTERVAL "debug-dump-interval"
+#define CONFIG_GROUP_INFER_DEBUG_DUMP_MAX_PER_OBJECT "debug-dump-max-per-object"
+#define CONFIG_GROUP_INFER_DEBUG_DUMP_MAX_BYTES "debug-dump-max-bytes"
+#define CONFIG_GROUP_INFER_DEBUG_DUMP_QUEUE_SIZE "debug-dump-queue-size"
+#define CONFIG_GROUP_INFER_EMBEDDING_PRECISION "embedding-precision"
+#define CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE "embedding-aggregate"
+#define CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE_MAX_VARIANCE "embedding-aggregate-max-variance"
+#define CONFIG_GROUP_INFER_EMBEDDING_AGGREGATE_MIN_COUNT "embedding-aggregate-min-count"
+#define CONFIG_GROUP_INFER_GALLERY_FILE "gallery-file"
+#define CONFIG_GROUP_INFER_GALLERY_TOP_K "gallery-top-k"
+#define CONFIG_GROUP_INFER_GALLERY_MIN_SCORE "gallery-min-score"
+#define CONFIG_GROUP_INFER_GALLERY_WORKERS "gallery-workers"
+#define CONFIG_GROUP_INFER_GALLERY_HNSW_M "gallery-hnsw-m"
+#define CONFIG_GROUP_INFER_GALLERY_HNSW_EF_CONSTRUCTION "gallery-hnsw-ef-construction"
+#define CONFIG_GROUP_INFER_GALLERY_HNSW_EF "gallery-hnsw-ef"
+#define CONFIG_GROUP_INFER_GALLERY_IVFPQ_LISTS "gallery-ivfpq-lists"
+#define CONFIG_GROUP_INFER_GALLERY_IVFPQ_SUBQUANTIZERS "gallery-ivfpq-subquantizers"
+#define CONFIG_GROUP_INFER_GALLERY_IVFPQ_NPROBE "gallery-ivfpq-nprobe"
+#define CONFIG_GROUP_INFER_GALLERY_IVFPQ_RERANK "gallery-ivfpq-rerank"
+#define CONFIG_GROUP_INFER_GALLERY_LOCK_MARGIN "gallery-lock-margin"
+#define CONFIG_GROUP_INFER_GALLERY_LOCK_CONFIRMATIONS "gallery-lock-confirmations"
+#define CONFIG_GROUP_INFER_GALLERY_LOCK_VERIFY_INTERVAL "gallery-lock-verify-interval"
+#define CONFIG_GROUP_INFER_GALLERY_SHARED "gallery-shared"
+
 /** Segmentaion specific parameters. */
 #define CONFIG_GROUP_INFER_SEGMENTATION_THRESHOLD "segmentation-threshold"
 
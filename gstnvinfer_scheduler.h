@@ -0,0 +1,282 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#ifndef __GSTNVINFER_SCHEDULER_H__
+#define __GSTNVINFER_SCHEDULER_H__
+
+#include <glib.h>
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace gstnvinfer {
+
+/**
+ * Bounds the number of objects inferred on, per input buffer and per
+ * second. The objects due for inference in a buffer are ranked by a
+ * priority the caller computes, and only as many as the budget allows are
+ * inferred on. The per second budget is a token bucket holding up to one
+ * second of tokens, so that a quiet second lets a busy one through.
+ *
+ * The budget is shared between the sources of the candidates, so that one
+ * crowded source cannot take every slot. Each source is first given its
+ * guaranteed minimum, then the remaining slots are dealt by deficit round
+ * robin in proportion to the source weights, and within a source by
+ * priority. A source that still has candidates keeps its unused share, and
+ * the next buffer starts the round after the last source served. A source
+ * of weight 0 only gets its minimum, even when that leaves slots unused.
+ *
+ * Only used from the streaming thread, except for stats ().
+ */
+class ObjectScheduler
+{
+public:
+  struct Candidate
+  {
+    const void *key;
+    gfloat priority;
+    guint source;
+  };
+
+  /** 0 for no limit. source_weights and source_min_objects are indexed by
+   * source, sources past their end have weight 1 and no minimum. Restarts
+   * the token bucket full and clears the counters. */
+  void configure (guint per_buffer, guint per_second,
+      const std::vector<gdouble> & source_weights,
+      const std::vector<guint> & source_min_objects)
+  {
+    m_PerBuffer = per_buffer;
+    m_PerSecond = per_second;
+    m_SourceWeights = source_weights;
+    m_HasZeroWeight = std::find (source_weights.begin (),
+        source_weights.end (), 0.0) != source_weights.end ();
+    m_SourceMinObjects = source_min_objects;
+    m_Tokens = per_second;
+    m_RefillTime = -1;
+    m_Deficits.clear ();
+    m_NextSource = 0;
+    m_Scheduled = 0;
+    m_Deferred = 0;
+    std::lock_guard<std::mutex> lock (m_SourceStatsLock);
+    m_SourceStats.clear ();
+  }
+
+  bool enabled () const
+  {
+    return m_PerBuffer > 0 || m_PerSecond > 0;
+  }
+
+  /** Reorder candidates so that the ones to infer on come first and return
+   * their number. now_us is a monotonic time in microseconds. */
+  size_t select (std::vector<Candidate> & candidates, gint64 now_us)
+  {
+    size_t count = candidates.size ();
+    if (m_PerBuffer > 0)
+      count = std::min<size_t> (count, m_PerBuffer);
+    if (m_PerSecond > 0) {
+      if (m_RefillTime >= 0)
+        m_Tokens = std::min<gdouble> (m_PerSecond,
+            m_Tokens + (now_us - m_RefillTime) * 1e-6 * m_PerSecond);
+      m_RefillTime = now_us;
+      count = std::min<size_t> (count, (size_t) m_Tokens);
+    }
+
+    if (count < candidates.size () ||
+        (m_HasZeroWeight && !candidates.empty ()))
+      count = share (candidates, count);
+    else
+      m_Deficits.clear ();
+    if (m_PerSecond > 0)
+      m_Tokens -= count;
+
+    add (m_Scheduled, count);
+    add (m_Deferred, candidates.size () - count);
+    std::lock_guard<std::mutex> lock (m_SourceStatsLock);
+    for (size_t i = 0; i < candidates.size (); i++) {
+      SourceStats &stats = m_SourceStats[candidates[i].source];
+      if (i < count)
+        stats.served++;
+      else
+        stats.deferred++;
+    }
+    return count;
+  }
+
+  struct SourceStats
+  {
+    guint64 served = 0;
+    guint64 deferred = 0;
+  };
+
+  struct Stats
+  {
+    guint64 scheduled = 0;
+    guint64 deferred = 0;
+    /** By source, of the sources that had candidates. */
+    std::map<guint, SourceStats> sources;
+  };
+
+  Stats stats () const
+  {
+    Stats stats;
+    stats.scheduled = m_Scheduled.load (std::memory_order_relaxed);
+    stats.deferred = m_Deferred.load (std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock (m_SourceStatsLock);
+    stats.sources = m_SourceStats;
+    return stats;
+  }
+
+private:
+  /* Candidates of one source, by decreasing priority, in
+   * [next, end) of the sorted candidates. */
+  struct Queue
+  {
+    guint source;
+    size_t next;
+    size_t end;
+    gdouble weight;
+  };
+
+  gdouble weight (guint source) const
+  {
+    return source < m_SourceWeights.size () ? m_SourceWeights[source] : 1;
+  }
+
+  guint minObjects (guint source) const
+  {
+    return source < m_SourceMinObjects.size () ?
+        m_SourceMinObjects[source] : 0;
+  }
+
+  /* Pick up to count of the candidates, fairly between their sources, move
+   * them to the front and return their number. Fewer are picked only when
+   * the sources left with candidates all have weight 0. */
+  size_t share (std::vector<Candidate> & candidates, size_t count)
+  {
+    std::sort (candidates.begin (), candidates.end (),
+        [] (const Candidate & a, const Candidate & b) {
+          return a.source != b.source ? a.source < b.source :
+              a.priority > b.priority;
+        });
+
+    /* The round starts at the first source not served first last time. */
+    std::vector<Queue> queues;
+    size_t first = 0;
+    for (size_t i = 0; i < candidates.size ();) {
+      guint source = candidates[i].source;
+      size_t end = i;
+      while (end < candidates.size () && candidates[end].source == source)
+        end++;
+      if (source < m_NextSource)
+        first = queues.size () + 1;
+      queues.push_back ({source, i, end, weight (source)});
+      i = end;
+    }
+    std::rotate (queues.begin (), queues.begin () + (first % queues.size ()),
+        queues.end ());
+
+    std::vector<Candidate> picked;
+    picked.reserve (candidates.size ());
+    auto pick = [&] (Queue & queue) {
+      picked.push_back (candidates[queue.next++]);
+      m_NextSource = queue.source + 1;
+    };
+
+    /* Guaranteed minimums, one object per source and turn. */
+    for (guint turn = 0; picked.size () < count; turn++) {
+      bool more = false;
+      for (Queue & queue : queues) {
+        if (picked.size () < count && queue.next < queue.end &&
+            turn < minObjects (queue.source)) {
+          pick (queue);
+          more = true;
+        }
+      }
+      if (!more)
+        break;
+    }
+
+    /* Deficit round robin over the rest, one object costing 1. Rounds in
+     * which no source would reach a whole object are skipped at once, a
+     * source left with a whole object from the last buffer goes first. */
+    while (picked.size () < count) {
+      gdouble rounds = G_MAXDOUBLE;
+      for (const Queue & queue : queues) {
+        if (queue.next == queue.end || queue.weight <= 0)
+          continue;
+        gdouble deficit = m_Deficits[queue.source];
+        rounds = std::min (rounds, deficit >= 1 ? 0.0 :
+            std::max (1.0, ceil ((1 - deficit) / queue.weight)));
+      }
+      if (rounds == G_MAXDOUBLE)
+        break;
+
+      for (Queue & queue : queues) {
+        if (queue.next == queue.end || queue.weight <= 0)
+          continue;
+        gdouble &deficit = m_Deficits[queue.source];
+        deficit += rounds * queue.weight;
+        while (deficit >= 1 && queue.next < queue.end &&
+            picked.size () < count) {
+          pick (queue);
+          deficit -= 1;
+        }
+      }
+    }
+
+    /* Only sources left with candidates keep their deficit. */
+    std::unordered_map<guint, gdouble> deficits;
+    for (const Queue & queue : queues) {
+      if (queue.next < queue.end && m_Deficits.count (queue.source))
+        deficits[queue.source] = m_Deficits[queue.source];
+    }
+    m_Deficits.swap (deficits);
+
+    size_t picked_count = picked.size ();
+    for (const Queue & queue : queues) {
+      picked.insert (picked.end (), candidates.begin () + queue.next,
+          candidates.begin () + queue.end);
+    }
+    candidates.swap (picked);
+    return picked_count;
+  }
+
+  static void add (std::atomic<guint64> &counter, guint64 value)
+  {
+    counter.store (counter.load (std::memory_order_relaxed) + value,
+        std::memory_order_relaxed);
+  }
+
+  guint m_PerBuffer = 0;
+  guint m_PerSecond = 0;
+  std::vector<gdouble> m_SourceWeights;
+  bool m_HasZeroWeight = false;
+  std::vector<guint> m_SourceMinObjects;
+  gdouble m_Tokens = 0;
+  gint64 m_RefillTime = -1;
+  /* Deficit round robin state. */
+  std::unordered_map<guint, gdouble> m_Deficits;
+  guint m_NextSource = 0;
+  /* Written by the streaming thread only. Atomic for stats (). */
+  std::atomic<guint64> m_Scheduled {0};
+  std::atomic<guint64> m_Deferred {0};
+  mutable std::mutex m_SourceStatsLock;
+  std::map<guint, SourceStats> m_SourceStats;
+};
+
+}
+
+#endif
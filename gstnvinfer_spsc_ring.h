@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#ifndef __GSTNVINFER_SPSC_RING_H__
+#define __GSTNVINFER_SPSC_RING_H__
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gstnvinfer {
+
+/**
+ * Lets threads sleep until a condition they check themselves becomes true,
+ * on a futex. Unlike a condition variable there is no mutex: notify() is a
+ * fence and a load when nobody sleeps, and only makes the wake-up system call
+ * if a thread is parked or about to park. The first notify() after a thread
+ * parks takes the parked flag, so a woken thread that has not run yet does
+ * not cost every following notify() another system call.
+ */
+class ParkingSpot
+{
+public:
+  template <typename Ready>
+  void wait (Ready ready)
+  {
+    while (!ready ())
+      park (ready, nullptr);
+  }
+
+  /** Like wait (), but gives up at deadline. Returns ready (). */
+  template <typename Ready>
+  bool waitUntil (Ready ready, std::chrono::steady_clock::time_point deadline)
+  {
+    while (!ready ()) {
+      auto left = deadline - std::chrono::steady_clock::now ();
+      if (left <= std::chrono::steady_clock::duration::zero ())
+        return false;
+      /* Futex timeouts are relative and measured on the monotonic clock,
+       * like the steady clock. */
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds> (left);
+      struct timespec timeout;
+      timeout.tv_sec = ns.count () / 1000000000;
+      timeout.tv_nsec = ns.count () % 1000000000;
+      park (ready, &timeout);
+    }
+    return true;
+  }
+
+  void notify ()
+  {
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (m_Parked.load (std::memory_order_seq_cst) == 0 ||
+        m_Parked.exchange (0, std::memory_order_seq_cst) == 0)
+      return;
+    m_Sequence.fetch_add (1, std::memory_order_seq_cst);
+    syscall (SYS_futex, &m_Sequence, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr,
+        nullptr, 0);
+  }
+
+private:
+  template <typename Ready>
+  void park (Ready &ready, const struct timespec *timeout)
+  {
+    /* Raise the flag before sampling the sequence and checking again. A
+     * notify() that misses the flag happened before the check, one that
+     * takes it changes the sequence and fails the futex wait. */
+    m_Parked.store (1, std::memory_order_seq_cst);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    uint32_t sequence = m_Sequence.load (std::memory_order_seq_cst);
+    if (!ready ())
+      syscall (SYS_futex, &m_Sequence, FUTEX_WAIT_PRIVATE, sequence,
+          timeout, nullptr, 0);
+  }
+
+  static_assert (sizeof (std::atomic<uint32_t>) == sizeof (uint32_t),
+      "futex word must be a plain 32 bit integer");
+  std::atomic<uint32_t> m_Sequence {0};
+  std::atomic<uint32_t> m_Parked {0};
+};
+
+/**
+ * Bounded queue between one producer thread and one consumer thread. Neither
+ * side takes a lock: the producer owns the tail, the consumer the head, and
+ * each only reads the other's index. A side that has to wait, the producer on
+ * a full ring or the consumer on an empty one, parks on a ParkingSpot that
+ * the other side only wakes if it is parked.
+ *
+ * The consumer reads the oldest item with front() and releases it with
+ * pop(). An item stays counted until it is popped, so waitEmpty() returning
+ * means the consumer is done with everything pushed before. Any thread may
+ * call waitEmpty() and close().
+ */
+template <typename T>
+class SpscRing
+{
+public:
+  /** capacity is rounded up to a power of two. */
+  explicit SpscRing (size_t capacity)
+  {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    m_Slots.resize (size);
+    m_Mask = size - 1;
+  }
+
+  /** Append item, waiting while the ring is full. Returns false if the ring
+   * is closed. Producer only. */
+  bool push (T item)
+  {
+    size_t tail = m_Tail.load (std::memory_order_relaxed);
+    m_NotFull.wait ([&] {
+          return m_Closed.load (std::memory_order_acquire) ||
+              tail - m_Head.load (std::memory_order_acquire) <= m_Mask;
+        });
+    if (m_Closed.load (std::memory_order_acquire))
+      return false;
+
+    m_Slots[tail & m_Mask] = item;
+    m_Tail.store (tail + 1, std::memory_order_release);
+    m_NotEmpty.notify ();
+    return true;
+  }
+
+  /** Oldest item, waiting while the ring is empty. Returns T () if the ring
+   * is closed and empty. Consumer only. */
+  T front ()
+  {
+    size_t head = m_Head.load (std::memory_order_relaxed);
+    m_NotEmpty.wait ([&] {
+          return m_Tail.load (std::memory_order_acquire) != head ||
+              m_Closed.load (std::memory_order_acquire);
+        });
+    if (m_Tail.load (std::memory_order_acquire) == head)
+      return T ();
+    return m_Slots[head & m_Mask];
+  }
+
+  /** Release the item returned by front (). Consumer only. */
+  void pop ()
+  {
+    size_t head = m_Head.load (std::memory_order_relaxed);
+    m_Slots[head & m_Mask] = T ();
+    m_Head.store (head + 1, std::memory_order_release);
+    m_NotFull.notify ();
+  }
+
+  bool empty () const
+  {
+    return m_Head.load (std::memory_order_acquire) ==
+        m_Tail.load (std::memory_order_acquire);
+  }
+
+  /** Wait until every pushed item is popped or the ring is closed. */
+  void waitEmpty ()
+  {
+    m_NotFull.wait ([&] {
+          return empty () || m_Closed.load (std::memory_order_acquire);
+        });
+  }
+
+  /** Wake and release every waiter. Items still queued can be read until
+   * the ring is empty, further pushes fail. */
+  void close ()
+  {
+    m_Closed.store (true, std::memory_order_release);
+    m_NotEmpty.notify ();
+    m_NotFull.notify ();
+  }
+
+private:
+  /* Keep the two indexes and their parking spots apart so that the producer
+   * and consumer do not invalidate each other's cache line on every item. */
+  static const size_t kCacheLine = 64;
+
+  std::vector<T> m_Slots;
+  size_t m_Mask = 0;
+  std::atomic<bool> m_Closed {false};
+
+  char m_Pad0[kCacheLine];
+  std::atomic<size_t> m_Head {0};
+  ParkingSpot m_NotFull;
+
+  char m_Pad1[kCacheLine];
+  std::atomic<size_t> m_Tail {0};
+  ParkingSpot m_NotEmpty;
+
+  char m_Pad2[kCacheLine];
+};
+
+}
+
+#endif
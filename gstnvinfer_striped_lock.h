@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#ifndef __GSTNVINFER_STRIPED_LOCK_H__
+#define __GSTNVINFER_STRIPED_LOCK_H__
+
+#include <glib.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace gstnvinfer {
+
+/**
+ * A fixed set of mutexes, the stripes, with every key mapped onto one of
+ * them. Threads working on different keys rarely share a stripe and so
+ * rarely wait for each other, without a mutex per key.
+ *
+ * Every stripe counts its acquisitions, and the acquisitions that had to
+ * wait and for how long. The counters are updated with the stripe held, on
+ * its own cache line, and an acquisition only reads the clock if the stripe
+ * is taken.
+ */
+class StripedLock
+{
+public:
+  /** stripes is rounded up to a power of two. */
+  explicit StripedLock (guint stripes)
+  {
+    guint size = 1;
+    while (size < stripes)
+      size <<= 1;
+    m_Stripes.reset (new Stripe[size]);
+    m_Mask = size - 1;
+  }
+
+  void lock (const void *key)
+  {
+    Stripe &stripe = m_Stripes[index (key)];
+    guint64 waited_ns = 0;
+    bool waited = !stripe.mutex.try_lock ();
+    if (waited) {
+      auto start = std::chrono::steady_clock::now ();
+      stripe.mutex.lock ();
+      waited_ns = std::chrono::duration_cast<std::chrono::nanoseconds> (
+          std::chrono::steady_clock::now () - start).count ();
+    }
+    add (stripe.acquisitions, 1);
+    if (waited) {
+      add (stripe.waits, 1);
+      add (stripe.wait_ns, waited_ns);
+    }
+  }
+
+  void unlock (const void *key)
+  {
+    m_Stripes[index (key)].mutex.unlock ();
+  }
+
+  /** Totals over all stripes. Can be read while the stripes are in use. */
+  struct Stats
+  {
+    guint64 acquisitions = 0;
+    guint64 waits = 0;
+    guint64 wait_ns = 0;
+  };
+
+  Stats stats () const
+  {
+    Stats stats;
+    for (guint i = 0; i <= m_Mask; i++) {
+      const Stripe &stripe = m_Stripes[i];
+      stats.acquisitions += stripe.acquisitions.load (std::memory_order_relaxed);
+      stats.waits += stripe.waits.load (std::memory_order_relaxed);
+      stats.wait_ns += stripe.wait_ns.load (std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+  /** Must not be called while a stripe is in use. */
+  void resetStats ()
+  {
+    for (guint i = 0; i <= m_Mask; i++) {
+      m_Stripes[i].acquisitions = 0;
+      m_Stripes[i].waits = 0;
+      m_Stripes[i].wait_ns = 0;
+    }
+  }
+
+private:
+  static const size_t kCacheLine = 64;
+
+  struct Stripe
+  {
+    std::mutex mutex;
+    /* Only written with the mutex held. Atomic for stats (). */
+    std::atomic<guint64> acquisitions {0};
+    std::atomic<guint64> waits {0};
+    std::atomic<guint64> wait_ns {0};
+    char pad[kCacheLine];
+  };
+
+  static void add (std::atomic<guint64> &counter, guint64 value)
+  {
+    counter.store (counter.load (std::memory_order_relaxed) + value,
+        std::memory_order_relaxed);
+  }
+
+  /* Keys are object addresses, their low bits are mostly zero. */
+  guint index (const void *key) const
+  {
+    guint64 k = (guint64) (uintptr_t) key;
+    return (guint) ((k * 0x9e3779b97f4a7c15ull) >> 40) & m_Mask;
+  }
+
+  std::unique_ptr<Stripe[]> m_Stripes;
+  guint m_Mask = 0;
+};
+
+/**
+ * Holds the stripe of a key for a scope, like LockGMutex. A guard for a
+ * NULL key holds nothing, so that code handling objects that may not exist
+ * can take the guard unconditionally.
+ */
+class StripeGuard
+{
+public:
+  StripeGuard (StripedLock &locks, const void *key)
+    : m_Locks (locks)
+  {
+    lock (key);
+  }
+
+  ~StripeGuard ()
+  {
+    unlock ();
+  }
+
+  /** Hold the stripe of key instead, releasing the one held. */
+  void lock (const void *key)
+  {
+    unlock ();
+    m_Key = key;
+    lock ();
+  }
+
+  /** Take the stripe of the current key again after unlock (). */
+  void lock ()
+  {
+    if (m_Key && !m_Locked) {
+      m_Locks.lock (m_Key);
+      m_Locked = true;
+    }
+  }
+
+  void unlock ()
+  {
+    if (m_Locked) {
+      m_Locks.unlock (m_Key);
+      m_Locked = false;
+    }
+  }
+
+private:
+  StripedLock &m_Locks;
+  const void *m_Key = nullptr;
+  bool m_Locked = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "gstnvinfer_worker_pool.h"
+
+namespace gstnvinfer
+{
+
+WorkerPool::WorkerPool (guint num_workers, const std::vector<gint> &cpus,
+    const std::string &name)
+{
+  for (guint i = 0; i < num_workers; i++) {
+    gint cpu = cpus.empty () ? -1 : cpus[i % cpus.size ()];
+    m_Threads.emplace_back (&WorkerPool::workerLoop, this, i, cpu,
+        name + std::to_string (i));
+  }
+}
+
+WorkerPool::~WorkerPool ()
+{
+  {
+    std::unique_lock<std::mutex> lock (m_Lock);
+    m_Stop = true;
+  }
+  m_WorkCond.notify_all ();
+  for (auto & thread : m_Threads)
+    thread.join ();
+}
+
+bool
+WorkerPool::run (guint num_jobs, const Job &job)
+{
+  if (num_jobs == 0)
+    return true;
+
+  std::unique_lock<std::mutex> lock (m_Lock);
+  m_Job = &job;
+  m_NumJobs = num_jobs;
+  m_NextJob = 0;
+  m_PendingJobs = num_jobs;
+  m_Failed = false;
+  m_Generation++;
+  m_WorkCond.notify_all ();
+
+  m_DoneCond.wait (lock, [this] { return m_PendingJobs == 0; });
+  m_Job = nullptr;
+  return !m_Failed;
+}
+
+void
+WorkerPool::workerLoop (guint worker, gint cpu, std::string name)
+{
+  /* Thread names are limited to 15 characters. */
+  if (name.size () > 15)
+    name.resize (15);
+  pthread_setname_np (pthread_self (), name.c_str ());
+
+  if (cpu >= 0) {
+    cpu_set_t cpuset;
+    CPU_ZERO (&cpuset);
+    CPU_SET (cpu, &cpuset);
+    if (pthread_setaffinity_np (pthread_self (), sizeof (cpuset), &cpuset))
+      g_warning ("Could not pin worker %u to CPU %d", worker, cpu);
+  }
+
+  guint64 generation = 0;
+  std::unique_lock<std::mutex> lock (m_Lock);
+  while (true) {
+    m_WorkCond.wait (lock,
+        [&] { return m_Stop || m_Generation != generation; });
+    if (m_Stop)
+      return;
+    generation = m_Generation;
+
+    while (m_NextJob < m_NumJobs) {
+      guint job = m_NextJob++;
+      const Job &func = *m_Job;
+
+      lock.unlock ();
+      bool ok = func (worker, job);
+      lock.lock ();
+
+      if (!ok)
+        m_Failed = true;
+      if (--m_PendingJobs == 0)
+        m_DoneCond.notify_one ();
+    }
+  }
+}
+
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#ifndef __GSTNVINFER_WORKER_POOL_H__
+#define __GSTNVINFER_WORKER_POOL_H__
+
+#include <glib.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gstnvinfer {
+
+/**
+ * Fixed set of threads that runs the independent jobs of one batch in
+ * parallel. run() hands out the jobs to the workers and returns once all of
+ * them are done, so the caller sees the batch as a single blocking call.
+ * Jobs only know their own index; each job must write to its own slot of
+ * the output to keep the results in order.
+ */
+class WorkerPool
+{
+public:
+  /** Job callback. Called with the index of the worker running it and the
+   * index of the job. Returns false on failure. */
+  using Job = std::function<bool (guint worker, guint job)>;
+
+  /** Start num_workers threads, named name followed by the worker index.
+   * If cpus is not empty, worker i is pinned to CPU cpus[i % cpus.size()]. */
+  WorkerPool (guint num_workers, const std::vector<gint> &cpus,
+      const std::string &name = "nvinfer-align");
+  ~WorkerPool ();
+
+  guint size () const { return m_Threads.size (); }
+
+  /** Run job for every index in [0, num_jobs) and wait for all of them to
+   * finish. Returns false if any of the jobs failed. Must not be called
+   * concurrently. */
+  bool run (guint num_jobs, const Job &job);
+
+private:
+  void workerLoop (guint worker, gint cpu, std::string name);
+
+  std::vector<std::thread> m_Threads;
+  std::mutex m_Lock;
+  std::condition_variable m_WorkCond;
+  std::condition_variable m_DoneCond;
+
+  /* State of the current run, protected by m_Lock. */
+  const Job *m_Job = nullptr;
+  guint m_NumJobs = 0;
+  guint m_NextJob = 0;
+  guint m_PendingJobs = 0;
+  guint64 m_Generation = 0;
+  bool m_Failed = false;
+  bool m_Stop = false;
+};
+
+}
+
+#endif
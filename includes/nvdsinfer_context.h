@@ -133,6 +133,10 @@ typedef enum
     /** Specifies a segmentation network. A segmentation network classifies
      each pixel into one of several classes. */
     NvDsInferNetworkType_Segmentation,
+    /** Specifies an embedding network. The first output layer holds one
+     feature vector per input, which is scaled to unit L2 norm so that
+     vectors can be compared with a dot product. */
+    NvDsInferNetworkType_Embedding,
     /** Specifies other. Output layers of an "other" network are not parsed by
      NvDsInferContext. This is useful for networks that produce custom output.
      Output can be parsed by the NvDsInferContext client or can be combined
@@ -155,6 +159,10 @@ typedef enum
     NvDsInferFormat_RGBA,
     /** Specifies 32-bit interleaved B-G-R-x format. */
     NvDsInferFormat_BGRx,
+    /** Specifies already pre-processed planar float data with the network
+     input dimensions. The pitch is the size of one row of one plane in bytes.
+     It is copied to the input layer without any conversion. */
+    NvDsInferFormat_Tensor,
     NvDsInferFormat_Unknown = 0xFFFFFFFF,
 } NvDsInferFormat;
 
@@ -366,6 +374,16 @@ typedef struct _NvDsInferContextInitParams
 
     /** Holds the type of clustering mode */
     NvDsInferClusterMode clusterMode;
+
+    /** Holds the data type of the floating point output layers of an engine
+     built from the model. HALF halves the device to host copies and host
+     buffers of the output. INT8 requires INT8 network mode. */
+    NvDsInferDataType outputDataType;
+    /** Holds the order of the output layers parsed by NvDsInferContext. */
+    NvDsInferTensorOrder outputTensorOrder;
+    /** Holds the factor INT8 output layers are multiplied by when parsed,
+     their dynamic range divided by 127. */
+    float outputInt8Scale;
 } NvDsInferContextInitParams;
 
 /**
@@ -468,6 +486,19 @@ typedef struct
     float *class_probability_map;
 } NvDsInferSegmentationOutput;
 
+/**
+ * Holds the feature vector produced by an embedding network for one frame.
+ */
+typedef struct
+{
+    /** Holds a pointer to the L2-normalized vector. */
+    float *vector;
+    /** Holds the number of elements in @a vector. */
+    unsigned int length;
+    /** Holds the L2 norm of the vector before normalization. */
+    float norm;
+} NvDsInferEmbeddingOutput;
+
 /**
  * Holds the information inferred by the network on one frame.
  */
@@ -490,6 +521,9 @@ typedef struct
         /** Holds classifier output. Valid when @a outputType is
          @ref NvDsInferNetworkType_Classifier. */
         NvDsInferSegmentationOutput segmentationOutput;
+        /** Holds embedding output. Valid when @a outputType is
+         @ref NvDsInferNetworkType_Embedding. */
+        NvDsInferEmbeddingOutput embeddingOutput;
     };
 } NvDsInferFrameOutput;
 
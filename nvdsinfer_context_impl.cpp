@@ -351,6 +351,9 @@ NvDsInferStatus InferPreprocessor::transform(
                 case NvDsInferFormat_BGRx:
                     convertFcn = NvDsInferConvert_C4ToP3RFloat;
                     break;
+                case NvDsInferFormat_Tensor:
+                    /* Already pre-processed, copied as is. */
+                    break;
                 default:
                     printError("Input format conversion is not supported");
                     return NVDSINFER_INVALID_PARAMS;
@@ -371,6 +374,9 @@ NvDsInferStatus InferPreprocessor::transform(
                 case NvDsInferFormat_BGRx:
                     convertFcn = NvDsInferConvert_C4ToP3Float;
                     break;
+                case NvDsInferFormat_Tensor:
+                    /* Already pre-processed, copied as is. */
+                    break;
                 default:
                     printError("Input format conversion is not supported");
                     return NVDSINFER_INVALID_PARAMS;
@@ -396,6 +402,19 @@ NvDsInferStatus InferPreprocessor::transform(
         float* outPtr =
             (float*)devBuf + i * m_NetworkInputLayer.inferDims.numElements;
 
+        if (!convertFcn)
+        {
+            /* Input is already pre-processed. Only drop the row padding. */
+            size_t rowBytes = m_NetworkInfo.width * sizeof(float);
+            RETURN_CUDA_ERR(
+                cudaMemcpy2DAsync(outPtr, rowBytes, batchInput.inputFrames[i],
+                    batchInput.inputPitch, rowBytes,
+                    m_NetworkInfo.height * m_NetworkInfo.channels,
+                    cudaMemcpyDefault, *m_PreProcessStream),
+                "Failed to copy pre-processed input to input binding buffer");
+            continue;
+        }
+
         /* Input needs to be pre-processed. */
         convertFcn(outPtr, (unsigned char*)batchInput.inputFrames[i],
             m_NetworkInfo.width, m_NetworkInfo.height, batchInput.inputPitch,
@@ -480,6 +499,8 @@ NvDsInferStatus
 InferPostprocessor::initResource(const NvDsInferContextInitParams& initParams)
 {
     m_CopyInputToHostBuffers = initParams.copyInputToHostBuffers;
+    m_OutputTensorOrder = initParams.outputTensorOrder;
+    m_OutputInt8Scale = initParams.outputInt8Scale;
 
     if (!string_empty(initParams.labelsFilePath))
     {
@@ -750,11 +771,48 @@ SegmentPostprocessor::parseEachBatch(
     NvDsInferFrameOutput& result)
 {
     result.outputType = NvDsInferNetworkType_Segmentation;
-    fillSegmentationOutput(outputLayers, result.segmentationOutput);
+    RETURN_NVINFER_ERROR(
+        fillSegmentationOutput(outputLayers, result.segmentationOutput),
+        "fill segmentation output failed");
 
     return NVDSINFER_SUCCESS;
 }
 
+NvDsInferStatus
+EmbeddingPostprocessor::initResource(const NvDsInferContextInitParams& initParams)
+{
+    RETURN_NVINFER_ERROR(InferPostprocessor::initResource(initParams),
+        "init post processing resource failed");
+
+    /* The vector is taken from the first output layer. */
+    if (m_OutputLayerInfo.empty())
+    {
+        printError("Failed to init embedding-postprocessor "
+                   "because the network has no output layer");
+        return NVDSINFER_CONFIG_FAILED;
+    }
+    const NvDsInferLayerInfo& layer = m_OutputLayerInfo[0];
+    if (layer.dataType != FLOAT && layer.dataType != HALF &&
+        layer.dataType != INT8)
+    {
+        printError("Failed to init embedding-postprocessor because output "
+                   "layer %s is not FLOAT, HALF or INT8",
+            safeStr(layer.layerName));
+        return NVDSINFER_CONFIG_FAILED;
+    }
+    return NVDSINFER_SUCCESS;
+}
+
+NvDsInferStatus
+EmbeddingPostprocessor::parseEachBatch(
+    const std::vector<NvDsInferLayerInfo>& outputLayers,
+    NvDsInferFrameOutput& result)
+{
+    result.outputType = NvDsInferNetworkType_Embedding;
+    fillEmbeddingOutput(outputLayers, result.embeddingOutput);
+    return NVDSINFER_SUCCESS;
+}
+
 NvDsInferStatus
 OtherPostprocessor::initResource(const NvDsInferContextInitParams& initParams)
 {
@@ -852,6 +910,10 @@ NvDsInferContextImpl::preparePostprocess(const NvDsInferContextInitParams& initP
         case NvDsInferNetworkType_Segmentation:
             processor = std::make_unique<SegmentPostprocessor>(m_UniqueID, m_GpuID);
             break;
+        case NvDsInferNetworkType_Embedding:
+            processor =
+                std::make_unique<EmbeddingPostprocessor>(m_UniqueID, m_GpuID);
+            break;
         case NvDsInferNetworkType_Other:
             processor = std::make_unique<OtherPostprocessor>(m_UniqueID, m_GpuID);
             break;
@@ -1821,6 +1883,9 @@ NvDsInferContext_ResetInitParams (NvDsInferContextInitParams *initParams)
     initParams->networkScaleFactor = 1.0;
     initParams->networkType = NvDsInferNetworkType_Detector;
     initParams->outputBufferPoolSize = NVDSINFER_MIN_OUTPUT_BUFFERPOOL_SIZE;
+    initParams->outputDataType = FLOAT;
+    initParams->outputTensorOrder = NvDsInferTensorOrder_kNCHW;
+    initParams->outputInt8Scale = 1.0;
 }
 
 const char *
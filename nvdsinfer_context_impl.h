@@ -31,6 +31,7 @@
 #include <nvdsinfer_utils.h>
 
 #include "nvdsinfer_backend.h"
+#include "nvdsinfer_tensor_accessor.h"
 
 namespace nvdsinfer {
 
@@ -160,6 +161,20 @@ protected:
     NvDsInferStatus allocDeviceResource();
     void releaseFrameOutput(NvDsInferFrameOutput& frameOutput);
 
+    /* Call func with an accessor reading layer, see dispatchTensor(). */
+    template <typename Func>
+    bool readOutputLayer(const NvDsInferLayerInfo& layer, Func&& func) const
+    {
+        return dispatchTensor(layer, m_OutputTensorOrder, m_OutputInt8Scale,
+            std::forward<Func>(func));
+    }
+    /* True if layer can not be read as a planar float array. */
+    bool needsFloatConversion(const NvDsInferLayerInfo& layer) const
+    {
+        return layer.dataType != FLOAT ||
+            m_OutputTensorOrder == NvDsInferTensorOrder_kNHWC;
+    }
+
 private:
     DISABLE_CLASS_COPY(InferPostprocessor);
 
@@ -178,6 +193,9 @@ protected:
     NvDsInferNetworkInfo m_NetworkInfo = {0};
     std::vector<NvDsInferLayerInfo> m_AllLayerInfo;
     std::vector<NvDsInferLayerInfo> m_OutputLayerInfo;
+    /* Order of the output layers and scale of INT8 output layers. */
+    NvDsInferTensorOrder m_OutputTensorOrder = NvDsInferTensorOrder_kNCHW;
+    float m_OutputInt8Scale = 1.0f;
 
     /* Holds the string labels for classes. */
     std::vector<std::vector<std::string>> m_Labels;
@@ -295,6 +313,26 @@ private:
     float m_SegmentationThreshold = 0.0f;
 };
 
+/** Implementation of post-processing class for embedding networks. */
+class EmbeddingPostprocessor : public InferPostprocessor
+{
+public:
+    EmbeddingPostprocessor(int id, int gpuId = 0)
+        : InferPostprocessor(NvDsInferNetworkType_Embedding, id, gpuId) {}
+
+    NvDsInferStatus initResource(
+        const NvDsInferContextInitParams& initParams) override;
+
+private:
+    NvDsInferStatus parseEachBatch(
+        const std::vector<NvDsInferLayerInfo>& outputLayers,
+        NvDsInferFrameOutput& result) override;
+
+    NvDsInferStatus fillEmbeddingOutput(
+        const std::vector<NvDsInferLayerInfo>& outputLayers,
+        NvDsInferEmbeddingOutput& output);
+};
+
 class OtherPostprocessor : public InferPostprocessor
 {
 public:
@@ -12,6 +12,7 @@
 #include <cassert>
 
 #include "nvdsinfer_context_impl.h"
+#include "embedding_kernels.h"
 
 #include <algorithm>
 
@@ -65,109 +66,107 @@ DetectPostprocessor::parseBoundingBox(vector<NvDsInferLayerInfo> const& outputLa
         return false;
     }
 
-    float *outputCoverageBuffer =
-        (float *)outputLayersInfo[outputCoverageLayerIndex].buffer;
-    float *outputBboxBuffer =
-        (float *)outputLayersInfo[outputBBoxLayerIndex].buffer;
+    const NvDsInferLayerInfo& coverageLayer =
+        outputLayersInfo[outputCoverageLayerIndex];
+    const NvDsInferLayerInfo& bboxLayer = outputLayersInfo[outputBBoxLayerIndex];
 
-    NvDsInferDimsCHW outputCoverageDims;
-    NvDsInferDimsCHW outputBBoxDims;
-
-    getDimsCHWFromDims(outputCoverageDims,
-        outputLayersInfo[outputCoverageLayerIndex].inferDims);
-    getDimsCHWFromDims(
-        outputBBoxDims, outputLayersInfo[outputBBoxLayerIndex].inferDims);
-
-    unsigned int targetShape[2] = { outputCoverageDims.w, outputCoverageDims.h };
-    float bboxNorm[2] = { 35.0, 35.0 };
-    float gcCenters0[targetShape[0]];
-    float gcCenters1[targetShape[1]];
-    int gridSize = outputCoverageDims.w * outputCoverageDims.h;
-    int strideX = DIVIDE_AND_ROUND_UP(networkInfo.width, outputBBoxDims.w);
-    int strideY = DIVIDE_AND_ROUND_UP(networkInfo.height, outputBBoxDims.h);
-
-    for (unsigned int i = 0; i < targetShape[0]; i++)
+    /* The layers are read through accessors matching their data type and
+     * order, see readOutputLayer(). */
+    auto parseGrid = [&](const auto& outputCoverage, const auto& outputBBox)
     {
-        gcCenters0[i] = (float)(i * strideX + 0.5);
-        gcCenters0[i] /= (float)bboxNorm[0];
-    }
-    for (unsigned int i = 0; i < targetShape[1]; i++)
-    {
-        gcCenters1[i] = (float)(i * strideY + 0.5);
-        gcCenters1[i] /= (float)bboxNorm[1];
-    }
-
-    unsigned int numClasses =
-        MIN(outputCoverageDims.c, detectionParams.numClassesConfigured);
-    for (unsigned int classIndex = 0; classIndex < numClasses; classIndex++)
-    {
-
-        /* Pointers to memory regions containing the (x1,y1) and (x2,y2) coordinates
-         * of rectangles in the output bounding box layer. */
-        float *outputX1 = outputBboxBuffer
-            + classIndex * sizeof (float) * outputBBoxDims.h * outputBBoxDims.w;
-
-        float *outputY1 = outputX1 + gridSize;
-        float *outputX2 = outputY1 + gridSize;
-        float *outputY2 = outputX2 + gridSize;
+        unsigned int targetShape[2] = { outputCoverage.width(),
+            outputCoverage.height() };
+        float bboxNorm[2] = { 35.0, 35.0 };
+        float gcCenters0[targetShape[0]];
+        float gcCenters1[targetShape[1]];
+        int strideX = DIVIDE_AND_ROUND_UP(networkInfo.width, outputBBox.width());
+        int strideY = DIVIDE_AND_ROUND_UP(networkInfo.height, outputBBox.height());
+
+        for (unsigned int i = 0; i < targetShape[0]; i++)
+        {
+            gcCenters0[i] = (float)(i * strideX + 0.5);
+            gcCenters0[i] /= (float)bboxNorm[0];
+        }
+        for (unsigned int i = 0; i < targetShape[1]; i++)
+        {
+            gcCenters1[i] = (float)(i * strideY + 0.5);
+            gcCenters1[i] /= (float)bboxNorm[1];
+        }
 
-        /* Iterate through each point in the grid and check if the rectangle at that
-         * point meets the minimum threshold criteria. */
-        for (unsigned int h = 0; h < outputCoverageDims.h; h++)
+        unsigned int numClasses =
+            MIN(outputCoverage.channels(), detectionParams.numClassesConfigured);
+        for (unsigned int classIndex = 0; classIndex < numClasses; classIndex++)
         {
-            for (unsigned int w = 0; w < outputCoverageDims.w; w++)
+            /* The bbox layer holds the (x1,y1) and (x2,y2) coordinates of
+             * the rectangles of each class in four consecutive channels. */
+            unsigned int channelX1 = classIndex * 4;
+
+            /* Iterate through each point in the grid and check if the rectangle at that
+             * point meets the minimum threshold criteria. */
+            for (unsigned int h = 0; h < outputCoverage.height(); h++)
             {
-                int i = w + h * outputCoverageDims.w;
-                float confidence = outputCoverageBuffer[classIndex * gridSize + i];
-
-                if (confidence < detectionParams.perClassPreclusterThreshold[classIndex])
-                    continue;
-
-                float rectX1Float, rectY1Float, rectX2Float, rectY2Float;
-
-                /* Centering and normalization of the rectangle. */
-                rectX1Float =
-                    outputX1[w + h * outputCoverageDims.w] - gcCenters0[w];
-                rectY1Float =
-                    outputY1[w + h * outputCoverageDims.w] - gcCenters1[h];
-                rectX2Float =
-                    outputX2[w + h * outputCoverageDims.w] + gcCenters0[w];
-                rectY2Float =
-                    outputY2[w + h * outputCoverageDims.w] + gcCenters1[h];
-
-                rectX1Float *= -bboxNorm[0];
-                rectY1Float *= -bboxNorm[1];
-                rectX2Float *= bboxNorm[0];
-                rectY2Float *= bboxNorm[1];
-
-                /* Clip parsed rectangles to frame bounds. */
-                if (rectX1Float >= (int)m_NetworkInfo.width)
-                    rectX1Float = m_NetworkInfo.width - 1;
-                if (rectX2Float >= (int)m_NetworkInfo.width)
-                    rectX2Float = m_NetworkInfo.width - 1;
-                if (rectY1Float >= (int)m_NetworkInfo.height)
-                    rectY1Float = m_NetworkInfo.height - 1;
-                if (rectY2Float >= (int)m_NetworkInfo.height)
-                    rectY2Float = m_NetworkInfo.height - 1;
-
-                if (rectX1Float < 0)
-                    rectX1Float = 0;
-                if (rectX2Float < 0)
-                    rectX2Float = 0;
-                if (rectY1Float < 0)
-                    rectY1Float = 0;
-                if (rectY2Float < 0)
-                    rectY2Float = 0;
-
-                //Prevent underflows
-                if(((rectX2Float - rectX1Float) < 0) || ((rectY2Float - rectY1Float) < 0))
-                    continue;
-
-                objectList.push_back({ classIndex, rectX1Float,
-                         rectY1Float, (rectX2Float - rectX1Float),
-                         (rectY2Float - rectY1Float), confidence});
+                for (unsigned int w = 0; w < outputCoverage.width(); w++)
+                {
+                    float confidence = outputCoverage(classIndex, h, w);
+
+                    if (confidence < detectionParams.perClassPreclusterThreshold[classIndex])
+                        continue;
+
+                    float rectX1Float, rectY1Float, rectX2Float, rectY2Float;
+
+                    /* Centering and normalization of the rectangle. */
+                    rectX1Float = outputBBox(channelX1, h, w) - gcCenters0[w];
+                    rectY1Float = outputBBox(channelX1 + 1, h, w) - gcCenters1[h];
+                    rectX2Float = outputBBox(channelX1 + 2, h, w) + gcCenters0[w];
+                    rectY2Float = outputBBox(channelX1 + 3, h, w) + gcCenters1[h];
+
+                    rectX1Float *= -bboxNorm[0];
+                    rectY1Float *= -bboxNorm[1];
+                    rectX2Float *= bboxNorm[0];
+                    rectY2Float *= bboxNorm[1];
+
+                    /* Clip parsed rectangles to frame bounds. */
+                    if (rectX1Float >= (int)m_NetworkInfo.width)
+                        rectX1Float = m_NetworkInfo.width - 1;
+                    if (rectX2Float >= (int)m_NetworkInfo.width)
+                        rectX2Float = m_NetworkInfo.width - 1;
+                    if (rectY1Float >= (int)m_NetworkInfo.height)
+                        rectY1Float = m_NetworkInfo.height - 1;
+                    if (rectY2Float >= (int)m_NetworkInfo.height)
+                        rectY2Float = m_NetworkInfo.height - 1;
+
+                    if (rectX1Float < 0)
+                        rectX1Float = 0;
+                    if (rectX2Float < 0)
+                        rectX2Float = 0;
+                    if (rectY1Float < 0)
+                        rectY1Float = 0;
+                    if (rectY2Float < 0)
+                        rectY2Float = 0;
+
+                    //Prevent underflows
+                    if(((rectX2Float - rectX1Float) < 0) || ((rectY2Float - rectY1Float) < 0))
+                        continue;
+
+                    objectList.push_back({ classIndex, rectX1Float,
+                             rectY1Float, (rectX2Float - rectX1Float),
+                             (rectY2Float - rectY1Float), confidence});
+                }
             }
         }
+    };
+
+    bool parsed = false;
+    readOutputLayer(coverageLayer, [&](const auto& outputCoverage) {
+        parsed = readOutputLayer(bboxLayer, [&](const auto& outputBBox) {
+            parseGrid(outputCoverage, outputBBox);
+        });
+    });
+    if (!parsed)
+    {
+        printError("Output layers %s and %s have an unsupported data type",
+            safeStr(coverageLayer.layerName), safeStr(bboxLayer.layerName));
+        return false;
     }
     return true;
 }
@@ -499,12 +498,6 @@ ClassifyPostprocessor::parseAttributesFromSoftmaxLayers(
          * to each class with each probability being in the range [0,1] and
          * sum all probabilities will be 1.
          */
-        NvDsInferDimsCHW dims;
-
-        getDimsCHWFromDims(dims, m_OutputLayerInfo[l].inferDims);
-        unsigned int numClasses = dims.c;
-        float *outputCoverageBuffer =
-            (float *)m_OutputLayerInfo[l].buffer;
         float maxProbability = 0;
         bool attrFound = false;
         NvDsInferAttribute attr;
@@ -512,18 +505,28 @@ ClassifyPostprocessor::parseAttributesFromSoftmaxLayers(
         /* Iterate through all the probabilities that the object belongs to
          * each class. Find the maximum probability and the corresponding class
          * which meets the minimum threshold. */
-        for (unsigned int c = 0; c < numClasses; c++)
+        auto findAttribute = [&](const auto& outputCoverage)
         {
-            float probability = outputCoverageBuffer[c];
-            if (probability > m_ClassifierThreshold
-                    && probability > maxProbability)
+            unsigned int numClasses = outputCoverage.channels();
+            for (unsigned int c = 0; c < numClasses; c++)
             {
-                maxProbability = probability;
-                attrFound = true;
-                attr.attributeIndex = l;
-                attr.attributeValue = c;
-                attr.attributeConfidence = probability;
+                float probability = outputCoverage(c, 0, 0);
+                if (probability > m_ClassifierThreshold
+                        && probability > maxProbability)
+                {
+                    maxProbability = probability;
+                    attrFound = true;
+                    attr.attributeIndex = l;
+                    attr.attributeValue = c;
+                    attr.attributeConfidence = probability;
+                }
             }
+        };
+        if (!readOutputLayer(m_OutputLayerInfo[l], findAttribute))
+        {
+            printError("Output layer %s has an unsupported data type",
+                safeStr(m_OutputLayerInfo[l].layerName));
+            return false;
         }
         if (attrFound)
         {
@@ -666,32 +669,83 @@ SegmentPostprocessor::fillSegmentationOutput(
     const std::vector<NvDsInferLayerInfo>& outputLayers,
     NvDsInferSegmentationOutput& output)
 {
-    NvDsInferDimsCHW outputDimsCHW;
-    getDimsCHWFromDims(outputDimsCHW, outputLayers[0].inferDims);
+    const NvDsInferLayerInfo& layer = outputLayers[0];
 
-    output.width = outputDimsCHW.w;
-    output.height = outputDimsCHW.h;
-    output.classes = outputDimsCHW.c;
+    /* Planar float layers are handed out as they are. Other layers are
+     * converted to a planar float map owned by the output. */
+    bool convert = needsFloatConversion(layer);
+    output.class_map = nullptr;
+    output.class_probability_map = nullptr;
 
-    output.class_map = new int [output.width * output.height];
-    output.class_probability_map = (float*)outputLayers[0].buffer;
-
-    for (unsigned int y = 0; y < output.height; y++)
+    auto fillClassMap = [&](const auto& outputProbabilities)
     {
-        for (unsigned int x = 0; x < output.width; x++)
+        output.width = outputProbabilities.width();
+        output.height = outputProbabilities.height();
+        output.classes = outputProbabilities.channels();
+
+        unsigned int planeSize = output.width * output.height;
+        output.class_map = new int [planeSize];
+        output.class_probability_map = convert ?
+            new float [output.classes * planeSize] : (float*)layer.buffer;
+
+        for (unsigned int y = 0; y < output.height; y++)
         {
-            float max_prob = -1;
-            int &cls = output.class_map[y * output.width + x] = -1;
-            for (unsigned int c = 0; c < output.classes; c++)
+            for (unsigned int x = 0; x < output.width; x++)
             {
-                float prob = output.class_probability_map[c * output.width * output.height + y * output.width + x];
-                if (prob > max_prob && prob > m_SegmentationThreshold)
+                float max_prob = -1;
+                int &cls = output.class_map[y * output.width + x] = -1;
+                for (unsigned int c = 0; c < output.classes; c++)
                 {
-                    cls = c;
-                    max_prob = prob;
+                    float prob = outputProbabilities(c, y, x);
+                    if (convert)
+                        output.class_probability_map[c * planeSize + y * output.width + x] = prob;
+                    if (prob > max_prob && prob > m_SegmentationThreshold)
+                    {
+                        cls = c;
+                        max_prob = prob;
+                    }
                 }
             }
         }
+    };
+    if (!readOutputLayer(layer, fillClassMap))
+    {
+        printError("Output layer %s has an unsupported data type",
+            safeStr(layer.layerName));
+        return NVDSINFER_OUTPUT_PARSING_FAILED;
+    }
+    return NVDSINFER_SUCCESS;
+}
+
+NvDsInferStatus
+EmbeddingPostprocessor::fillEmbeddingOutput(
+    const std::vector<NvDsInferLayerInfo>& outputLayers,
+    NvDsInferEmbeddingOutput& output)
+{
+    const NvDsInferLayerInfo& layer = outputLayers[0];
+
+    output.length = layer.inferDims.numElements;
+    output.vector = new float[output.length];
+    /* The vector is read whole, so it is converted with the vectorized
+     * kernels rather than element by element. */
+    switch (layer.dataType)
+    {
+        case HALF:
+            mirror::HalfToFloat((const uint16_t*)layer.buffer, output.vector,
+                output.length);
+            output.norm = mirror::L2Normalize(output.vector, output.vector,
+                output.length);
+            break;
+        case INT8:
+            mirror::DequantizeInt8((const int8_t*)layer.buffer,
+                m_OutputInt8Scale, output.vector, output.length);
+            output.norm = mirror::L2Normalize(output.vector, output.vector,
+                output.length);
+            break;
+        default:
+            output.norm = mirror::L2Normalize(
+                (const float*)layer.buffer, output.vector, output.length);
+            break;
     }
     return NVDSINFER_SUCCESS;
 }
@@ -715,6 +769,12 @@ InferPostprocessor::releaseFrameOutput(NvDsInferFrameOutput& frameOutput)
             break;
         case NvDsInferNetworkType_Segmentation:
             delete[] frameOutput.segmentationOutput.class_map;
+            if (!m_OutputLayerInfo.empty() &&
+                    needsFloatConversion(m_OutputLayerInfo[0]))
+                delete[] frameOutput.segmentationOutput.class_probability_map;
+            break;
+        case NvDsInferNetworkType_Embedding:
+            delete[] frameOutput.embeddingOutput.vector;
             break;
         default:
             break;
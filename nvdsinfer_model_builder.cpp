@@ -445,6 +445,14 @@ BuildParams::sanityCheck() const
         default:
             return false;
     }
+
+    /* INT8 outputs need the dynamic ranges of INT8 mode. */
+    if (outputDataType == nvinfer1::DataType::kINT8 &&
+        networkMode != NvDsInferNetworkMode_INT8)
+    {
+        dsInferError("INT8 output layers require INT8 network mode.");
+        return false;
+    }
     return true;
 }
 
@@ -1050,6 +1058,19 @@ TrtModelBuilder::initCommonParams(BuildParams& params,
     }
     params.int8CalibrationFilePath = initParams.int8CalibrationFilePath;
 
+    switch (initParams.outputDataType)
+    {
+        case HALF:
+            params.outputDataType = nvinfer1::DataType::kHALF;
+            break;
+        case INT8:
+            params.outputDataType = nvinfer1::DataType::kINT8;
+            break;
+        default:
+            params.outputDataType = nvinfer1::DataType::kFLOAT;
+            break;
+    }
+
     if (initParams.useDLA && initParams.dlaCore >= 0)
         params.dlaCore = initParams.dlaCore;
     else
@@ -1129,6 +1150,10 @@ TrtModelBuilder::configCommonOptions(BuildParams& params)
             output->setType(std::get<0>(params.outputFormats[oL]));
             output->setAllowedFormats(std::get<1>(params.outputFormats[oL]));
         }
+        else if (output->getType() == nvinfer1::DataType::kFLOAT)
+        {
+            output->setType(params.outputDataType);
+        }
     }
 
     /* Set workspace size. */
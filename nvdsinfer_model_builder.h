@@ -206,6 +206,8 @@ struct BuildParams
     int dlaCore = -1;
     std::vector<TensorIOFormat> inputFormats;
     std::vector<TensorIOFormat> outputFormats;
+    /* Data type of float output layers without an entry in outputFormats. */
+    nvinfer1::DataType outputDataType = nvinfer1::DataType::kFLOAT;
 
 public:
     virtual ~BuildParams(){};
@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+#ifndef __NVDSINFER_TENSOR_ACCESSOR_H__
+#define __NVDSINFER_TENSOR_ACCESSOR_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#include <cstddef>
+#include <utility>
+
+#include <nvdsinfer.h>
+#include <nvdsinfer_context.h>
+
+namespace nvdsinfer {
+
+/* Convert an IEEE 754 half precision value to float. Zeros and subnormals
+ * are rescaled by a multiplication rather than normalised in a loop, so only
+ * infinities and NaNs take a different path. */
+inline float
+halfToFloat(uint16_t value)
+{
+#if defined(__aarch64__)
+    __fp16 h;
+    memcpy(&h, &value, sizeof(h));
+    return h;
+#else
+    static const float kDenormScale = 5.192296858534828e+33f; /* 2^112 */
+    uint32_t bits = (uint32_t)(value & 0x7fff) << 13;
+    float f;
+    if ((value & 0x7c00) == 0x7c00)
+    {
+        bits |= 0x7f800000;
+        memcpy(&f, &bits, sizeof(f));
+    }
+    else
+    {
+        memcpy(&f, &bits, sizeof(f));
+        f *= kDenormScale;
+    }
+    uint32_t out;
+    memcpy(&out, &f, sizeof(out));
+    out |= (uint32_t)(value & 0x8000) << 16;
+    memcpy(&f, &out, sizeof(f));
+    return f;
+#endif
+}
+
+/* Storage type of each supported output layer data type and how one element
+ * is read as float. INT8 layers are multiplied by the scale of the layer. */
+template <NvDsInferDataType DataType>
+struct TensorElement;
+
+template <>
+struct TensorElement<FLOAT>
+{
+    using Type = float;
+    static float load(const float* p, float) { return *p; }
+};
+
+template <>
+struct TensorElement<HALF>
+{
+    using Type = uint16_t;
+    static float load(const uint16_t* p, float) { return halfToFloat(*p); }
+};
+
+template <>
+struct TensorElement<INT8>
+{
+    using Type = int8_t;
+    static float load(const int8_t* p, float scale) { return *p * scale; }
+};
+
+/**
+ * Reads one frame of an output layer by channel, row and column whatever
+ * its data type and order. Both are template parameters, so the element
+ * index and conversion are resolved at compile time and the parsing loops
+ * have no per-element branches. Layers of less than three dimensions are
+ * read as C x 1 x 1 or C x H x 1.
+ */
+template <NvDsInferDataType DataType, NvDsInferTensorOrder Order>
+class TensorAccessor
+{
+public:
+    using Element = typename TensorElement<DataType>::Type;
+
+    TensorAccessor(const NvDsInferLayerInfo& layer, float int8Scale)
+        : m_Data(static_cast<const Element*>(layer.buffer)),
+          m_Scale(int8Scale)
+    {
+        const NvDsInferDims& d = layer.inferDims;
+        if (Order == NvDsInferTensorOrder_kNHWC && d.numDims >= 3)
+        {
+            m_Dims = {d.d[2], d.d[0], d.d[1]};
+        }
+        else
+        {
+            m_Dims.c = d.numDims > 0 ? d.d[0] : 1;
+            m_Dims.h = d.numDims > 1 ? d.d[1] : 1;
+            m_Dims.w = d.numDims > 2 ? d.d[2] : 1;
+        }
+    }
+
+    unsigned int channels() const { return m_Dims.c; }
+    unsigned int height() const { return m_Dims.h; }
+    unsigned int width() const { return m_Dims.w; }
+
+    float operator()(unsigned int c, unsigned int h, unsigned int w) const
+    {
+        return TensorElement<DataType>::load(m_Data + index(c, h, w), m_Scale);
+    }
+
+private:
+    size_t index(unsigned int c, unsigned int h, unsigned int w) const
+    {
+        if (Order == NvDsInferTensorOrder_kNHWC)
+            return ((size_t)h * m_Dims.w + w) * m_Dims.c + c;
+        return ((size_t)c * m_Dims.h + h) * m_Dims.w + w;
+    }
+
+    const Element* m_Data;
+    float m_Scale;
+    NvDsInferDimsCHW m_Dims;
+};
+
+/**
+ * Call func with the TensorAccessor matching the data type of layer and
+ * order. The choice is made once per layer. Returns false without calling
+ * func if the data type is not FLOAT, HALF or INT8.
+ */
+template <NvDsInferTensorOrder Order, typename Func>
+inline bool
+dispatchTensor(const NvDsInferLayerInfo& layer, float int8Scale, Func&& func)
+{
+    switch (layer.dataType)
+    {
+        case FLOAT:
+            func(TensorAccessor<FLOAT, Order>(layer, int8Scale));
+            return true;
+        case HALF:
+            func(TensorAccessor<HALF, Order>(layer, int8Scale));
+            return true;
+        case INT8:
+            func(TensorAccessor<INT8, Order>(layer, int8Scale));
+            return true;
+        default:
+            return false;
+    }
+}
+
+template <typename Func>
+inline bool
+dispatchTensor(const NvDsInferLayerInfo& layer, NvDsInferTensorOrder order,
+    float int8Scale, Func&& func)
+{
+    if (order == NvDsInferTensorOrder_kNHWC)
+        return dispatchTensor<NvDsInferTensorOrder_kNHWC>(
+            layer, int8Scale, std::forward<Func>(func));
+    return dispatchTensor<NvDsInferTensorOrder_kNCHW>(
+        layer, int8Scale, std::forward<Func>(func));
+}
+
+} // namespace nvdsinfer
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * Times the fused WarpAffineRGBAToPlanar against the chain it replaces on the
+ * host, cv::cvtColor -> cv::warpAffine -> C3ToP3, and checks its row kernels
+ * against each other and against the chain.
+ *
+ *   planar_warp_bench [count]
+ *
+ * count faces of random size, angle and position are warped from the source
+ * rectangle of a synthetic RGBA frame into RGB and BGR tensors with two
+ * normalisations. Every kernel this CPU supports (AVX2, NEON) must be within
+ * kMaxKernelDifference of the scalar kernel. The fused warp must be within
+ * kMaxChainDifference of the chain, with a mean difference of at most
+ * kMaxMeanChainDifference, the chain rounding the warped pixels to 8 bits.
+ * Differences are in 8-bit input levels, i.e. divided by the scale.
+ *
+ * Exits with 1 if any check fails.
+ */
+
+#include "opencv2/opencv.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "aligner_kernels.h"
+
+using namespace mirror;
+
+static const float kTemplate[kNumLandmarks][2] = {
+	{ 30.2946f + 8.0f, 51.6963f },
+	{ 65.5318f + 8.0f, 51.5014f },
+	{ 48.0252f + 8.0f, 71.7366f },
+	{ 33.5493f + 8.0f, 92.3655f },
+	{ 62.7299f + 8.0f, 92.2041f }
+};
+
+static const int kFrameWidth = 1920;
+static const int kFrameHeight = 1080;
+static const int kPlaneSize = kAlignedFaceSize * kAlignedFaceSize;
+static const int kTensorPitch = kAlignedFaceSize * sizeof(float);
+
+/* The kernels differ by the rounding of the source co-ordinates (FMA),
+ * which moves the bilinear weights by a few ulps of co-ordinates up to the
+ * frame size. */
+static const double kMaxKernelDifference = 0.05;
+
+/* The chain rounds the warped pixels to 8 bits, and cv::warpAffine uses
+ * fixed point weights. */
+static const double kMaxChainDifference = 1.0;
+static const double kMaxMeanChainDifference = 0.3;
+
+struct Kernel {
+	const char *name;
+	PlanarWarpKernel kernel;
+};
+
+static const Kernel kKernels[] = {
+	{ "scalar", kPlanarWarpScalar },
+	{ "avx2", kPlanarWarpAVX2 },
+	{ "neon", kPlanarWarpNEON },
+};
+
+struct Format {
+	const char *name;
+	TensorNormalization norm;
+	int color_conversion;
+};
+
+static const Format kFormats[] = {
+	{ "rgb", { 1.0f / 127.5f, { 127.5f, 127.5f, 127.5f }, { 0, 1, 2 } },
+		cv::COLOR_RGBA2RGB },
+	{ "bgr", { 1.0f, { 104.0f, 117.0f, 123.0f }, { 2, 1, 0 } },
+		cv::COLOR_RGBA2BGR },
+};
+
+struct Difference {
+	int count = 0;
+	double max = 0;
+	double mean = 0;
+	int failed = 0;
+
+	void Add(const std::vector<float>& a, const std::vector<float>& b,
+		float scale, double max_difference, double max_mean_difference) {
+		double worst = 0, sum = 0;
+		for (size_t i = 0; i < a.size(); i++) {
+			double d = fabs(a[i] - b[i]) / scale;
+			worst = std::max(worst, d);
+			sum += d;
+		}
+		count++;
+		max = std::max(max, worst);
+		mean += sum / a.size();
+		failed += worst > max_difference ||
+			sum / a.size() > max_mean_difference;
+	}
+
+	void Print(const char *name) const {
+		printf("%-20s %6d tensors: max difference %.4f, mean %.5f, %d failed\n",
+			name, count, max, count ? mean / count : 0.0, failed);
+	}
+};
+
+/* cv::cvtColor -> cv::warpAffine -> C3ToP3, the last as
+ * NvDsInferConvert_C3ToP3Float with per-channel means computes it. */
+static void Chain(const cv::Mat& crop, const float *transform,
+	const Format& format, std::vector<float>& tensor) {
+	cv::Mat converted, warped;
+	cv::cvtColor(crop, converted, format.color_conversion);
+	cv::Mat m(2, 3, CV_32FC1, (void *)transform);
+	cv::warpAffine(converted, warped, m,
+		cv::Size(kAlignedFaceSize, kAlignedFaceSize), cv::INTER_LINEAR,
+		cv::BORDER_CONSTANT, cv::Scalar());
+	for (int y = 0; y < kAlignedFaceSize; y++) {
+		const unsigned char *row = warped.ptr<unsigned char>(y);
+		for (int x = 0; x < kAlignedFaceSize; x++) {
+			for (int c = 0; c < 3; c++) {
+				tensor[c * kPlaneSize + y * kAlignedFaceSize + x] =
+					format.norm.scale * (row[x * 3 + c] - format.norm.means[c]);
+			}
+		}
+	}
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+		start).count();
+}
+
+int main(int argc, char *argv[]) {
+	int count = argc > 1 ? atoi(argv[1]) : 2000;
+	if (count <= 0) {
+		fprintf(stderr, "usage: %s [count]\n", argv[0]);
+		return 2;
+	}
+
+	std::vector<Kernel> kernels;
+	for (const Kernel& kernel : kKernels) {
+		if (PlanarWarpKernelSupported(kernel.kernel))
+			kernels.push_back(kernel);
+		else
+			printf("%s kernel not supported here\n", kernel.name);
+	}
+
+	cv::Mat noise(kFrameHeight / 8, kFrameWidth / 8, CV_8UC4), frame;
+	cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(256));
+	cv::resize(noise, frame, cv::Size(kFrameWidth, kFrameHeight), 0, 0,
+		cv::INTER_CUBIC);
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> size(20.0f, 600.0f);
+	std::uniform_real_distribution<float> angle(-0.8f, 0.8f);
+	std::uniform_real_distribution<float> center_x(-50.0f, kFrameWidth + 50.0f);
+	std::uniform_real_distribution<float> center_y(-50.0f, kFrameHeight + 50.0f);
+
+	std::vector<Difference> kernel_differences(kernels.size());
+	Difference chain_difference;
+	std::vector<double> kernel_times(kernels.size());
+	double chain_time = 0;
+	int timed = 0;
+	std::vector<std::vector<float>> tensors(kernels.size(),
+		std::vector<float>(3 * kPlaneSize));
+	std::vector<float> reference(3 * kPlaneSize);
+
+	for (int i = 0; i < count; i++) {
+		float s = size(rng) / kAlignedFaceSize, a = angle(rng);
+		float cx = center_x(rng), cy = center_y(rng);
+		float c = s * cosf(a), d = s * sinf(a);
+		float xs[kNumLandmarks], ys[kNumLandmarks];
+		for (int k = 0; k < kNumLandmarks; k++) {
+			float x = kTemplate[k][0] - 56.0f, y = kTemplate[k][1] - 56.0f;
+			xs[k] = c * x - d * y + cx;
+			ys[k] = d * x + c * y + cy;
+		}
+
+		float transform[6];
+		int left, top, right, bottom;
+		if (EstimateSimilarityBatch(xs, ys, 1, transform) != 0 ||
+				!ComputeAlignmentSourceRect(transform, kFrameWidth, kFrameHeight,
+					&left, &top, &right, &bottom))
+			continue;
+		cv::Mat crop = frame(cv::Rect(left, top, right - left, bottom - top));
+		float crop_transform[6];
+		ComposeCropTransform(transform, left, top, 1.0f, crop_transform);
+
+		for (const Format& format : kFormats) {
+			for (size_t k = 0; k < kernels.size(); k++) {
+				WarpAffineRGBAToPlanar(crop.data, crop.cols, crop.rows,
+					(int)crop.step, crop_transform, format.norm,
+					tensors[k].data(), kTensorPitch, kernels[k].kernel);
+				if (k > 0)
+					kernel_differences[k].Add(tensors[k], tensors[0],
+						format.norm.scale, kMaxKernelDifference,
+						kMaxKernelDifference);
+			}
+			Chain(crop, crop_transform, format, reference);
+			chain_difference.Add(tensors[0], reference, format.norm.scale,
+				kMaxChainDifference, kMaxMeanChainDifference);
+		}
+
+		const Format& format = kFormats[0];
+		for (size_t k = 0; k < kernels.size(); k++) {
+			auto start = std::chrono::steady_clock::now();
+			for (int r = 0; r < 10; r++)
+				WarpAffineRGBAToPlanar(crop.data, crop.cols, crop.rows,
+					(int)crop.step, crop_transform, format.norm,
+					tensors[k].data(), kTensorPitch, kernels[k].kernel);
+			kernel_times[k] += SecondsSince(start);
+		}
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < 10; r++)
+			Chain(crop, crop_transform, format, reference);
+		chain_time += SecondsSince(start);
+		timed += 10;
+	}
+
+	int failures = chain_difference.failed;
+	for (size_t k = 1; k < kernels.size(); k++) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s vs scalar", kernels[k].name);
+		kernel_differences[k].Print(name);
+		failures += kernel_differences[k].failed;
+	}
+	chain_difference.Print("fused vs chain");
+
+	if (timed) {
+		for (size_t k = 0; k < kernels.size(); k++)
+			printf("fused %-6s %.2f us/face\n", kernels[k].name,
+				kernel_times[k] * 1e6 / timed);
+		printf("chain        %.2f us/face\n", chain_time * 1e6 / timed);
+	}
+
+	return failures ? 1 : 0;
+}
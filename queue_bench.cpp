@@ -0,0 +1,211 @@
+/**
+ * Copyright (c) 2019-2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software, related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ *
+ */
+
+/*
+ * Cost of handing batches from the streaming thread to the input thread and
+ * on to the output thread, as gst-nvinfer does, with the GQueue, mutex and
+ * broadcast condition it used before and with the lock-free rings.
+ *
+ *   queue_bench [count [work]]
+ *
+ * work is the number of loop iterations each thread spends on an item, to
+ * see the handoff cost when the threads are not all waiting on each other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include <glib.h>
+
+#include "gstnvinfer_spsc_ring.h"
+
+using namespace gstnvinfer;
+
+#define BENCH_QUEUE_SIZE 64
+
+static volatile guint64 bench_sink;
+
+static void
+spend (guint work)
+{
+  guint64 v = 0;
+  for (guint i = 0; i < work; i++)
+    v = v * 31 + i;
+  bench_sink = v;
+}
+
+static double
+seconds_since (std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double> (std::chrono::steady_clock::now () -
+      start).count ();
+}
+
+/* The previous scheme: two queues, one lock and one condition that every
+ * push and pop broadcasts. */
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  GQueue *input_queue;
+  GQueue *process_queue;
+  guint count;
+  guint work;
+} LockedPipe;
+
+static gpointer
+locked_input_loop (gpointer data)
+{
+  LockedPipe *pipe = (LockedPipe *) data;
+  g_mutex_lock (&pipe->lock);
+  for (guint i = 0; i < pipe->count; i++) {
+    while (g_queue_is_empty (pipe->input_queue))
+      g_cond_wait (&pipe->cond, &pipe->lock);
+    gpointer item = g_queue_pop_head (pipe->input_queue);
+    g_mutex_unlock (&pipe->lock);
+    spend (pipe->work);
+    g_mutex_lock (&pipe->lock);
+    g_queue_push_tail (pipe->process_queue, item);
+    g_cond_broadcast (&pipe->cond);
+  }
+  g_mutex_unlock (&pipe->lock);
+  return nullptr;
+}
+
+static gpointer
+locked_output_loop (gpointer data)
+{
+  LockedPipe *pipe = (LockedPipe *) data;
+  g_mutex_lock (&pipe->lock);
+  for (guint i = 0; i < pipe->count; i++) {
+    while (g_queue_is_empty (pipe->process_queue))
+      g_cond_wait (&pipe->cond, &pipe->lock);
+    g_queue_pop_head (pipe->process_queue);
+    g_cond_broadcast (&pipe->cond);
+    g_mutex_unlock (&pipe->lock);
+    spend (pipe->work);
+    g_mutex_lock (&pipe->lock);
+  }
+  g_mutex_unlock (&pipe->lock);
+  return nullptr;
+}
+
+static double
+run_locked (guint count, guint work)
+{
+  LockedPipe pipe;
+  g_mutex_init (&pipe.lock);
+  g_cond_init (&pipe.cond);
+  pipe.input_queue = g_queue_new ();
+  pipe.process_queue = g_queue_new ();
+  pipe.count = count;
+  pipe.work = work;
+
+  auto start = std::chrono::steady_clock::now ();
+  GThread *input = g_thread_new ("input", locked_input_loop, &pipe);
+  GThread *output = g_thread_new ("output", locked_output_loop, &pipe);
+  for (guint i = 0; i < count; i++) {
+    spend (work);
+    /* The streaming thread waited for nothing but the lock. */
+    g_mutex_lock (&pipe.lock);
+    g_queue_push_tail (pipe.input_queue, GUINT_TO_POINTER (i + 1));
+    g_cond_broadcast (&pipe.cond);
+    g_mutex_unlock (&pipe.lock);
+  }
+  g_thread_join (input);
+  g_thread_join (output);
+  double elapsed = seconds_since (start);
+
+  g_queue_free (pipe.input_queue);
+  g_queue_free (pipe.process_queue);
+  g_cond_clear (&pipe.cond);
+  g_mutex_clear (&pipe.lock);
+  return elapsed;
+}
+
+typedef struct
+{
+  SpscRing<gpointer> *input_queue;
+  SpscRing<gpointer> *process_queue;
+  guint work;
+} RingPipe;
+
+static gpointer
+ring_input_loop (gpointer data)
+{
+  RingPipe *pipe = (RingPipe *) data;
+  gpointer item;
+  while ((item = pipe->input_queue->front ())) {
+    spend (pipe->work);
+    pipe->process_queue->push (item);
+    pipe->input_queue->pop ();
+  }
+  pipe->process_queue->close ();
+  return nullptr;
+}
+
+static gpointer
+ring_output_loop (gpointer data)
+{
+  RingPipe *pipe = (RingPipe *) data;
+  while (pipe->process_queue->front ()) {
+    pipe->process_queue->pop ();
+    spend (pipe->work);
+  }
+  return nullptr;
+}
+
+static double
+run_ring (guint count, guint work)
+{
+  RingPipe pipe;
+  pipe.input_queue = new SpscRing<gpointer> (BENCH_QUEUE_SIZE);
+  pipe.process_queue = new SpscRing<gpointer> (BENCH_QUEUE_SIZE);
+  pipe.work = work;
+
+  auto start = std::chrono::steady_clock::now ();
+  GThread *input = g_thread_new ("input", ring_input_loop, &pipe);
+  GThread *output = g_thread_new ("output", ring_output_loop, &pipe);
+  for (guint i = 0; i < count; i++) {
+    spend (work);
+    pipe.input_queue->push (GUINT_TO_POINTER (i + 1));
+  }
+  pipe.input_queue->close ();
+  g_thread_join (input);
+  g_thread_join (output);
+  double elapsed = seconds_since (start);
+
+  delete pipe.input_queue;
+  delete pipe.process_queue;
+  return elapsed;
+}
+
+int
+main (int argc, char *argv[])
+{
+  guint count = argc > 1 ? atoi (argv[1]) : 1000000;
+  guint work = argc > 2 ? atoi (argv[2]) : 0;
+
+  if (count == 0) {
+    fprintf (stderr, "usage: %s [count [work]]\n", argv[0]);
+    return 1;
+  }
+
+  printf ("%u items, %u iterations of work per item and thread\n", count,
+      work);
+  printf ("mutex, GQueue and condition: %8.1f ns per item\n",
+      run_locked (count, work) * 1e9 / count);
+  printf ("lock-free rings:             %8.1f ns per item\n",
+      run_ring (count, work) * 1e9 / count);
+  return 0;
+}
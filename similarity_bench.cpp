@@ -0,0 +1,412 @@
+/*
+ * Checks EstimateSimilarityBatch against the SVD based Umeyama estimator the
+ * aligner used before, and times both.
+ *
+ *   similarity_bench [count]
+ *
+ * count random faces are fitted with both: the template moved by a random
+ * rotation, scale and translation plus landmark noise. Where the reference
+ * finds the least-squares fit, both must map every landmark to within
+ * kAgreeTolerance pixels of each other in the aligned face. The reference does
+ * not handle the reflection correction (det(A) < 0, strongly perturbed faces)
+ * nor rank deficient covariances (collinear landmarks), there the closed form
+ * must fit the template at least as well, within kResidualTolerance. Faces
+ * whose covariance is the zero matrix (coincident landmarks) make the
+ * reference divide by zero, the closed form must give them a zero matrix and
+ * count them as degenerate.
+ *
+ * Exits with 1 if any check fails.
+ */
+
+#include "opencv2/opencv.hpp"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "aligner_kernels.h"
+
+using namespace mirror;
+
+static const float kTemplate[kNumLandmarks][2] = {
+	{ 30.2946f + 8.0f, 51.6963f },
+	{ 65.5318f + 8.0f, 51.5014f },
+	{ 48.0252f + 8.0f, 71.7366f },
+	{ 33.5493f + 8.0f, 92.3655f },
+	{ 62.7299f + 8.0f, 92.2041f }
+};
+
+/* Largest distance, in aligned face pixels, between the landmarks mapped by
+ * the two estimators. */
+static const double kAgreeTolerance = 1e-2;
+
+/* Relative slack on the sum of squared template residuals. */
+static const double kResidualTolerance = 1e-4;
+
+/* The reference, as it was in aligner.cpp. */
+
+static cv::Mat MeanAxis0(const cv::Mat & src) {
+	int num = src.rows;
+	int dim = src.cols;
+
+	cv::Mat output(1, dim, CV_32FC1);
+	for (int i = 0; i < dim; i++) {
+		float sum = 0;
+		for (int j = 0; j < num; j++) {
+			sum += src.at<float>(j, i);
+		}
+		output.at<float>(0, i) = sum / num;
+	}
+
+	return output;
+}
+
+static cv::Mat ElementwiseMinus(const cv::Mat & A, const cv::Mat & B) {
+	cv::Mat output(A.rows, A.cols, A.type());
+	assert(B.cols == A.cols);
+	if (B.cols == A.cols) {
+		for (int i = 0; i < A.rows; i++) {
+			for (int j = 0; j < B.cols; j++) {
+				output.at<float>(i, j) = A.at<float>(i, j) - B.at<float>(0, j);
+			}
+		}
+	}
+
+	return output;
+}
+
+static cv::Mat VarAxis0(const cv::Mat & src) {
+	cv::Mat temp_ = ElementwiseMinus(src, MeanAxis0(src));
+	cv::multiply(temp_, temp_, temp_);
+	return MeanAxis0(temp_);
+}
+
+static int MatrixRank(cv::Mat M) {
+	cv::Mat w, u, vt;
+	cv::SVD::compute(M, w, u, vt);
+	cv::Mat1b nonZeroSingularValues = w > 0.0001;
+	int rank = countNonZero(nonZeroSingularValues);
+	return rank;
+}
+
+/*
+References: "Least-squares estimation of transformation parameters between two point patterns", Shinji Umeyama, PAMI 1991, DOI: 10.1109/34.88573
+Anthor: Jack Yu
+*/
+static cv::Mat SimilarTransform(const cv::Mat & src, const cv::Mat & dst) {
+	int num = src.rows;
+	int dim = src.cols;
+	cv::Mat src_mean = MeanAxis0(src);
+	cv::Mat dst_mean = MeanAxis0(dst);
+	cv::Mat src_demean = ElementwiseMinus(src, src_mean);
+	cv::Mat dst_demean = ElementwiseMinus(dst, dst_mean);
+	cv::Mat A = (dst_demean.t() * src_demean) / static_cast<float>(num);
+	cv::Mat d(dim, 1, CV_32F);
+	d.setTo(1.0f);
+	if (cv::determinant(A) < 0) {
+		d.at<float>(dim - 1, 0) = -1;
+
+	}
+	cv::Mat T = cv::Mat::eye(dim + 1, dim + 1, CV_32F);
+	cv::Mat U, S, V;
+	cv::SVD::compute(A, S, U, V);
+
+	// the SVD function in opencv differ from scipy .
+
+	int rank = MatrixRank(A);
+	if (rank == 0) {
+		assert(rank == 0);
+
+	}
+	else if (rank == dim - 1) {
+		if (cv::determinant(U) * cv::determinant(V) > 0) {
+			T.rowRange(0, dim).colRange(0, dim) = U * V;
+		}
+		else {
+			int s = d.at<float>(dim - 1, 0) = -1;
+			d.at<float>(dim - 1, 0) = -1;
+
+			T.rowRange(0, dim).colRange(0, dim) = U * V;
+			cv::Mat diag_ = cv::Mat::diag(d);
+			cv::Mat twp = diag_ * V; //np.dot(np.diag(d), V.T)
+			cv::Mat B = cv::Mat::zeros(3, 3, CV_8UC1);
+			cv::Mat C = B.diag(0);
+			T.rowRange(0, dim).colRange(0, dim) = U * twp;
+			d.at<float>(dim - 1, 0) = s;
+		}
+	}
+	else {
+		cv::Mat diag_ = cv::Mat::diag(d);
+		cv::Mat twp = diag_ * V.t(); //np.dot(np.diag(d), V.T)
+		cv::Mat res = U * twp; // U
+		T.rowRange(0, dim).colRange(0, dim) = -U.t()* twp;
+	}
+	cv::Mat var_ = VarAxis0(src_demean);
+	float val = cv::sum(var_).val[0];
+	cv::Mat res;
+	cv::multiply(d, S, res);
+	float scale = 1.0 / val * cv::sum(res).val[0];
+	T.rowRange(0, dim).colRange(0, dim) = -T.rowRange(0, dim).colRange(0, dim).t();
+	cv::Mat  temp1 = T.rowRange(0, dim).colRange(0, dim); // T[:dim, :dim]
+	cv::Mat  temp2 = src_mean.t();
+	cv::Mat  temp3 = temp1 * temp2;
+	cv::Mat temp4 = scale * temp3;
+	T.rowRange(0, dim).colRange(dim, dim + 1) = -(temp4 - dst_mean.t());
+	T.rowRange(0, dim).colRange(0, dim) *= scale;
+	return T;
+}
+
+/* End of the reference. */
+
+struct Faces {
+	std::vector<float> x;
+	std::vector<float> y;
+
+	int size() const { return (int)x.size() / kNumLandmarks; }
+	void Add(const float points[kNumLandmarks][2]) {
+		for (int k = 0; k < kNumLandmarks; k++) {
+			x.push_back(points[k][0]);
+			y.push_back(points[k][1]);
+		}
+	}
+};
+
+static void ReferenceTransform(const Faces& faces, int f, float *transform) {
+	float points[kNumLandmarks][2];
+	for (int k = 0; k < kNumLandmarks; k++) {
+		points[k][0] = faces.x[f * kNumLandmarks + k];
+		points[k][1] = faces.y[f * kNumLandmarks + k];
+	}
+	cv::Mat src_mat(kNumLandmarks, 2, CV_32FC1, points);
+	cv::Mat dst_mat(kNumLandmarks, 2, CV_32FC1, (void *)kTemplate);
+	cv::Mat T = SimilarTransform(src_mat, dst_mat);
+	for (int i = 0; i < 6; i++)
+		transform[i] = T.at<float>(i / 3, i % 3);
+}
+
+/* Determinant of the landmark / template covariance, the reference only
+ * fits the faces for which it is positive. */
+static double CovarianceDeterminant(const Faces& faces, int f) {
+	double sx = 0, sy = 0, tx = 0, ty = 0;
+	for (int k = 0; k < kNumLandmarks; k++) {
+		sx += faces.x[f * kNumLandmarks + k];
+		sy += faces.y[f * kNumLandmarks + k];
+		tx += kTemplate[k][0];
+		ty += kTemplate[k][1];
+	}
+	sx /= kNumLandmarks; sy /= kNumLandmarks;
+	tx /= kNumLandmarks; ty /= kNumLandmarks;
+	double a[2][2] = { { 0, 0 }, { 0, 0 } };
+	for (int k = 0; k < kNumLandmarks; k++) {
+		double u = faces.x[f * kNumLandmarks + k] - sx;
+		double v = faces.y[f * kNumLandmarks + k] - sy;
+		a[0][0] += (kTemplate[k][0] - tx) * u;
+		a[0][1] += (kTemplate[k][0] - tx) * v;
+		a[1][0] += (kTemplate[k][1] - ty) * u;
+		a[1][1] += (kTemplate[k][1] - ty) * v;
+	}
+	return a[0][0] * a[1][1] - a[0][1] * a[1][0];
+}
+
+static void Map(const float *transform, double x, double y, double *u,
+	double *v) {
+	*u = transform[0] * x + transform[1] * y + transform[2];
+	*v = transform[3] * x + transform[4] * y + transform[5];
+}
+
+static double LandmarkDistance(const Faces& faces, int f, const float *a,
+	const float *b) {
+	double worst = 0;
+	for (int k = 0; k < kNumLandmarks; k++) {
+		double x = faces.x[f * kNumLandmarks + k];
+		double y = faces.y[f * kNumLandmarks + k];
+		double au, av, bu, bv;
+		Map(a, x, y, &au, &av);
+		Map(b, x, y, &bu, &bv);
+		worst = std::max(worst, hypot(au - bu, av - bv));
+	}
+	return worst;
+}
+
+static double Residual(const Faces& faces, int f, const float *transform) {
+	double sum = 0;
+	for (int k = 0; k < kNumLandmarks; k++) {
+		double u, v;
+		Map(transform, faces.x[f * kNumLandmarks + k],
+			faces.y[f * kNumLandmarks + k], &u, &v);
+		sum += (u - kTemplate[k][0]) * (u - kTemplate[k][0]) +
+			(v - kTemplate[k][1]) * (v - kTemplate[k][1]);
+	}
+	return sum;
+}
+
+/* The template moved by a random similarity, mirrored if asked, with noise of
+ * up to max_noise pixels on every landmark. */
+static void RandomFace(std::mt19937& rng, bool mirrored, float max_noise,
+	float points[kNumLandmarks][2]) {
+	std::uniform_real_distribution<float> angle(-(float)CV_PI, (float)CV_PI);
+	std::uniform_real_distribution<float> scale(0.05f, 5.0f);
+	std::uniform_real_distribution<float> offset(0.0f, 2000.0f);
+	std::uniform_real_distribution<float> noise_level(0.0f, max_noise);
+	float a = angle(rng), s = scale(rng), tx = offset(rng), ty = offset(rng);
+	std::normal_distribution<float> noise(0.0f, noise_level(rng));
+	float c = s * cosf(a), d = s * sinf(a);
+	for (int k = 0; k < kNumLandmarks; k++) {
+		float x = kTemplate[k][0] - 56.0f, y = kTemplate[k][1] - 56.0f;
+		if (mirrored)
+			x = -x;
+		points[k][0] = c * x - d * y + tx + noise(rng);
+		points[k][1] = d * x + c * y + ty + noise(rng);
+	}
+}
+
+/* Landmarks on a random line. */
+static void CollinearFace(std::mt19937& rng, float points[kNumLandmarks][2]) {
+	std::uniform_real_distribution<float> position(0.0f, 1000.0f);
+	std::uniform_real_distribution<float> along(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> angle(-(float)CV_PI, (float)CV_PI);
+	float x = position(rng), y = position(rng), a = angle(rng);
+	for (int k = 0; k < kNumLandmarks; k++) {
+		float t = along(rng);
+		points[k][0] = x + t * cosf(a);
+		points[k][1] = y + t * sinf(a);
+	}
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+		start).count();
+}
+
+int main(int argc, char *argv[]) {
+	int count = argc > 1 ? atoi(argv[1]) : 20000;
+	if (count <= 0) {
+		fprintf(stderr, "usage: %s [count]\n", argv[0]);
+		return 2;
+	}
+
+	std::mt19937 rng(1);
+	Faces random, mirrored, collinear, coincident;
+	float points[kNumLandmarks][2];
+	for (int f = 0; f < count; f++) {
+		RandomFace(rng, false, 5.0f, points);
+		random.Add(points);
+	}
+	for (int f = 0; f < 1000; f++) {
+		RandomFace(rng, true, 1.0f, points);
+		mirrored.Add(points);
+		CollinearFace(rng, points);
+		collinear.Add(points);
+	}
+	std::uniform_real_distribution<float> position(0.0f, 1000.0f);
+	for (int f = 0; f < 100; f++) {
+		float x = f ? position(rng) : 0.0f, y = f ? position(rng) : 0.0f;
+		for (int k = 0; k < kNumLandmarks; k++) {
+			points[k][0] = x;
+			points[k][1] = y;
+		}
+		coincident.Add(points);
+	}
+
+	int failures = 0;
+
+	/* Where the reference finds the least-squares fit both must agree,
+	 * elsewhere the closed form must fit no worse. */
+	struct {
+		const char *name;
+		const Faces *faces;
+		bool reference_fits;
+	} sets[] = {
+		{ "random", &random, true },
+		{ "mirrored", &mirrored, false },
+		{ "collinear", &collinear, false },
+	};
+	for (const auto& set : sets) {
+		const Faces& faces = *set.faces;
+		std::vector<float> transforms(faces.size() * 6);
+		int degenerate = EstimateSimilarityBatch(faces.x.data(),
+			faces.y.data(), faces.size(), transforms.data());
+		int agreed = 0, better = 0, failed = degenerate;
+		double worst = 0;
+		for (int f = 0; f < faces.size(); f++) {
+			float reference[6];
+			ReferenceTransform(faces, f, reference);
+			const float *transform = &transforms[f * 6];
+			double distance = LandmarkDistance(faces, f, reference, transform);
+			if (set.reference_fits && CovarianceDeterminant(faces, f) > 0) {
+				worst = std::max(worst, distance);
+				if (distance <= kAgreeTolerance)
+					agreed++;
+				else
+					failed++;
+			} else if (distance <= kAgreeTolerance) {
+				agreed++;
+			} else if (Residual(faces, f, transform) <=
+					Residual(faces, f, reference) * (1 + kResidualTolerance)) {
+				better++;
+			} else {
+				failed++;
+			}
+		}
+		printf("%-10s %6d faces: %6d agree (worst %.2e px), %5d fit better "
+			"than the reference, %d failed\n", set.name, faces.size(), agreed,
+			worst, better, failed);
+		failures += failed;
+	}
+
+	/* Zero covariance matrix. */
+	{
+		std::vector<float> transforms(coincident.size() * 6, 1.0f);
+		int degenerate = EstimateSimilarityBatch(coincident.x.data(),
+			coincident.y.data(), coincident.size(), transforms.data());
+		int zero = 0, reference_finite = 0;
+		for (int f = 0; f < coincident.size(); f++) {
+			float reference[6];
+			ReferenceTransform(coincident, f, reference);
+			bool all_zero = true, finite = true;
+			for (int i = 0; i < 6; i++) {
+				all_zero = all_zero && transforms[f * 6 + i] == 0.0f;
+				finite = finite && std::isfinite(reference[i]);
+			}
+			zero += all_zero;
+			reference_finite += finite;
+		}
+		int failed = coincident.size() - zero +
+			(degenerate != coincident.size());
+		printf("%-10s %6d faces: %6d zero matrices, %d counted degenerate, "
+			"reference finite for %d, %d failed\n", "coincident",
+			coincident.size(), zero, degenerate, reference_finite, failed);
+		failures += failed;
+	}
+
+	/* Timing on the random faces. */
+	{
+		float reference[6];
+		auto start = std::chrono::steady_clock::now();
+		for (int f = 0; f < random.size(); f++)
+			ReferenceTransform(random, f, reference);
+		double reference_time = SecondsSince(start);
+
+		std::vector<float> transforms(random.size() * 6);
+		int rounds = 0;
+		start = std::chrono::steady_clock::now();
+		do {
+			EstimateSimilarityBatch(random.x.data(), random.y.data(),
+				random.size(), transforms.data());
+			rounds++;
+		} while (SecondsSince(start) < 0.5);
+		double batch_time = SecondsSince(start) / rounds;
+
+		printf("reference %.3f us/face, closed form %.4f us/face, %.0fx\n",
+			reference_time * 1e6 / random.size(),
+			batch_time * 1e6 / random.size(), reference_time / batch_time);
+	}
+
+	return failures ? 1 : 0;
+}
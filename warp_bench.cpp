@@ -0,0 +1,223 @@
+/*
+ * Checks the host alignment path of align-faces against cv::warpAffine and
+ * times both.
+ *
+ *   warp_bench [count]
+ *
+ * count faces of random size, angle and position, some partly outside of the
+ * frame, are aligned from a synthetic RGBA frame the way gst-nvinfer does it:
+ * the landmarks give the transform, the transform the source rectangle, the
+ * rectangle is cropped and scaled down (cv::resize standing in for
+ * NvBufSurfTransform), and ComposeCropTransform + WarpAffineRGBA warp the crop
+ * into a packed RGB and RGBA slot. Every slot must be within kMaxDifference of
+ * cv::warpAffine of the same crop with INTER_LINEAR and BORDER_CONSTANT, with a
+ * mean difference of at most kMaxMeanDifference. Unscaled crops are also
+ * checked against cv::warpAffine of the whole frame with the frame transform,
+ * which checks ComposeCropTransform and the rectangle. A transform that cannot
+ * be inverted must fail and leave a black slot.
+ *
+ * Exits with 1 if any check fails.
+ */
+
+#include "opencv2/opencv.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "aligner_kernels.h"
+
+using namespace mirror;
+
+static const float kTemplate[kNumLandmarks][2] = {
+	{ 30.2946f + 8.0f, 51.6963f },
+	{ 65.5318f + 8.0f, 51.5014f },
+	{ 48.0252f + 8.0f, 71.7366f },
+	{ 33.5493f + 8.0f, 92.3655f },
+	{ 62.7299f + 8.0f, 92.2041f }
+};
+
+static const int kFrameWidth = 1920;
+static const int kFrameHeight = 1080;
+
+/* As ALIGN_MAX_SOURCE_PIXELS_PER_FACE_PIXEL in gstnvinfer.cpp. */
+static const float kMaxSourcePixelsPerFacePixel = 2.0f;
+
+/* Both round to the nearest level, cv::warpAffine from fixed point
+ * weights. */
+static const int kMaxDifference = 1;
+static const double kMaxMeanDifference = 0.01;
+
+struct Difference {
+	int count = 0;
+	int max = 0;
+	double mean = 0;
+	int failed = 0;
+
+	void Add(const cv::Mat& slot, const cv::Mat& reference, int channels) {
+		int worst = 0;
+		double sum = 0;
+		for (int y = 0; y < kAlignedFaceSize; y++) {
+			const unsigned char *a = slot.ptr<unsigned char>(y);
+			const unsigned char *b = reference.ptr<unsigned char>(y);
+			for (int x = 0; x < kAlignedFaceSize; x++) {
+				for (int c = 0; c < channels; c++) {
+					int d = abs(a[x * channels + c] - b[x * 4 + c]);
+					worst = std::max(worst, d);
+					sum += d;
+				}
+			}
+		}
+		double face_mean = sum / (kAlignedFaceSize * kAlignedFaceSize * channels);
+		count++;
+		max = std::max(max, worst);
+		mean += face_mean;
+		failed += worst > kMaxDifference || face_mean > kMaxMeanDifference;
+	}
+
+	void Print(const char *name) const {
+		printf("%-20s %6d slots: max difference %d, mean %.5f, %d failed\n",
+			name, count, max, count ? mean / count : 0.0, failed);
+	}
+};
+
+/* Source rectangle as get_face_alignment in gstnvinfer.cpp. */
+static bool AlignmentRect(const float *transform, cv::Rect *rect) {
+	int left, top, right, bottom;
+	if (!ComputeAlignmentSourceRect(transform, kFrameWidth, kFrameHeight,
+			&left, &top, &right, &bottom))
+		return false;
+	left &= ~1;
+	top &= ~1;
+	right = std::min((right + 1) & ~1, kFrameWidth & ~1);
+	bottom = std::min((bottom + 1) & ~1, kFrameHeight & ~1);
+	if (right <= left || bottom <= top)
+		return false;
+	*rect = cv::Rect(left, top, right - left, bottom - top);
+	return true;
+}
+
+static cv::Mat Reference(const cv::Mat& src, const float *transform) {
+	cv::Mat m(2, 3, CV_32FC1, (void *)transform);
+	cv::Mat out;
+	cv::warpAffine(src, out, m, cv::Size(kAlignedFaceSize, kAlignedFaceSize),
+		cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar());
+	return out;
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+		start).count();
+}
+
+int main(int argc, char *argv[]) {
+	int count = argc > 1 ? atoi(argv[1]) : 3000;
+	if (count <= 0) {
+		fprintf(stderr, "usage: %s [count]\n", argv[0]);
+		return 2;
+	}
+
+	/* Smooth noise, so that every warp has detail to get wrong. */
+	cv::Mat noise(kFrameHeight / 8, kFrameWidth / 8, CV_8UC4), frame;
+	cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(256));
+	cv::resize(noise, frame, cv::Size(kFrameWidth, kFrameHeight), 0, 0,
+		cv::INTER_CUBIC);
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> size(20.0f, 600.0f);
+	std::uniform_real_distribution<float> angle(-0.8f, 0.8f);
+	std::uniform_real_distribution<float> center_x(-50.0f, kFrameWidth + 50.0f);
+	std::uniform_real_distribution<float> center_y(-50.0f, kFrameHeight + 50.0f);
+
+	Difference scaled, native, whole_frame;
+	double warp_time = 0, reference_time = 0;
+	int timed = 0;
+	for (int i = 0; i < count; i++) {
+		float s = size(rng) / kAlignedFaceSize, a = angle(rng);
+		float cx = center_x(rng), cy = center_y(rng);
+		float c = s * cosf(a), d = s * sinf(a);
+		float xs[kNumLandmarks], ys[kNumLandmarks];
+		for (int k = 0; k < kNumLandmarks; k++) {
+			float x = kTemplate[k][0] - 56.0f, y = kTemplate[k][1] - 56.0f;
+			xs[k] = c * x - d * y + cx;
+			ys[k] = d * x + c * y + cy;
+		}
+
+		float transform[6];
+		cv::Rect rect(0, 0, 0, 0);
+		if (EstimateSimilarityBatch(xs, ys, 1, transform) != 0 ||
+				!AlignmentRect(transform, &rect))
+			continue;
+
+		float scale = kMaxSourcePixelsPerFacePixel *
+			sqrtf(transform[0] * transform[0] + transform[3] * transform[3]);
+		scale = std::min(1.0f, scale);
+		cv::Mat crop = frame(rect).clone();
+		if (scale < 1.0f) {
+			cv::Mat resized;
+			cv::resize(crop, resized,
+				cv::Size(std::max(1, (int)(rect.width * scale + 0.5f)),
+					std::max(1, (int)(rect.height * scale + 0.5f))),
+				0, 0, cv::INTER_LINEAR);
+			crop = resized;
+		}
+
+		float crop_transform[6];
+		ComposeCropTransform(transform, rect.x, rect.y, scale, crop_transform);
+		cv::Mat reference = Reference(crop, crop_transform);
+		for (int channels = 3; channels <= 4; channels++) {
+			cv::Mat slot(kAlignedFaceSize, kAlignedFaceSize,
+				channels == 3 ? CV_8UC3 : CV_8UC4);
+			bool warped = WarpAffineRGBA(crop.data, crop.cols, crop.rows,
+				(int)crop.step, crop_transform, slot.data, (int)slot.step,
+				channels);
+			Difference& difference = scale < 1.0f ? scaled : native;
+			if (!warped)
+				difference.failed++;
+			difference.Add(slot, reference, channels);
+			if (scale == 1.0f && channels == 4)
+				whole_frame.Add(slot, Reference(frame, transform), channels);
+		}
+
+		/* Timing, packed RGB as for the usual network input. */
+		cv::Mat slot(kAlignedFaceSize, kAlignedFaceSize, CV_8UC3);
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < 10; r++)
+			WarpAffineRGBA(crop.data, crop.cols, crop.rows, (int)crop.step,
+				crop_transform, slot.data, (int)slot.step, 3);
+		warp_time += SecondsSince(start);
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < 10; r++)
+			Reference(crop, crop_transform);
+		reference_time += SecondsSince(start);
+		timed += 10;
+	}
+
+	int failures = scaled.failed + native.failed + whole_frame.failed;
+	scaled.Print("scaled crop");
+	native.Print("native crop");
+	whole_frame.Print("native vs frame");
+
+	/* Not invertible: must fail with a black slot. */
+	{
+		float zero[6] = { 0, 0, 0, 0, 0, 0 };
+		cv::Mat slot(kAlignedFaceSize, kAlignedFaceSize, CV_8UC3,
+			cv::Scalar::all(255));
+		bool warped = WarpAffineRGBA(frame.data, frame.cols, frame.rows,
+			(int)frame.step, zero, slot.data, (int)slot.step, 3);
+		int failed = warped || cv::countNonZero(slot.reshape(1)) != 0;
+		printf("%-20s %s\n", "singular transform", failed ? "failed" : "ok");
+		failures += failed;
+	}
+
+	if (timed)
+		printf("WarpAffineRGBA %.2f us/face, cv::warpAffine %.2f us/face\n",
+			warp_time * 1e6 / timed, reference_time * 1e6 / timed);
+
+	return failures ? 1 : 0;
+}